@@ -32,19 +32,18 @@ G_DEFINE_TYPE (BgColorsSource, bg_colors_source, BG_TYPE_SOURCE)
 #define COLORS_SOURCE_PRIVATE(o) \
   (G_TYPE_INSTANCE_GET_PRIVATE ((o), BG_TYPE_COLORS_SOURCE, BgColorsSourcePrivate))
 
-static void
-bg_colors_source_class_init (BgColorsSourceClass *klass)
+struct _BgColorsSourcePrivate
 {
-}
+  GnomeDesktopThumbnailFactory *thumb_factory;
+};
 
 struct {
 	const char *name;
 	GDesktopBackgroundShading type;
-	int orientation;
 } items[] = {
-	{ N_("Horizontal Gradient"), G_DESKTOP_BACKGROUND_SHADING_HORIZONTAL, GTK_ORIENTATION_HORIZONTAL },
-	{ N_("Vertical Gradient"), G_DESKTOP_BACKGROUND_SHADING_VERTICAL, GTK_ORIENTATION_VERTICAL },
-	{ N_("Solid Color"), G_DESKTOP_BACKGROUND_SHADING_SOLID, -1 },
+	{ N_("Horizontal Gradient"), G_DESKTOP_BACKGROUND_SHADING_HORIZONTAL },
+	{ N_("Vertical Gradient"), G_DESKTOP_BACKGROUND_SHADING_VERTICAL },
+	{ N_("Solid Color"), G_DESKTOP_BACKGROUND_SHADING_SOLID },
 };
 
 #define PCOLOR "#023c88"
@@ -64,22 +63,82 @@ get_arrow_icon (GtkOrientation orientation)
   return emblem;
 }
 
+static GIcon *
+bg_colors_source_get_thumbnail (BgSource         *source,
+                                CcAppearanceItem *item)
+{
+  BgColorsSourcePrivate *priv = BG_COLORS_SOURCE (source)->priv;
+  GIcon *pixbuf;
+  GEmblem *emblem;
+  GIcon *icon;
+
+  pixbuf = cc_appearance_item_get_thumbnail (item,
+					     priv->thumb_factory,
+					     THUMBNAIL_WIDTH, THUMBNAIL_HEIGHT);
+  if (pixbuf == NULL)
+    return NULL;
+
+  switch (cc_appearance_item_get_shading (item))
+    {
+    case G_DESKTOP_BACKGROUND_SHADING_HORIZONTAL:
+      emblem = get_arrow_icon (GTK_ORIENTATION_HORIZONTAL);
+      break;
+    case G_DESKTOP_BACKGROUND_SHADING_VERTICAL:
+      emblem = get_arrow_icon (GTK_ORIENTATION_VERTICAL);
+      break;
+    default:
+      return pixbuf;
+    }
+
+  icon = g_emblemed_icon_new (pixbuf, emblem);
+  g_object_unref (emblem);
+  g_object_unref (pixbuf);
+
+  return icon;
+}
+
+static void
+bg_colors_source_finalize (GObject *object)
+{
+  BgColorsSourcePrivate *priv = BG_COLORS_SOURCE (object)->priv;
+
+  /* the thumbnail workers use the factory until the parent's dispose
+   * has stopped them */
+  g_object_unref (priv->thumb_factory);
+
+  G_OBJECT_CLASS (bg_colors_source_parent_class)->finalize (object);
+}
+
+static void
+bg_colors_source_class_init (BgColorsSourceClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+  BgSourceClass *source_class = BG_SOURCE_CLASS (klass);
+
+  g_type_class_add_private (klass, sizeof (BgColorsSourcePrivate));
+
+  object_class->finalize = bg_colors_source_finalize;
+
+  source_class->get_thumbnail = bg_colors_source_get_thumbnail;
+}
+
 static void
 bg_colors_source_init (BgColorsSource *self)
 {
-  GnomeDesktopThumbnailFactory *thumb_factory;
+  BgColorsSourcePrivate *priv;
   guint i;
   GtkListStore *store;
 
+  priv = self->priv = COLORS_SOURCE_PRIVATE (self);
+
   store = bg_source_get_liststore (BG_SOURCE (self));
 
-  thumb_factory = gnome_desktop_thumbnail_factory_new (GNOME_DESKTOP_THUMBNAIL_SIZE_NORMAL);
+  priv->thumb_factory = gnome_desktop_thumbnail_factory_new (GNOME_DESKTOP_THUMBNAIL_SIZE_NORMAL);
 
   for (i = 0; i < G_N_ELEMENTS (items); i++)
     {
       CcAppearanceItemFlags flags;
       CcAppearanceItem *item;
-      GIcon *pixbuf;
 
       item = cc_appearance_item_new (NULL);
       flags = CC_APPEARANCE_ITEM_HAS_PCOLOR |
@@ -98,31 +157,16 @@ bg_colors_source_init (BgColorsSource *self)
 		    "flags", flags,
 		    NULL);
 
-      /* insert the item into the liststore */
-      pixbuf = cc_appearance_item_get_thumbnail (item,
-						 thumb_factory,
-						 THUMBNAIL_WIDTH, THUMBNAIL_HEIGHT);
-      if (items[i].orientation != -1)
-        {
-          GEmblem *emblem;
-          GIcon *icon;
-
-	  emblem = get_arrow_icon (items[i].orientation);
-	  icon = g_emblemed_icon_new (G_ICON (pixbuf), emblem);
-	  g_object_unref (emblem);
-	  g_object_unref (pixbuf);
-	  pixbuf = icon;
-	}
+      /* insert the item into the liststore, the thumbnail is rendered
+       * once the source is shown */
       gtk_list_store_insert_with_values (store, NULL, 0,
-                                         0, pixbuf,
+                                         0, bg_source_get_placeholder (BG_SOURCE (self)),
                                          1, item,
                                          2, _(items[i].name),
                                          -1);
 
-      g_object_unref (pixbuf);
+      g_object_unref (item);
     }
-
-  g_object_unref (thumb_factory);
 }
 
 BgColorsSource *
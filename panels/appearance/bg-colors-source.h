@@ -51,10 +51,13 @@ G_BEGIN_DECLS
 
 typedef struct _BgColorsSource BgColorsSource;
 typedef struct _BgColorsSourceClass BgColorsSourceClass;
+typedef struct _BgColorsSourcePrivate BgColorsSourcePrivate;
 
 struct _BgColorsSource
 {
   BgSource parent;
+
+  BgColorsSourcePrivate *priv;
 };
 
 struct _BgColorsSourceClass
@@ -25,6 +25,7 @@
 
 #include <string.h>
 #include <gio/gio.h>
+#include <glib/gstdio.h>
 #include <libgnome-desktop/gnome-desktop-thumbnail.h>
 #include <gdesktop-enums.h>
 
@@ -34,7 +35,44 @@ G_DEFINE_TYPE (BgPicturesSource, bg_pictures_source, BG_TYPE_SOURCE)
   (G_TYPE_INSTANCE_GET_PRIVATE ((o), BG_TYPE_PICTURES_SOURCE, BgPicturesSourcePrivate))
 
 #define ATTRIBUTES G_FILE_ATTRIBUTE_STANDARD_NAME "," \
-	G_FILE_ATTRIBUTE_STANDARD_CONTENT_TYPE
+	G_FILE_ATTRIBUTE_STANDARD_DISPLAY_NAME "," \
+	G_FILE_ATTRIBUTE_STANDARD_CONTENT_TYPE "," \
+	G_FILE_ATTRIBUTE_STANDARD_TYPE "," \
+	G_FILE_ATTRIBUTE_STANDARD_IS_HIDDEN "," \
+	G_FILE_ATTRIBUTE_STANDARD_SIZE "," \
+	G_FILE_ATTRIBUTE_TIME_MODIFIED "," \
+	G_FILE_ATTRIBUTE_ID_FILE
+
+/* The folders are scanned a chunk of files at a time, so that a large
+ * collection neither sits in memory as one list nor blocks the main loop */
+#define SCAN_CHUNK_SIZE 100
+
+/* What is known about every picture, kept across runs so that unchanged
+ * files are not probed again */
+#define INDEX_FILENAME "pictures.index"
+#define INDEX_VERSION 2
+/* uri -> mtime, size, width, height, probed, is screenshot,
+ * thumbnail failed, thumbnail */
+#define INDEX_FORMAT "(ua{s(xtiibbbs)})"
+#define INDEX_SAVE_DELAY 5
+
+/* Digests are only looked up again for recently added pictures */
+#define MAX_DIGESTS 256
+
+typedef struct
+{
+  gint64    mtime;
+  guint64   size;
+  gint      width;
+  gint      height;
+  gboolean  probed;
+  gboolean  is_screenshot;
+  /* no shared thumbnail can be made, the picture is loaded instead */
+  gboolean  thumbnail_failed;
+  gchar    *thumbnail;
+
+  gboolean  seen;
+} PictureRecord;
 
 struct _BgPicturesSourcePrivate
 {
@@ -43,6 +81,22 @@ struct _BgPicturesSourcePrivate
   GnomeDesktopThumbnailFactory *thumb_factory;
 
   GHashTable *known_items;
+  /* uri -> digest, so that checking a uri doesn't checksum it again */
+  GHashTable *digests;
+
+  GFile      *cache_dir;
+
+  /* directories left to scan, and the ones already seen by file id */
+  GQueue     *scan_queue;
+  GHashTable *scanned_dirs;
+  /* records are only pruned after a scan that read every directory */
+  gboolean    scan_failed;
+
+  /* uri -> PictureRecord, also used by the thumbnail workers */
+  GMutex      records_lock;
+  GHashTable *records;
+  gboolean    records_dirty;
+  guint       save_id;
 };
 
 const char * const content_types[] = {
@@ -54,6 +108,16 @@ const char * const content_types[] = {
 };
 
 static char *bg_pictures_source_get_unique_filename (const char *uri);
+static const char *get_digest (BgPicturesSource *bg_source,
+                               const char       *uri);
+static void  save_records   (BgPicturesSource *bg_source);
+static void  row_changed_cb (GtkTreeModel     *model,
+                             GtkTreePath      *path,
+                             GtkTreeIter      *iter,
+                             BgPicturesSource *bg_source);
+static void  row_deleted_cb (GtkTreeModel     *model,
+                             GtkTreePath      *path,
+                             BgPicturesSource *bg_source);
 
 static void
 bg_pictures_source_get_property (GObject    *object,
@@ -84,7 +148,10 @@ bg_pictures_source_set_property (GObject      *object,
 static void
 bg_pictures_source_dispose (GObject *object)
 {
-  BgPicturesSourcePrivate *priv = BG_PICTURES_SOURCE (object)->priv;
+  BgPicturesSource *bg_source = BG_PICTURES_SOURCE (object);
+  BgPicturesSourcePrivate *priv = bg_source->priv;
+  GtkListStore *store;
+  gboolean dirty;
 
   if (priv->cancellable)
     {
@@ -93,12 +160,38 @@ bg_pictures_source_dispose (GObject *object)
       priv->cancellable = NULL;
     }
 
-  if (priv->thumb_factory)
+  if (priv->scan_queue)
+    {
+      g_queue_free_full (priv->scan_queue, g_object_unref);
+      priv->scan_queue = NULL;
+    }
+
+  if (priv->scanned_dirs)
+    {
+      g_hash_table_destroy (priv->scanned_dirs);
+      priv->scanned_dirs = NULL;
+    }
+
+  if (priv->save_id != 0)
+    {
+      g_source_remove (priv->save_id);
+      priv->save_id = 0;
+    }
+
+  store = bg_source_get_liststore (BG_SOURCE (bg_source));
+  if (store)
     {
-      g_object_unref (priv->thumb_factory);
-      priv->thumb_factory = NULL;
+      g_signal_handlers_disconnect_by_func (store, row_changed_cb, bg_source);
+      g_signal_handlers_disconnect_by_func (store, row_deleted_cb, bg_source);
     }
 
+  g_mutex_lock (&priv->records_lock);
+  dirty = priv->records_dirty;
+  g_mutex_unlock (&priv->records_lock);
+
+  if (dirty)
+    save_records (bg_source);
+
   G_OBJECT_CLASS (bg_pictures_source_parent_class)->dispose (object);
 }
 
@@ -119,13 +212,34 @@ bg_pictures_source_finalize (GObject *object)
       bg_source->priv->known_items = NULL;
     }
 
+  if (bg_source->priv->digests)
+    {
+      g_hash_table_destroy (bg_source->priv->digests);
+      bg_source->priv->digests = NULL;
+    }
+
+  /* the thumbnail workers use the records until the parent's dispose
+   * has stopped them */
+  g_hash_table_destroy (bg_source->priv->records);
+  g_mutex_clear (&bg_source->priv->records_lock);
+
+  if (bg_source->priv->cache_dir)
+    {
+      g_object_unref (bg_source->priv->cache_dir);
+      bg_source->priv->cache_dir = NULL;
+    }
+
   G_OBJECT_CLASS (bg_pictures_source_parent_class)->finalize (object);
 }
 
+static GIcon *bg_pictures_source_get_thumbnail (BgSource         *source,
+                                                 CcAppearanceItem *item);
+
 static void
 bg_pictures_source_class_init (BgPicturesSourceClass *klass)
 {
   GObjectClass *object_class = G_OBJECT_CLASS (klass);
+  BgSourceClass *source_class = BG_SOURCE_CLASS (klass);
 
   g_type_class_add_private (klass, sizeof (BgPicturesSourcePrivate));
 
@@ -133,6 +247,8 @@ bg_pictures_source_class_init (BgPicturesSourceClass *klass)
   object_class->set_property = bg_pictures_source_set_property;
   object_class->dispose = bg_pictures_source_dispose;
   object_class->finalize = bg_pictures_source_finalize;
+
+  source_class->get_thumbnail = bg_pictures_source_get_thumbnail;
 }
 
 static int
@@ -166,135 +282,441 @@ sort_func (GtkTreeModel *model,
 }
 
 static void
-picture_scaled (GObject *source_object,
-                GAsyncResult *res,
-                gpointer user_data)
+picture_record_free (PictureRecord *record)
 {
-  BgPicturesSource *bg_source;
-  CcAppearanceItem *item;
-  GError *error = NULL;
+  g_free (record->thumbnail);
+  g_slice_free (PictureRecord, record);
+}
+
+static GdkPixbuf *
+load_picture (const char  *uri,
+              GError     **error)
+{
+  GFile *file;
+  GFileInputStream *stream;
   GdkPixbuf *pixbuf;
-  const char *source_url;
-  const char *software;
-  GtkTreeIter iter;
-  GtkListStore *store;
 
-  pixbuf = gdk_pixbuf_new_from_stream_finish (res, &error);
+  file = g_file_new_for_uri (uri);
+  stream = g_file_read (file, NULL, error);
+  g_object_unref (file);
+
+  if (stream == NULL)
+    return NULL;
+
+  pixbuf = gdk_pixbuf_new_from_stream_at_scale (G_INPUT_STREAM (stream),
+                                                THUMBNAIL_WIDTH, THUMBNAIL_HEIGHT,
+                                                TRUE, NULL, error);
+  g_object_unref (stream);
+
+  return pixbuf;
+}
+
+/* gnome-screenshot tags its files with a tEXt chunk, which comes before
+ * the image data, so only the start of the file is read */
+static gboolean
+is_gnome_screenshot (const char *filename)
+{
+  static const guchar png_signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+  static const char software[] = "Software\0gnome-screenshot";
+  gboolean retval = FALSE;
+  guchar header[8];
+  FILE *f;
+
+  f = g_fopen (filename, "rb");
+  if (f == NULL)
+    return FALSE;
+
+  if (fread (header, 1, sizeof (header), f) != sizeof (header) ||
+      memcmp (header, png_signature, sizeof (png_signature)) != 0)
+    goto out;
+
+  while (fread (header, 1, sizeof (header), f) == sizeof (header))
+    {
+      guint32 length;
+
+      length = ((guint32) header[0] << 24) | (header[1] << 16) |
+               (header[2] << 8) | header[3];
+
+      if (memcmp (header + 4, "IDAT", 4) == 0 ||
+          memcmp (header + 4, "IEND", 4) == 0)
+        break;
+
+      if (memcmp (header + 4, "tEXt", 4) == 0 &&
+          length == sizeof (software) - 1)
+        {
+          char text[sizeof (software) - 1];
+
+          if (fread (text, 1, length, f) != length)
+            break;
+          if (memcmp (text, software, length) == 0)
+            {
+              retval = TRUE;
+              break;
+            }
+          length = 0;
+        }
+
+      /* skip the data and the CRC */
+      if (fseek (f, (long) length + 4, SEEK_CUR) != 0)
+        break;
+    }
+
+out:
+  fclose (f);
+
+  return retval;
+}
+
+/* Returns the path of the picture's thumbnail in the shared thumbnail
+ * cache, making it if there is none yet */
+static char *
+get_shared_thumbnail (BgPicturesSource *bg_source,
+                      const char       *uri,
+                      gint64            mtime)
+{
+  GnomeDesktopThumbnailFactory *factory = bg_source->priv->thumb_factory;
+  GdkPixbuf *pixbuf;
+  GFileInfo *info;
+  GFile *file;
+  const char *content_type;
+  char *mime_type;
+  char *thumbnail;
+
+  thumbnail = gnome_desktop_thumbnail_factory_lookup (factory, uri, mtime);
+  if (thumbnail != NULL)
+    return thumbnail;
+
+  if (gnome_desktop_thumbnail_factory_has_valid_failed_thumbnail (factory, uri, mtime))
+    return NULL;
+
+  file = g_file_new_for_uri (uri);
+  info = g_file_query_info (file, G_FILE_ATTRIBUTE_STANDARD_CONTENT_TYPE,
+                            G_FILE_QUERY_INFO_NONE, NULL, NULL);
+  g_object_unref (file);
+
+  if (info == NULL)
+    return NULL;
+
+  content_type = g_file_info_get_content_type (info);
+  mime_type = content_type ? g_content_type_get_mime_type (content_type) : NULL;
+  g_object_unref (info);
+
+  if (mime_type == NULL ||
+      !gnome_desktop_thumbnail_factory_can_thumbnail (factory, uri, mime_type, mtime))
+    {
+      g_free (mime_type);
+      return NULL;
+    }
+
+  pixbuf = gnome_desktop_thumbnail_factory_generate_thumbnail (factory, uri, mime_type);
+  g_free (mime_type);
+
   if (pixbuf == NULL)
     {
-      if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
-        g_warning ("Failed to load image: %s", error->message);
+      gnome_desktop_thumbnail_factory_create_failed_thumbnail (factory, uri, mtime);
+      return NULL;
+    }
 
-      g_error_free (error);
-      return;
+  gnome_desktop_thumbnail_factory_save_thumbnail (factory, pixbuf, uri, mtime);
+  g_object_unref (pixbuf);
+
+  return gnome_desktop_thumbnail_factory_lookup (factory, uri, mtime);
+}
+
+static gint64
+get_mtime (const char *uri)
+{
+  GFileInfo *info;
+  GFile *file;
+  gint64 mtime = 0;
+
+  file = g_file_new_for_uri (uri);
+  info = g_file_query_info (file, G_FILE_ATTRIBUTE_TIME_MODIFIED,
+                            G_FILE_QUERY_INFO_NONE, NULL, NULL);
+  g_object_unref (file);
+
+  if (info != NULL)
+    {
+      mtime = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED);
+      g_object_unref (info);
     }
 
-  /* since we were not cancelled, we can now cast user_data
-   * back to BgPicturesSource.
-   */
-  bg_source = BG_PICTURES_SOURCE (user_data);
-  store = bg_source_get_liststore (BG_SOURCE (bg_source));
-  item = g_object_get_data (source_object, "item");
+  return mtime;
+}
 
-  gtk_tree_sortable_set_sort_func (GTK_TREE_SORTABLE (store),
-                                   1,
-                                   (GtkTreeIterCompareFunc)sort_func,
-                                   bg_source,
-                                   NULL);
+/* Called from the thumbnail workers */
+static GIcon *
+bg_pictures_source_get_thumbnail (BgSource         *source,
+                                  CcAppearanceItem *item)
+{
+  BgPicturesSource *bg_source = BG_PICTURES_SOURCE (source);
+  BgPicturesSourcePrivate *priv = bg_source->priv;
+  PictureRecord *record;
+  GdkPixbuf *pixbuf = NULL;
+  const char *uri;
+  gboolean is_screenshot = FALSE;
+  gboolean has_record;
+  gboolean probed = FALSE;
+  char *thumbnail = NULL;
+  char *filename;
+  gint64 mtime = 0;
+  gint width = 0, height = 0;
+  GError *error = NULL;
 
-  gtk_tree_sortable_set_sort_column_id (GTK_TREE_SORTABLE (store),
-                                        1,
-                                        GTK_SORT_ASCENDING);
+  uri = cc_appearance_item_get_uri (item);
+
+  g_mutex_lock (&priv->records_lock);
+  record = g_hash_table_lookup (priv->records, uri);
+  has_record = (record != NULL);
+  if (record != NULL)
+    {
+      mtime = record->mtime;
+      probed = record->probed;
+      if (probed)
+        {
+          is_screenshot = record->is_screenshot;
+          thumbnail = g_strdup (record->thumbnail);
+        }
+    }
+  g_mutex_unlock (&priv->records_lock);
+
+  /* the record already says what the picture is, including that no
+   * shared thumbnail could be made for it */
+  if (!probed)
+    {
+      filename = g_filename_from_uri (uri, NULL, NULL);
+      if (filename != NULL)
+        {
+          gdk_pixbuf_get_file_info (filename, &width, &height);
+          is_screenshot = is_gnome_screenshot (filename);
+        }
+      g_free (filename);
+
+      if (!has_record)
+        mtime = get_mtime (uri);
+
+      /* the shared thumbnail is also what the file manager shows, so
+       * it is only made once for both */
+      if (!is_screenshot)
+        thumbnail = get_shared_thumbnail (bg_source, uri, mtime);
+
+      g_mutex_lock (&priv->records_lock);
+      record = g_hash_table_lookup (priv->records, uri);
+      if (record != NULL && record->mtime == mtime)
+        {
+          record->probed = TRUE;
+          record->is_screenshot = is_screenshot;
+          record->width = width;
+          record->height = height;
+          record->thumbnail_failed = (!is_screenshot && thumbnail == NULL);
+          g_free (record->thumbnail);
+          record->thumbnail = g_strdup (thumbnail);
+          priv->records_dirty = TRUE;
+        }
+      g_mutex_unlock (&priv->records_lock);
+    }
 
   /* Ignore screenshots */
-  software = gdk_pixbuf_get_option (pixbuf, "tEXt::Software");
-  if (software != NULL &&
-      g_str_equal (software, "gnome-screenshot"))
+  if (is_screenshot)
     {
       g_debug ("Ignored URL '%s' as it's a screenshot from gnome-screenshot",
-               cc_appearance_item_get_uri (item));
-      g_object_unref (pixbuf);
-      g_object_unref (item);
-      return;
+               uri);
+      return NULL;
     }
 
-  cc_appearance_item_load (item, NULL);
+  /* a thumbnail is much quicker to scale down than the picture */
+  if (thumbnail != NULL)
+    {
+      pixbuf = gdk_pixbuf_new_from_file_at_scale (thumbnail,
+                                                  THUMBNAIL_WIDTH, THUMBNAIL_HEIGHT,
+                                                  TRUE, NULL);
+      g_free (thumbnail);
+    }
 
-  /* insert the item into the liststore */
-  gtk_list_store_insert_with_values (store, &iter, 0,
-                                     0, pixbuf,
-                                     1, item,
-                                     -1);
-  source_url = cc_appearance_item_get_source_url (item);
-  if (source_url != NULL)
+  if (pixbuf == NULL)
     {
-      g_hash_table_insert (bg_source->priv->known_items,
-			   bg_pictures_source_get_unique_filename (source_url), GINT_TO_POINTER (TRUE));
+      pixbuf = load_picture (uri, &error);
+      if (pixbuf == NULL)
+        {
+          g_warning ("Failed to load picture '%s': %s", uri, error->message);
+          g_error_free (error);
+          return NULL;
+        }
     }
-  else
+
+  /* the item is the worker's own copy; the size read here is handed to
+   * the row's item from the main thread */
+  cc_appearance_item_load (item, NULL);
+
+  return G_ICON (pixbuf);
+}
+
+static char *
+get_index_path (void)
+{
+  char *cache_path, *path;
+
+  cache_path = bg_pictures_source_get_cache_path ();
+  path = g_build_filename (cache_path, INDEX_FILENAME, NULL);
+  g_free (cache_path);
+
+  return path;
+}
+
+static void
+load_records (BgPicturesSource *bg_source)
+{
+  BgPicturesSourcePrivate *priv = bg_source->priv;
+  GMappedFile *mapped;
+  GVariant *index, *records;
+  GVariantIter iter;
+  const char *uri, *thumbnail;
+  guint32 version;
+  PictureRecord record;
+  char *path;
+
+  path = get_index_path ();
+  mapped = g_mapped_file_new (path, FALSE, NULL);
+  g_free (path);
+
+  if (mapped == NULL)
+    return;
+
+  if (g_mapped_file_get_length (mapped) == 0)
     {
-      char *cache_path;
-      GFile *file, *parent, *dir;
+      g_mapped_file_unref (mapped);
+      return;
+    }
 
-      cache_path = bg_pictures_source_get_cache_path ();
-      dir = g_file_new_for_path (cache_path);
-      g_free (cache_path);
+  index = g_variant_new_from_data (G_VARIANT_TYPE (INDEX_FORMAT),
+                                   g_mapped_file_get_contents (mapped),
+                                   g_mapped_file_get_length (mapped),
+                                   FALSE,
+                                   (GDestroyNotify) g_mapped_file_unref,
+                                   mapped);
+  g_variant_ref_sink (index);
 
-      file = g_file_new_for_uri (cc_appearance_item_get_uri (item));
-      parent = g_file_get_parent (file);
+  g_variant_get (index, "(u@a{s(xtiibbbs)})", &version, &records);
 
-      if (g_file_equal (parent, dir))
+  if (version == INDEX_VERSION)
+    {
+      g_variant_iter_init (&iter, records);
+      while (g_variant_iter_next (&iter, "{&s(xtiibbb&s)}",
+                                  &uri, &record.mtime, &record.size,
+                                  &record.width, &record.height,
+                                  &record.probed, &record.is_screenshot,
+                                  &record.thumbnail_failed, &thumbnail))
         {
-          char *basename;
-          basename = g_file_get_basename (file);
-	  g_hash_table_insert (bg_source->priv->known_items,
-			       basename, GINT_TO_POINTER (TRUE));
-	}
-      g_object_unref (file);
-      g_object_unref (parent);
+          PictureRecord *copy;
+
+          copy = g_slice_dup (PictureRecord, &record);
+          copy->thumbnail = *thumbnail ? g_strdup (thumbnail) : NULL;
+          copy->seen = FALSE;
+          g_hash_table_insert (priv->records, g_strdup (uri), copy);
+        }
     }
 
-  g_object_unref (pixbuf);
+  g_variant_unref (records);
+  g_variant_unref (index);
 }
 
 static void
-picture_opened_for_read (GObject *source_object,
-                         GAsyncResult *res,
-                         gpointer user_data)
+save_records (BgPicturesSource *bg_source)
 {
-  BgPicturesSource *bg_source;
-  CcAppearanceItem *item;
-  GFileInputStream *stream;
+  BgPicturesSourcePrivate *priv = bg_source->priv;
+  GVariantBuilder builder;
+  GHashTableIter iter;
+  const char *uri;
+  PictureRecord *record;
+  GVariant *index;
+  char *path, *dirname;
   GError *error = NULL;
 
-  item = g_object_get_data (source_object, "item");
-  stream = g_file_read_finish (G_FILE (source_object), res, &error);
-  if (stream == NULL)
-    {
-      if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
-        {
-          char *filename = g_file_get_path (G_FILE (source_object));
-          g_warning ("Failed to load picture '%s': %s", filename, error->message);
-          g_free (filename);
-        }
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a{s(xtiibbbs)}"));
 
+  g_mutex_lock (&priv->records_lock);
+  g_hash_table_iter_init (&iter, priv->records);
+  while (g_hash_table_iter_next (&iter, (gpointer *) &uri, (gpointer *) &record))
+    {
+      g_variant_builder_add (&builder, "{s(xtiibbbs)}",
+                             uri, record->mtime, record->size,
+                             record->width, record->height,
+                             record->probed, record->is_screenshot,
+                             record->thumbnail_failed,
+                             record->thumbnail ? record->thumbnail : "");
+    }
+  priv->records_dirty = FALSE;
+  g_mutex_unlock (&priv->records_lock);
+
+  index = g_variant_new ("(u@a{s(xtiibbbs)})", INDEX_VERSION,
+                         g_variant_builder_end (&builder));
+  g_variant_ref_sink (index);
+
+  path = get_index_path ();
+  dirname = g_path_get_dirname (path);
+  g_mkdir_with_parents (dirname, 0755);
+  g_free (dirname);
+
+  if (!g_file_set_contents (path,
+                            g_variant_get_data (index),
+                            g_variant_get_size (index),
+                            &error))
+    {
+      g_warning ("Could not save the pictures index '%s': %s", path, error->message);
       g_error_free (error);
-      g_object_unref (item);
-      return;
     }
 
-  /* since we were not cancelled, we can now cast user_data
-   * back to BgPicturesSource.
-   */
-  bg_source = BG_PICTURES_SOURCE (user_data);
+  g_free (path);
+  g_variant_unref (index);
+}
 
-  g_object_set_data (G_OBJECT (stream), "item", item);
-  gdk_pixbuf_new_from_stream_at_scale_async (G_INPUT_STREAM (stream),
-                                             THUMBNAIL_WIDTH, THUMBNAIL_HEIGHT,
-                                             TRUE,
-                                             bg_source->priv->cancellable,
-                                             picture_scaled, bg_source);
-  g_object_unref (stream);
+static gboolean
+save_records_timeout (gpointer user_data)
+{
+  BgPicturesSource *bg_source = user_data;
+
+  bg_source->priv->save_id = 0;
+  save_records (bg_source);
+
+  return FALSE;
+}
+
+static void
+schedule_save (BgPicturesSource *bg_source)
+{
+  BgPicturesSourcePrivate *priv = bg_source->priv;
+  gboolean dirty;
+
+  if (priv->save_id != 0)
+    return;
+
+  g_mutex_lock (&priv->records_lock);
+  dirty = priv->records_dirty;
+  g_mutex_unlock (&priv->records_lock);
+
+  if (dirty)
+    priv->save_id = g_timeout_add_seconds (INDEX_SAVE_DELAY,
+                                           save_records_timeout,
+                                           bg_source);
+}
+
+/* Rows change when their thumbnail arrives, and are removed if they turn
+ * out to be screenshots, which is when the workers update the records */
+static void
+row_changed_cb (GtkTreeModel     *model,
+                GtkTreePath      *path,
+                GtkTreeIter      *iter,
+                BgPicturesSource *bg_source)
+{
+  schedule_save (bg_source);
+}
+
+static void
+row_deleted_cb (GtkTreeModel     *model,
+                GtkTreePath      *path,
+                BgPicturesSource *bg_source)
+{
+  schedule_save (bg_source);
 }
 
 static gboolean
@@ -315,6 +737,8 @@ add_single_file (BgPicturesSource *bg_source,
 {
   const gchar *content_type;
   CcAppearanceItem *item;
+  GtkListStore *store;
+  const char *source_url;
   char *uri;
 
   /* find png and jpeg files */
@@ -337,10 +761,46 @@ add_single_file (BgPicturesSource *bg_source,
   if (source_uri != NULL && !g_file_is_native (file))
     g_object_set (G_OBJECT (item), "source-url", source_uri, NULL);
 
-  g_object_set_data (G_OBJECT (file), "item", item);
-  g_file_read_async (file, G_PRIORITY_DEFAULT,
-                     bg_source->priv->cancellable,
-                     picture_opened_for_read, bg_source);
+  /* the rest of the item is loaded with its thumbnail, once it is in
+   * view, except for pictures the user adds, which get selected
+   * straight away */
+  if (source_uri != NULL)
+    cc_appearance_item_load (item, info);
+  else
+    g_object_set (G_OBJECT (item),
+                  "name", g_file_info_get_display_name (info),
+                  NULL);
+
+  store = bg_source_get_liststore (BG_SOURCE (bg_source));
+  gtk_list_store_insert_with_values (store, NULL, 0,
+                                     0, bg_source_get_placeholder (BG_SOURCE (bg_source)),
+                                     1, item,
+                                     -1);
+
+  source_url = cc_appearance_item_get_source_url (item);
+  if (source_url != NULL)
+    {
+      g_hash_table_insert (bg_source->priv->known_items,
+			   g_strdup (get_digest (bg_source, source_url)),
+			   GINT_TO_POINTER (TRUE));
+    }
+  else
+    {
+      GFile *parent;
+
+      parent = g_file_get_parent (file);
+
+      if (g_file_equal (parent, bg_source->priv->cache_dir))
+        {
+          char *basename;
+          basename = g_file_get_basename (file);
+	  g_hash_table_insert (bg_source->priv->known_items,
+			       basename, GINT_TO_POINTER (TRUE));
+	}
+      g_object_unref (parent);
+    }
+
+  g_object_unref (item);
   g_object_unref (file);
   return TRUE;
 }
@@ -407,47 +867,168 @@ bg_pictures_source_remove (BgPicturesSource *bg_source,
   return retval;
 }
 
+static void scan_next_dir (BgPicturesSource *bg_source);
+
+static void
+scan_finished (BgPicturesSource *bg_source)
+{
+  BgPicturesSourcePrivate *priv = bg_source->priv;
+  GHashTableIter iter;
+  PictureRecord *record;
+
+  g_hash_table_destroy (priv->scanned_dirs);
+  priv->scanned_dirs = NULL;
+
+  /* a directory that couldn't be read doesn't mean its pictures are gone */
+  if (priv->scan_failed)
+    {
+      g_debug ("Pictures scan incomplete, keeping the records of unseen pictures");
+      schedule_save (bg_source);
+      return;
+    }
+
+  /* forget about the pictures that are gone */
+  g_mutex_lock (&priv->records_lock);
+  g_hash_table_iter_init (&iter, priv->records);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &record))
+    {
+      if (!record->seen)
+        {
+          g_hash_table_iter_remove (&iter);
+          priv->records_dirty = TRUE;
+        }
+    }
+  g_mutex_unlock (&priv->records_lock);
+
+  schedule_save (bg_source);
+}
+
+static void
+scan_file (BgPicturesSource *bg_source,
+           GFile            *parent,
+           GFileInfo        *info)
+{
+  BgPicturesSourcePrivate *priv = bg_source->priv;
+  PictureRecord *record;
+  const char *content_type;
+  gboolean is_screenshot;
+  gint64 mtime;
+  guint64 size;
+  GFile *file;
+  char *uri;
+
+  if (g_file_info_get_file_type (info) == G_FILE_TYPE_DIRECTORY)
+    {
+      const char *id;
+
+      if (g_file_info_get_is_hidden (info))
+        return;
+
+      /* symbolic links can make loops */
+      id = g_file_info_get_attribute_string (info, G_FILE_ATTRIBUTE_ID_FILE);
+      if (id != NULL)
+        {
+          if (g_hash_table_contains (priv->scanned_dirs, id))
+            return;
+          g_hash_table_add (priv->scanned_dirs, g_strdup (id));
+        }
+
+      g_queue_push_tail (priv->scan_queue,
+                         g_file_get_child (parent, g_file_info_get_name (info)));
+      return;
+    }
+
+  content_type = g_file_info_get_content_type (info);
+  if (content_type == NULL || !in_content_types (content_type))
+    return;
+
+  file = g_file_get_child (parent, g_file_info_get_name (info));
+  uri = g_file_get_uri (file);
+  mtime = g_file_info_get_attribute_uint64 (info, G_FILE_ATTRIBUTE_TIME_MODIFIED);
+  size = g_file_info_get_size (info);
+
+  g_mutex_lock (&priv->records_lock);
+  record = g_hash_table_lookup (priv->records, uri);
+  if (record == NULL || record->mtime != mtime || record->size != size)
+    {
+      /* new or changed, probed again when its thumbnail is made */
+      record = g_slice_new0 (PictureRecord);
+      record->mtime = mtime;
+      record->size = size;
+      g_hash_table_insert (priv->records, g_strdup (uri), record);
+      priv->records_dirty = TRUE;
+    }
+  record->seen = TRUE;
+  is_screenshot = record->probed && record->is_screenshot;
+  g_mutex_unlock (&priv->records_lock);
+
+  if (is_screenshot)
+    {
+      g_debug ("Ignored URL '%s' as it's a screenshot from gnome-screenshot", uri);
+      g_object_unref (file);
+    }
+  else
+    {
+      add_single_file (bg_source, file, info, NULL);
+    }
+
+  g_free (uri);
+}
+
 static void
 file_info_async_ready (GObject      *source,
                        GAsyncResult *res,
                        gpointer      user_data)
 {
+  GFileEnumerator *enumerator = G_FILE_ENUMERATOR (source);
   BgPicturesSource *bg_source;
   GList *files, *l;
   GError *err = NULL;
   GFile *parent;
-  files = g_file_enumerator_next_files_finish (G_FILE_ENUMERATOR (source),
-                                               res,
-                                               &err);
+
+  files = g_file_enumerator_next_files_finish (enumerator, res, &err);
 
   if (err)
     {
-      if (!g_error_matches (err, G_IO_ERROR, G_IO_ERROR_CANCELLED))
-        g_warning ("Could not get pictures file information: %s", err->message);
-      g_error_free (err);
+      if (g_error_matches (err, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        {
+          g_error_free (err);
+          g_object_unref (enumerator);
+          return;
+        }
 
-      g_list_foreach (files, (GFunc) g_object_unref, NULL);
-      g_list_free (files);
-      return;
+      g_warning ("Could not get pictures file information: %s", err->message);
+      g_error_free (err);
+      BG_PICTURES_SOURCE (user_data)->priv->scan_failed = TRUE;
     }
 
+  /* since we were not cancelled, we can now cast user_data
+   * back to BgPicturesSource.
+   */
   bg_source = BG_PICTURES_SOURCE (user_data);
 
-  parent = g_file_enumerator_get_container (G_FILE_ENUMERATOR (source));
-
-  /* iterate over the available files */
-  for (l = files; l; l = g_list_next (l))
+  if (files == NULL)
     {
-      GFileInfo *info = l->data;
-      GFile *file;
+      /* done with this folder */
+      g_object_unref (enumerator);
+      scan_next_dir (bg_source);
+      return;
+    }
 
-      file = g_file_get_child (parent, g_file_info_get_name (info));
+  parent = g_file_enumerator_get_container (enumerator);
 
-      add_single_file (bg_source, file, info, NULL);
-    }
+  for (l = files; l; l = g_list_next (l))
+    scan_file (bg_source, parent, l->data);
 
   g_list_foreach (files, (GFunc) g_object_unref, NULL);
   g_list_free (files);
+
+  g_file_enumerator_next_files_async (enumerator,
+                                      SCAN_CHUNK_SIZE,
+                                      G_PRIORITY_LOW,
+                                      bg_source->priv->cancellable,
+                                      file_info_async_ready,
+                                      bg_source);
 }
 
 static void
@@ -455,7 +1036,7 @@ dir_enum_async_ready (GObject      *source,
                       GAsyncResult *res,
                       gpointer      user_data)
 {
-  BgPicturesSourcePrivate *priv;
+  BgPicturesSource *bg_source;
   GFileEnumerator *enumerator;
   GError *err = NULL;
 
@@ -463,22 +1044,93 @@ dir_enum_async_ready (GObject      *source,
 
   if (err)
     {
-      if (!g_error_matches (err, G_IO_ERROR, G_IO_ERROR_NOT_FOUND) &&
-          !g_error_matches (err, G_IO_ERROR, G_IO_ERROR_CANCELLED))
-        g_warning ("Could not fill pictures source: %s", err->message);
+      if (g_error_matches (err, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        {
+          g_error_free (err);
+          return;
+        }
+
+      /* a directory which is gone took its pictures with it */
+      if (!g_error_matches (err, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+        {
+          g_warning ("Could not fill pictures source: %s", err->message);
+          BG_PICTURES_SOURCE (user_data)->priv->scan_failed = TRUE;
+        }
       g_error_free (err);
+
+      scan_next_dir (BG_PICTURES_SOURCE (user_data));
       return;
     }
 
-  priv = BG_PICTURES_SOURCE (user_data)->priv;
+  bg_source = BG_PICTURES_SOURCE (user_data);
 
   /* get the files */
   g_file_enumerator_next_files_async (enumerator,
-                                      G_MAXINT,
+                                      SCAN_CHUNK_SIZE,
                                       G_PRIORITY_LOW,
-                                      priv->cancellable,
+                                      bg_source->priv->cancellable,
                                       file_info_async_ready,
-                                      user_data);
+                                      bg_source);
+}
+
+static void
+scan_next_dir (BgPicturesSource *bg_source)
+{
+  BgPicturesSourcePrivate *priv = bg_source->priv;
+  GFile *dir;
+
+  dir = g_queue_pop_head (priv->scan_queue);
+  if (dir == NULL)
+    {
+      scan_finished (bg_source);
+      return;
+    }
+
+  g_file_enumerate_children_async (dir,
+				   ATTRIBUTES,
+                                   G_FILE_QUERY_INFO_NONE,
+                                   G_PRIORITY_LOW, priv->cancellable,
+                                   dir_enum_async_ready, bg_source);
+  g_object_unref (dir);
+}
+
+/* The Pictures folder is seen by file id too, so that a link back to it
+ * from one of its subfolders isn't scanned again */
+static void
+pictures_dir_info_ready (GObject      *source,
+                         GAsyncResult *res,
+                         gpointer      user_data)
+{
+  BgPicturesSource *bg_source;
+  GFileInfo *info;
+  GError *err = NULL;
+  const char *id;
+
+  info = g_file_query_info_finish (G_FILE (source), res, &err);
+
+  if (err)
+    {
+      if (g_error_matches (err, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+        {
+          g_error_free (err);
+          return;
+        }
+
+      /* enumerating it will tell what is wrong */
+      g_error_free (err);
+    }
+
+  bg_source = BG_PICTURES_SOURCE (user_data);
+
+  if (info)
+    {
+      id = g_file_info_get_attribute_string (info, G_FILE_ATTRIBUTE_ID_FILE);
+      if (id != NULL)
+        g_hash_table_add (bg_source->priv->scanned_dirs, g_strdup (id));
+      g_object_unref (info);
+    }
+
+  scan_next_dir (bg_source);
 }
 
 char *
@@ -525,18 +1177,32 @@ bg_pictures_source_get_unique_path (const char *uri)
   return ret;
 }
 
+static const char *
+get_digest (BgPicturesSource *bg_source,
+            const char       *uri)
+{
+  char *digest;
+
+  digest = g_hash_table_lookup (bg_source->priv->digests, uri);
+  if (digest == NULL)
+    {
+      /* checksumming again is cheap, so just start over when full */
+      if (g_hash_table_size (bg_source->priv->digests) >= MAX_DIGESTS)
+        g_hash_table_remove_all (bg_source->priv->digests);
+
+      digest = bg_pictures_source_get_unique_filename (uri);
+      g_hash_table_insert (bg_source->priv->digests, g_strdup (uri), digest);
+    }
+
+  return digest;
+}
+
 gboolean
 bg_pictures_source_is_known (BgPicturesSource *bg_source,
 			     const char       *uri)
 {
-  gboolean retval;
-  char *uuid;
-
-  uuid = bg_pictures_source_get_unique_filename (uri);
-  retval = (GPOINTER_TO_INT (g_hash_table_lookup (bg_source->priv->known_items, uuid)));
-  g_free (uuid);
-
-  return retval;
+  return GPOINTER_TO_INT (g_hash_table_lookup (bg_source->priv->known_items,
+                                               get_digest (bg_source, uri)));
 }
 
 static void
@@ -544,7 +1210,8 @@ bg_pictures_source_init (BgPicturesSource *self)
 {
   const gchar *pictures_path;
   BgPicturesSourcePrivate *priv;
-  GFile *dir;
+  GtkListStore *store;
+  GFile *pictures_dir;
   char *cache_path;
 
   priv = self->priv = PICTURES_SOURCE_PRIVATE (self);
@@ -554,27 +1221,53 @@ bg_pictures_source_init (BgPicturesSource *self)
 					     g_str_equal,
 					     (GDestroyNotify) g_free,
 					     NULL);
+  priv->digests = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                         g_free, g_free);
 
-  pictures_path = g_get_user_special_dir (G_USER_DIRECTORY_PICTURES);
-  dir = g_file_new_for_path (pictures_path);
-  g_file_enumerate_children_async (dir,
-				   ATTRIBUTES,
-                                   G_FILE_QUERY_INFO_NONE,
-                                   G_PRIORITY_LOW, priv->cancellable,
-                                   dir_enum_async_ready, self);
-  g_object_unref (dir);
+  store = bg_source_get_liststore (BG_SOURCE (self));
+  gtk_tree_sortable_set_sort_func (GTK_TREE_SORTABLE (store),
+                                   1,
+                                   (GtkTreeIterCompareFunc)sort_func,
+                                   self,
+                                   NULL);
+  gtk_tree_sortable_set_sort_column_id (GTK_TREE_SORTABLE (store),
+                                        1,
+                                        GTK_SORT_ASCENDING);
 
-  cache_path = bg_pictures_source_get_cache_path ();
-  dir = g_file_new_for_path (cache_path);
-  g_file_enumerate_children_async (dir,
-				   ATTRIBUTES,
-                                   G_FILE_QUERY_INFO_NONE,
-                                   G_PRIORITY_LOW, priv->cancellable,
-                                   dir_enum_async_ready, self);
-  g_object_unref (dir);
+  g_signal_connect (store, "row-changed",
+                    G_CALLBACK (row_changed_cb), self);
+  g_signal_connect (store, "row-deleted",
+                    G_CALLBACK (row_deleted_cb), self);
 
   priv->thumb_factory =
     gnome_desktop_thumbnail_factory_new (GNOME_DESKTOP_THUMBNAIL_SIZE_NORMAL);
+
+  g_mutex_init (&priv->records_lock);
+  priv->records = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                         (GDestroyNotify) picture_record_free);
+  load_records (self);
+
+  cache_path = bg_pictures_source_get_cache_path ();
+  priv->cache_dir = g_file_new_for_path (cache_path);
+  g_free (cache_path);
+
+  /* scan the Pictures folder and its subfolders, then the pictures
+   * downloaded from other sources */
+  priv->scan_queue = g_queue_new ();
+  priv->scanned_dirs = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                              g_free, NULL);
+
+  pictures_path = g_get_user_special_dir (G_USER_DIRECTORY_PICTURES);
+  pictures_dir = g_file_new_for_path (pictures_path);
+  g_queue_push_tail (priv->scan_queue, g_object_ref (pictures_dir));
+  g_queue_push_tail (priv->scan_queue, g_object_ref (priv->cache_dir));
+
+  g_file_query_info_async (pictures_dir,
+                           G_FILE_ATTRIBUTE_ID_FILE,
+                           G_FILE_QUERY_INFO_NONE,
+                           G_PRIORITY_LOW, priv->cancellable,
+                           pictures_dir_info_ready, self);
+  g_object_unref (pictures_dir);
 }
 
 BgPicturesSource *
@@ -23,12 +23,62 @@
 
 G_DEFINE_ABSTRACT_TYPE (BgSource, bg_source, G_TYPE_OBJECT)
 
+
 #define SOURCE_PRIVATE(o) \
   (G_TYPE_INSTANCE_GET_PRIVATE ((o), BG_TYPE_SOURCE, BgSourcePrivate))
 
+/* Thumbnails are only rendered for the rows in view, plus a margin on
+ * either side, by a small pool of worker threads. They are handed back to
+ * the main thread in batches so that the icon view is not relaid out for
+ * every single thumbnail, and the ones far out of view are dropped again
+ * once they take more than the memory budget. */
+#define THUMBNAIL_MAX_THREADS 4
+#define THUMBNAIL_BATCH_SIZE 16
+#define THUMBNAIL_PREFETCH_ROWS 48
+#define THUMBNAIL_DEFAULT_BUDGET (16 * 1024 * 1024)
+
+/* The workers render from their own copy of the item, as the GnomeBG of
+ * the one in the store is used from the main thread */
+typedef struct
+{
+  CcAppearanceItem    *item;
+  CcAppearanceItem    *copy;
+  GtkTreeRowReference *row;
+  gint                 position;
+  guint                serial;
+  volatile gint        cancelled;
+  GIcon               *icon;
+} ThumbnailJob;
+
+typedef struct
+{
+  GtkTreeRowReference *row;
+  gsize                size;
+} LoadedThumbnail;
+
 struct _BgSourcePrivate
 {
   GtkListStore *store;
+
+  GIcon        *placeholder;
+  GThreadPool  *pool;
+  GHashTable   *pending;
+  guint         serial;
+  gboolean      active;
+  guint         refresh_id;
+
+  gint          visible_start;
+  gint          visible_end;
+
+  /* thumbnails in the store, by item */
+  GHashTable   *loaded;
+  gsize         loaded_size;
+  gsize         budget;
+
+  /* finished jobs, filled by the workers */
+  GMutex        done_lock;
+  GQueue       *done;
+  guint         done_id;
 };
 
 enum
@@ -69,13 +119,511 @@ bg_source_set_property (GObject      *object,
     }
 }
 
+static void
+thumbnail_job_free (ThumbnailJob *job)
+{
+  g_object_unref (job->item);
+  g_object_unref (job->copy);
+  gtk_tree_row_reference_free (job->row);
+  if (job->icon)
+    g_object_unref (job->icon);
+  g_slice_free (ThumbnailJob, job);
+}
+
+static void
+loaded_thumbnail_free (LoadedThumbnail *loaded)
+{
+  gtk_tree_row_reference_free (loaded->row);
+  g_slice_free (LoadedThumbnail, loaded);
+}
+
+static gsize
+get_icon_size (GIcon *icon)
+{
+  GdkPixbuf *pixbuf;
+
+  if (G_IS_EMBLEMED_ICON (icon))
+    icon = g_emblemed_icon_get_icon (G_EMBLEMED_ICON (icon));
+
+  if (!GDK_IS_PIXBUF (icon))
+    return 0;
+
+  pixbuf = GDK_PIXBUF (icon);
+  return gdk_pixbuf_get_rowstride (pixbuf) * gdk_pixbuf_get_height (pixbuf);
+}
+
+/* The rows that get thumbnails: the visible ones and a margin around them */
+static void
+get_window (BgSourcePrivate *priv,
+            gint            *first,
+            gint            *last)
+{
+  if (priv->visible_end < priv->visible_start)
+    {
+      *first = 0;
+      *last = THUMBNAIL_PREFETCH_ROWS;
+      return;
+    }
+
+  *first = MAX (priv->visible_start - THUMBNAIL_PREFETCH_ROWS, 0);
+  *last = priv->visible_end + THUMBNAIL_PREFETCH_ROWS;
+}
+
+static gint
+get_distance (BgSourcePrivate *priv,
+              gint             position)
+{
+  if (position < priv->visible_start)
+    return priv->visible_start - position;
+  if (position > priv->visible_end)
+    return position - MAX (priv->visible_end, priv->visible_start);
+  return 0;
+}
+
+/* Only called from the main thread, when pushing jobs or resorting */
+static gint
+compare_jobs (gconstpointer a,
+              gconstpointer b,
+              gpointer      user_data)
+{
+  const ThumbnailJob *job_a = a;
+  const ThumbnailJob *job_b = b;
+  BgSourcePrivate *priv = user_data;
+  gint distance_a, distance_b;
+
+  distance_a = get_distance (priv, job_a->position);
+  distance_b = get_distance (priv, job_b->position);
+
+  if (distance_a != distance_b)
+    return distance_a < distance_b ? -1 : 1;
+
+  return job_a->serial < job_b->serial ? -1 : 1;
+}
+
+static gint
+get_row_position (GtkTreeRowReference *row)
+{
+  GtkTreePath *path;
+  gint position;
+
+  path = gtk_tree_row_reference_get_path (row);
+  if (path == NULL)
+    return -1;
+
+  position = gtk_tree_path_get_indices (path)[0];
+  gtk_tree_path_free (path);
+
+  return position;
+}
+
+/* Rows are inserted and removed while jobs are queued, so the positions
+ * the jobs are sorted on are looked up again before they are used */
+static void
+update_job_positions (BgSource *source)
+{
+  BgSourcePrivate *priv = source->priv;
+  GHashTableIter iter;
+  ThumbnailJob *job;
+  gboolean moved = FALSE;
+
+  g_hash_table_iter_init (&iter, priv->pending);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &job))
+    {
+      gint position;
+
+      position = get_row_position (job->row);
+      if (position < 0)
+        {
+          g_atomic_int_set (&job->cancelled, TRUE);
+          g_hash_table_iter_remove (&iter);
+        }
+      else if (position != job->position)
+        {
+          job->position = position;
+          moved = TRUE;
+        }
+    }
+
+  /* setting the sort function again resorts the queued jobs */
+  if (moved && priv->pool)
+    g_thread_pool_set_sort_function (priv->pool, compare_jobs, priv);
+}
+
+static void
+set_row_icon (BgSourcePrivate     *priv,
+              GtkTreeRowReference *row,
+              GIcon               *icon)
+{
+  GtkTreePath *path;
+  GtkTreeIter iter;
+
+  path = gtk_tree_row_reference_get_path (row);
+  if (path == NULL)
+    return;
+
+  if (gtk_tree_model_get_iter (GTK_TREE_MODEL (priv->store), &iter, path))
+    {
+      if (icon != NULL)
+        gtk_list_store_set (priv->store, &iter, 0, icon, -1);
+      else
+        gtk_list_store_remove (priv->store, &iter);
+    }
+
+  gtk_tree_path_free (path);
+}
+
+typedef struct
+{
+  CcAppearanceItem *item;
+  gint              distance;
+} EvictCandidate;
+
+static gint
+compare_candidates (gconstpointer a,
+                    gconstpointer b)
+{
+  const EvictCandidate *candidate_a = a;
+  const EvictCandidate *candidate_b = b;
+
+  return candidate_b->distance - candidate_a->distance;
+}
+
+/* Puts the placeholder back in the rows furthest from the visible range
+ * until the thumbnails fit in the budget again. The rows in the prefetch
+ * window are always kept. */
+static void
+evict_thumbnails (BgSource *source)
+{
+  BgSourcePrivate *priv = source->priv;
+  GHashTableIter iter;
+  CcAppearanceItem *item;
+  LoadedThumbnail *loaded;
+  GArray *candidates;
+  gint first, last;
+  guint i;
+
+  if (priv->loaded_size <= priv->budget)
+    return;
+
+  get_window (priv, &first, &last);
+  candidates = g_array_new (FALSE, FALSE, sizeof (EvictCandidate));
+
+  g_hash_table_iter_init (&iter, priv->loaded);
+  while (g_hash_table_iter_next (&iter, (gpointer *) &item, (gpointer *) &loaded))
+    {
+      EvictCandidate candidate;
+      gint position;
+
+      position = get_row_position (loaded->row);
+      if (position < 0)
+        {
+          /* the row is gone, and its thumbnail with it */
+          priv->loaded_size -= loaded->size;
+          g_hash_table_iter_remove (&iter);
+          continue;
+        }
+
+      if (position >= first && position <= last)
+        continue;
+
+      candidate.item = item;
+      candidate.distance = get_distance (priv, position);
+      g_array_append_val (candidates, candidate);
+    }
+
+  g_array_sort (candidates, compare_candidates);
+
+  for (i = 0; i < candidates->len && priv->loaded_size > priv->budget; i++)
+    {
+      EvictCandidate *candidate = &g_array_index (candidates, EvictCandidate, i);
+
+      loaded = g_hash_table_lookup (priv->loaded, candidate->item);
+      set_row_icon (priv, loaded->row, priv->placeholder);
+      priv->loaded_size -= loaded->size;
+      g_hash_table_remove (priv->loaded, candidate->item);
+    }
+
+  g_array_free (candidates, TRUE);
+}
+
+static void
+add_loaded (BgSource         *source,
+            CcAppearanceItem *item,
+            ThumbnailJob     *job)
+{
+  BgSourcePrivate *priv = source->priv;
+  LoadedThumbnail *loaded;
+
+  loaded = g_hash_table_lookup (priv->loaded, item);
+  if (loaded != NULL)
+    {
+      priv->loaded_size -= loaded->size;
+      g_hash_table_remove (priv->loaded, item);
+    }
+
+  loaded = g_slice_new (LoadedThumbnail);
+  loaded->row = gtk_tree_row_reference_copy (job->row);
+  loaded->size = get_icon_size (job->icon);
+
+  g_hash_table_insert (priv->loaded, g_object_ref (item), loaded);
+  priv->loaded_size += loaded->size;
+}
+
+static gboolean
+flush_thumbnails (gpointer user_data)
+{
+  BgSource *source = user_data;
+  BgSourcePrivate *priv = source->priv;
+  GQueue batch = G_QUEUE_INIT;
+  ThumbnailJob *job;
+  gboolean more;
+  guint i;
+
+  g_mutex_lock (&priv->done_lock);
+  for (i = 0; i < THUMBNAIL_BATCH_SIZE && !g_queue_is_empty (priv->done); i++)
+    g_queue_push_tail (&batch, g_queue_pop_head (priv->done));
+  more = !g_queue_is_empty (priv->done);
+  if (!more)
+    priv->done_id = 0;
+  g_mutex_unlock (&priv->done_lock);
+
+  while ((job = g_queue_pop_head (&batch)) != NULL)
+    {
+      if (g_hash_table_lookup (priv->pending, job->item) == job)
+        g_hash_table_remove (priv->pending, job->item);
+
+      if (!job->cancelled && gtk_tree_row_reference_valid (job->row))
+        {
+          /* items that cannot be rendered are not shown at all */
+          set_row_icon (priv, job->row, job->icon);
+          if (job->icon != NULL)
+            {
+              cc_appearance_item_update_size (job->item, job->copy);
+              add_loaded (source, job->item, job);
+            }
+        }
+
+      thumbnail_job_free (job);
+    }
+
+  evict_thumbnails (source);
+
+  return more;
+}
+
+static void
+thumbnail_thread (gpointer data,
+                  gpointer user_data)
+{
+  ThumbnailJob *job = data;
+  BgSource *source = user_data;
+  BgSourcePrivate *priv = source->priv;
+
+  if (!g_atomic_int_get (&job->cancelled))
+    job->icon = BG_SOURCE_GET_CLASS (source)->get_thumbnail (source, job->copy);
+
+  /* the row reference is only safe to touch from the main thread, so even
+   * cancelled jobs are freed there */
+  g_mutex_lock (&priv->done_lock);
+  g_queue_push_tail (priv->done, job);
+  if (priv->done_id == 0)
+    priv->done_id = g_idle_add (flush_thumbnails, source);
+  g_mutex_unlock (&priv->done_lock);
+}
+
+static void
+queue_thumbnail (BgSource    *source,
+                 GtkTreeIter *iter,
+                 gint         position)
+{
+  BgSourcePrivate *priv = source->priv;
+  ThumbnailJob *job;
+  CcAppearanceItem *item;
+  GtkTreePath *path;
+
+  gtk_tree_model_get (GTK_TREE_MODEL (priv->store), iter, 1, &item, -1);
+  if (item == NULL)
+    return;
+
+  if (g_hash_table_contains (priv->pending, item))
+    {
+      g_object_unref (item);
+      return;
+    }
+
+  if (priv->pool == NULL)
+    {
+      priv->done = g_queue_new ();
+      priv->pool = g_thread_pool_new (thumbnail_thread, source,
+                                      THUMBNAIL_MAX_THREADS, FALSE, NULL);
+      g_thread_pool_set_sort_function (priv->pool, compare_jobs, priv);
+    }
+
+  path = gtk_tree_path_new_from_indices (position, -1);
+
+  job = g_slice_new0 (ThumbnailJob);
+  job->item = item;
+  job->copy = cc_appearance_item_copy (item);
+  job->row = gtk_tree_row_reference_new (GTK_TREE_MODEL (priv->store), path);
+  job->position = position;
+  job->serial = priv->serial++;
+
+  gtk_tree_path_free (path);
+
+  g_hash_table_insert (priv->pending, item, job);
+  g_thread_pool_push (priv->pool, job, NULL);
+}
+
+/* Queues the thumbnails of the rows in the window still showing the
+ * placeholder */
+static void
+refresh_window (BgSource *source)
+{
+  BgSourcePrivate *priv = source->priv;
+  GtkTreeModel *model;
+  GtkTreeIter iter;
+  gint first, last, position;
+
+  if (!priv->active ||
+      priv->placeholder == NULL ||
+      BG_SOURCE_GET_CLASS (source)->get_thumbnail == NULL)
+    return;
+
+  update_job_positions (source);
+  get_window (priv, &first, &last);
+
+  model = GTK_TREE_MODEL (priv->store);
+  if (!gtk_tree_model_iter_nth_child (model, &iter, NULL, first))
+    return;
+
+  position = first;
+  do
+    {
+      GIcon *icon;
+
+      gtk_tree_model_get (model, &iter, 0, &icon, -1);
+      if (icon == priv->placeholder)
+        queue_thumbnail (source, &iter, position);
+      if (icon)
+        g_object_unref (icon);
+    }
+  while (++position <= last && gtk_tree_model_iter_next (model, &iter));
+}
+
+static gboolean
+refresh_window_idle (gpointer user_data)
+{
+  BgSource *source = user_data;
+
+  source->priv->refresh_id = 0;
+  refresh_window (source);
+
+  return FALSE;
+}
+
+static void
+schedule_refresh (BgSource *source)
+{
+  BgSourcePrivate *priv = source->priv;
+
+  if (priv->active && priv->refresh_id == 0)
+    priv->refresh_id = g_idle_add_full (G_PRIORITY_LOW, refresh_window_idle,
+                                        source, NULL);
+}
+
+/* The sources fill in rows after inserting them, and usually insert a lot
+ * of them at once, so the window is looked at again once they are done.
+ * Removing rows moves other ones into the window. */
+static void
+row_inserted_cb (GtkTreeModel *model,
+                 GtkTreePath  *path,
+                 GtkTreeIter  *iter,
+                 BgSource     *source)
+{
+  schedule_refresh (source);
+}
+
+static void
+row_deleted_cb (GtkTreeModel *model,
+                GtkTreePath  *path,
+                BgSource     *source)
+{
+  schedule_refresh (source);
+}
+
+static void
+cancel_jobs (BgSource *source,
+             gboolean  all)
+{
+  BgSourcePrivate *priv = source->priv;
+  GHashTableIter iter;
+  ThumbnailJob *job;
+  gint first, last;
+
+  get_window (priv, &first, &last);
+
+  g_hash_table_iter_init (&iter, priv->pending);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &job))
+    {
+      if (all || job->position < first || job->position > last)
+        {
+          g_atomic_int_set (&job->cancelled, TRUE);
+          g_hash_table_iter_remove (&iter);
+        }
+    }
+}
+
 static void
 bg_source_dispose (GObject *object)
 {
-  BgSourcePrivate *priv = BG_SOURCE (object)->priv;
+  BgSource *source = BG_SOURCE (object);
+  BgSourcePrivate *priv = source->priv;
+
+  if (priv->refresh_id != 0)
+    {
+      g_source_remove (priv->refresh_id);
+      priv->refresh_id = 0;
+    }
+
+  if (priv->pool)
+    {
+      /* let the workers run through the queue, which is quick now that
+       * every job is cancelled */
+      cancel_jobs (source, TRUE);
+      g_thread_pool_free (priv->pool, FALSE, TRUE);
+      priv->pool = NULL;
+
+      if (priv->done_id != 0)
+        {
+          g_source_remove (priv->done_id);
+          priv->done_id = 0;
+        }
+      g_queue_free_full (priv->done, (GDestroyNotify) thumbnail_job_free);
+      priv->done = NULL;
+    }
+
+  if (priv->pending)
+    {
+      g_hash_table_destroy (priv->pending);
+      priv->pending = NULL;
+    }
+
+  if (priv->loaded)
+    {
+      g_hash_table_destroy (priv->loaded);
+      priv->loaded = NULL;
+    }
+
+  if (priv->placeholder)
+    {
+      g_object_unref (priv->placeholder);
+      priv->placeholder = NULL;
+    }
 
   if (priv->store)
     {
+      g_signal_handlers_disconnect_by_func (priv->store, row_inserted_cb, source);
+      g_signal_handlers_disconnect_by_func (priv->store, row_deleted_cb, source);
       g_object_unref (priv->store);
       priv->store = NULL;
     }
@@ -86,6 +634,10 @@ bg_source_dispose (GObject *object)
 static void
 bg_source_finalize (GObject *object)
 {
+  BgSourcePrivate *priv = BG_SOURCE (object)->priv;
+
+  g_mutex_clear (&priv->done_lock);
+
   G_OBJECT_CLASS (bg_source_parent_class)->finalize (object);
 }
 
@@ -114,10 +666,29 @@ static void
 bg_source_init (BgSource *self)
 {
   BgSourcePrivate *priv;
+  const gchar *budget;
 
   priv = self->priv = SOURCE_PRIVATE (self);
 
   priv->store = gtk_list_store_new (3, G_TYPE_ICON, G_TYPE_OBJECT, G_TYPE_STRING);
+  g_signal_connect (priv->store, "row-inserted",
+                    G_CALLBACK (row_inserted_cb), self);
+  g_signal_connect (priv->store, "row-deleted",
+                    G_CALLBACK (row_deleted_cb), self);
+
+  priv->pending = g_hash_table_new (g_direct_hash, g_direct_equal);
+  priv->loaded = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                        g_object_unref,
+                                        (GDestroyNotify) loaded_thumbnail_free);
+  priv->visible_end = -1;
+  g_mutex_init (&priv->done_lock);
+
+  /* in MiB */
+  budget = g_getenv ("UCC_THUMBNAIL_BUDGET");
+  if (budget != NULL)
+    priv->budget = (gsize) g_ascii_strtoull (budget, NULL, 10) * 1024 * 1024;
+  else
+    priv->budget = THUMBNAIL_DEFAULT_BUDGET;
 }
 
 GtkListStore*
@@ -127,3 +698,108 @@ bg_source_get_liststore (BgSource *source)
 
   return source->priv->store;
 }
+
+/**
+ * bg_source_get_placeholder:
+ * @source: a #BgSource
+ *
+ * Sources with a get_thumbnail() function insert their rows with this
+ * blank icon. The actual thumbnail is rendered in a worker thread once
+ * the row gets close to the visible range.
+ *
+ * Returns: (transfer none): the placeholder icon
+ */
+GIcon *
+bg_source_get_placeholder (BgSource *source)
+{
+  BgSourcePrivate *priv;
+
+  g_return_val_if_fail (BG_IS_SOURCE (source), NULL);
+
+  priv = source->priv;
+
+  if (priv->placeholder == NULL)
+    {
+      GdkPixbuf *pixbuf;
+
+      pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, TRUE, 8,
+                               THUMBNAIL_WIDTH, THUMBNAIL_HEIGHT);
+      gdk_pixbuf_fill (pixbuf, 0x00000000);
+      priv->placeholder = G_ICON (pixbuf);
+    }
+
+  return priv->placeholder;
+}
+
+/**
+ * bg_source_set_visible_range:
+ * @source: a #BgSource
+ * @start: (allow-none): the first visible row
+ * @end: (allow-none): the last visible row
+ *
+ * Renders the thumbnails of the rows between @start and @end, and of the
+ * rows around them, closest first. Queued thumbnails of rows that are now
+ * far out of view are dropped.
+ */
+void
+bg_source_set_visible_range (BgSource    *source,
+                             GtkTreePath *start,
+                             GtkTreePath *end)
+{
+  BgSourcePrivate *priv;
+  gint visible_start, visible_end;
+
+  g_return_if_fail (BG_IS_SOURCE (source));
+
+  priv = source->priv;
+
+  visible_start = start ? gtk_tree_path_get_indices (start)[0] : 0;
+  visible_end = end ? gtk_tree_path_get_indices (end)[0] : -1;
+
+  if (visible_start != priv->visible_start || visible_end != priv->visible_end)
+    {
+      priv->visible_start = visible_start;
+      priv->visible_end = visible_end;
+
+      update_job_positions (source);
+      cancel_jobs (source, FALSE);
+
+      /* setting the sort function again resorts the queued jobs */
+      if (priv->pool)
+        g_thread_pool_set_sort_function (priv->pool, compare_jobs, priv);
+    }
+
+  refresh_window (source);
+  evict_thumbnails (source);
+}
+
+/**
+ * bg_source_cancel_thumbnails:
+ * @source: a #BgSource
+ *
+ * Drops the queued thumbnails and stops rendering new ones, for instance
+ * when the source is no longer shown.
+ */
+void
+bg_source_cancel_thumbnails (BgSource *source)
+{
+  g_return_if_fail (BG_IS_SOURCE (source));
+
+  source->priv->active = FALSE;
+  cancel_jobs (source, TRUE);
+}
+
+/**
+ * bg_source_resume_thumbnails:
+ * @source: a #BgSource
+ *
+ * Starts rendering the thumbnails of the rows in view again.
+ */
+void
+bg_source_resume_thumbnails (BgSource *source)
+{
+  g_return_if_fail (BG_IS_SOURCE (source));
+
+  source->priv->active = TRUE;
+  refresh_window (source);
+}
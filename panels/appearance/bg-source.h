@@ -23,11 +23,18 @@
 
 #include <gtk/gtk.h>
 
+#include "cc-appearance-item.h"
+
 G_BEGIN_DECLS
 
 #define THUMBNAIL_WIDTH 48
 #define THUMBNAIL_HEIGHT 48
 
+/* Slideshow thumbnails carry a strip of up to SLIDESHOW_FRAMES frames,
+ * each THUMBNAIL_WIDTH wide, as object data under this key */
+#define SLIDESHOW_FRAMES 8
+#define SLIDESHOW_STRIP_KEY "frame-strip"
+
 #define BG_TYPE_SOURCE bg_source_get_type()
 
 #define BG_SOURCE(obj) \
@@ -64,12 +71,24 @@ struct _BgSource
 struct _BgSourceClass
 {
   GObjectClass parent_class;
+
+  /* called from a worker thread for the rows in view, with a copy of the
+   * row's item that only this call uses; returning %NULL removes the row */
+  GIcon * (* get_thumbnail) (BgSource         *source,
+                             CcAppearanceItem *item);
 };
 
 GType bg_source_get_type (void) G_GNUC_CONST;
 
 GtkListStore* bg_source_get_liststore (BgSource *source);
 
+GIcon *bg_source_get_placeholder    (BgSource    *source);
+void   bg_source_set_visible_range  (BgSource    *source,
+                                     GtkTreePath *start,
+                                     GtkTreePath *end);
+void   bg_source_cancel_thumbnails  (BgSource    *source);
+void   bg_source_resume_thumbnails  (BgSource    *source);
+
 G_END_DECLS
 
 #endif /* _BG_SOURCE_H */
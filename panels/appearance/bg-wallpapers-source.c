@@ -71,11 +71,6 @@ bg_wallpapers_source_dispose (GObject *object)
 {
   BgWallpapersSourcePrivate *priv = BG_WALLPAPERS_SOURCE (object)->priv;
 
-  if (priv->thumb_factory)
-    {
-      g_object_unref (priv->thumb_factory);
-      priv->thumb_factory = NULL;
-    }
   if (priv->xml)
     {
       g_object_unref (priv->xml);
@@ -88,13 +83,44 @@ bg_wallpapers_source_dispose (GObject *object)
 static void
 bg_wallpapers_source_finalize (GObject *object)
 {
+  BgWallpapersSourcePrivate *priv = BG_WALLPAPERS_SOURCE (object)->priv;
+
+  /* the thumbnail workers use the factory until the parent's dispose
+   * has stopped them */
+  g_object_unref (priv->thumb_factory);
+
   G_OBJECT_CLASS (bg_wallpapers_source_parent_class)->finalize (object);
 }
 
+static GIcon *
+bg_wallpapers_source_get_thumbnail (BgSource         *source,
+                                    CcAppearanceItem *item)
+{
+  BgWallpapersSourcePrivate *priv = BG_WALLPAPERS_SOURCE (source)->priv;
+  GdkPixbuf *strip;
+  GIcon *icon;
+
+  icon = cc_appearance_item_get_thumbnail (item, priv->thumb_factory,
+                                           THUMBNAIL_WIDTH, THUMBNAIL_HEIGHT);
+  if (icon == NULL || !cc_appearance_item_changes_with_time (item))
+    return icon;
+
+  /* lets the icon view scrub through the slideshow */
+  strip = cc_appearance_item_get_frame_strip (item, priv->thumb_factory,
+                                              THUMBNAIL_WIDTH, THUMBNAIL_HEIGHT,
+                                              SLIDESHOW_FRAMES);
+  if (strip)
+    g_object_set_data_full (G_OBJECT (icon), SLIDESHOW_STRIP_KEY,
+                            strip, g_object_unref);
+
+  return icon;
+}
+
 static void
 bg_wallpapers_source_class_init (BgWallpapersSourceClass *klass)
 {
   GObjectClass *object_class = G_OBJECT_CLASS (klass);
+  BgSourceClass *source_class = BG_SOURCE_CLASS (klass);
 
   g_type_class_add_private (klass, sizeof (BgWallpapersSourcePrivate));
 
@@ -102,6 +128,8 @@ bg_wallpapers_source_class_init (BgWallpapersSourceClass *klass)
   object_class->set_property = bg_wallpapers_source_set_property;
   object_class->dispose = bg_wallpapers_source_dispose;
   object_class->finalize = bg_wallpapers_source_finalize;
+
+  source_class->get_thumbnail = bg_wallpapers_source_get_thumbnail;
 }
 
 static void
@@ -109,9 +137,7 @@ load_wallpapers (gchar              *key,
                  CcAppearanceItem   *item,
                  BgWallpapersSource *source)
 {
-  BgWallpapersSourcePrivate *priv = source->priv;
   GtkTreeIter iter;
-  GIcon *pixbuf;
   GtkListStore *store = bg_source_get_liststore (BG_SOURCE (source));
   gboolean deleted;
 
@@ -120,19 +146,14 @@ load_wallpapers (gchar              *key,
   if (deleted)
     return;
 
+  /* the thumbnail is rendered in a worker thread once the row is in
+   * view, show a blank one until then */
   gtk_list_store_append (store, &iter);
-
-  pixbuf = cc_appearance_item_get_thumbnail (item, priv->thumb_factory,
-					     THUMBNAIL_WIDTH, THUMBNAIL_HEIGHT);
-
   gtk_list_store_set (store, &iter,
-                      0, pixbuf,
+                      0, bg_source_get_placeholder (BG_SOURCE (source)),
                       1, g_object_ref (item),
                       2, cc_appearance_item_get_name (item),
                       -1);
-
-  if (pixbuf)
-    g_object_unref (pixbuf);
 }
 
 static void
@@ -21,10 +21,14 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <errno.h>
+#include <string.h>
 
 #include <gtk/gtk.h>
 #include <gio/gio.h>
 #include <glib/gi18n-lib.h>
+#include <glib/gstdio.h>
+#include <libxml/xmlreader.h>
 
 #include <libgnome-desktop/gnome-bg.h>
 #include <gdesktop-enums.h>
@@ -246,6 +250,325 @@ cc_appearance_item_get_thumbnail (CcAppearanceItem             *item,
         return cc_appearance_item_get_frame_thumbnail (item, thumbs, width, height, -1, FALSE);
 }
 
+/* The frames GnomeBG can render are the static slides of the show. The
+ * files of the slides are collected too, as the strip has to be rendered
+ * again when one of them changes. */
+static int
+read_slideshow (const char *filename,
+                GPtrArray  *files)
+{
+        xmlTextReaderPtr reader;
+        GHashTable *seen;
+        const char *element = NULL;
+        int n_frames = 0;
+
+        reader = xmlReaderForFile (filename, NULL, 0);
+        if (reader == NULL)
+                return 0;
+
+        seen = g_hash_table_new (g_str_hash, g_str_equal);
+
+        while (xmlTextReaderRead (reader) == 1) {
+                switch (xmlTextReaderNodeType (reader)) {
+                case XML_READER_TYPE_ELEMENT:
+                        element = (const char *) xmlTextReaderConstName (reader);
+                        if (xmlTextReaderDepth (reader) == 1 &&
+                            strcmp (element, "static") == 0)
+                                n_frames++;
+                        break;
+                case XML_READER_TYPE_END_ELEMENT:
+                        element = NULL;
+                        break;
+                case XML_READER_TYPE_TEXT:
+                        if (element != NULL &&
+                            (strcmp (element, "file") == 0 ||
+                             strcmp (element, "size") == 0 ||
+                             strcmp (element, "from") == 0 ||
+                             strcmp (element, "to") == 0)) {
+                                char *path;
+
+                                path = g_strstrip (g_strdup ((const char *) xmlTextReaderConstValue (reader)));
+                                if (*path != '\0' && !g_hash_table_lookup (seen, path)) {
+                                        g_hash_table_insert (seen, path, path);
+                                        g_ptr_array_add (files, path);
+                                } else {
+                                        g_free (path);
+                                }
+                        }
+                        break;
+                default:
+                        break;
+                }
+        }
+
+        g_hash_table_destroy (seen);
+        xmlFreeTextReader (reader);
+
+        return n_frames;
+}
+
+/* A checksum of the modification times of the slideshow and its slides */
+static char *
+get_slideshow_stamp (const char *filename,
+                     GPtrArray  *files)
+{
+        GChecksum *checksum;
+        GStatBuf buf;
+        char *stamp;
+        guint i;
+
+        checksum = g_checksum_new (G_CHECKSUM_MD5);
+
+        for (i = 0; i <= files->len; i++) {
+                const char *path;
+                gint64 mtime = -1;
+
+                path = (i == 0) ? filename : g_ptr_array_index (files, i - 1);
+                if (g_stat (path, &buf) == 0)
+                        mtime = buf.st_mtime;
+
+                stamp = g_strdup_printf ("%s:%" G_GINT64_FORMAT ";", path, mtime);
+                g_checksum_update (checksum, (const guchar *) stamp, -1);
+                g_free (stamp);
+        }
+
+        stamp = g_strdup (g_checksum_get_string (checksum));
+        g_checksum_free (checksum);
+
+        return stamp;
+}
+
+static char *
+get_strip_dir (void)
+{
+        return g_build_filename (g_get_user_cache_dir (),
+                                 "unity-control-center",
+                                 "slideshows",
+                                 NULL);
+}
+
+static char *
+get_strip_prefix (const char *uri)
+{
+        char *checksum, *prefix;
+
+        checksum = g_compute_checksum_for_string (G_CHECKSUM_MD5, uri, -1);
+        prefix = g_strconcat (checksum, "-", NULL);
+        g_free (checksum);
+
+        return prefix;
+}
+
+static char *
+get_strip_path (const char *uri,
+                int         width,
+                int         height,
+                int         n_frames)
+{
+        char *dirname, *prefix, *basename, *path;
+
+        dirname = get_strip_dir ();
+        prefix = get_strip_prefix (uri);
+        basename = g_strdup_printf ("%s%dx%d-%d.png", prefix, width, height, n_frames);
+        path = g_build_filename (dirname, basename, NULL);
+        g_free (dirname);
+        g_free (prefix);
+        g_free (basename);
+
+        return path;
+}
+
+/* Strips of the same slideshow rendered at another size or with another
+ * number of frames are never looked up again */
+static void
+prune_strips (const char *uri,
+              const char *path)
+{
+        GDir *dir;
+        const char *name;
+        char *dirname, *prefix, *basename;
+
+        dirname = get_strip_dir ();
+        dir = g_dir_open (dirname, 0, NULL);
+        if (dir == NULL) {
+                g_free (dirname);
+                return;
+        }
+
+        prefix = get_strip_prefix (uri);
+        basename = g_path_get_basename (path);
+
+        while ((name = g_dir_read_name (dir)) != NULL) {
+                char *old_path;
+
+                if (!g_str_has_prefix (name, prefix) ||
+                    !g_str_has_suffix (name, ".png") ||
+                    strcmp (name, basename) == 0)
+                        continue;
+
+                old_path = g_build_filename (dirname, name, NULL);
+                g_unlink (old_path);
+                g_free (old_path);
+        }
+
+        g_dir_close (dir);
+        g_free (basename);
+        g_free (prefix);
+        g_free (dirname);
+}
+
+static GdkPixbuf *
+render_frame_strip (CcAppearanceItem             *item,
+                    GnomeDesktopThumbnailFactory *thumbs,
+                    int                           n_slides,
+                    int                           width,
+                    int                           height,
+                    int                           n_frames)
+{
+        GdkPixbuf *strip;
+        int i;
+
+        if (n_slides <= 0)
+                return NULL;
+
+        n_frames = MIN (n_frames, n_slides);
+        strip = gdk_pixbuf_new (GDK_COLORSPACE_RGB, TRUE, 8, width * n_frames, height);
+        gdk_pixbuf_fill (strip, 0x00000000);
+
+        set_bg_properties (item);
+
+        /* frames are picked evenly over the slides, and centered in
+         * their part of the strip */
+        for (i = 0; i < n_frames; i++) {
+                GdkPixbuf *frame;
+                int frame_width, frame_height;
+
+                frame = gnome_bg_create_frame_thumbnail (item->priv->bg,
+                                                         thumbs,
+                                                         gdk_screen_get_default (),
+                                                         width,
+                                                         height,
+                                                         i * n_slides / n_frames);
+                if (frame == NULL)
+                        break;
+
+                frame_width = MIN (gdk_pixbuf_get_width (frame), width);
+                frame_height = MIN (gdk_pixbuf_get_height (frame), height);
+                gdk_pixbuf_copy_area (frame, 0, 0, frame_width, frame_height,
+                                      strip,
+                                      i * width + (width - frame_width) / 2,
+                                      (height - frame_height) / 2);
+                g_object_unref (frame);
+        }
+
+        if (i == 0) {
+                g_object_unref (strip);
+                return NULL;
+        }
+
+        if (i < n_frames) {
+                GdkPixbuf *partial;
+
+                partial = gdk_pixbuf_new_subpixbuf (strip, 0, 0, width * i, height);
+                g_object_unref (strip);
+                strip = gdk_pixbuf_copy (partial);
+                g_object_unref (partial);
+        }
+
+        return strip;
+}
+
+/**
+ * cc_appearance_item_get_frame_strip:
+ * @item: a slideshow item
+ * @thumbs: a thumbnail factory
+ * @width: the width of a frame
+ * @height: the height of a frame
+ * @n_frames: the maximum number of frames
+ *
+ * Renders up to @n_frames frames spread over the slideshow side by side,
+ * each in a @width by @height cell. Strips are cached on disk until the
+ * slideshow file or one of its slides changes. This does blocking I/O and
+ * decoding, so it is meant to be called from a thumbnail worker, on a copy
+ * of the item that no other thread uses: the frames are rendered with its
+ * #GnomeBG.
+ *
+ * Returns: a new pixbuf, or %NULL if @item is not a slideshow
+ */
+GdkPixbuf *
+cc_appearance_item_get_frame_strip (CcAppearanceItem             *item,
+                                    GnomeDesktopThumbnailFactory *thumbs,
+                                    int                           width,
+                                    int                           height,
+                                    int                           n_frames)
+{
+        GdkPixbuf *strip = NULL;
+        GPtrArray *files;
+        GFile *file;
+        char *filename, *path, *tmp_path, *dirname, *stamp;
+        int n_slides;
+        GError *error = NULL;
+
+	g_return_val_if_fail (CC_IS_APPEARANCE_ITEM (item), NULL);
+	g_return_val_if_fail (width > 0 && height > 0 && n_frames > 0, NULL);
+
+        if (item->priv->uri == NULL)
+                return NULL;
+
+        file = g_file_new_for_commandline_arg (item->priv->uri);
+        filename = g_file_get_path (file);
+        g_object_unref (file);
+
+        if (filename == NULL || !g_file_test (filename, G_FILE_TEST_IS_REGULAR)) {
+                g_free (filename);
+                return NULL;
+        }
+
+        files = g_ptr_array_new_with_free_func (g_free);
+        n_slides = read_slideshow (filename, files);
+        stamp = get_slideshow_stamp (filename, files);
+        path = get_strip_path (item->priv->uri, width, height, n_frames);
+
+        strip = gdk_pixbuf_new_from_file (path, NULL);
+        if (strip != NULL &&
+            g_strcmp0 (gdk_pixbuf_get_option (strip, "tEXt::Slideshow::Stamp"), stamp) == 0)
+                goto out;
+
+        if (strip != NULL)
+                g_object_unref (strip);
+
+        strip = render_frame_strip (item, thumbs, n_slides, width, height, n_frames);
+        if (strip == NULL)
+                goto out;
+
+        dirname = g_path_get_dirname (path);
+        g_mkdir_with_parents (dirname, 0700);
+        g_free (dirname);
+
+        /* write to a temporary file so other workers never see half a strip */
+        tmp_path = g_strconcat (path, ".tmp", NULL);
+        if (!gdk_pixbuf_save (strip, tmp_path, "png", &error,
+                              "tEXt::Slideshow::Stamp", stamp,
+                              NULL) ||
+            g_rename (tmp_path, path) != 0) {
+                g_warning ("Could not save slideshow strip '%s': %s",
+                           path, error ? error->message : g_strerror (errno));
+                g_clear_error (&error);
+                g_unlink (tmp_path);
+        } else {
+                prune_strips (item->priv->uri, path);
+        }
+        g_free (tmp_path);
+
+out:
+        g_ptr_array_unref (files);
+        g_free (filename);
+        g_free (stamp);
+        g_free (path);
+
+        return strip;
+}
+
 static void
 update_info (CcAppearanceItem *item,
 	     GFileInfo        *_info)
@@ -791,6 +1114,8 @@ cc_appearance_item_copy (CcAppearanceItem *item)
 	ret->priv->size = g_strdup (item->priv->size);
 	ret->priv->placement = item->priv->placement;
 	ret->priv->shading = item->priv->shading;
+	g_free (ret->priv->primary_color);
+	g_free (ret->priv->secondary_color);
 	ret->priv->primary_color = g_strdup (item->priv->primary_color);
 	ret->priv->secondary_color = g_strdup (item->priv->secondary_color);
 	ret->priv->source_url = g_strdup (item->priv->source_url);
@@ -802,6 +1127,33 @@ cc_appearance_item_copy (CcAppearanceItem *item)
 	return ret;
 }
 
+/**
+ * cc_appearance_item_update_size:
+ * @item: a #CcAppearanceItem
+ * @rendered: a copy of @item that a thumbnail was rendered from
+ *
+ * Takes the image size found while rendering the thumbnail of @rendered.
+ * Thumbnails are rendered from copies so that the workers never touch
+ * the #GnomeBG of the items shown in the main thread.
+ */
+void
+cc_appearance_item_update_size (CcAppearanceItem *item,
+                                CcAppearanceItem *rendered)
+{
+	g_return_if_fail (CC_IS_APPEARANCE_ITEM (item));
+	g_return_if_fail (CC_IS_APPEARANCE_ITEM (rendered));
+
+	if (g_strcmp0 (item->priv->size, rendered->priv->size) == 0)
+		return;
+
+	item->priv->width = rendered->priv->width;
+	item->priv->height = rendered->priv->height;
+	g_free (item->priv->size);
+	item->priv->size = g_strdup (rendered->priv->size);
+
+	g_object_notify (G_OBJECT (item), "size");
+}
+
 static const char *
 flags_to_str (CcAppearanceItemFlags flag)
 {
@@ -69,6 +69,8 @@ CcAppearanceItem * cc_appearance_item_copy                (CcAppearanceItem
 gboolean           cc_appearance_item_load                (CcAppearanceItem             *item,
 							   GFileInfo                    *info);
 gboolean           cc_appearance_item_changes_with_time   (CcAppearanceItem             *item);
+void               cc_appearance_item_update_size         (CcAppearanceItem             *item,
+                                                           CcAppearanceItem             *rendered);
 
 GIcon     *        cc_appearance_item_get_thumbnail       (CcAppearanceItem             *item,
                                                            GnomeDesktopThumbnailFactory *thumbs,
@@ -80,6 +82,11 @@ GIcon     *        cc_appearance_item_get_frame_thumbnail (CcAppearanceItem
                                                            int                           height,
                                                            int                           frame,
                                                            gboolean                      force_size);
+GdkPixbuf *        cc_appearance_item_get_frame_strip     (CcAppearanceItem             *item,
+                                                           GnomeDesktopThumbnailFactory *thumbs,
+                                                           int                           width,
+                                                           int                           height,
+                                                           int                           n_frames);
 
 GDesktopBackgroundStyle   cc_appearance_item_get_placement  (CcAppearanceItem *item);
 GDesktopBackgroundShading cc_appearance_item_get_shading    (CcAppearanceItem *item);
@@ -35,6 +35,7 @@
 
 #include "cc-appearance-item.h"
 #include "cc-appearance-xml.h"
+#include "cc-theme-registry.h"
 
 #define WP_PATH_ID "org.gnome.desktop.background"
 #define WP_URI_KEY "picture-uri"
@@ -74,6 +75,8 @@ struct _CcAppearancePanelPrivate
   GSettings *settings;
   GSettings *interface_settings;
   GSettings *wm_theme_settings;
+  CcThemeRegistry *theme_registry;
+  gchar *default_gtk_theme;
   GSettings *unity_own_settings;
   GSettings *unity_launcher_settings;
 
@@ -88,12 +91,32 @@ struct _CcAppearancePanelPrivate
   CcAppearanceItem *current_background;
   gint current_source;
 
+  /* the source shown in the icon view */
+  BgSource *shown_source;
+
   GCancellable *copy_cancellable;
 
   GtkWidget *spinner;
 
   GdkPixbuf *display_base;
   GdkPixbuf *display_overlay;
+
+  /* the display with the background composited in, the description of
+   * what it shows, and a copy scaled to the preview area */
+  GdkPixbuf *preview_composite;
+  gchar *preview_key;
+  cairo_surface_t *preview_surface;
+  gint preview_size;
+
+  /* the preview job running in a thread, if any */
+  GCancellable *preview_cancellable;
+  gint preview_job_size;
+  gboolean preview_job_renders;
+
+  /* the slideshow under the pointer, and the frame shown for it */
+  GtkTreePath *scrub_path;
+  gint scrub_index;
+  GdkPixbuf *scrub_frame;
 };
 
 enum
@@ -183,6 +206,13 @@ cc_appearance_panel_dispose (GObject *object)
       priv->spinner = NULL;
     }
 
+  /* the sources may outlive the panel, stop their thumbnailing now */
+  if (priv->shown_source)
+    {
+      bg_source_cancel_thumbnails (priv->shown_source);
+      priv->shown_source = NULL;
+    }
+
   if (priv->wallpapers_source)
     {
       g_object_unref (priv->wallpapers_source);
@@ -226,6 +256,17 @@ cc_appearance_panel_dispose (GObject *object)
       priv->wm_theme_settings = NULL;
     }
 
+  if (priv->theme_registry)
+    {
+      /* a scan in progress keeps the registry alive */
+      g_signal_handlers_disconnect_by_data (priv->theme_registry, object);
+      g_object_unref (priv->theme_registry);
+      priv->theme_registry = NULL;
+    }
+
+  g_free (priv->default_gtk_theme);
+  priv->default_gtk_theme = NULL;
+
   if (priv->unity_compiz_gs)
     {
       g_object_unref (priv->unity_compiz_gs);
@@ -289,6 +330,40 @@ cc_appearance_panel_dispose (GObject *object)
       priv->display_overlay = NULL;
     }
 
+  if (priv->preview_cancellable)
+    {
+      g_cancellable_cancel (priv->preview_cancellable);
+      g_object_unref (priv->preview_cancellable);
+      priv->preview_cancellable = NULL;
+    }
+
+  if (priv->preview_composite)
+    {
+      g_object_unref (priv->preview_composite);
+      priv->preview_composite = NULL;
+    }
+
+  if (priv->preview_surface)
+    {
+      cairo_surface_destroy (priv->preview_surface);
+      priv->preview_surface = NULL;
+    }
+
+  g_free (priv->preview_key);
+  priv->preview_key = NULL;
+
+  if (priv->scrub_path)
+    {
+      gtk_tree_path_free (priv->scrub_path);
+      priv->scrub_path = NULL;
+    }
+
+  if (priv->scrub_frame)
+    {
+      g_object_unref (priv->scrub_frame);
+      priv->scrub_frame = NULL;
+    }
+
   G_OBJECT_CLASS (cc_appearance_panel_parent_class)->dispose (object);
 }
 
@@ -343,20 +418,99 @@ struct _GroupedGSettingsClass {
   GObjectClass parent_class;
 };
 
+/* Changes are kept in the delayed GSettings until nothing was set for
+ * GROUPED_GSETTINGS_QUIET_PERIOD ms, but never for longer than
+ * GROUPED_GSETTINGS_MAX_DELAY ms, so that dragging a scale writes to dconf
+ * a few times a second rather than on every motion event */
+#define GROUPED_GSETTINGS_QUIET_PERIOD 150
+#define GROUPED_GSETTINGS_MAX_DELAY 500
+
 struct _GroupedGSettingsPrivate
 {
   GList *settings_list;
   GSettings *default_gs;
   GSettings **remote_gs;
+
+  GHashTable *pending;
+  guint flush_id;
+  guint quiet_period;
+  gint64 pending_since;
+  gboolean writing;
+
+  guint writes_requested;
+  guint writes_applied;
 };
 
 G_DEFINE_TYPE (GroupedGSettings, grouped_gsettings, G_TYPE_OBJECT)
 
+static void
+grouped_gsettings_flush (GroupedGSettings *self)
+{
+  GroupedGSettingsPrivate *priv = self->priv;
+  GList *l;
+
+  if (priv->flush_id)
+    {
+      g_source_remove (priv->flush_id);
+      priv->flush_id = 0;
+    }
+
+  if (g_hash_table_size (priv->pending) == 0)
+    return;
+
+  /* applying doesn't signal the changes again, unless the backend failed
+   * to write them and the widgets have to go back to the stored values */
+  for (l = priv->settings_list; l; l = l->next)
+    {
+      g_settings_apply (G_SETTINGS (l->data));
+      priv->writes_applied += g_hash_table_size (priv->pending);
+    }
+
+  g_hash_table_remove_all (priv->pending);
+
+  /* the values set so far which never reached dconf on their own */
+  g_debug ("GroupedGSettings %p: %u of %u writes coalesced", self,
+           priv->writes_requested - priv->writes_applied,
+           priv->writes_requested);
+}
+
+/* Writes the pending changes out now, and waits for the backend to have
+ * them so that they survive the process exiting right after */
+static void
+grouped_gsettings_apply (GroupedGSettings *self)
+{
+  g_return_if_fail (IS_GSETTINGS_GROUPED (self));
+
+  if (g_hash_table_size (self->priv->pending) == 0)
+    return;
+
+  grouped_gsettings_flush (self);
+  g_settings_sync ();
+}
+
+static gboolean
+grouped_gsettings_flush_cb (gpointer user_data)
+{
+  GroupedGSettings *self = user_data;
+
+  self->priv->flush_id = 0;
+  grouped_gsettings_flush (self);
+
+  return FALSE;
+}
+
 static void
 grouped_gsettings_dispose (GObject *object)
 {
   GroupedGSettings *self = (GroupedGSettings *) object;
 
+  if (self->priv->pending)
+    {
+      grouped_gsettings_apply (self);
+      g_hash_table_destroy (self->priv->pending);
+      self->priv->pending = NULL;
+    }
+
   if (self->priv->settings_list)
     {
       g_list_free_full (self->priv->settings_list, g_object_unref);
@@ -387,6 +541,10 @@ grouped_gsettings_init (GroupedGSettings *self)
 {
   self->priv = G_TYPE_INSTANCE_GET_PRIVATE (self, grouped_gsettings_get_type (),
                                             GroupedGSettingsPrivate);
+
+  self->priv->pending = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                               g_free, NULL);
+  self->priv->quiet_period = GROUPED_GSETTINGS_QUIET_PERIOD;
 }
 
 static void
@@ -394,7 +552,13 @@ on_default_settings_changed (GSettings *settings,
                              gchar     *key,
                              GroupedGSettings *self)
 {
-  gchar *signal = g_strdup_printf ("changed::%s", key);
+  gchar *signal;
+
+  /* don't bounce our own changes back to the widgets that made them */
+  if (self->priv->writing)
+    return;
+
+  signal = g_strdup_printf ("changed::%s", key);
   g_signal_emit_by_name (self, signal, key);
   g_free (signal);
 }
@@ -456,12 +620,27 @@ grouped_gsettings_set_default_profile (GroupedGSettings *self,
     }
 }
 
+/* A quiet period of 0 applies the changes once per main loop iteration */
+static void
+grouped_gsettings_set_quiet_period (GroupedGSettings *self,
+                                    guint             msec)
+{
+  g_return_if_fail (IS_GSETTINGS_GROUPED (self));
+  self->priv->quiet_period = msec;
+}
+
 static void
 grouped_gsettings_reset (GroupedGSettings *self, const gchar *key)
 {
   g_return_if_fail (IS_GSETTINGS_GROUPED (self));
+
+  /* resetting comes from a button, so let the widgets pick up the
+   * default and write it out right away */
   g_list_foreach (self->priv->settings_list,
                   (GFunc) g_settings_reset, (gpointer) key);
+  self->priv->writes_requested += g_list_length (self->priv->settings_list);
+  g_hash_table_add (self->priv->pending, g_strdup (key));
+  grouped_gsettings_flush (self);
 }
 
 static void
@@ -469,17 +648,48 @@ grouped_gsettings_set_value (GroupedGSettings *self,
                              const gchar      *key,
                              GVariant         *value)
 {
+  GroupedGSettingsPrivate *priv;
   GList *l;
+  gint64 now;
 
   g_return_if_fail (IS_GSETTINGS_GROUPED (self));
   g_return_if_fail (g_variant_get_type (value));
 
+  priv = self->priv;
   g_variant_ref_sink (value);
 
-  for (l = self->priv->settings_list; l; l = l->next)
-    g_settings_set_value (G_SETTINGS (l->data), key, value);
+  /* the settings are in delay mode, so this only updates what they read
+   * back until the next flush */
+  priv->writing = TRUE;
+  for (l = priv->settings_list; l; l = l->next)
+    {
+      g_settings_set_value (G_SETTINGS (l->data), key, value);
+      priv->writes_requested++;
+    }
+  priv->writing = FALSE;
 
   g_variant_unref (value);
+
+  now = g_get_monotonic_time ();
+  if (g_hash_table_size (priv->pending) == 0)
+    priv->pending_since = now;
+  g_hash_table_add (priv->pending, g_strdup (key));
+
+  if (priv->flush_id)
+    {
+      /* keep a long drag from postponing the write forever */
+      if (now - priv->pending_since >= GROUPED_GSETTINGS_MAX_DELAY * 1000)
+        return;
+
+      g_source_remove (priv->flush_id);
+      priv->flush_id = 0;
+    }
+
+  if (priv->quiet_period == 0)
+    priv->flush_id = g_idle_add (grouped_gsettings_flush_cb, self);
+  else
+    priv->flush_id = g_timeout_add (priv->quiet_period,
+                                    grouped_gsettings_flush_cb, self);
 }
 
 static GSettings *
@@ -494,6 +704,7 @@ grouped_gsettings_add (GroupedGSettings *self,
   g_return_val_if_fail (IS_GSETTINGS_GROUPED (self), NULL);
 
   settings = g_settings_new_full (settings_schema, /*backend*/ NULL, settings_path);
+  g_settings_delay (settings);
   self->priv->settings_list = g_list_prepend (self->priv->settings_list, settings);
   self->priv->remote_gs = remote_settings;
 
@@ -602,6 +813,156 @@ source_update_edit_box (CcAppearancePanelPrivate *priv,
    * and provides the colours? */
 }
 
+static void
+update_visible_range (CcAppearancePanelPrivate *priv)
+{
+  GtkIconView *view;
+  GtkTreePath *start = NULL, *end = NULL;
+
+  if (priv->shown_source == NULL)
+    return;
+
+  view = (GtkIconView *) gtk_builder_get_object (priv->builder,
+                                                 "backgrounds-iconview");
+
+  gtk_icon_view_get_visible_range (view, &start, &end);
+  bg_source_set_visible_range (priv->shown_source, start, end);
+
+  if (start)
+    gtk_tree_path_free (start);
+  if (end)
+    gtk_tree_path_free (end);
+}
+
+static void
+scrolled_value_changed_cb (GtkAdjustment            *adjustment,
+                           CcAppearancePanelPrivate *priv)
+{
+  update_visible_range (priv);
+}
+
+static void
+set_scrub_frame (CcAppearancePanelPrivate *priv,
+                 GtkTreePath              *path,
+                 GdkPixbuf                *strip,
+                 gint                      index)
+{
+  if (path == NULL && priv->scrub_path == NULL)
+    return;
+
+  if (path && priv->scrub_path &&
+      gtk_tree_path_compare (path, priv->scrub_path) == 0 &&
+      index == priv->scrub_index)
+    return;
+
+  if (priv->scrub_path)
+    {
+      gtk_tree_path_free (priv->scrub_path);
+      priv->scrub_path = NULL;
+    }
+
+  if (priv->scrub_frame)
+    {
+      g_object_unref (priv->scrub_frame);
+      priv->scrub_frame = NULL;
+    }
+
+  /* the frame shares the strip's pixels, nothing is decoded here */
+  if (path)
+    {
+      priv->scrub_path = gtk_tree_path_copy (path);
+      priv->scrub_index = index;
+      priv->scrub_frame = gdk_pixbuf_new_subpixbuf (strip,
+                                                    index * THUMBNAIL_WIDTH, 0,
+                                                    THUMBNAIL_WIDTH,
+                                                    gdk_pixbuf_get_height (strip));
+    }
+
+  gtk_widget_queue_draw (WID ("backgrounds-iconview"));
+}
+
+/* Moving the pointer across a slideshow thumbnail shows its frames */
+static gboolean
+backgrounds_motion_cb (GtkWidget                *widget,
+                       GdkEventMotion           *event,
+                       CcAppearancePanelPrivate *priv)
+{
+  GtkIconView *view = GTK_ICON_VIEW (widget);
+  GtkTreePath *path;
+  GtkTreeModel *model;
+  GtkTreeIter iter;
+  GdkPixbuf *strip = NULL;
+  GdkRectangle rect;
+  GIcon *icon = NULL;
+  gint x, y, n_frames, index;
+
+  if (!gtk_icon_view_get_item_at_pos (view, event->x, event->y, &path, NULL))
+    {
+      set_scrub_frame (priv, NULL, NULL, 0);
+      return FALSE;
+    }
+
+  model = gtk_icon_view_get_model (view);
+  if (gtk_tree_model_get_iter (model, &iter, path))
+    gtk_tree_model_get (model, &iter, 0, &icon, -1);
+
+  if (icon)
+    {
+      strip = g_object_get_data (G_OBJECT (icon), SLIDESHOW_STRIP_KEY);
+      g_object_unref (icon);
+    }
+
+  if (strip == NULL ||
+      !gtk_icon_view_get_cell_rect (view, path,
+                                    GTK_CELL_RENDERER (WID ("pixbuf-renderer")),
+                                    &rect) ||
+      rect.width <= 0)
+    {
+      set_scrub_frame (priv, NULL, NULL, 0);
+      gtk_tree_path_free (path);
+      return FALSE;
+    }
+
+  gtk_icon_view_convert_bin_window_to_widget_coords (view, event->x, event->y,
+                                                     &x, &y);
+
+  n_frames = gdk_pixbuf_get_width (strip) / THUMBNAIL_WIDTH;
+  index = CLAMP ((x - rect.x) * n_frames / rect.width, 0, n_frames - 1);
+  set_scrub_frame (priv, path, strip, index);
+
+  gtk_tree_path_free (path);
+
+  return FALSE;
+}
+
+static gboolean
+backgrounds_leave_cb (GtkWidget                *widget,
+                      GdkEventCrossing         *event,
+                      CcAppearancePanelPrivate *priv)
+{
+  set_scrub_frame (priv, NULL, NULL, 0);
+
+  return FALSE;
+}
+
+static void
+backgrounds_pixbuf_data_func (GtkCellLayout            *layout,
+                              GtkCellRenderer          *cell,
+                              GtkTreeModel             *model,
+                              GtkTreeIter              *iter,
+                              CcAppearancePanelPrivate *priv)
+{
+  GtkTreePath *path;
+
+  if (priv->scrub_path == NULL)
+    return;
+
+  path = gtk_tree_model_get_path (model, iter);
+  if (gtk_tree_path_compare (path, priv->scrub_path) == 0)
+    g_object_set (cell, "pixbuf", priv->scrub_frame, NULL);
+  gtk_tree_path_free (path);
+}
+
 static void
 source_changed_cb (GtkComboBox              *combo,
                    CcAppearancePanelPrivate *priv)
@@ -621,8 +982,17 @@ source_changed_cb (GtkComboBox              *combo,
   view = (GtkIconView *) gtk_builder_get_object (priv->builder,
                                                  "backgrounds-iconview");
 
+  /* only the shown source renders thumbnails */
+  if (priv->shown_source && priv->shown_source != source)
+    bg_source_cancel_thumbnails (priv->shown_source);
+  priv->shown_source = source;
+
+  set_scrub_frame (priv, NULL, NULL, 0);
   gtk_icon_view_set_model (view,
                            GTK_TREE_MODEL (bg_source_get_liststore (source)));
+
+  update_visible_range (priv);
+  bg_source_resume_thumbnails (source);
 }
 
 static void
@@ -655,11 +1025,241 @@ select_style (GtkComboBox *box,
     gtk_combo_box_set_active (box, -1);
 }
 
+/* The preview is rendered in a thread: a job either composites the
+ * background into the display and scales the result, or only rescales
+ * the composite it was given when the preview area changed size */
+typedef struct
+{
+  CcAppearanceItem *item;
+  GnomeDesktopThumbnailFactory *thumb_factory;
+  GdkPixbuf *base;
+  GdkPixbuf *overlay;
+  GdkPixbuf *composite;
+  GdkPixbuf *scaled;
+  gchar *key;
+  gint size;
+  gboolean renders;
+  GCancellable *cancellable;
+} PreviewJob;
+
+static void
+preview_job_free (PreviewJob *job)
+{
+  if (job->item)
+    g_object_unref (job->item);
+  if (job->thumb_factory)
+    g_object_unref (job->thumb_factory);
+  if (job->base)
+    g_object_unref (job->base);
+  if (job->overlay)
+    g_object_unref (job->overlay);
+  if (job->composite)
+    g_object_unref (job->composite);
+  if (job->scaled)
+    g_object_unref (job->scaled);
+  g_free (job->key);
+  g_object_unref (job->cancellable);
+  g_free (job);
+}
+
+static void
+render_preview_thread (GSimpleAsyncResult *res,
+                       GObject            *object,
+                       GCancellable       *cancellable)
+{
+  PreviewJob *job;
+  const gint preview_width = 416;
+  const gint preview_height = 248;
+  const gint preview_x = 45;
+  const gint preview_y = 84;
+
+  job = g_simple_async_result_get_op_res_gpointer (res);
+
+  if (job->renders)
+    {
+      job->composite = gdk_pixbuf_copy (job->base);
+
+      if (job->item)
+        {
+          GIcon *icon;
+
+          icon = cc_appearance_item_get_frame_thumbnail (job->item,
+                                                         job->thumb_factory,
+                                                         preview_width,
+                                                         preview_height,
+                                                         -2, TRUE);
+          if (icon)
+            {
+              gdk_pixbuf_composite (GDK_PIXBUF (icon), job->composite,
+                                    preview_x, preview_y,
+                                    preview_width, preview_height,
+                                    preview_x, preview_y, 1, 1,
+                                    GDK_INTERP_BILINEAR, 255);
+              g_object_unref (icon);
+            }
+        }
+
+      if (job->overlay)
+        {
+          gdk_pixbuf_composite (job->overlay, job->composite,
+                                0, 0, 512, 512,
+                                0, 0, 1, 1,
+                                GDK_INTERP_BILINEAR, 255);
+        }
+    }
+
+  if (job->size > 0 && !g_cancellable_is_cancelled (cancellable))
+    job->scaled = gdk_pixbuf_scale_simple (job->composite, job->size, job->size,
+                                           GDK_INTERP_BILINEAR);
+}
+
+static void
+render_preview_cb (GObject      *source_object,
+                   GAsyncResult *res,
+                   gpointer      user_data)
+{
+  CcAppearancePanelPrivate *priv = user_data;
+  PreviewJob *job;
+
+  job = g_simple_async_result_get_op_res_gpointer (G_SIMPLE_ASYNC_RESULT (res));
+
+  /* a newer job replaced this one, or the panel is gone */
+  if (g_cancellable_is_cancelled (job->cancellable))
+    return;
+
+  g_object_unref (priv->preview_cancellable);
+  priv->preview_cancellable = NULL;
+
+  if (job->renders)
+    {
+      if (priv->preview_composite)
+        g_object_unref (priv->preview_composite);
+      priv->preview_composite = g_object_ref (job->composite);
+    }
+
+  if (priv->preview_surface)
+    {
+      cairo_surface_destroy (priv->preview_surface);
+      priv->preview_surface = NULL;
+    }
+
+  if (job->scaled)
+    {
+      cairo_t *cr;
+
+      priv->preview_surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
+                                                          job->size, job->size);
+      cr = cairo_create (priv->preview_surface);
+      gdk_cairo_set_source_pixbuf (cr, job->scaled, 0, 0);
+      cairo_paint (cr);
+      cairo_destroy (cr);
+    }
+  priv->preview_size = job->size;
+
+  gtk_widget_queue_draw (WID ("preview-area"));
+}
+
+static gint
+get_preview_size (GtkWidget *widget)
+{
+  GtkAllocation allocation;
+
+  if (!gtk_widget_get_realized (widget))
+    return 0;
+
+  gtk_widget_get_allocation (widget, &allocation);
+
+  return MIN (allocation.width, allocation.height);
+}
+
+/* What the preview shows. A slideshow shows whichever slide is current,
+ * so it has no key and is rendered every time */
+static gchar *
+get_preview_key (CcAppearanceItem *item)
+{
+  const char *uri, *pcolor, *scolor;
+
+  if (item == NULL)
+    return g_strdup ("");
+
+  if (cc_appearance_item_changes_with_time (item))
+    return NULL;
+
+  uri = cc_appearance_item_get_uri (item);
+  pcolor = cc_appearance_item_get_pcolor (item);
+  scolor = cc_appearance_item_get_scolor (item);
+
+  return g_strdup_printf ("%s\n%d\n%d\n%s\n%s",
+                          uri ? uri : "",
+                          cc_appearance_item_get_placement (item),
+                          cc_appearance_item_get_shading (item),
+                          pcolor ? pcolor : "",
+                          scolor ? scolor : "");
+}
+
+/* Starts a preview job, replacing the one in progress. @renders is
+ * whether the background changed, and the composite needs redoing */
+static void
+queue_preview_job (CcAppearancePanelPrivate *priv,
+                   gboolean                  renders,
+                   gint                      size)
+{
+  GSimpleAsyncResult *res;
+  PreviewJob *job;
+
+  if (priv->display_base == NULL)
+    return;
+
+  /* don't lose a render in progress when only the size changes */
+  if (priv->preview_cancellable)
+    {
+      renders = renders || priv->preview_job_renders;
+      g_cancellable_cancel (priv->preview_cancellable);
+      g_object_unref (priv->preview_cancellable);
+      priv->preview_cancellable = NULL;
+    }
+
+  if (priv->preview_composite == NULL)
+    renders = TRUE;
+
+  job = g_new0 (PreviewJob, 1);
+  job->renders = renders;
+  job->size = size;
+  job->cancellable = g_cancellable_new ();
+
+  if (renders)
+    {
+      if (priv->current_background)
+        job->item = cc_appearance_item_copy (priv->current_background);
+      if (priv->thumb_factory)
+        job->thumb_factory = g_object_ref (priv->thumb_factory);
+      job->base = g_object_ref (priv->display_base);
+      if (priv->display_overlay)
+        job->overlay = g_object_ref (priv->display_overlay);
+    }
+  else
+    {
+      job->composite = g_object_ref (priv->preview_composite);
+    }
+
+  priv->preview_cancellable = g_object_ref (job->cancellable);
+  priv->preview_job_size = size;
+  priv->preview_job_renders = renders;
+
+  res = g_simple_async_result_new (NULL, render_preview_cb, priv,
+                                   queue_preview_job);
+  g_simple_async_result_set_op_res_gpointer (res, job,
+                                             (GDestroyNotify) preview_job_free);
+  g_simple_async_result_run_in_thread (res, render_preview_thread,
+                                       G_PRIORITY_DEFAULT, job->cancellable);
+  g_object_unref (res);
+}
+
 static void
 update_preview (CcAppearancePanelPrivate *priv,
                 CcAppearanceItem         *item)
 {
-  gchar *markup;
+  gchar *markup, *key;
   gboolean changes_with_time;
 
   if (item && priv->current_background)
@@ -707,7 +1307,18 @@ update_preview (CcAppearancePanelPrivate *priv,
   gtk_widget_set_visible (WID ("slide_image"), changes_with_time);
   gtk_widget_set_visible (WID ("slide-label"), changes_with_time);
 
-  gtk_widget_queue_draw (WID ("preview-area"));
+  /* the old preview stays up until the new one is ready */
+  key = get_preview_key (priv->current_background);
+  if (key == NULL || g_strcmp0 (key, priv->preview_key) != 0)
+    {
+      g_free (priv->preview_key);
+      priv->preview_key = key;
+      queue_preview_job (priv, TRUE, get_preview_size (WID ("preview-area")));
+    }
+  else
+    {
+      g_free (key);
+    }
 }
 
 static char *
@@ -1038,70 +1649,32 @@ preview_draw_cb (GtkWidget         *widget,
 {
   GtkAllocation allocation;
   CcAppearancePanelPrivate *priv = panel->priv;
-  GdkPixbuf *pixbuf = NULL;
-  const gint preview_width = 416;
-  const gint preview_height = 248;
-  const gint preview_x = 45;
-  const gint preview_y = 84;
-  GdkPixbuf *preview, *temp;
   gint size;
 
-  gtk_widget_get_allocation (widget, &allocation);
-
-  if (priv->current_background)
-    {
-      GIcon *icon;
-      icon = cc_appearance_item_get_frame_thumbnail (priv->current_background,
-                                                     priv->thumb_factory,
-                                                     preview_width,
-                                                     preview_height,
-                                                     -2, TRUE);
-      pixbuf = GDK_PIXBUF (icon);
-    }
-
   if (!priv->display_base)
     return FALSE;
 
-
-  preview = gdk_pixbuf_copy (priv->display_base);
-
-  if (pixbuf)
-    {
-      gdk_pixbuf_composite (pixbuf, preview,
-                            preview_x, preview_y,
-                            preview_width, preview_height,
-                            preview_x, preview_y, 1, 1,
-                            GDK_INTERP_BILINEAR, 255);
-
-      g_object_unref (pixbuf);
-    }
-
-
-  if (priv->display_overlay)
-    {
-      gdk_pixbuf_composite (priv->display_overlay, preview,
-                            0, 0, 512, 512,
-                            0, 0, 1, 1,
-                            GDK_INTERP_BILINEAR, 255);
-    }
-
-
-  if (allocation.width < allocation.height)
-    size = allocation.width;
-  else
-    size = allocation.height;
-
-  temp = gdk_pixbuf_scale_simple (preview, size, size, GDK_INTERP_BILINEAR);
-
-  gdk_cairo_set_source_pixbuf (cr,
-                               temp,
-                               allocation.width / 2 - (size / 2),
-                               allocation.height / 2 - (size / 2));
+  gtk_widget_get_allocation (widget, &allocation);
+  size = MIN (allocation.width, allocation.height);
+
+  /* rescaling happens in a thread, and until it's done the last preview
+   * is stretched to the new size */
+  if (size != priv->preview_size &&
+      (priv->preview_cancellable == NULL || priv->preview_job_size != size))
+    queue_preview_job (priv, FALSE, size);
+
+  if (priv->preview_surface == NULL || priv->preview_size <= 0)
+    return TRUE;
+
+  cairo_translate (cr,
+                   allocation.width / 2 - (size / 2),
+                   allocation.height / 2 - (size / 2));
+  cairo_scale (cr,
+               (double) size / priv->preview_size,
+               (double) size / priv->preview_size);
+  cairo_set_source_surface (cr, priv->preview_surface, 0, 0);
   cairo_paint (cr);
 
-  g_object_unref (temp);
-  g_object_unref (preview);
-
   return TRUE;
 }
 
@@ -1524,133 +2097,175 @@ cc_appearance_panel_drag_uris (GtkWidget *widget,
 static gchar *themes_id[] = { "Adwaita", "Ambiance", "Radiance", "HighContrast" };
 static gchar *themes_name[] = { "Adwaita", "Ambiance", "Radiance", "High Contrast" };
 
-static gboolean
-get_theme_data (const gchar *theme_name,
-		gchar **gtk_theme,
-		gchar **icon_theme,
-		gchar **window_theme,
-		gchar **cursor_theme)
+static void
+theme_selection_changed (GtkComboBox *combo, CcAppearancePanel *self)
 {
-  gchar *path;
-  GKeyFile *theme_file;
-  GError *error = NULL;
-  gboolean result = FALSE;
+  CcAppearancePanelPrivate *priv = self->priv;
+  const CcThemeInfo *info;
 
-  *gtk_theme = *icon_theme = *window_theme = *cursor_theme = NULL;
+  info = cc_theme_registry_lookup (priv->theme_registry,
+                                   gtk_combo_box_get_active_id (combo));
+  if (info == NULL)
+    return;
 
-  theme_file = g_key_file_new ();
-  path = g_build_filename ("/usr/share/themes", theme_name, "index.theme", NULL);
-  if (g_key_file_load_from_file (theme_file, path, G_KEY_FILE_NONE, &error))
-    {
-      *gtk_theme = g_key_file_get_string (theme_file, "X-GNOME-Metatheme", "GtkTheme", NULL);
-      *icon_theme = g_key_file_get_string (theme_file, "X-GNOME-Metatheme", "IconTheme", NULL);
-      *window_theme = g_key_file_get_string (theme_file, "X-GNOME-Metatheme", "MetacityTheme", NULL);
-      *cursor_theme = g_key_file_get_string (theme_file, "X-GNOME-Metatheme", "CursorTheme", NULL);
+  /* the themes are switched with a single write to each schema */
+  g_settings_delay (priv->interface_settings);
+  g_settings_delay (priv->wm_theme_settings);
 
-      result = TRUE;
-    }
-  else
-    {
-      g_warning ("Could not load %s: %s", path, error->message);
-      g_error_free (error);
-    }
+  if (info->gtk_theme)
+    g_settings_set_string (priv->interface_settings, "gtk-theme", info->gtk_theme);
+  if (info->icon_theme)
+    g_settings_set_string (priv->interface_settings, "icon-theme", info->icon_theme);
+  if (info->cursor_theme)
+    g_settings_set_string (priv->interface_settings, "cursor-theme", info->cursor_theme);
+  if (info->window_theme)
+    g_settings_set_string (priv->wm_theme_settings, "theme", info->window_theme);
 
-  g_key_file_free (theme_file);
-  g_free (path);
+  g_settings_apply (priv->interface_settings);
+  g_settings_apply (priv->wm_theme_settings);
+}
 
-  return result;
+static guint32
+rgba_to_pixel (const GdkRGBA *color)
+{
+  return ((guint32) (color->red * 255. + 0.5) << 24) |
+         ((guint32) (color->green * 255. + 0.5) << 16) |
+         ((guint32) (color->blue * 255. + 0.5) << 8) |
+         0xff;
 }
 
 static void
-theme_selection_changed (GtkComboBox *combo, CcAppearancePanel *self)
+theme_swatch_data_func (GtkCellLayout     *layout,
+                        GtkCellRenderer   *cell,
+                        GtkTreeModel      *model,
+                        GtkTreeIter       *iter,
+                        CcAppearancePanel *self)
 {
-  gint active;
-  gchar *gtk_theme, *icon_theme, *window_theme, *cursor_theme;
-
-  active = gtk_combo_box_get_active (combo);
-  g_return_if_fail (active >= 0 && active < G_N_ELEMENTS (themes_id));
+  const CcThemeInfo *info;
+  GdkPixbuf *pixbuf = NULL;
+  gchar *id;
 
-  if (!get_theme_data (gtk_combo_box_get_active_id (combo),
-                       &gtk_theme, &icon_theme, &window_theme, &cursor_theme))
-    return;
+  gtk_tree_model_get (model, iter, 0, &id, -1);
+  info = cc_theme_registry_lookup (self->priv->theme_registry, id);
+  g_free (id);
 
-  g_settings_delay (self->priv->interface_settings);
+  /* the window background, with a strip of the selection color */
+  if (info && info->has_swatch)
+    {
+      GdkPixbuf *strip;
 
-  g_settings_set_string (self->priv->interface_settings, "gtk-theme", gtk_theme);
-  g_settings_set_string (self->priv->interface_settings, "icon-theme", icon_theme);
-  g_settings_set_string (self->priv->interface_settings, "cursor-theme", cursor_theme);
-  g_settings_set_string (self->priv->wm_theme_settings, "theme", window_theme);
+      pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8, 24, 16);
+      gdk_pixbuf_fill (pixbuf, rgba_to_pixel (&info->bg_color));
+      strip = gdk_pixbuf_new_subpixbuf (pixbuf, 16, 0, 8, 16);
+      gdk_pixbuf_fill (strip, rgba_to_pixel (&info->selected_color));
+      g_object_unref (strip);
+    }
 
-  g_settings_apply (self->priv->interface_settings);
+  g_object_set (cell,
+                "pixbuf", pixbuf,
+                "visible", pixbuf != NULL,
+                NULL);
 
-  g_free (gtk_theme);
-  g_free (icon_theme);
-  g_free (window_theme);
-  g_free (cursor_theme);
+  if (pixbuf)
+    g_object_unref (pixbuf);
 }
 
 static void
-setup_theme_selector (CcAppearancePanel *self)
+populate_theme_selector (CcAppearancePanel *self)
 {
-  gchar *current_gtk_theme;
-  gchar *default_gtk_theme;
-  gint i, current_theme_index = 0;
-  GtkWidget *widget;
-  GtkWidget *liststore;
-  GSettingsSchemaSource *source;
   CcAppearancePanelPrivate *priv = self->priv;
-  GSettings *defaults_settings = g_settings_new ("org.gnome.desktop.interface");
+  GtkWidget *widget;
+  GtkListStore *liststore;
+  gchar *current_gtk_theme;
+  gint i;
 
-  priv->interface_settings = g_settings_new ("org.gnome.desktop.interface");
+  widget = WID ("theme-selector");
+  liststore = GTK_LIST_STORE (WID ("theme-list-store"));
+  current_gtk_theme = g_settings_get_string (priv->interface_settings, "gtk-theme");
 
-  source = g_settings_schema_source_get_default ();
+  g_signal_handlers_block_by_func (widget, theme_selection_changed, self);
+  gtk_list_store_clear (liststore);
 
-  priv->wm_theme_settings = g_settings_new ("org.gnome.desktop.wm.preferences");
-  current_gtk_theme = g_settings_get_string (priv->interface_settings, "gtk-theme");
+  /* until the first scan finishes, only say that the themes are coming */
+  if (!cc_theme_registry_is_ready (priv->theme_registry))
+    {
+      GtkTreeIter iter;
 
-  /* gettint the default for the theme */
-  g_settings_delay (defaults_settings);
-  g_settings_reset (defaults_settings, "gtk-theme");
-  default_gtk_theme = g_settings_get_string (defaults_settings, "gtk-theme");
-  g_object_unref (defaults_settings);
+      gtk_list_store_append (liststore, &iter);
+      gtk_list_store_set (liststore, &iter, 0, "", 1, _("Loading themes..."), -1);
+      gtk_combo_box_set_active_iter (GTK_COMBO_BOX (widget), &iter);
+      gtk_widget_set_sensitive (widget, FALSE);
 
-  widget = WID ("theme-selector");
-  liststore = WID ("theme-list-store");
+      g_signal_handlers_unblock_by_func (widget, theme_selection_changed, self);
+      g_free (current_gtk_theme);
+      return;
+    }
+
+  gtk_widget_set_sensitive (widget, TRUE);
 
-  for (i = 0; i < G_N_ELEMENTS (themes_id); i++, current_theme_index++)
+  for (i = 0; i < G_N_ELEMENTS (themes_id); i++)
     {
-      gchar *gtk_theme, *icon_theme, *window_theme, *cursor_theme, *new_theme_name;
+      const CcThemeInfo *info;
+      gchar *new_theme_name;
       GtkTreeIter iter;
 
-      if (!get_theme_data (themes_id[i], &gtk_theme, &icon_theme, &window_theme, &cursor_theme))
-        {
-          current_theme_index--;
-          continue;
-        }
+      info = cc_theme_registry_lookup (priv->theme_registry, themes_id[i]);
+      if (info == NULL)
+        continue;
 
-      if (g_strcmp0 (gtk_theme, default_gtk_theme) == 0)
+      if (g_strcmp0 (info->gtk_theme, priv->default_gtk_theme) == 0)
         new_theme_name = g_strdup_printf ("%s <small><i>(%s)</i></small>", themes_name[i], _("default"));
       else
         new_theme_name = g_strdup (themes_name[i]);
 
-      gtk_list_store_append (GTK_LIST_STORE (liststore), &iter);
-      gtk_list_store_set (GTK_LIST_STORE (liststore), &iter, 0, themes_id[i], 1, new_theme_name, -1);
+      gtk_list_store_append (liststore, &iter);
+      gtk_list_store_set (liststore, &iter, 0, themes_id[i], 1, new_theme_name, -1);
 
-      if (g_strcmp0 (gtk_theme, current_gtk_theme) == 0)
-	  /* This is the current theme, so select item in the combo box */
-         gtk_combo_box_set_active (GTK_COMBO_BOX (widget), current_theme_index);
+      if (g_strcmp0 (info->gtk_theme, current_gtk_theme) == 0)
+        /* This is the current theme, so select item in the combo box */
+        gtk_combo_box_set_active_iter (GTK_COMBO_BOX (widget), &iter);
 
-      g_free (gtk_theme);
       g_free (new_theme_name);
-      g_free (icon_theme);
-      g_free (window_theme);
-      g_free (cursor_theme);
     }
-    g_free (current_gtk_theme);
-    g_free (default_gtk_theme);
 
-    g_signal_connect (G_OBJECT (widget), "changed",
-		      G_CALLBACK (theme_selection_changed), self);
+  g_signal_handlers_unblock_by_func (widget, theme_selection_changed, self);
+  g_free (current_gtk_theme);
+}
+
+static void
+setup_theme_selector (CcAppearancePanel *self)
+{
+  GtkWidget *widget;
+  GtkCellRenderer *renderer;
+  CcAppearancePanelPrivate *priv = self->priv;
+  GSettings *defaults_settings = g_settings_new ("org.gnome.desktop.interface");
+
+  priv->interface_settings = g_settings_new ("org.gnome.desktop.interface");
+  priv->wm_theme_settings = g_settings_new ("org.gnome.desktop.wm.preferences");
+
+  /* gettint the default for the theme */
+  g_settings_delay (defaults_settings);
+  g_settings_reset (defaults_settings, "gtk-theme");
+  priv->default_gtk_theme = g_settings_get_string (defaults_settings, "gtk-theme");
+  g_object_unref (defaults_settings);
+
+  widget = WID ("theme-selector");
+
+  renderer = gtk_cell_renderer_pixbuf_new ();
+  gtk_cell_layout_pack_start (GTK_CELL_LAYOUT (widget), renderer, FALSE);
+  gtk_cell_layout_reorder (GTK_CELL_LAYOUT (widget), renderer, 0);
+  gtk_cell_layout_set_cell_data_func (GTK_CELL_LAYOUT (widget), renderer,
+                                      (GtkCellLayoutDataFunc) theme_swatch_data_func,
+                                      self, NULL);
+
+  g_signal_connect (G_OBJECT (widget), "changed",
+                    G_CALLBACK (theme_selection_changed), self);
+
+  /* the themes are listed once the registry has read them */
+  priv->theme_registry = cc_theme_registry_new ();
+  g_signal_connect_swapped (priv->theme_registry, "changed",
+                            G_CALLBACK (populate_theme_selector), self);
+  populate_theme_selector (self);
 }
 
 static void
@@ -2272,6 +2887,9 @@ setup_unity_settings (CcAppearancePanel *self)
                                                                  priv->compiz_settings,
                                                                  COMPIZCORE_GSETTINGS_PATH,
                                                                  &priv->compizcore_settings);
+      /* the workspace keys are set together from a check button, there is
+       * no point in waiting for more */
+      grouped_gsettings_set_quiet_period (priv->compizcore_compiz_gs, 0);
       g_settings_schema_unref (schema);
     }
 
@@ -2370,6 +2988,20 @@ setup_unity_settings (CcAppearancePanel *self)
                     G_CALLBACK (on_restore_defaults_page2_clicked), self);
 }
 
+/* The shell may exit right after destroying the panel, don't let the
+ * changes still waiting to be grouped get lost */
+static void
+panel_destroy_cb (GtkWidget         *widget,
+                  CcAppearancePanel *self)
+{
+  CcAppearancePanelPrivate *priv = self->priv;
+
+  if (priv->unity_compiz_gs)
+    grouped_gsettings_apply (priv->unity_compiz_gs);
+  if (priv->compizcore_compiz_gs)
+    grouped_gsettings_apply (priv->compizcore_compiz_gs);
+}
+
 static void
 cc_appearance_panel_init (CcAppearancePanel *self)
 {
@@ -2380,6 +3012,7 @@ cc_appearance_panel_init (CcAppearancePanel *self)
   GtkWidget *widget;
   GtkListStore *store;
   GtkStyleContext *context;
+  GtkAdjustment *adjustment;
 
   priv = self->priv = APPEARANCE_PANEL_PRIVATE (self);
 
@@ -2400,6 +3033,8 @@ cc_appearance_panel_init (CcAppearancePanel *self)
   g_signal_connect (WID ("scrolledwindow1"), "realize",
                     G_CALLBACK (scrolled_realize_cb), self);
 
+  g_signal_connect (self, "destroy", G_CALLBACK (panel_destroy_cb), self);
+
   priv->settings = g_settings_new (WP_PATH_ID);
   g_settings_delay (priv->settings);
 
@@ -2455,6 +3090,14 @@ cc_appearance_panel_init (CcAppearancePanel *self)
   g_signal_connect (widget, "selection-changed",
                     G_CALLBACK (backgrounds_changed_cb),
                     self);
+  g_signal_connect (widget, "motion-notify-event",
+                    G_CALLBACK (backgrounds_motion_cb), priv);
+  g_signal_connect (widget, "leave-notify-event",
+                    G_CALLBACK (backgrounds_leave_cb), priv);
+  gtk_cell_layout_set_cell_data_func (GTK_CELL_LAYOUT (widget),
+                                      GTK_CELL_RENDERER (WID ("pixbuf-renderer")),
+                                      (GtkCellLayoutDataFunc) backgrounds_pixbuf_data_func,
+                                      priv, NULL);
 
   /* Join treeview and buttons */
   widget = WID ("scrolledwindow1");
@@ -2464,6 +3107,13 @@ cc_appearance_panel_init (CcAppearancePanel *self)
   context = gtk_widget_get_style_context (widget);
   gtk_style_context_set_junction_sides (context, GTK_JUNCTION_TOP);
 
+  /* render the thumbnails in view first */
+  adjustment = gtk_scrolled_window_get_vadjustment (GTK_SCROLLED_WINDOW (WID ("scrolledwindow1")));
+  g_signal_connect (adjustment, "value-changed",
+                    G_CALLBACK (scrolled_value_changed_cb), priv);
+  g_signal_connect (adjustment, "changed",
+                    G_CALLBACK (scrolled_value_changed_cb), priv);
+
   g_signal_connect (WID ("add_button"), "clicked",
 		    G_CALLBACK (add_button_clicked), self);
   g_signal_connect (WID ("remove_button"), "clicked",
@@ -20,8 +20,10 @@
  */
 
 #include <gio/gio.h>
+#include <glib/gstdio.h>
 #include <string.h>
 #include <libxml/parser.h>
+#include <libxml/xmlreader.h>
 #include <libgnome-desktop/gnome-bg.h>
 #include <gdesktop-enums.h>
 
@@ -29,15 +31,56 @@
 #include "cc-appearance-item.h"
 #include "cc-appearance-xml.h"
 
-/* The number of items we signal as "added" before
- * returning to the main loop */
-#define NUM_ITEMS_PER_BATCH 1
+/* How long we spend signalling items as "added" before returning
+ * to the main loop, so that a frame can still be drawn in between */
+#define EMIT_BUDGET_USEC 4000
+
+/* Upper bound on the threads parsing wallpaper lists */
+#define MAX_LOADER_THREADS 8
+
+/* The parsed wallpaper lists are cached, so that only the files that
+ * changed since the last run are parsed again */
+#define CACHE_VERSION 1
+/* version, locale, path -> (mtime, size, wallpapers) */
+#define CACHE_FORMAT "(usa{s(xta" RECORD_FORMAT ")})"
+/* name, untranslated name, uri, deleted, placement, shading, primary
+ * color, secondary color, source url, flags */
+#define RECORD_FORMAT "(sssbiisssu)"
+
+typedef struct
+{
+  gchar                    *name;
+  gchar                    *cname;
+  gchar                    *uri;
+  gboolean                  deleted;
+  GDesktopBackgroundStyle   placement;
+  GDesktopBackgroundShading shading;
+  gchar                    *pcolor;
+  gchar                    *scolor;
+  gchar                    *source_url;
+  CcAppearanceItemFlags     flags;
+} WallpaperRecord;
+
+typedef struct
+{
+  gint64     mtime;
+  guint64    size;
+  GPtrArray *records;
+} CachedFile;
 
 struct CcAppearanceXmlPrivate
 {
+  /* files are loaded in parallel, hash_lock protects wp_hash */
+  GMutex       hash_lock;
   GHashTable  *wp_hash;
   GAsyncQueue *item_added_queue;
   guint        item_added_id;
+
+  /* path -> CachedFile, and the paths loaded by the current list load */
+  GMutex       cache_lock;
+  GHashTable  *cache;
+  GHashTable  *cache_seen;
+  gboolean     cache_dirty;
 };
 
 #define CC_APPEARANCE_XML_GET_PRIVATE(o) (G_TYPE_INSTANCE_GET_PRIVATE ((o), CC_TYPE_APPEARANCE_XML, CcAppearanceXmlPrivate))
@@ -56,26 +99,12 @@ static void     cc_appearance_xml_finalize       (GObject              *object);
 G_DEFINE_TYPE (CcAppearanceXml, cc_appearance_xml, G_TYPE_OBJECT)
 
 static gboolean
-cc_appearance_xml_get_bool (const xmlNode *parent,
-			    const gchar   *prop_name)
+parse_bool (const gchar *value)
 {
-  xmlChar * prop;
-  gboolean ret_val = FALSE;
+  if (value == NULL)
+    return FALSE;
 
-  g_return_val_if_fail (parent != NULL, FALSE);
-  g_return_val_if_fail (prop_name != NULL, FALSE);
-
-  prop = xmlGetProp ((xmlNode *) parent, (xmlChar*)prop_name);
-  if (prop != NULL) {
-    if (!g_ascii_strcasecmp ((gchar *)prop, "true") || !g_ascii_strcasecmp ((gchar *)prop, "1")) {
-      ret_val = TRUE;
-    } else {
-      ret_val = FALSE;
-    }
-    g_free (prop);
-  }
-
-  return ret_val;
+  return (!g_ascii_strcasecmp (value, "true") || !g_ascii_strcasecmp (value, "1"));
 }
 
 static struct {
@@ -115,208 +144,532 @@ static gboolean
 idle_emit (CcAppearanceXml *xml)
 {
 	GObject *item;
-	guint i = NUM_ITEMS_PER_BATCH;
-
-	g_async_queue_lock (xml->priv->item_added_queue);
+	gint64 start;
+	gboolean retval;
 
-	while (i > 0 && (item = g_async_queue_try_pop_unlocked (xml->priv->item_added_queue)) != NULL) {
+	/* The number of items per batch follows from the time the
+	 * handlers take, rather than being fixed */
+	start = g_get_monotonic_time ();
+	while ((item = g_async_queue_try_pop (xml->priv->item_added_queue)) != NULL) {
 		g_signal_emit (G_OBJECT (xml), signals[ADDED], 0, item);
 		g_object_unref (item);
-		i--;
+
+		if (g_get_monotonic_time () - start >= EMIT_BUDGET_USEC)
+			break;
 	}
 
+	g_async_queue_lock (xml->priv->item_added_queue);
+	retval = g_async_queue_length_unlocked (xml->priv->item_added_queue) > 0;
+	if (!retval)
+		xml->priv->item_added_id = 0;
 	g_async_queue_unlock (xml->priv->item_added_queue);
 
-        if (g_async_queue_length (xml->priv->item_added_queue) > 0) {
-                return TRUE;
-        } else {
-                xml->priv->item_added_id = 0;
-                return FALSE;
-        }
+	return retval;
 }
 
 static void
 emit_added_in_idle (CcAppearanceXml *xml,
-		    GObject         *object)
+		    GPtrArray       *items)
 {
+	guint i;
+
 	g_async_queue_lock (xml->priv->item_added_queue);
-	g_async_queue_push_unlocked (xml->priv->item_added_queue, object);
-	if (xml->priv->item_added_id == 0)
+	for (i = 0; i < items->len; i++)
+		g_async_queue_push_unlocked (xml->priv->item_added_queue,
+					     g_object_ref (g_ptr_array_index (items, i)));
+	if (xml->priv->item_added_id == 0 && items->len > 0)
 		xml->priv->item_added_id = g_idle_add ((GSourceFunc) idle_emit, xml);
 	g_async_queue_unlock (xml->priv->item_added_queue);
 }
 
 #define NONE "(none)"
-#define UNSET_FLAG(flag) G_STMT_START{ (flags&=~(flag)); }G_STMT_END
-#define SET_FLAG(flag) G_STMT_START{ (flags|=flag); }G_STMT_END
+#define SET_FLAG(flag) G_STMT_START{ (record->flags|=flag); }G_STMT_END
+
+static void
+wallpaper_record_free (WallpaperRecord *record)
+{
+  g_free (record->name);
+  g_free (record->cname);
+  g_free (record->uri);
+  g_free (record->pcolor);
+  g_free (record->scolor);
+  g_free (record->source_url);
+  g_slice_free (WallpaperRecord, record);
+}
+
+static void
+cached_file_free (CachedFile *cached)
+{
+  g_ptr_array_unref (cached->records);
+  g_slice_free (CachedFile, cached);
+}
+
+static const char *
+empty_to_null (const char *str)
+{
+  return (str && *str) ? str : NULL;
+}
+
+/* Returns FALSE if the rest of the wallpaper should be ignored */
+static gboolean
+parse_wallpaper_element (WallpaperRecord     *record,
+			 const gchar         *name,
+			 gchar               *content,
+			 const gchar         *lang,
+			 const gchar * const *syslangs)
+{
+  gint i;
+
+  if (content != NULL)
+    content = g_strstrip (content);
+
+  if (!strcmp (name, "filename")) {
+    if (content == NULL || *content == '\0')
+      return FALSE;
+
+    /* FIXME same rubbish as in other parts of the code */
+    g_free (record->uri);
+    if (strcmp (content, NONE) == 0) {
+      record->uri = NULL;
+    } else {
+      GFile *file;
+      file = g_file_new_for_commandline_arg (content);
+      record->uri = g_file_get_uri (file);
+      g_object_unref (file);
+    }
+    SET_FLAG(CC_APPEARANCE_ITEM_HAS_URI);
+  } else if (!strcmp (name, "name")) {
+    if (content == NULL || *content == '\0')
+      return FALSE;
+
+    if (record->name == NULL && lang == NULL) {
+      g_free (record->cname);
+      record->cname = g_strdup (content);
+      record->name = g_strdup (content);
+    } else if (lang != NULL) {
+      for (i = 0; syslangs[i] != NULL; i++) {
+	if (!strcmp (syslangs[i], lang)) {
+	  g_free (record->name);
+	  record->name = g_strdup (content);
+	  break;
+	}
+      }
+    }
+  } else if (!strcmp (name, "options")) {
+    if (content != NULL) {
+      record->placement = enum_string_to_value (G_DESKTOP_TYPE_DESKTOP_BACKGROUND_STYLE, content);
+      SET_FLAG(CC_APPEARANCE_ITEM_HAS_PLACEMENT);
+    }
+  } else if (!strcmp (name, "shade_type")) {
+    if (content != NULL) {
+      record->shading = enum_string_to_value (G_DESKTOP_TYPE_DESKTOP_BACKGROUND_SHADING, content);
+      SET_FLAG(CC_APPEARANCE_ITEM_HAS_SHADING);
+    }
+  } else if (!strcmp (name, "pcolor")) {
+    if (content != NULL) {
+      g_free (record->pcolor);
+      record->pcolor = g_strdup (content);
+      SET_FLAG(CC_APPEARANCE_ITEM_HAS_PCOLOR);
+    }
+  } else if (!strcmp (name, "scolor")) {
+    if (content != NULL) {
+      g_free (record->scolor);
+      record->scolor = g_strdup (content);
+      SET_FLAG(CC_APPEARANCE_ITEM_HAS_SCOLOR);
+    }
+  } else if (!strcmp (name, "source_url")) {
+    if (content != NULL) {
+      g_free (record->source_url);
+      record->source_url = g_strdup (content);
+    }
+  } else if (!strcmp (name, "text")) {
+    /* Do nothing here, libxml2 is being weird */
+  } else {
+    g_warning ("Unknown Tag: %s", name);
+  }
+
+  return TRUE;
+}
+
+/* Parses a wallpaper list with a streaming reader, without building the
+ * whole document in memory */
+static GPtrArray *
+parse_wallpaper_list (const gchar *filename)
+{
+  xmlTextReaderPtr reader;
+  const gchar * const *syslangs;
+  WallpaperRecord *record = NULL;
+  gboolean ignore_rest = FALSE;
+  GPtrArray *records;
+  int ret;
+
+  reader = xmlReaderForFile (filename, NULL, 0);
+  if (reader == NULL)
+    return NULL;
+
+  records = g_ptr_array_new_with_free_func ((GDestroyNotify) wallpaper_record_free);
+  syslangs = g_get_language_names ();
+
+  while ((ret = xmlTextReaderRead (reader)) == 1) {
+    const gchar *name;
+    int type, depth;
+
+    type = xmlTextReaderNodeType (reader);
+    depth = xmlTextReaderDepth (reader);
+    name = (const gchar *) xmlTextReaderConstName (reader);
+
+    if (depth == 1 && type == XML_READER_TYPE_ELEMENT &&
+	!strcmp (name, "wallpaper")) {
+      xmlChar *deleted;
+
+      record = g_slice_new0 (WallpaperRecord);
+      deleted = xmlTextReaderGetAttribute (reader, (xmlChar *) "deleted");
+      record->deleted = parse_bool ((gchar *) deleted);
+      xmlFree (deleted);
+      ignore_rest = FALSE;
+
+      if (xmlTextReaderIsEmptyElement (reader)) {
+	g_ptr_array_add (records, record);
+	record = NULL;
+      }
+    } else if (depth == 1 && type == XML_READER_TYPE_END_ELEMENT &&
+	       record != NULL) {
+      g_ptr_array_add (records, record);
+      record = NULL;
+    } else if (depth == 2 && type == XML_READER_TYPE_ELEMENT &&
+	       record != NULL && !ignore_rest) {
+      xmlChar *content;
+
+      content = xmlTextReaderReadString (reader);
+      ignore_rest = !parse_wallpaper_element (record, name, (gchar *) content,
+					      (const gchar *) xmlTextReaderConstXmlLang (reader),
+					      syslangs);
+      xmlFree (content);
+    }
+  }
+
+  xmlFreeTextReader (reader);
+
+  if (record != NULL)
+    wallpaper_record_free (record);
+
+  /* like a DOM parse, a broken file gives no wallpapers at all */
+  if (ret != 0) {
+    g_ptr_array_unref (records);
+    return NULL;
+  }
+
+  return records;
+}
+
+static gchar *
+get_cache_path (void)
+{
+  return g_build_filename (g_get_user_cache_dir (),
+			   "unity-control-center",
+			   "background-properties.cache",
+			   NULL);
+}
+
+static void
+load_cache (CcAppearanceXml *xml)
+{
+  GMappedFile *mapped;
+  GVariant *cache, *files, *records;
+  GVariantIter iter, record_iter;
+  const gchar *locale, *path;
+  guint32 version;
+  gint64 mtime;
+  guint64 size;
+  gchar *cache_path;
+
+  xml->priv->cache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+					    (GDestroyNotify) cached_file_free);
+
+  cache_path = get_cache_path ();
+  mapped = g_mapped_file_new (cache_path, FALSE, NULL);
+  g_free (cache_path);
+
+  if (mapped == NULL)
+    return;
+
+  if (g_mapped_file_get_length (mapped) == 0) {
+    g_mapped_file_unref (mapped);
+    return;
+  }
+
+  cache = g_variant_new_from_data (G_VARIANT_TYPE (CACHE_FORMAT),
+				   g_mapped_file_get_contents (mapped),
+				   g_mapped_file_get_length (mapped),
+				   FALSE,
+				   (GDestroyNotify) g_mapped_file_unref,
+				   mapped);
+  g_variant_ref_sink (cache);
+
+  g_variant_get (cache, "(u&s@a{s(xta" RECORD_FORMAT ")})",
+		 &version, &locale, &files);
+
+  /* names are stored translated */
+  if (version == CACHE_VERSION &&
+      g_strcmp0 (locale, g_get_language_names ()[0]) == 0) {
+    g_variant_iter_init (&iter, files);
+    while (g_variant_iter_next (&iter, "{&s(xt@a" RECORD_FORMAT ")}",
+				&path, &mtime, &size, &records)) {
+      CachedFile *cached;
+      const gchar *name, *cname, *uri, *pcolor, *scolor, *source_url;
+      gboolean deleted;
+      gint placement, shading;
+      guint32 flags;
+
+      cached = g_slice_new (CachedFile);
+      cached->mtime = mtime;
+      cached->size = size;
+      cached->records = g_ptr_array_new_with_free_func ((GDestroyNotify) wallpaper_record_free);
+
+      g_variant_iter_init (&record_iter, records);
+      while (g_variant_iter_next (&record_iter, "(&s&s&sbii&s&s&su)",
+				  &name, &cname, &uri, &deleted,
+				  &placement, &shading, &pcolor, &scolor,
+				  &source_url, &flags)) {
+	WallpaperRecord *record;
+
+	record = g_slice_new0 (WallpaperRecord);
+	record->name = g_strdup (empty_to_null (name));
+	record->cname = g_strdup (empty_to_null (cname));
+	record->uri = g_strdup (empty_to_null (uri));
+	record->deleted = deleted;
+	record->placement = placement;
+	record->shading = shading;
+	record->pcolor = g_strdup (empty_to_null (pcolor));
+	record->scolor = g_strdup (empty_to_null (scolor));
+	record->source_url = g_strdup (empty_to_null (source_url));
+	record->flags = flags;
+	g_ptr_array_add (cached->records, record);
+      }
+      g_variant_unref (records);
+
+      g_hash_table_insert (xml->priv->cache, g_strdup (path), cached);
+    }
+  }
+
+  g_variant_unref (files);
+  g_variant_unref (cache);
+}
+
+static void
+save_cache (CcAppearanceXml *xml)
+{
+  GVariantBuilder files;
+  GHashTableIter iter;
+  const gchar *path;
+  CachedFile *cached;
+  GVariant *cache;
+  gchar *cache_path, *dirname;
+  GError *error = NULL;
+
+  g_variant_builder_init (&files, G_VARIANT_TYPE ("a{s(xta" RECORD_FORMAT ")}"));
+
+  g_mutex_lock (&xml->priv->cache_lock);
+  g_hash_table_iter_init (&iter, xml->priv->cache);
+  while (g_hash_table_iter_next (&iter, (gpointer *) &path, (gpointer *) &cached)) {
+    GVariantBuilder records;
+    guint i;
+
+    g_variant_builder_init (&records, G_VARIANT_TYPE ("a" RECORD_FORMAT));
+    for (i = 0; i < cached->records->len; i++) {
+      WallpaperRecord *record = g_ptr_array_index (cached->records, i);
+
+      g_variant_builder_add (&records, RECORD_FORMAT,
+			     record->name ? record->name : "",
+			     record->cname ? record->cname : "",
+			     record->uri ? record->uri : "",
+			     record->deleted,
+			     record->placement,
+			     record->shading,
+			     record->pcolor ? record->pcolor : "",
+			     record->scolor ? record->scolor : "",
+			     record->source_url ? record->source_url : "",
+			     record->flags);
+    }
+
+    g_variant_builder_add (&files, "{s(xta" RECORD_FORMAT ")}",
+			   path, cached->mtime, cached->size, &records);
+  }
+  xml->priv->cache_dirty = FALSE;
+  g_mutex_unlock (&xml->priv->cache_lock);
+
+  cache = g_variant_new (CACHE_FORMAT,
+			 CACHE_VERSION,
+			 g_get_language_names ()[0],
+			 &files);
+  g_variant_ref_sink (cache);
+
+  cache_path = get_cache_path ();
+  dirname = g_path_get_dirname (cache_path);
+  g_mkdir_with_parents (dirname, 0700);
+  g_free (dirname);
+
+  if (!g_file_set_contents (cache_path,
+			    g_variant_get_data (cache),
+			    g_variant_get_size (cache),
+			    &error)) {
+    g_warning ("Could not write wallpaper cache '%s': %s", cache_path, error->message);
+    g_error_free (error);
+  }
+
+  g_free (cache_path);
+  g_variant_unref (cache);
+}
+
+/* Returns the wallpapers described in @filename, from the cache if the
+ * file did not change since it was last parsed */
+static GPtrArray *
+get_wallpaper_records (CcAppearanceXml *xml,
+		       const gchar     *filename)
+{
+  CcAppearanceXmlPrivate *priv = xml->priv;
+  CachedFile *cached;
+  GPtrArray *records = NULL;
+  GStatBuf buf;
+
+  if (g_stat (filename, &buf) != 0)
+    return NULL;
+
+  g_mutex_lock (&priv->cache_lock);
+  if (priv->cache_seen != NULL)
+    g_hash_table_add (priv->cache_seen, g_strdup (filename));
+  if (priv->cache != NULL) {
+    cached = g_hash_table_lookup (priv->cache, filename);
+    /* the size catches a file rewritten within the same second */
+    if (cached != NULL &&
+	cached->mtime == (gint64) buf.st_mtime &&
+	cached->size == (guint64) buf.st_size)
+      records = g_ptr_array_ref (cached->records);
+  }
+  g_mutex_unlock (&priv->cache_lock);
+
+  if (records != NULL)
+    return records;
+
+  records = parse_wallpaper_list (filename);
+  if (records == NULL)
+    return NULL;
+
+  g_mutex_lock (&priv->cache_lock);
+  if (priv->cache != NULL) {
+    cached = g_slice_new (CachedFile);
+    cached->mtime = (gint64) buf.st_mtime;
+    cached->size = (guint64) buf.st_size;
+    cached->records = g_ptr_array_ref (records);
+    g_hash_table_insert (priv->cache, g_strdup (filename), cached);
+    priv->cache_dirty = TRUE;
+  }
+  g_mutex_unlock (&priv->cache_lock);
+
+  return records;
+}
+
+static CcAppearanceItem *
+item_from_record (WallpaperRecord *record,
+		  const gchar     *filename)
+{
+  CcAppearanceItem *item;
+
+  item = cc_appearance_item_new (record->uri);
+  g_object_set (G_OBJECT (item),
+		"is-deleted", record->deleted,
+		"source-xml", filename,
+		"flags", record->flags,
+		NULL);
+
+  if (record->name != NULL)
+    g_object_set (G_OBJECT (item), "name", record->name, NULL);
+  if (record->flags & CC_APPEARANCE_ITEM_HAS_PLACEMENT)
+    g_object_set (G_OBJECT (item), "placement", record->placement, NULL);
+  if (record->flags & CC_APPEARANCE_ITEM_HAS_SHADING)
+    g_object_set (G_OBJECT (item), "shading", record->shading, NULL);
+  if (record->flags & CC_APPEARANCE_ITEM_HAS_PCOLOR)
+    g_object_set (G_OBJECT (item), "primary-color", record->pcolor, NULL);
+  if (record->flags & CC_APPEARANCE_ITEM_HAS_SCOLOR)
+    g_object_set (G_OBJECT (item), "secondary-color", record->scolor, NULL);
+  if (record->source_url != NULL)
+    g_object_set (G_OBJECT (item),
+		  "source-url", record->source_url,
+		  "needs-download", FALSE,
+		  NULL);
+
+  return item;
+}
 
 static gboolean
 cc_appearance_xml_load_xml_internal (CcAppearanceXml *xml,
 				     const gchar     *filename,
 				     gboolean         in_thread)
 {
-  xmlDoc * wplist;
-  xmlNode * root, * list, * wpa;
-  xmlChar * nodelang;
-  const gchar * const * syslangs;
-  gint i;
+  GPtrArray *records, *added;
+  gchar *xml_uri;
   gboolean retval;
+  guint i;
 
-  wplist = xmlParseFile (filename);
+  records = get_wallpaper_records (xml, filename);
   retval = FALSE;
 
-  if (!wplist)
+  if (records == NULL)
     return retval;
 
-  syslangs = g_get_language_names ();
+  xml_uri = g_filename_to_uri (filename, NULL, NULL);
+  added = g_ptr_array_new_with_free_func (g_object_unref);
 
-  root = xmlDocGetRootElement (wplist);
-
-  for (list = root->children; list != NULL; list = list->next) {
-    if (!strcmp ((gchar *)list->name, "wallpaper")) {
-      CcAppearanceItem * item;
-      CcAppearanceItemFlags flags;
-      char *uri, *cname, *id;
-
-      flags = 0;
-      cname = NULL;
-      item = cc_appearance_item_new (NULL);
-
-      g_object_set (G_OBJECT (item),
-		    "is-deleted", cc_appearance_xml_get_bool (list, "deleted"),
-		    "source-xml", filename,
-		    NULL);
-
-      for (wpa = list->children; wpa != NULL; wpa = wpa->next) {
-	if (wpa->type == XML_COMMENT_NODE) {
-	  continue;
-	} else if (!strcmp ((gchar *)wpa->name, "filename")) {
-	  if (wpa->last != NULL && wpa->last->content != NULL) {
-	    gchar *content = g_strstrip ((gchar *)wpa->last->content);
-	    char *bg_uri;
-
-	    /* FIXME same rubbish as in other parts of the code */
-	    if (strcmp (content, NONE) == 0) {
-	      bg_uri = NULL;
-	    } else {
-	      GFile *file;
-	      file = g_file_new_for_commandline_arg (content);
-	      bg_uri = g_file_get_uri (file);
-	      g_object_unref (file);
-	    }
-	    SET_FLAG(CC_APPEARANCE_ITEM_HAS_URI);
-	    g_object_set (G_OBJECT (item), "uri", bg_uri, NULL);
-	    g_free (bg_uri);
-	  } else {
-	    break;
-	  }
-	} else if (!strcmp ((gchar *)wpa->name, "name")) {
-	  if (wpa->last != NULL && wpa->last->content != NULL) {
-	    char *name;
-	    nodelang = xmlNodeGetLang (wpa->last);
-
-	    g_object_get (G_OBJECT (item), "name", &name, NULL);
-
-	    if (name == NULL && nodelang == NULL) {
-	       g_free (cname);
-	       cname = g_strdup (g_strstrip ((gchar *)wpa->last->content));
-	       g_object_set (G_OBJECT (item), "name", cname, NULL);
-            } else {
-	       for (i = 0; syslangs[i] != NULL; i++) {
-	         if (!strcmp (syslangs[i], (gchar *)nodelang)) {
-		   g_object_set (G_OBJECT (item), "name",
-				 g_strstrip ((gchar *)wpa->last->content), NULL);
-	           break;
-	         }
-	       }
-	    }
-
-	    g_free (name);
-	    xmlFree (nodelang);
-	  } else {
-	    break;
-	  }
-	} else if (!strcmp ((gchar *)wpa->name, "options")) {
-	  if (wpa->last != NULL) {
-	    g_object_set (G_OBJECT (item), "placement",
-			  enum_string_to_value (G_DESKTOP_TYPE_DESKTOP_BACKGROUND_STYLE,
-						g_strstrip ((gchar *)wpa->last->content)), NULL);
-	    SET_FLAG(CC_APPEARANCE_ITEM_HAS_PLACEMENT);
-	  }
-	} else if (!strcmp ((gchar *)wpa->name, "shade_type")) {
-	  if (wpa->last != NULL) {
-	    g_object_set (G_OBJECT (item), "shading",
-			  enum_string_to_value (G_DESKTOP_TYPE_DESKTOP_BACKGROUND_SHADING,
-						g_strstrip ((gchar *)wpa->last->content)), NULL);
-	    SET_FLAG(CC_APPEARANCE_ITEM_HAS_SHADING);
-	  }
-	} else if (!strcmp ((gchar *)wpa->name, "pcolor")) {
-	  if (wpa->last != NULL) {
-	    g_object_set (G_OBJECT (item), "primary-color",
-			  g_strstrip ((gchar *)wpa->last->content), NULL);
-	    SET_FLAG(CC_APPEARANCE_ITEM_HAS_PCOLOR);
-	  }
-	} else if (!strcmp ((gchar *)wpa->name, "scolor")) {
-	  if (wpa->last != NULL) {
-	    g_object_set (G_OBJECT (item), "secondary-color",
-			  g_strstrip ((gchar *)wpa->last->content), NULL);
-	    SET_FLAG(CC_APPEARANCE_ITEM_HAS_SCOLOR);
-	  }
-	} else if (!strcmp ((gchar *)wpa->name, "source_url")) {
-	   if (wpa->last != NULL) {
-             g_object_set (G_OBJECT (item),
-			   "source-url", g_strstrip ((gchar *)wpa->last->content),
-			   "needs-download", FALSE,
-			   NULL);
-	   }
-	} else if (!strcmp ((gchar *)wpa->name, "text")) {
-	  /* Do nothing here, libxml2 is being weird */
-	} else {
-	  g_warning ("Unknown Tag: %s", wpa->name);
-	}
-      }
+  for (i = 0; i < records->len; i++) {
+    WallpaperRecord *record = g_ptr_array_index (records, i);
+    CcAppearanceItem *item;
+    char *id;
 
-      /* Check whether the target file exists */
-      {
-        GFile *file;
-        const char *uri;
-
-	uri = cc_appearance_item_get_uri (item);
-	if (uri != NULL)
-	  {
-            file = g_file_new_for_uri (uri);
-	    if (g_file_query_exists (file, NULL) == FALSE)
-	      {
-	        g_object_unref (item);
-	        continue;
-	      }
-	  }
-      }
+    /* Check whether the target file exists */
+    if (record->uri != NULL) {
+      GFile *file;
+      gboolean exists;
 
-      /* FIXME, this is a broken way of doing,
-       * need to use proper code here */
-      uri = g_filename_to_uri (filename, NULL, NULL);
-      id = g_strdup_printf ("%s#%s", uri, cname);
-      g_free (uri);
+      file = g_file_new_for_uri (record->uri);
+      exists = g_file_query_exists (file, NULL);
+      g_object_unref (file);
 
-      /* Make sure we don't already have this one and that filename exists */
-      if (g_hash_table_lookup (xml->priv->wp_hash, id) != NULL) {
-	g_object_unref (item);
-	g_free (id);
+      if (!exists)
 	continue;
-      }
+    }
+
+    /* FIXME, this is a broken way of doing,
+     * need to use proper code here */
+    id = g_strdup_printf ("%s#%s", xml_uri, record->cname);
 
-      g_object_set (G_OBJECT (item), "flags", flags, NULL);
-      g_hash_table_insert (xml->priv->wp_hash, id, item);
-      /* Don't free ID, we added it to the hash table */
-      if (in_thread)
-        emit_added_in_idle (xml, g_object_ref (item));
-      else
-        g_signal_emit (G_OBJECT (xml), signals[ADDED], 0, item);
-      retval = TRUE;
+    /* Make sure we don't already have this one and that filename exists */
+    g_mutex_lock (&xml->priv->hash_lock);
+    if (g_hash_table_lookup (xml->priv->wp_hash, id) != NULL) {
+      g_mutex_unlock (&xml->priv->hash_lock);
+      g_free (id);
+      continue;
     }
+
+    item = item_from_record (record, filename);
+    g_hash_table_insert (xml->priv->wp_hash, id, item);
+    /* Don't free ID, we added it to the hash table */
+    g_mutex_unlock (&xml->priv->hash_lock);
+
+    g_ptr_array_add (added, g_object_ref (item));
+    retval = TRUE;
   }
-  xmlFreeDoc (wplist);
+
+  /* items from one file go to the main thread in a single batch */
+  if (in_thread) {
+    emit_added_in_idle (xml, added);
+  } else {
+    for (i = 0; i < added->len; i++)
+      g_signal_emit (G_OBJECT (xml), signals[ADDED], 0, g_ptr_array_index (added, i));
+  }
+
+  g_ptr_array_unref (added);
+  g_free (xml_uri);
+  g_ptr_array_unref (records);
 
   return retval;
 }
@@ -369,10 +722,11 @@ cc_appearance_xml_add_monitor (GFile      *directory,
                     data);
 }
 
+/* Adds the files in @path to @files, and starts monitoring @path */
 static void
 cc_appearance_xml_load_from_dir (const gchar      *path,
 				 CcAppearanceXml  *data,
-				 gboolean          in_thread)
+				 GPtrArray        *files)
 {
   GFile *directory;
   GFileEnumerator *enumerator;
@@ -398,14 +752,10 @@ cc_appearance_xml_load_from_dir (const gchar      *path,
 
   while ((info = g_file_enumerator_next_file (enumerator, NULL, NULL))) {
     const gchar *filename;
-    gchar *fullpath;
 
     filename = g_file_info_get_name (info);
-    fullpath = g_build_filename (path, filename, NULL);
+    g_ptr_array_add (files, g_build_filename (path, filename, NULL));
     g_object_unref (info);
-
-    cc_appearance_xml_load_xml_internal (data, fullpath, in_thread);
-    g_free (fullpath);
   }
   g_file_enumerator_close (enumerator, NULL, NULL);
 
@@ -415,18 +765,38 @@ cc_appearance_xml_load_from_dir (const gchar      *path,
   g_object_unref (enumerator);
 }
 
+static void
+load_file_func (gchar           *path,
+		CcAppearanceXml *data)
+{
+  cc_appearance_xml_load_xml_internal (data, path, TRUE);
+  g_free (path);
+}
+
 static void
 cc_appearance_xml_load_list (CcAppearanceXml *data,
 			     gboolean         in_thread)
 {
   const char * const *system_data_dirs;
   gchar * datadir;
+  GPtrArray *files;
+  GThreadPool *pool = NULL;
+  GError *error = NULL;
+  guint j;
   gint i;
 
+  g_mutex_lock (&data->priv->cache_lock);
+  if (data->priv->cache == NULL)
+    load_cache (data);
+  data->priv->cache_seen = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  g_mutex_unlock (&data->priv->cache_lock);
+
+  files = g_ptr_array_new ();
+
   datadir = g_build_filename (g_get_user_data_dir (),
                               "gnome-background-properties",
                               NULL);
-  cc_appearance_xml_load_from_dir (datadir, data, in_thread);
+  cc_appearance_xml_load_from_dir (datadir, data, files);
   g_free (datadir);
 
   system_data_dirs = g_get_system_data_dirs ();
@@ -434,9 +804,58 @@ cc_appearance_xml_load_list (CcAppearanceXml *data,
     datadir = g_build_filename (system_data_dirs[i],
                                 "gnome-background-properties",
 				NULL);
-    cc_appearance_xml_load_from_dir (datadir, data, in_thread);
+    cc_appearance_xml_load_from_dir (datadir, data, files);
     g_free (datadir);
   }
+
+  /* Each file is parsed on its own, so the files of all the directories
+   * are spread over the cores together, in one pool */
+  if (in_thread && files->len > 1) {
+    pool = g_thread_pool_new ((GFunc) load_file_func, data,
+			      MIN (g_get_num_processors (), MAX_LOADER_THREADS),
+			      FALSE, &error);
+    if (pool == NULL) {
+      g_warning ("Unable to start the wallpaper list loaders: %s", error->message);
+      g_error_free (error);
+    }
+  }
+
+  for (j = 0; j < files->len; j++) {
+    gchar *path = g_ptr_array_index (files, j);
+
+    if (pool != NULL) {
+      g_thread_pool_push (pool, path, NULL);
+    } else {
+      cc_appearance_xml_load_xml_internal (data, path, in_thread);
+      g_free (path);
+    }
+  }
+
+  /* wait for all the files to be loaded */
+  if (pool != NULL)
+    g_thread_pool_free (pool, FALSE, TRUE);
+  g_ptr_array_free (files, TRUE);
+
+  /* forget about the files that are gone */
+  g_mutex_lock (&data->priv->cache_lock);
+  {
+    GHashTableIter iter;
+    const gchar *path;
+
+    g_hash_table_iter_init (&iter, data->priv->cache);
+    while (g_hash_table_iter_next (&iter, (gpointer *) &path, NULL)) {
+      if (!g_hash_table_contains (data->priv->cache_seen, path)) {
+        g_hash_table_iter_remove (&iter);
+        data->priv->cache_dirty = TRUE;
+      }
+    }
+  }
+  g_hash_table_destroy (data->priv->cache_seen);
+  data->priv->cache_seen = NULL;
+  g_mutex_unlock (&data->priv->cache_lock);
+
+  if (data->priv->cache_dirty)
+    save_cache (data);
 }
 
 const GHashTable *
@@ -634,6 +1053,15 @@ cc_appearance_xml_finalize (GObject *object)
 		g_async_queue_unref (xml->priv->item_added_queue);
 		xml->priv->item_added_queue = NULL;
 	}
+	if (xml->priv->cache) {
+		/* files changed on disk while the panel was open */
+		if (xml->priv->cache_dirty)
+			save_cache (xml);
+		g_hash_table_destroy (xml->priv->cache);
+		xml->priv->cache = NULL;
+	}
+	g_mutex_clear (&xml->priv->cache_lock);
+	g_mutex_clear (&xml->priv->hash_lock);
 }
 
 static void
@@ -658,11 +1086,13 @@ static void
 cc_appearance_xml_init (CcAppearanceXml *xml)
 {
         xml->priv = CC_APPEARANCE_XML_GET_PRIVATE (xml);
+	g_mutex_init (&xml->priv->hash_lock);
         xml->priv->wp_hash = g_hash_table_new_full (g_str_hash,
 						    g_str_equal,
 						    (GDestroyNotify) g_free,
 						    (GDestroyNotify) g_object_unref);
 	xml->priv->item_added_queue = g_async_queue_new_full ((GDestroyNotify) g_object_unref);
+	g_mutex_init (&xml->priv->cache_lock);
 }
 
 CcAppearanceXml *
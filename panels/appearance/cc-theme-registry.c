@@ -0,0 +1,433 @@
+/*
+ * Copyright (C) 2026 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * The theme registry reads the index.theme of every metatheme in the
+ * theme directories once, in a thread, and answers lookups from memory.
+ * The directories are monitored, and scanned again when they change.
+ */
+
+#include <string.h>
+
+#include "cc-theme-registry.h"
+
+G_DEFINE_TYPE (CcThemeRegistry, cc_theme_registry, G_TYPE_OBJECT)
+
+#define THEME_REGISTRY_PRIVATE(o) \
+  (G_TYPE_INSTANCE_GET_PRIVATE ((o), CC_TYPE_THEME_REGISTRY, CcThemeRegistryPrivate))
+
+#define METATHEME_GROUP "X-GNOME-Metatheme"
+
+/* seconds to wait for a theme installation to settle before scanning */
+#define RESCAN_DELAY 1
+
+struct _CcThemeRegistryPrivate
+{
+  /* the theme directories, most important first */
+  gchar       **dirs;
+  GPtrArray    *monitors;
+
+  /* name -> CcThemeInfo, NULL until the first scan is done */
+  GHashTable   *themes;
+
+  GCancellable *cancellable;
+  gboolean      rescan;
+  guint         rescan_id;
+};
+
+enum
+{
+  CHANGED,
+  LAST_SIGNAL
+};
+
+static guint signals[LAST_SIGNAL] = { 0 };
+
+static void start_scan (CcThemeRegistry *registry);
+
+static void
+theme_info_free (CcThemeInfo *info)
+{
+  g_free (info->name);
+  g_free (info->gtk_theme);
+  g_free (info->icon_theme);
+  g_free (info->window_theme);
+  g_free (info->cursor_theme);
+  g_slice_free (CcThemeInfo, info);
+}
+
+/* Picks the background and selection colors out of the theme's gtk.css,
+ * as long as they are given as colors rather than references */
+static void
+load_swatch (CcThemeInfo *info,
+             const gchar *theme_dir)
+{
+  gchar *path, *contents;
+  gchar **lines;
+  gboolean has_bg = FALSE, has_selected = FALSE;
+  guint i;
+
+  path = g_build_filename (theme_dir, "gtk-3.0", "gtk.css", NULL);
+  if (!g_file_get_contents (path, &contents, NULL, NULL))
+    {
+      g_free (path);
+      return;
+    }
+  g_free (path);
+
+  lines = g_strsplit (contents, "\n", -1);
+  g_free (contents);
+
+  for (i = 0; lines[i] != NULL; i++)
+    {
+      gchar **tokens;
+      gchar *value;
+
+      if (!g_str_has_prefix (g_strchug (lines[i]), "@define-color"))
+        continue;
+
+      tokens = g_strsplit_set (lines[i], " \t", 3);
+      if (g_strv_length (tokens) == 3)
+        {
+          value = g_strstrip (g_strdelimit (tokens[2], ";", ' '));
+
+          if ((g_str_equal (tokens[1], "theme_bg_color") ||
+               (g_str_equal (tokens[1], "bg_color") && !has_bg)) &&
+              gdk_rgba_parse (&info->bg_color, value))
+            has_bg = TRUE;
+          else if ((g_str_equal (tokens[1], "theme_selected_bg_color") ||
+                    (g_str_equal (tokens[1], "selected_bg_color") && !has_selected)) &&
+                   gdk_rgba_parse (&info->selected_color, value))
+            has_selected = TRUE;
+        }
+      g_strfreev (tokens);
+    }
+
+  g_strfreev (lines);
+
+  info->has_swatch = has_bg && has_selected;
+}
+
+static CcThemeInfo *
+load_theme (const gchar *theme_dir,
+            const gchar *name)
+{
+  CcThemeInfo *info;
+  GKeyFile *theme_file;
+  gchar *path;
+
+  theme_file = g_key_file_new ();
+  path = g_build_filename (theme_dir, "index.theme", NULL);
+
+  if (!g_key_file_load_from_file (theme_file, path, G_KEY_FILE_NONE, NULL))
+    {
+      g_key_file_free (theme_file);
+      g_free (path);
+      return NULL;
+    }
+
+  info = g_slice_new0 (CcThemeInfo);
+  info->name = g_strdup (name);
+  info->gtk_theme = g_key_file_get_string (theme_file, METATHEME_GROUP, "GtkTheme", NULL);
+  info->icon_theme = g_key_file_get_string (theme_file, METATHEME_GROUP, "IconTheme", NULL);
+  info->window_theme = g_key_file_get_string (theme_file, METATHEME_GROUP, "MetacityTheme", NULL);
+  info->cursor_theme = g_key_file_get_string (theme_file, METATHEME_GROUP, "CursorTheme", NULL);
+
+  load_swatch (info, theme_dir);
+
+  g_key_file_free (theme_file);
+  g_free (path);
+
+  return info;
+}
+
+static void
+scan_thread (GSimpleAsyncResult *res,
+             GObject            *object,
+             GCancellable       *cancellable)
+{
+  CcThemeRegistry *registry = CC_THEME_REGISTRY (object);
+  GHashTable *themes;
+  guint i;
+
+  themes = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+                                  (GDestroyNotify) theme_info_free);
+
+  for (i = 0; registry->priv->dirs[i] != NULL; i++)
+    {
+      const gchar *name;
+      GDir *dir;
+
+      dir = g_dir_open (registry->priv->dirs[i], 0, NULL);
+      if (dir == NULL)
+        continue;
+
+      while ((name = g_dir_read_name (dir)) != NULL &&
+             !g_cancellable_is_cancelled (cancellable))
+        {
+          CcThemeInfo *info;
+          gchar *theme_dir;
+
+          /* the first directory a theme is found in wins */
+          if (g_hash_table_contains (themes, name))
+            continue;
+
+          theme_dir = g_build_filename (registry->priv->dirs[i], name, NULL);
+          info = load_theme (theme_dir, name);
+          g_free (theme_dir);
+
+          if (info)
+            g_hash_table_insert (themes, info->name, info);
+        }
+
+      g_dir_close (dir);
+    }
+
+  g_simple_async_result_set_op_res_gpointer (res, themes,
+                                             (GDestroyNotify) g_hash_table_unref);
+}
+
+static void
+scan_done_cb (GObject      *source_object,
+              GAsyncResult *res,
+              gpointer      user_data)
+{
+  CcThemeRegistry *registry = CC_THEME_REGISTRY (source_object);
+  CcThemeRegistryPrivate *priv = registry->priv;
+  GCancellable *cancellable = user_data;
+  GHashTable *themes;
+
+  /* the registry is going away */
+  if (g_cancellable_is_cancelled (cancellable))
+    {
+      g_object_unref (cancellable);
+      return;
+    }
+  g_object_unref (cancellable);
+
+  g_object_unref (priv->cancellable);
+  priv->cancellable = NULL;
+
+  themes = g_simple_async_result_get_op_res_gpointer (G_SIMPLE_ASYNC_RESULT (res));
+  if (priv->themes)
+    g_hash_table_unref (priv->themes);
+  priv->themes = g_hash_table_ref (themes);
+
+  g_debug ("Found %u themes", g_hash_table_size (priv->themes));
+
+  /* the directories changed while they were being scanned */
+  if (priv->rescan)
+    start_scan (registry);
+
+  g_signal_emit (registry, signals[CHANGED], 0);
+}
+
+static void
+start_scan (CcThemeRegistry *registry)
+{
+  CcThemeRegistryPrivate *priv = registry->priv;
+  GSimpleAsyncResult *res;
+
+  if (priv->cancellable)
+    {
+      priv->rescan = TRUE;
+      return;
+    }
+
+  priv->rescan = FALSE;
+  priv->cancellable = g_cancellable_new ();
+
+  res = g_simple_async_result_new (G_OBJECT (registry), scan_done_cb,
+                                   g_object_ref (priv->cancellable),
+                                   start_scan);
+  g_simple_async_result_run_in_thread (res, scan_thread,
+                                       G_PRIORITY_LOW, priv->cancellable);
+  g_object_unref (res);
+}
+
+static gboolean
+rescan_timeout (CcThemeRegistry *registry)
+{
+  registry->priv->rescan_id = 0;
+  start_scan (registry);
+
+  return FALSE;
+}
+
+static void
+dir_changed_cb (GFileMonitor      *monitor,
+                GFile             *file,
+                GFile             *other_file,
+                GFileMonitorEvent  event_type,
+                CcThemeRegistry   *registry)
+{
+  if (registry->priv->rescan_id != 0)
+    g_source_remove (registry->priv->rescan_id);
+
+  registry->priv->rescan_id = g_timeout_add_seconds (RESCAN_DELAY,
+                                                     (GSourceFunc) rescan_timeout,
+                                                     registry);
+}
+
+static void
+cc_theme_registry_dispose (GObject *object)
+{
+  CcThemeRegistryPrivate *priv = CC_THEME_REGISTRY (object)->priv;
+
+  if (priv->cancellable)
+    {
+      g_cancellable_cancel (priv->cancellable);
+      g_object_unref (priv->cancellable);
+      priv->cancellable = NULL;
+    }
+
+  if (priv->rescan_id != 0)
+    {
+      g_source_remove (priv->rescan_id);
+      priv->rescan_id = 0;
+    }
+
+  if (priv->monitors)
+    {
+      guint i;
+
+      for (i = 0; i < priv->monitors->len; i++)
+        g_signal_handlers_disconnect_by_func (g_ptr_array_index (priv->monitors, i),
+                                              dir_changed_cb, object);
+      g_ptr_array_unref (priv->monitors);
+      priv->monitors = NULL;
+    }
+
+  G_OBJECT_CLASS (cc_theme_registry_parent_class)->dispose (object);
+}
+
+static void
+cc_theme_registry_finalize (GObject *object)
+{
+  CcThemeRegistryPrivate *priv = CC_THEME_REGISTRY (object)->priv;
+
+  if (priv->themes)
+    {
+      g_hash_table_unref (priv->themes);
+      priv->themes = NULL;
+    }
+
+  g_strfreev (priv->dirs);
+
+  G_OBJECT_CLASS (cc_theme_registry_parent_class)->finalize (object);
+}
+
+static void
+cc_theme_registry_class_init (CcThemeRegistryClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  g_type_class_add_private (klass, sizeof (CcThemeRegistryPrivate));
+
+  object_class->dispose = cc_theme_registry_dispose;
+  object_class->finalize = cc_theme_registry_finalize;
+
+  signals[CHANGED] = g_signal_new ("changed",
+                                   G_OBJECT_CLASS_TYPE (object_class),
+                                   G_SIGNAL_RUN_LAST,
+                                   G_STRUCT_OFFSET (CcThemeRegistryClass, changed),
+                                   NULL, NULL,
+                                   g_cclosure_marshal_VOID__VOID,
+                                   G_TYPE_NONE, 0);
+}
+
+static void
+cc_theme_registry_init (CcThemeRegistry *self)
+{
+  CcThemeRegistryPrivate *priv;
+  const gchar * const *system_data_dirs;
+  GPtrArray *dirs;
+  guint i;
+
+  priv = self->priv = THEME_REGISTRY_PRIVATE (self);
+
+  dirs = g_ptr_array_new ();
+  g_ptr_array_add (dirs, g_build_filename (g_get_user_data_dir (), "themes", NULL));
+  g_ptr_array_add (dirs, g_build_filename (g_get_home_dir (), ".themes", NULL));
+  system_data_dirs = g_get_system_data_dirs ();
+  for (i = 0; system_data_dirs[i] != NULL; i++)
+    g_ptr_array_add (dirs, g_build_filename (system_data_dirs[i], "themes", NULL));
+  g_ptr_array_add (dirs, NULL);
+  priv->dirs = (gchar **) g_ptr_array_free (dirs, FALSE);
+
+  priv->monitors = g_ptr_array_new_with_free_func (g_object_unref);
+  for (i = 0; priv->dirs[i] != NULL; i++)
+    {
+      GFileMonitor *monitor;
+      GFile *dir;
+
+      dir = g_file_new_for_path (priv->dirs[i]);
+      monitor = g_file_monitor_directory (dir, G_FILE_MONITOR_NONE, NULL, NULL);
+      g_object_unref (dir);
+
+      if (monitor == NULL)
+        continue;
+
+      g_signal_connect (monitor, "changed",
+                        G_CALLBACK (dir_changed_cb), self);
+      g_ptr_array_add (priv->monitors, monitor);
+    }
+
+  start_scan (self);
+}
+
+CcThemeRegistry *
+cc_theme_registry_new (void)
+{
+  return g_object_new (CC_TYPE_THEME_REGISTRY, NULL);
+}
+
+/**
+ * cc_theme_registry_is_ready:
+ * @registry: a #CcThemeRegistry
+ *
+ * Returns: whether the theme directories were scanned at least once
+ */
+gboolean
+cc_theme_registry_is_ready (CcThemeRegistry *registry)
+{
+  g_return_val_if_fail (CC_IS_THEME_REGISTRY (registry), FALSE);
+
+  return registry->priv->themes != NULL;
+}
+
+/**
+ * cc_theme_registry_lookup:
+ * @registry: a #CcThemeRegistry
+ * @name: the name of a theme directory
+ *
+ * Returns: the metatheme called @name, or %NULL if it isn't installed or
+ * the directories were not scanned yet. The info is owned by @registry
+ * and valid until the next "changed" signal.
+ */
+const CcThemeInfo *
+cc_theme_registry_lookup (CcThemeRegistry *registry,
+                          const gchar     *name)
+{
+  g_return_val_if_fail (CC_IS_THEME_REGISTRY (registry), NULL);
+
+  if (registry->priv->themes == NULL || name == NULL)
+    return NULL;
+
+  return g_hash_table_lookup (registry->priv->themes, name);
+}
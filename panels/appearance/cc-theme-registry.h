@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2026 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _CC_THEME_REGISTRY_H
+#define _CC_THEME_REGISTRY_H
+
+#include <gtk/gtk.h>
+
+G_BEGIN_DECLS
+
+#define CC_TYPE_THEME_REGISTRY cc_theme_registry_get_type()
+
+#define CC_THEME_REGISTRY(obj) \
+  (G_TYPE_CHECK_INSTANCE_CAST ((obj), \
+  CC_TYPE_THEME_REGISTRY, CcThemeRegistry))
+
+#define CC_THEME_REGISTRY_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_CAST ((klass), \
+  CC_TYPE_THEME_REGISTRY, CcThemeRegistryClass))
+
+#define CC_IS_THEME_REGISTRY(obj) \
+  (G_TYPE_CHECK_INSTANCE_TYPE ((obj), \
+  CC_TYPE_THEME_REGISTRY))
+
+#define CC_IS_THEME_REGISTRY_CLASS(klass) \
+  (G_TYPE_CHECK_CLASS_TYPE ((klass), \
+  CC_TYPE_THEME_REGISTRY))
+
+#define CC_THEME_REGISTRY_GET_CLASS(obj) \
+  (G_TYPE_INSTANCE_GET_CLASS ((obj), \
+  CC_TYPE_THEME_REGISTRY, CcThemeRegistryClass))
+
+typedef struct _CcThemeRegistry CcThemeRegistry;
+typedef struct _CcThemeRegistryClass CcThemeRegistryClass;
+typedef struct _CcThemeRegistryPrivate CcThemeRegistryPrivate;
+
+/* What a metatheme's index.theme maps to, and the colors it is
+ * previewed with */
+typedef struct
+{
+  gchar    *name;
+  gchar    *gtk_theme;
+  gchar    *icon_theme;
+  gchar    *window_theme;
+  gchar    *cursor_theme;
+
+  gboolean  has_swatch;
+  GdkRGBA   bg_color;
+  GdkRGBA   selected_color;
+} CcThemeInfo;
+
+struct _CcThemeRegistry
+{
+  GObject parent;
+
+  CcThemeRegistryPrivate *priv;
+};
+
+struct _CcThemeRegistryClass
+{
+  GObjectClass parent_class;
+
+  /* emitted on the main thread once a scan has finished */
+  void (* changed) (CcThemeRegistry *registry);
+};
+
+GType              cc_theme_registry_get_type (void) G_GNUC_CONST;
+
+CcThemeRegistry   *cc_theme_registry_new      (void);
+
+gboolean           cc_theme_registry_is_ready (CcThemeRegistry *registry);
+const CcThemeInfo *cc_theme_registry_lookup   (CcThemeRegistry *registry,
+                                               const gchar     *name);
+
+G_END_DECLS
+
+#endif /* _CC_THEME_REGISTRY_H */
@@ -186,12 +186,18 @@ cc_keyboard_panel_init (CcKeyboardPanel *self)
   const gchar *uifile = GNOMECC_UI_DIR "/gnome-keyboard-panel.ui";
   CcKeyboardPanelPrivate *priv;
   GError *error = NULL;
+  gint64 begin;
+  guint ret;
 
   priv = self->priv = KEYBOARD_PANEL_PRIVATE (self);
 
   priv->builder = gtk_builder_new ();
 
-  if (gtk_builder_add_from_file (priv->builder, uifile, &error) == 0)
+  begin = cc_panel_trace_begin (CC_PANEL (self));
+  ret = gtk_builder_add_from_file (priv->builder, uifile, &error);
+  cc_panel_trace_end (CC_PANEL (self), "GtkBuilder", begin);
+
+  if (ret == 0)
     {
       g_warning ("Could not load UI: %s", error->message);
       g_clear_error (&error);
@@ -1031,15 +1031,18 @@ cc_power_panel_init (CcPowerPanel *self)
   GtkWidget  *widget;
   gint        value;
   char       *text;
+  gint64      begin;
 
   self->priv = POWER_PANEL_PRIVATE (self);
 
   self->priv->builder = gtk_builder_new ();
 
   error = NULL;
+  begin = cc_panel_trace_begin (CC_PANEL (self));
   gtk_builder_add_from_file (self->priv->builder,
                              GNOMECC_UI_DIR "/power.ui",
                              &error);
+  cc_panel_trace_end (CC_PANEL (self), "GtkBuilder", begin);
 
   if (error != NULL)
     {
@@ -57,6 +57,9 @@ CC_PANEL_REGISTER (CcPrintersPanel, cc_printers_panel)
 
 #define CUPS_STATUS_CHECK_INTERVAL 5
 
+/* Notifications keep the list up to date, this only catches what they miss */
+#define RESYNC_INTERVAL 300
+
 #if (CUPS_VERSION_MAJOR > 1) || (CUPS_VERSION_MINOR > 5)
 #define HAVE_CUPS_1_6 1
 #endif
@@ -78,6 +81,13 @@ struct _CcPrintersPanelPrivate
   int current_dest;
 
   int num_jobs;
+  PpJobsCounter *jobs_counter;
+  GCancellable  *count_jobs_cancellable;
+  GQueue        *job_changes;
+  guint          job_changes_serial;
+  guint          snapshot_serial;
+  guint          count_jobs_serial;
+  gboolean       count_jobs_pending;
 
   GdkRGBA background_color;
 
@@ -95,6 +105,7 @@ struct _CcPrintersPanelPrivate
   gint             subscription_id;
   guint            subscription_renewal_id;
   guint            cups_status_check_id;
+  guint            resync_id;
   guint            dbus_subscription_id;
 
   GtkWidget    *popup_menu;
@@ -102,9 +113,15 @@ struct _CcPrintersPanelPrivate
   GCancellable *get_ppd_name_cancellable;
   gboolean      getting_ppd_names;
   PPDList      *all_ppds_list;
+  PpPPDIndex   *ppd_index;
   GHashTable   *preferred_drivers;
   GCancellable *get_all_ppds_cancellable;
 
+  GCancellable *get_printers_cancellable;
+  gboolean      printers_refresh_pending;
+  gchar        *ppd_fetch_printer;
+  gchar        *printer_to_select;
+
   gchar    *new_printer_name;
   gchar    *new_printer_location;
   gchar    *new_printer_make_and_model;
@@ -122,11 +139,19 @@ typedef struct
 
 static void update_jobs_count (CcPrintersPanel *self);
 static void actualize_printers_list (CcPrintersPanel *self);
+static void count_jobs (CcPrintersPanel *self);
 static void update_sensitivity (gpointer user_data);
 static void printer_disable_cb (GObject *gobject, GParamSpec *pspec, gpointer user_data);
 static void printer_set_default_cb (GtkToggleButton *button, gpointer user_data);
 static void detach_from_cups_notifier (gpointer data);
 static void free_dests (CcPrintersPanel *self);
+static void printer_state_changed (CcPrintersPanel *self,
+                                   const gchar     *printer_name,
+                                   gint             printer_state,
+                                   const gchar     *printer_state_reasons,
+                                   gboolean         printer_is_accepting_jobs);
+static void printer_deleted (CcPrintersPanel *self,
+                             const gchar     *printer_name);
 
 static void
 cc_printers_panel_get_property (GObject    *object,
@@ -162,8 +187,29 @@ cc_printers_panel_dispose (GObject *object)
   if (priv->pp_new_printer_dialog)
     g_clear_object (&priv->pp_new_printer_dialog);
 
+  if (priv->get_printers_cancellable)
+    {
+      g_cancellable_cancel (priv->get_printers_cancellable);
+      g_clear_object (&priv->get_printers_cancellable);
+    }
+
+  if (priv->count_jobs_cancellable)
+    {
+      g_cancellable_cancel (priv->count_jobs_cancellable);
+      g_clear_object (&priv->count_jobs_cancellable);
+    }
+
   free_dests (CC_PRINTERS_PANEL (object));
 
+  g_clear_pointer (&priv->jobs_counter, pp_jobs_counter_free);
+  if (priv->job_changes)
+    {
+      g_queue_foreach (priv->job_changes, (GFunc) g_free, NULL);
+      g_queue_free (priv->job_changes);
+      priv->job_changes = NULL;
+    }
+  g_clear_pointer (&priv->printer_to_select, g_free);
+  g_clear_pointer (&priv->ppd_fetch_printer, g_free);
   g_clear_pointer (&priv->new_printer_name, g_free);
   g_clear_pointer (&priv->new_printer_location, g_free);
   g_clear_pointer (&priv->new_printer_make_and_model, g_free);
@@ -200,6 +246,12 @@ cc_printers_panel_dispose (GObject *object)
       priv->all_ppds_list = NULL;
     }
 
+  if (priv->ppd_index)
+    {
+      pp_ppd_index_unref (priv->ppd_index);
+      priv->ppd_index = NULL;
+    }
+
   if (priv->preferred_drivers)
     {
       g_hash_table_unref (priv->preferred_drivers);
@@ -271,6 +323,168 @@ cc_printers_panel_class_init (CcPrintersPanelClass *klass)
   panel_class->get_help_uri = cc_printers_panel_get_help_uri;
 }
 
+/*
+ * A job notification which arrived while the jobs were being counted. The
+ * count may or may not include it, so it is applied again to the new
+ * counter.
+ */
+typedef struct
+{
+  gint  job_id;
+  gint  job_state;
+  guint serial;
+} JobChange;
+
+/*
+ * Forgets the job notifications which every running count was asked for
+ * after, or all of them if nothing is being counted.
+ */
+static void
+trim_job_changes (CcPrintersPanel *self)
+{
+  CcPrintersPanelPrivate *priv;
+  JobChange              *change;
+  guint                   oldest = G_MAXUINT;
+
+  priv = PRINTERS_PANEL_PRIVATE (self);
+
+  if (priv->get_printers_cancellable)
+    oldest = priv->snapshot_serial;
+  if (priv->count_jobs_cancellable)
+    oldest = MIN (oldest, priv->count_jobs_serial);
+
+  while ((change = g_queue_peek_head (priv->job_changes)) != NULL &&
+         change->serial <= oldest)
+    g_free (g_queue_pop_head (priv->job_changes));
+}
+
+/*
+ * Replaces the jobs counter by @counter, which was asked for after the
+ * notification numbered @serial, and applies the later notifications to it.
+ */
+static void
+set_jobs_counter (CcPrintersPanel *self,
+                  PpJobsCounter   *counter,
+                  guint            serial)
+{
+  CcPrintersPanelPrivate *priv;
+  JobChange              *change;
+  gboolean                recount = FALSE;
+  GList                  *iter;
+
+  priv = PRINTERS_PANEL_PRIVATE (self);
+
+  g_clear_pointer (&priv->jobs_counter, pp_jobs_counter_free);
+  priv->jobs_counter = counter;
+
+  if (counter)
+    {
+      for (iter = priv->job_changes->head; iter; iter = iter->next)
+        {
+          change = (JobChange *) iter->data;
+
+          if (change->serial > serial &&
+              !pp_jobs_counter_job_changed (counter, change->job_id, change->job_state) &&
+              change->job_state < IPP_JOB_CANCELED)
+            recount = TRUE;
+        }
+    }
+
+  trim_job_changes (self);
+
+  if (recount)
+    count_jobs (self);
+}
+
+static void
+count_jobs_cb (PpJobsCounter *counter,
+               gpointer       user_data)
+{
+  CcPrintersPanelPrivate *priv;
+  CcPrintersPanel        *self = (CcPrintersPanel *) user_data;
+
+  priv = PRINTERS_PANEL_PRIVATE (self);
+
+  g_clear_object (&priv->count_jobs_cancellable);
+
+  /* the notifications which asked for the pending count are replayed
+   * onto the result and start it again only if still needed */
+  if (counter)
+    {
+      priv->count_jobs_pending = FALSE;
+      set_jobs_counter (self, counter, priv->count_jobs_serial);
+      update_jobs_count (self);
+    }
+  else
+    {
+      trim_job_changes (self);
+      if (priv->count_jobs_pending)
+        {
+          priv->count_jobs_pending = FALSE;
+          count_jobs (self);
+        }
+    }
+}
+
+/*
+ * Counts the jobs again. Only one count runs at a time and requests
+ * arriving meanwhile are merged into a single pending one; the
+ * notifications are replayed onto the result of the running count,
+ * which starts the pending one if one of them was about an unknown job.
+ */
+static void
+count_jobs (CcPrintersPanel *self)
+{
+  CcPrintersPanelPrivate *priv;
+
+  priv = PRINTERS_PANEL_PRIVATE (self);
+
+  if (priv->count_jobs_cancellable)
+    {
+      priv->count_jobs_pending = TRUE;
+      return;
+    }
+
+  priv->count_jobs_cancellable = g_cancellable_new ();
+  priv->count_jobs_serial = priv->job_changes_serial;
+  get_jobs_counter_async (priv->count_jobs_cancellable,
+                          count_jobs_cb,
+                          self);
+}
+
+/*
+ * The notifications don't say who owns the job, so an active job the
+ * counter doesn't know about, neither as ours nor as another user's,
+ * might be a new job of the current user and is only counted by asking
+ * CUPS again.
+ */
+static void
+job_changed (CcPrintersPanel *self,
+             gint             job_id,
+             gint             job_state)
+{
+  CcPrintersPanelPrivate *priv;
+  JobChange              *change;
+
+  priv = PRINTERS_PANEL_PRIVATE (self);
+
+  priv->job_changes_serial++;
+
+  if (priv->get_printers_cancellable || priv->count_jobs_cancellable)
+    {
+      change = g_new0 (JobChange, 1);
+      change->job_id = job_id;
+      change->job_state = job_state;
+      change->serial = priv->job_changes_serial;
+      g_queue_push_tail (priv->job_changes, change);
+    }
+
+  if (priv->jobs_counter &&
+      !pp_jobs_counter_job_changed (priv->jobs_counter, job_id, job_state) &&
+      job_state < IPP_JOB_CANCELED)
+    count_jobs (self);
+}
+
 static void
 on_cups_notification (GDBusConnection *connection,
                       const char      *sender_name,
@@ -293,9 +507,6 @@ on_cups_notification (GDBusConnection *connection,
   gint                    printer_state;
   gint                    job_state;
   gint                    job_impressions_completed;
-  static const char * const requested_attrs[] = {
-    "job-printer-uri",
-    "job-originating-user-name"};
 
   priv = PRINTERS_PANEL_PRIVATE (self);
 
@@ -335,56 +546,30 @@ on_cups_notification (GDBusConnection *connection,
                      &job_impressions_completed);
     }
 
-  if (g_strcmp0 (signal_name, "PrinterAdded") == 0 ||
-      g_strcmp0 (signal_name, "PrinterDeleted") == 0 ||
-      g_strcmp0 (signal_name, "PrinterStateChanged") == 0 ||
-      g_strcmp0 (signal_name, "PrinterStopped") == 0)
-    actualize_printers_list (self);
-  else if (g_strcmp0 (signal_name, "JobCreated") == 0 ||
-           g_strcmp0 (signal_name, "JobCompleted") == 0)
+  if (g_strcmp0 (signal_name, "JobCreated") == 0 ||
+      g_strcmp0 (signal_name, "JobCompleted") == 0)
     {
-      http_t *http;
-      gchar  *job_uri;
-      ipp_t  *request, *response;
-
-      job_uri = g_strdup_printf ("ipp://localhost/jobs/%d", job_id);
-      if ((http = httpConnectEncrypt (cupsServer (), ippPort (),
-                                     cupsEncryption ())) != NULL)
-        {
-          request = ippNewRequest (IPP_GET_JOB_ATTRIBUTES);
-          ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI,
-                       "job-uri", NULL, job_uri);
-          ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_NAME,
-                        "requesting-user-name", NULL, cupsUser ());
-          ippAddStrings (request, IPP_TAG_OPERATION, IPP_TAG_KEYWORD,
-                         "requested-attributes", G_N_ELEMENTS (requested_attrs), NULL, requested_attrs);
-          response = cupsDoRequest (http, request, "/");
+      job_changed (self, job_id, job_state);
 
-          if (response)
-            {
-              if (ippGetStatusCode (response) <= IPP_OK_CONFLICT)
-                {
-                  ipp_attribute_t *attr_username = NULL;
-                  ipp_attribute_t *attr_printer_uri = NULL;
-
-                  attr_username = ippFindAttribute(response, "job-originating-user-name", IPP_TAG_NAME);
-                  attr_printer_uri = ippFindAttribute(response, "job-printer-uri", IPP_TAG_URI);
-                  if (attr_username && attr_printer_uri &&
-                      g_strcmp0 (ippGetString (attr_username, 0, NULL), cupsUser ()) == 0 &&
-                      g_strrstr (ippGetString (attr_printer_uri, 0, NULL), "/") != 0 &&
-                      priv->current_dest >= 0 &&
-                      priv->current_dest < priv->num_dests &&
-                      priv->dests != NULL &&
-                      g_strcmp0 (g_strrstr (ippGetString (attr_printer_uri, 0, NULL), "/") + 1,
-                                 priv->dests[priv->current_dest].name) == 0)
-                    update_jobs_count (self);
-                }
-              ippDelete(response);
-            }
-          httpClose (http);
-        }
-      g_free (job_uri);
+      if (priv->jobs_counter &&
+          priv->current_dest >= 0 &&
+          priv->current_dest < priv->num_dests &&
+          priv->dests != NULL &&
+          g_strcmp0 (printer_name, priv->dests[priv->current_dest].name) == 0)
+        update_jobs_count (self);
     }
+  /* The attributes of a new printer have to be asked for anyway, and a
+   * notification without a printer can't be applied to the list */
+  else if (g_strcmp0 (signal_name, "PrinterAdded") == 0 || printer_name == NULL)
+    actualize_printers_list (self);
+  else if (g_strcmp0 (signal_name, "PrinterDeleted") == 0)
+    printer_deleted (self, printer_name);
+  else
+    printer_state_changed (self,
+                           printer_name,
+                           printer_state,
+                           printer_state_reasons,
+                           printer_is_accepting_jobs);
 }
 
 static gboolean
@@ -413,6 +598,14 @@ renew_subscription (gpointer data)
     return FALSE;
 }
 
+static gboolean
+resync_printers_list (gpointer data)
+{
+  actualize_printers_list ((CcPrintersPanel*) data);
+
+  return TRUE;
+}
+
 static void
 attach_to_cups_notifier (gpointer data)
 {
@@ -456,6 +649,9 @@ attach_to_cups_notifier (gpointer data)
                                             on_cups_notification,
                                             self,
                                             NULL);
+
+      priv->resync_id =
+        g_timeout_add_seconds (RESYNC_INTERVAL, resync_printers_list, self);
     }
 }
 
@@ -481,6 +677,11 @@ detach_from_cups_notifier (gpointer data)
     priv->subscription_renewal_id = 0;
   }
 
+  if (priv->resync_id != 0) {
+    g_source_remove (priv->resync_id);
+    priv->resync_id = 0;
+  }
+
   if (priv->cups_proxy != NULL) {
     g_object_unref (priv->cups_proxy);
     priv->cups_proxy = NULL;
@@ -495,20 +696,20 @@ free_dests (CcPrintersPanel *self)
 
   priv = PRINTERS_PANEL_PRIVATE (self);
 
-  if (priv->num_dests > 0)
+  for (i = 0; i < priv->num_dests; i++)
     {
-      for (i = 0; i < priv->num_dests; i++)
-        {
-          g_free (priv->dest_model_names[i]);
-          if (priv->ppd_file_names[i]) {
-            g_unlink (priv->ppd_file_names[i]);
-            g_free (priv->ppd_file_names[i]);
-          }
-        }
-      g_free (priv->dest_model_names);
-      g_free (priv->ppd_file_names);
-      cupsFreeDests (priv->num_dests, priv->dests);
+      g_free (priv->dest_model_names[i]);
+      if (priv->ppd_file_names[i]) {
+        g_unlink (priv->ppd_file_names[i]);
+        g_free (priv->ppd_file_names[i]);
+      }
     }
+  g_free (priv->dest_model_names);
+  g_free (priv->ppd_file_names);
+
+  /* removing the last printer leaves an empty array */
+  if (priv->dests)
+    cupsFreeDests (priv->num_dests, priv->dests);
   priv->dests = NULL;
   priv->num_dests = 0;
   priv->current_dest = -1;
@@ -534,6 +735,101 @@ enum
   PRINTER_N_COLUMNS
 };
 
+static void printer_selection_changed_cb (GtkTreeSelection *selection,
+                                          gpointer          user_data);
+
+typedef struct
+{
+  CcPrintersPanel *self;
+  gchar           *printer_name;
+} PPDFetchData;
+
+static gint
+find_dest (CcPrintersPanel *self,
+           const gchar     *printer_name)
+{
+  CcPrintersPanelPrivate *priv;
+  gint                    i;
+
+  priv = PRINTERS_PANEL_PRIVATE (self);
+
+  for (i = 0; i < priv->num_dests; i++)
+    if (g_strcmp0 (priv->dests[i].name, printer_name) == 0)
+      return i;
+
+  return -1;
+}
+
+static void
+fetch_ppd_cb (const gchar *ppd_filename,
+              gpointer     user_data)
+{
+  CcPrintersPanelPrivate *priv;
+  CcPrintersPanel        *self;
+  PPDFetchData           *data = (PPDFetchData *) user_data;
+  GtkTreeView            *treeview;
+  gint                    i = -1;
+
+  self = data->self;
+  priv = PRINTERS_PANEL_PRIVATE (self);
+
+  if (g_strcmp0 (priv->ppd_fetch_printer, data->printer_name) == 0)
+    g_clear_pointer (&priv->ppd_fetch_printer, g_free);
+
+  /* the panel may have been disposed while the PPD was downloaded */
+  if (priv->builder)
+    i = find_dest (self, data->printer_name);
+
+  if (i >= 0 && ppd_filename && priv->ppd_file_names[i] == NULL)
+    {
+      priv->ppd_file_names[i] = g_strdup (ppd_filename);
+
+      g_free (priv->dest_model_names[i]);
+      priv->dest_model_names[i] = get_ppd_attribute (ppd_filename, "ModelName");
+
+      if (i == priv->current_dest)
+        {
+          treeview = (GtkTreeView*)
+            gtk_builder_get_object (priv->builder, "printers-treeview");
+          printer_selection_changed_cb (gtk_tree_view_get_selection (treeview), self);
+        }
+    }
+  else if (ppd_filename)
+    {
+      g_unlink (ppd_filename);
+    }
+
+  g_object_unref (data->self);
+  g_free (data->printer_name);
+  g_free (data);
+}
+
+/*
+ * Downloads the PPD of @printer_name in a thread; the details of the
+ * printer are shown again once it is there.
+ */
+static void
+fetch_ppd (CcPrintersPanel *self,
+           const gchar     *printer_name)
+{
+  CcPrintersPanelPrivate *priv;
+  PPDFetchData           *data;
+
+  priv = PRINTERS_PANEL_PRIVATE (self);
+
+  if (g_strcmp0 (priv->ppd_fetch_printer, printer_name) == 0)
+    return;
+
+  g_free (priv->ppd_fetch_printer);
+  priv->ppd_fetch_printer = g_strdup (printer_name);
+
+  data = g_new0 (PPDFetchData, 1);
+  data->self = g_object_ref (self);
+  data->printer_name = g_strdup (printer_name);
+
+  printer_get_ppd_async (printer_name, NULL, 0, fetch_ppd_cb, data);
+}
+
 static void
 printer_selection_changed_cb (GtkTreeSelection *selection,
                               gpointer          user_data)
@@ -667,14 +963,9 @@ printer_selection_changed_cb (GtkTreeSelection *selection,
             device_uri = priv->dests[priv->current_dest].options[i].value;
         }
 
+      /* the model name is filled in when the PPD has been downloaded */
       if (priv->ppd_file_names[priv->current_dest] == NULL)
-        priv->ppd_file_names[priv->current_dest] =
-          g_strdup (cupsGetPPD (priv->dests[priv->current_dest].name));
-
-      if (priv->dest_model_names[priv->current_dest] == NULL)
-        priv->dest_model_names[priv->current_dest] =
-          get_ppd_attribute (priv->ppd_file_names[priv->current_dest],
-                             "ModelName");
+        fetch_ppd (self, priv->dests[priv->current_dest].name);
 
       printer_model = g_strdup (priv->dest_model_names[priv->current_dest]);
 
@@ -1027,45 +1318,197 @@ printer_selection_changed_cb (GtkTreeSelection *selection,
   update_sensitivity (self);
 }
 
+typedef struct
+{
+  gint         id;
+  gchar       *name;
+  gboolean     paused;
+  const gchar *default_icon_name;
+  const gchar *icon_name;
+} PrinterRow;
+
 static void
-actualize_printers_list (CcPrintersPanel *self)
+update_printer_row (GtkListStore *store,
+                    GtkTreeIter  *iter,
+                    PrinterRow   *row)
+{
+  gboolean  paused;
+  gchar    *default_icon_name;
+  gchar    *icon_name;
+  gint      id;
+
+  gtk_tree_model_get (GTK_TREE_MODEL (store), iter,
+                      PRINTER_ID_COLUMN, &id,
+                      PRINTER_PAUSED_COLUMN, &paused,
+                      PRINTER_DEFAULT_ICON_COLUMN, &default_icon_name,
+                      PRINTER_ICON_COLUMN, &icon_name,
+                      -1);
+
+  /* Don't make the view redraw rows which didn't change */
+  if (id != row->id ||
+      paused != row->paused ||
+      g_strcmp0 (default_icon_name, row->default_icon_name) != 0 ||
+      g_strcmp0 (icon_name, row->icon_name) != 0)
+    gtk_list_store_set (store, iter,
+                        PRINTER_ID_COLUMN, row->id,
+                        PRINTER_NAME_COLUMN, row->name,
+                        PRINTER_PAUSED_COLUMN, row->paused,
+                        PRINTER_DEFAULT_ICON_COLUMN, row->default_icon_name,
+                        PRINTER_ICON_COLUMN, row->icon_name,
+                        -1);
+
+  g_free (default_icon_name);
+  g_free (icon_name);
+}
+
+/*
+ * Makes the content of the store match @rows. Rows are matched by name,
+ * so the ones which stay keep their iters and the selection and scroll
+ * position of the view are not disturbed.
+ */
+static void
+sync_printers_store (GtkListStore *store,
+                     PrinterRow   *rows,
+                     gint          num_of_rows)
+{
+  GtkTreeModel *model = GTK_TREE_MODEL (store);
+  GtkTreeIter   iter;
+  GtkTreeIter   new_iter;
+  GHashTable   *wanted;
+  GHashTable   *placed;
+  gboolean      valid;
+  gint          i;
+
+  wanted = g_hash_table_new (g_str_hash, g_str_equal);
+  placed = g_hash_table_new (g_str_hash, g_str_equal);
+
+  for (i = 0; i < num_of_rows; i++)
+    g_hash_table_add (wanted, rows[i].name);
+
+  valid = gtk_tree_model_get_iter_first (model, &iter);
+  for (i = 0; i < num_of_rows; i++)
+    {
+      gchar *name = NULL;
+
+      /* Remove printers which are gone or which were already placed */
+      while (valid)
+        {
+          gtk_tree_model_get (model, &iter, PRINTER_NAME_COLUMN, &name, -1);
+
+          if (g_hash_table_contains (wanted, name) &&
+              !g_hash_table_contains (placed, name))
+            break;
+
+          g_clear_pointer (&name, g_free);
+          valid = gtk_list_store_remove (store, &iter);
+        }
+
+      if (valid && g_strcmp0 (name, rows[i].name) == 0)
+        {
+          update_printer_row (store, &iter, &rows[i]);
+          valid = gtk_tree_model_iter_next (model, &iter);
+        }
+      else
+        {
+          gtk_list_store_insert_before (store, &new_iter, valid ? &iter : NULL);
+          gtk_list_store_set (store, &new_iter,
+                              PRINTER_ID_COLUMN, rows[i].id,
+                              PRINTER_NAME_COLUMN, rows[i].name,
+                              PRINTER_PAUSED_COLUMN, rows[i].paused,
+                              PRINTER_DEFAULT_ICON_COLUMN, rows[i].default_icon_name,
+                              PRINTER_ICON_COLUMN, rows[i].icon_name,
+                              -1);
+        }
+
+      g_hash_table_add (placed, rows[i].name);
+      g_free (name);
+    }
+
+  while (valid)
+    valid = gtk_list_store_remove (store, &iter);
+
+  g_hash_table_destroy (wanted);
+  g_hash_table_destroy (placed);
+}
+
+static gboolean
+find_printer_row (GtkTreeModel *model,
+                  const gchar  *name,
+                  gint          id,
+                  GtkTreeIter  *iter)
+{
+  gboolean valid;
+  gchar   *row_name;
+  gint     row_id;
+
+  valid = gtk_tree_model_get_iter_first (model, iter);
+  while (valid)
+    {
+      gtk_tree_model_get (model, iter,
+                          PRINTER_ID_COLUMN, &row_id,
+                          PRINTER_NAME_COLUMN, &row_name,
+                          -1);
+
+      if (name ? g_strcmp0 (row_name, name) == 0 : row_id == id)
+        {
+          g_free (row_name);
+          return TRUE;
+        }
+
+      g_free (row_name);
+      valid = gtk_tree_model_iter_next (model, iter);
+    }
+
+  return FALSE;
+}
+
+/*
+ * Shows priv->dests in the list, keeping the selected printer selected if
+ * it is still there. The last used printer, the default one or the first
+ * one is selected otherwise.
+ */
+static void
+update_printers_list (CcPrintersPanel *self,
+                      gboolean         cups_running,
+                      const gchar     *last_used_dest)
 {
   CcPrintersPanelPrivate *priv;
   GtkTreeSelection       *selection;
-  GtkListStore           *store;
   cups_ptype_t            printer_type = 0;
   GtkTreeModel           *model;
   GtkTreeIter             selected_iter;
   GtkTreeView            *treeview;
   GtkTreeIter             iter;
-  cups_job_t             *jobs = NULL;
+  PrinterRow             *rows;
   GtkWidget              *widget;
   gboolean                paused = FALSE;
   gboolean                selected_iter_set = FALSE;
-  gboolean                valid = FALSE;
-  http_t                 *http;
   gchar                  *current_printer_name = NULL;
-  gchar                  *printer_icon_name = NULL;
-  gchar                  *default_icon_name = NULL;
   gchar                  *device_uri = NULL;
   gint                    new_printer_position = 0;
-  int                     current_dest = -1;
+  gint                    num_of_rows = 0;
   int                     i, j;
-  int                     num_jobs = 0;
 
   priv = PRINTERS_PANEL_PRIVATE (self);
 
   treeview = (GtkTreeView*)
     gtk_builder_get_object (priv->builder, "printers-treeview");
+  selection = gtk_tree_view_get_selection (treeview);
 
-  if ((selection = gtk_tree_view_get_selection (treeview)) != NULL &&
-      gtk_tree_selection_get_selected (selection, &model, &iter))
+  if (gtk_tree_selection_get_selected (selection, &model, &iter))
     {
       gtk_tree_model_get (model, &iter,
 			  PRINTER_NAME_COLUMN, &current_printer_name,
 			  -1);
     }
 
+  if (priv->printer_to_select)
+    {
+      g_free (current_printer_name);
+      current_printer_name = priv->printer_to_select;
+      priv->printer_to_select = NULL;
+    }
+
   if (priv->new_printer_name &&
       priv->select_new_printer)
     {
@@ -1074,41 +1517,24 @@ actualize_printers_list (CcPrintersPanel *self)
       priv->select_new_printer = FALSE;
     }
 
-  free_dests (self);
-  priv->num_dests = cupsGetDests (&priv->dests);
-  priv->dest_model_names = g_new0 (gchar *, priv->num_dests);
-  priv->ppd_file_names = g_new0 (gchar *, priv->num_dests);
-
-  store = gtk_list_store_new (PRINTER_N_COLUMNS,
-                              G_TYPE_INT,
-                              G_TYPE_STRING,
-                              G_TYPE_BOOLEAN,
-                              G_TYPE_STRING,
-                              G_TYPE_STRING);
+  rows = g_new0 (PrinterRow, priv->num_dests + 1);
 
   if (priv->num_dests == 0 && !priv->new_printer_name)
     {
       widget = (GtkWidget*)
         gtk_builder_get_object (priv->builder, "notebook");
 
-      http = httpConnectEncrypt (cupsServer (), ippPort (), cupsEncryption ());
-      if (http)
-        {
-          httpClose (http);
-          gtk_notebook_set_current_page (GTK_NOTEBOOK (widget), NOTEBOOK_NO_PRINTERS_PAGE);
-        }
+      if (cups_running)
+        gtk_notebook_set_current_page (GTK_NOTEBOOK (widget), NOTEBOOK_NO_PRINTERS_PAGE);
       else
         gtk_notebook_set_current_page (GTK_NOTEBOOK (widget), NOTEBOOK_NO_CUPS_PAGE);
 
-      gtk_list_store_append (store, &iter);
-      gtk_list_store_set (store, &iter,
-                          PRINTER_ID_COLUMN, 0,
+      rows[0].id = 0;
       /* Translators: There are no printers available (none is configured or CUPS is not running) */
-                          PRINTER_NAME_COLUMN, _("No printers available"),
-                          PRINTER_PAUSED_COLUMN, TRUE,
-                          PRINTER_DEFAULT_ICON_COLUMN, NULL,
-                          PRINTER_ICON_COLUMN, NULL,
-                          -1);
+      rows[0].name = g_strdup (_("No printers available"));
+      rows[0].paused = TRUE;
+      num_of_rows = 1;
+
       gtk_widget_set_sensitive (GTK_WIDGET (treeview), FALSE);
     }
   else
@@ -1116,7 +1542,11 @@ actualize_printers_list (CcPrintersPanel *self)
 
   for (i = 0; i < priv->num_dests; i++)
     {
-      gchar *instance;
+      PrinterRow *row = &rows[num_of_rows++];
+
+      paused = FALSE;
+      device_uri = NULL;
+      printer_type = 0;
 
       if (priv->new_printer_name && new_printer_position >= 0)
         {
@@ -1128,15 +1558,13 @@ actualize_printers_list (CcPrintersPanel *self)
             new_printer_position = -1;
         }
 
-      gtk_list_store_append (store, &iter);
-
       if (priv->dests[i].instance)
         {
-          instance = g_strdup_printf ("%s / %s", priv->dests[i].name, priv->dests[i].instance);
+          row->name = g_strdup_printf ("%s / %s", priv->dests[i].name, priv->dests[i].instance);
         }
       else
         {
-          instance = g_strdup (priv->dests[i].name);
+          row->name = g_strdup (priv->dests[i].name);
         }
 
       for (j = 0; j < priv->dests[i].num_options; j++)
@@ -1149,139 +1577,318 @@ actualize_printers_list (CcPrintersPanel *self)
             printer_type = atoi (priv->dests[i].options[j].value);
         }
 
+      row->id = i;
+      row->paused = paused;
+
       if (priv->dests[i].is_default)
-        default_icon_name = g_strdup ("emblem-default-symbolic");
-      else
-        default_icon_name = NULL;
+        row->default_icon_name = "emblem-default-symbolic";
 
       if (printer_is_local (printer_type, device_uri))
-        printer_icon_name = g_strdup ("printer");
+        row->icon_name = "printer";
       else
-        printer_icon_name = g_strdup ("printer-network");
-
-      gtk_list_store_set (store, &iter,
-                          PRINTER_ID_COLUMN, i,
-                          PRINTER_NAME_COLUMN, instance,
-                          PRINTER_PAUSED_COLUMN, paused,
-                          PRINTER_DEFAULT_ICON_COLUMN, default_icon_name,
-                          PRINTER_ICON_COLUMN, printer_icon_name,
-                          -1);
-
-      if (g_strcmp0 (current_printer_name, instance) == 0)
-        {
-          current_dest = i;
-          selected_iter = iter;
-          selected_iter_set = TRUE;
-        }
-
-      g_free (instance);
-      g_free (printer_icon_name);
-      g_free (default_icon_name);
+        row->icon_name = "printer-network";
     }
 
   if (priv->new_printer_name && new_printer_position >= 0)
     {
-      gtk_list_store_insert (store, &iter, new_printer_position);
-      gtk_list_store_set (store, &iter,
-                          PRINTER_ID_COLUMN, -1,
-                          PRINTER_NAME_COLUMN, priv->new_printer_name,
-                          PRINTER_PAUSED_COLUMN, TRUE,
-                          PRINTER_DEFAULT_ICON_COLUMN, NULL,
-                          PRINTER_ICON_COLUMN, priv->new_printer_on_network ?
-                            "printer-network" : "printer",
-                          -1);
-
-      if (g_strcmp0 (current_printer_name, priv->new_printer_name) == 0)
-        {
-          selected_iter = iter;
-          selected_iter_set = TRUE;
-        }
+      memmove (&rows[new_printer_position + 1], &rows[new_printer_position],
+               (num_of_rows - new_printer_position) * sizeof (PrinterRow));
+      rows[new_printer_position].id = -1;
+      rows[new_printer_position].name = g_strdup (priv->new_printer_name);
+      rows[new_printer_position].paused = TRUE;
+      rows[new_printer_position].default_icon_name = NULL;
+      rows[new_printer_position].icon_name = priv->new_printer_on_network ?
+        "printer-network" : "printer";
+      num_of_rows++;
     }
 
-  g_signal_handlers_block_by_func (
-    G_OBJECT (gtk_tree_view_get_selection (GTK_TREE_VIEW (treeview))),
-    printer_selection_changed_cb,
-    self);
-
-  gtk_tree_view_set_model (treeview, GTK_TREE_MODEL (store));
+  g_signal_handlers_block_by_func (G_OBJECT (selection),
+                                   printer_selection_changed_cb,
+                                   self);
 
-  g_signal_handlers_unblock_by_func (
-    G_OBJECT (gtk_tree_view_get_selection (GTK_TREE_VIEW (treeview))),
-    printer_selection_changed_cb,
-    self);
+  model = gtk_tree_view_get_model (treeview);
+  sync_printers_store (GTK_LIST_STORE (model), rows, num_of_rows);
 
-  if (selected_iter_set)
+  if (current_printer_name &&
+      find_printer_row (model, current_printer_name, 0, &selected_iter))
     {
-      priv->current_dest = current_dest;
-      gtk_tree_selection_select_iter (
-        gtk_tree_view_get_selection (GTK_TREE_VIEW (treeview)),
-        &selected_iter);
+      selected_iter_set = TRUE;
     }
   else
     {
-      num_jobs = cupsGetJobs (&jobs, NULL, 1, CUPS_WHICHJOBS_ALL);
+      gint id = -1;
 
       /* Select last used printer */
-      if (num_jobs > 0)
+      if (last_used_dest)
         {
           for (i = 0; i < priv->num_dests; i++)
-            if (g_strcmp0 (priv->dests[i].name, jobs[num_jobs - 1].dest) == 0)
+            if (g_strcmp0 (priv->dests[i].name, last_used_dest) == 0)
               {
-                priv->current_dest = i;
+                id = i;
                 break;
               }
-          cupsFreeJobs (num_jobs, jobs);
         }
 
       /* Select default printer */
-      if (priv->current_dest < 0)
+      if (id < 0)
         {
           for (i = 0; i < priv->num_dests; i++)
             if (priv->dests[i].is_default)
               {
-                priv->current_dest = i;
+                id = i;
                 break;
               }
         }
 
-      if (priv->current_dest >= 0)
-        {
-          gint id;
-          valid = gtk_tree_model_get_iter_first ((GtkTreeModel *) store,
-                                                 &selected_iter);
+      if (id >= 0)
+        selected_iter_set = find_printer_row (model, NULL, id, &selected_iter);
+      else if (priv->num_dests > 0)
+        /* Select first printer */
+        selected_iter_set = gtk_tree_model_get_iter_first (model, &selected_iter);
+    }
 
-          while (valid)
-            {
-              gtk_tree_model_get ((GtkTreeModel *) store, &selected_iter,
-                                  PRINTER_ID_COLUMN, &id,
-                                  -1);
-              if (id == priv->current_dest)
-                break;
+  if (selected_iter_set)
+    gtk_tree_selection_select_iter (selection, &selected_iter);
+  else
+    gtk_tree_selection_unselect_all (selection);
 
-              valid = gtk_tree_model_iter_next ((GtkTreeModel *) store,
-                                                &selected_iter);
-            }
+  g_signal_handlers_unblock_by_func (G_OBJECT (selection),
+                                     printer_selection_changed_cb,
+                                     self);
 
-          gtk_tree_selection_select_iter (
-            gtk_tree_view_get_selection (GTK_TREE_VIEW (treeview)),
-            &selected_iter);
-        }
-      else if (priv->num_dests > 0)
+  /* The destinations were replaced, so show the details even
+   * if the same row stayed selected */
+  printer_selection_changed_cb (selection, self);
+
+  for (i = 0; i < num_of_rows; i++)
+    g_free (rows[i].name);
+  g_free (rows);
+  g_free (current_printer_name);
+}
+
+static void
+actualize_printers_list_cb (PpPrintersSnapshot *snapshot,
+                            gpointer            user_data)
+{
+  CcPrintersPanelPrivate *priv;
+  CcPrintersPanel        *self = (CcPrintersPanel*) user_data;
+  gchar                 **dest_model_names;
+  gchar                 **ppd_file_names;
+  gint                    num_dests = 0;
+  gint                    i, j;
+
+  priv = PRINTERS_PANEL_PRIVATE (self);
+
+  g_clear_object (&priv->get_printers_cancellable);
+
+  if (snapshot)
+    num_dests = snapshot->num_of_dests;
+
+  /* keep the PPDs of the printers which are still there, so that they
+   * don't need downloading again */
+  dest_model_names = g_new0 (gchar *, num_dests);
+  ppd_file_names = g_new0 (gchar *, num_dests);
+  for (i = 0; i < num_dests; i++)
+    {
+      j = find_dest (self, snapshot->dests[i].name);
+      if (j >= 0 &&
+          g_strcmp0 (priv->dests[j].instance, snapshot->dests[i].instance) == 0)
         {
-          /* Select first printer */
-          gtk_tree_model_get_iter_first ((GtkTreeModel *) store,
-                                         &selected_iter);
+          dest_model_names[i] = priv->dest_model_names[j];
+          ppd_file_names[i] = priv->ppd_file_names[j];
+          priv->dest_model_names[j] = NULL;
+          priv->ppd_file_names[j] = NULL;
+        }
+    }
+
+  free_dests (self);
+
+  if (snapshot)
+    {
+      priv->dests = snapshot->dests;
+      priv->num_dests = snapshot->num_of_dests;
+      snapshot->dests = NULL;
+    }
+
+  priv->dest_model_names = dest_model_names;
+  priv->ppd_file_names = ppd_file_names;
+
+  set_jobs_counter (self,
+                    snapshot ? snapshot->jobs : NULL,
+                    priv->snapshot_serial);
+  if (snapshot)
+    snapshot->jobs = NULL;
+
+  update_printers_list (self,
+                        snapshot && snapshot->cups_running,
+                        snapshot ? snapshot->last_used_dest : NULL);
+
+  pp_printers_snapshot_free (snapshot);
+
+  if (priv->printers_refresh_pending)
+    {
+      priv->printers_refresh_pending = FALSE;
+      actualize_printers_list (self);
+    }
+}
+
+/*
+ * Refreshes the list of printers in a thread. While a refresh is running,
+ * further requests are merged into a single one started after it.
+ */
+static void
+actualize_printers_list (CcPrintersPanel *self)
+{
+  CcPrintersPanelPrivate *priv;
+  GtkTreeSelection       *selection;
+  GtkTreeView            *treeview;
+
+  priv = PRINTERS_PANEL_PRIVATE (self);
+
+  if (priv->get_printers_cancellable)
+    {
+      priv->printers_refresh_pending = TRUE;
+      return;
+    }
+
+  treeview = (GtkTreeView*)
+    gtk_builder_get_object (priv->builder, "printers-treeview");
+  selection = gtk_tree_view_get_selection (treeview);
+
+  priv->get_printers_cancellable = g_cancellable_new ();
+  priv->snapshot_serial = priv->job_changes_serial;
+  get_printers_snapshot_async (gtk_tree_selection_count_selected_rows (selection) == 0,
+                               priv->get_printers_cancellable,
+                               actualize_printers_list_cb,
+                               self);
+}
+
+static void
+set_dest_option (cups_dest_t *dest,
+                 const gchar *name,
+                 const gchar *value)
+{
+  dest->num_options = cupsAddOption (name, value,
+                                     dest->num_options,
+                                     &dest->options);
+}
+
+/*
+ * Applies a printer-state-changed notification to the destinations
+ * we have, so a busy queue doesn't make us ask CUPS for everything again.
+ */
+static void
+printer_state_changed (CcPrintersPanel *self,
+                       const gchar     *printer_name,
+                       gint             printer_state,
+                       const gchar     *printer_state_reasons,
+                       gboolean         printer_is_accepting_jobs)
+{
+  CcPrintersPanelPrivate *priv;
+  GtkTreeModel           *model;
+  GtkTreeView            *treeview;
+  GtkTreeIter             iter;
+  gboolean                paused = printer_state == IPP_PRINTER_STOPPED;
+  gboolean                row_paused;
+  gboolean                found = FALSE;
+  gboolean                current = FALSE;
+  gchar                  *state;
+  int                     i;
+
+  priv = PRINTERS_PANEL_PRIVATE (self);
 
-          gtk_tree_selection_select_iter (
-            gtk_tree_view_get_selection (GTK_TREE_VIEW (treeview)),
-            &selected_iter);
+  treeview = (GtkTreeView*)
+    gtk_builder_get_object (priv->builder, "printers-treeview");
+  model = gtk_tree_view_get_model (treeview);
+
+  state = g_strdup_printf ("%d", printer_state);
+
+  /* Instances of the printer share its state */
+  for (i = 0; i < priv->num_dests; i++)
+    {
+      if (g_strcmp0 (priv->dests[i].name, printer_name) != 0)
+        continue;
+
+      found = TRUE;
+      set_dest_option (&priv->dests[i], "printer-state", state);
+      set_dest_option (&priv->dests[i], "printer-state-reasons",
+                       printer_state_reasons ? printer_state_reasons : "");
+      set_dest_option (&priv->dests[i], "printer-is-accepting-jobs",
+                       printer_is_accepting_jobs ? "true" : "false");
+
+      if (find_printer_row (model, NULL, i, &iter))
+        {
+          gtk_tree_model_get (model, &iter, PRINTER_PAUSED_COLUMN, &row_paused, -1);
+          if (row_paused != paused)
+            gtk_list_store_set (GTK_LIST_STORE (model), &iter,
+                                PRINTER_PAUSED_COLUMN, paused,
+                                -1);
         }
+
+      if (i == priv->current_dest)
+        current = TRUE;
     }
 
-  g_free (current_printer_name);
-  g_object_unref (store);
+  g_free (state);
 
-  update_sensitivity (self);
+  if (!found)
+    actualize_printers_list (self);
+  else if (current)
+    printer_selection_changed_cb (gtk_tree_view_get_selection (treeview), self);
+}
+
+static void
+remove_dest (CcPrintersPanel *self,
+             gint             index)
+{
+  CcPrintersPanelPrivate *priv;
+  gchar                  *name;
+  gchar                  *instance;
+  gint                    tail;
+
+  priv = PRINTERS_PANEL_PRIVATE (self);
+
+  g_free (priv->dest_model_names[index]);
+  if (priv->ppd_file_names[index])
+    {
+      g_unlink (priv->ppd_file_names[index]);
+      g_free (priv->ppd_file_names[index]);
+    }
+
+  tail = priv->num_dests - index - 1;
+  memmove (&priv->dest_model_names[index], &priv->dest_model_names[index + 1],
+           tail * sizeof (gchar *));
+  memmove (&priv->ppd_file_names[index], &priv->ppd_file_names[index + 1],
+           tail * sizeof (gchar *));
+
+  name = g_strdup (priv->dests[index].name);
+  instance = g_strdup (priv->dests[index].instance);
+  priv->num_dests = cupsRemoveDest (name, instance, priv->num_dests, &priv->dests);
+  g_free (instance);
+  g_free (name);
+}
+
+static void
+printer_deleted (CcPrintersPanel *self,
+                 const gchar     *printer_name)
+{
+  CcPrintersPanelPrivate *priv;
+  gboolean                found = FALSE;
+  gint                    i;
+
+  priv = PRINTERS_PANEL_PRIVATE (self);
+
+  for (i = priv->num_dests - 1; i >= 0; i--)
+    {
+      if (g_strcmp0 (priv->dests[i].name, printer_name) == 0)
+        {
+          remove_dest (self, i);
+          found = TRUE;
+        }
+    }
+
+  if (found)
+    update_printers_list (self, TRUE, NULL);
 }
 
 static void
@@ -1334,6 +1941,7 @@ populate_printers_list (CcPrintersPanel *self)
   GtkCellRenderer        *icon_renderer;
   GtkCellRenderer        *icon_renderer2;
   GtkCellRenderer        *renderer;
+  GtkListStore           *store;
   GtkWidget              *treeview;
 
   priv = PRINTERS_PANEL_PRIVATE (self);
@@ -1341,6 +1949,15 @@ populate_printers_list (CcPrintersPanel *self)
   treeview = (GtkWidget*)
     gtk_builder_get_object (priv->builder, "printers-treeview");
 
+  store = gtk_list_store_new (PRINTER_N_COLUMNS,
+                              G_TYPE_INT,
+                              G_TYPE_STRING,
+                              G_TYPE_BOOLEAN,
+                              G_TYPE_STRING,
+                              G_TYPE_STRING);
+  gtk_tree_view_set_model (GTK_TREE_VIEW (treeview), GTK_TREE_MODEL (store));
+  g_object_unref (store);
+
   g_signal_connect (gtk_tree_view_get_selection (GTK_TREE_VIEW (treeview)),
                     "changed", G_CALLBACK (printer_selection_changed_cb), self);
 
@@ -1389,10 +2006,9 @@ static void
 update_jobs_count (CcPrintersPanel *self)
 {
   CcPrintersPanelPrivate *priv;
-  cups_job_t             *jobs;
   GtkWidget              *widget;
   gchar                  *active_jobs = NULL;
-  gint                    num_jobs;
+  guint                   num_jobs;
 
   priv = PRINTERS_PANEL_PRIVATE (self);
 
@@ -1402,11 +2018,9 @@ update_jobs_count (CcPrintersPanel *self)
       priv->current_dest < priv->num_dests &&
       priv->dests != NULL)
     {
-      priv->num_jobs = cupsGetJobs (&jobs, priv->dests[priv->current_dest].name, 1, CUPS_WHICHJOBS_ACTIVE);
-      if (priv->num_jobs > 0)
-        cupsFreeJobs (priv->num_jobs, jobs);
-
-      num_jobs = priv->num_jobs < 0 ? 0 : (guint) priv->num_jobs;
+      num_jobs = pp_jobs_counter_get_active (priv->jobs_counter,
+                                             priv->dests[priv->current_dest].name);
+      priv->num_jobs = num_jobs;
       /* Translators: there is n active print jobs on this printer */
       active_jobs = g_strdup_printf (ngettext ("%u active", "%u active", num_jobs), num_jobs);
     }
@@ -1671,13 +2285,10 @@ printer_set_default_cb (GtkToggleButton *button,
 
   if (name)
     {
+      /* The refreshed list puts the button back in sync with CUPS */
       printer_set_default (name);
       actualize_printers_list (self);
-
-      g_signal_handlers_block_by_func (G_OBJECT (button), printer_set_default_cb, self);
-      gtk_toggle_button_set_active (button, priv->dests[priv->current_dest].is_default);
-      g_signal_handlers_unblock_by_func (G_OBJECT (button), printer_set_default_cb, self);
-  }
+    }
 }
 
 static void
@@ -1752,6 +2363,10 @@ printer_add_cb (GtkToolButton *toolbutton,
   toplevel = gtk_widget_get_toplevel (GTK_WIDGET (self));
   priv->pp_new_printer_dialog = PP_NEW_PRINTER_DIALOG (pp_new_printer_dialog_new (GTK_WINDOW (toplevel)));
 
+  if (priv->ppd_index)
+    pp_new_printer_dialog_set_ppd_index (priv->pp_new_printer_dialog,
+                                         priv->ppd_index);
+
   g_signal_connect (priv->pp_new_printer_dialog,
                     "pre-response",
                     G_CALLBACK (new_printer_dialog_pre_response_cb),
@@ -1790,7 +2405,6 @@ printer_name_edit_cb (GtkWidget *entry,
   CcPrintersPanel         *self = (CcPrintersPanel*) user_data;
   const gchar             *new_name;
   gchar                   *old_name = NULL;
-  gint                     i;
 
   priv = PRINTERS_PANEL_PRIVATE (self);
 
@@ -1803,17 +2417,8 @@ printer_name_edit_cb (GtkWidget *entry,
 
   if (printer_rename (old_name, new_name))
     {
-      free_dests (self);
-      priv->num_dests = cupsGetDests (&priv->dests);
-      priv->dest_model_names = g_new0 (gchar *, priv->num_dests);
-      priv->ppd_file_names = g_new0 (gchar *, priv->num_dests);
-
-      for (i = 0; i < priv->num_dests; i++)
-        if (g_strcmp0 (priv->dests[i].name, new_name) == 0)
-          {
-            priv->current_dest  = i;
-            break;
-          }
+      g_free (priv->printer_to_select);
+      priv->printer_to_select = g_strdup (new_name);
     }
 
   actualize_printers_list (self);
@@ -2044,6 +2649,10 @@ select_ppd_in_dialog (GtkMenuItem *menuitem,
         ppd_selection_dialog_response_cb,
         self);
 
+      if (priv->pp_ppd_selection_dialog && priv->ppd_index)
+        pp_ppd_selection_dialog_set_ppd_index (priv->pp_ppd_selection_dialog,
+                                               priv->ppd_index);
+
       g_free (manufacturer);
       g_free (device_id);
     }
@@ -2086,25 +2695,6 @@ set_ppd_from_list (GtkMenuItem *menuitem,
     }
 }
 
-static void
-ppd_names_free (gpointer user_data)
-{
-  PPDName **names = (PPDName **) user_data;
-  gint      i;
-
-  if (names)
-    {
-      for (i = 0; names[i]; i++)
-        {
-          g_free (names[i]->ppd_name);
-          g_free (names[i]->ppd_display_name);
-          g_free (names[i]);
-        }
-
-      g_free (names);
-    }
-}
-
 static void
 get_ppd_names_cb (PPDName     **names,
                   const gchar  *printer_name,
@@ -2154,7 +2744,7 @@ get_ppd_names_cb (PPDName     **names,
   if (!priv->preferred_drivers)
     {
       priv->preferred_drivers = g_hash_table_new_full (g_str_hash, g_str_equal,
-                                                       g_free, ppd_names_free);
+                                                       g_free, (GDestroyNotify) ppd_names_free);
     }
 
   if (!cancelled &&
@@ -2332,6 +2922,7 @@ popup_model_menu_cb (GtkButton *button,
           priv->getting_ppd_names = TRUE;
           get_ppd_names_async (priv->dests[priv->current_dest].name,
                                3,
+                               priv->ppd_index,
                                priv->get_ppd_name_cancellable,
                                get_ppd_names_cb,
                                user_data);
@@ -2733,22 +3324,40 @@ cups_status_check (gpointer user_data)
 }
 
 static void
-get_all_ppds_async_cb (PPDList  *ppds,
-                       gpointer  user_data)
+get_all_ppds_async_cb (PPDList    *ppds,
+                       PpPPDIndex *index,
+                       gpointer    user_data)
 {
   CcPrintersPanelPrivate *priv;
   CcPrintersPanel        *self = (CcPrintersPanel*) user_data;
+  PPDList                *old_ppds;
+  PpPPDIndex             *old_index;
 
   priv = self->priv = PRINTERS_PANEL_PRIVATE (self);
 
+  /* the cached list comes first, and is replaced if the drivers changed */
+  old_ppds = priv->all_ppds_list;
+  old_index = priv->ppd_index;
+
   priv->all_ppds_list = ppds;
+  priv->ppd_index = index ? pp_ppd_index_ref (index) : NULL;
 
   if (priv->pp_ppd_selection_dialog)
-    pp_ppd_selection_dialog_set_ppd_list (priv->pp_ppd_selection_dialog,
-                                          priv->all_ppds_list);
+    {
+      pp_ppd_selection_dialog_set_ppd_list (priv->pp_ppd_selection_dialog,
+                                            priv->all_ppds_list);
+      pp_ppd_selection_dialog_set_ppd_index (priv->pp_ppd_selection_dialog,
+                                             priv->ppd_index);
+    }
 
-  g_object_unref (priv->get_all_ppds_cancellable);
-  priv->get_all_ppds_cancellable = NULL;
+  if (priv->pp_new_printer_dialog)
+    pp_new_printer_dialog_set_ppd_index (priv->pp_new_printer_dialog,
+                                         priv->ppd_index);
+
+  if (old_ppds)
+    ppd_list_free (old_ppds);
+  if (old_index)
+    pp_ppd_index_unref (old_index);
 }
 
 static void
@@ -2843,6 +3452,14 @@ cc_printers_panel_init (CcPrintersPanel *self)
   priv->current_dest = -1;
 
   priv->num_jobs = 0;
+  priv->jobs_counter = NULL;
+  priv->count_jobs_cancellable = NULL;
+  priv->job_changes = g_queue_new ();
+  priv->job_changes_serial = 0;
+  priv->snapshot_serial = 0;
+  priv->count_jobs_serial = 0;
+  priv->count_jobs_pending = FALSE;
+  priv->resync_id = 0;
 
   priv->pp_new_printer_dialog = NULL;
   priv->pp_options_dialog = NULL;
@@ -2854,6 +3471,11 @@ cc_printers_panel_init (CcPrintersPanel *self)
   priv->cups_bus_connection = NULL;
   priv->dbus_subscription_id = 0;
 
+  priv->get_printers_cancellable = NULL;
+  priv->printers_refresh_pending = FALSE;
+  priv->ppd_fetch_printer = NULL;
+  priv->printer_to_select = NULL;
+
   priv->new_printer_name = NULL;
   priv->new_printer_location = NULL;
   priv->new_printer_make_and_model = NULL;
@@ -2866,6 +3488,7 @@ cc_printers_panel_init (CcPrintersPanel *self)
   priv->getting_ppd_names = FALSE;
 
   priv->all_ppds_list = NULL;
+  priv->ppd_index = NULL;
   priv->get_all_ppds_cancellable = NULL;
 
   priv->preferred_drivers = NULL;
@@ -99,6 +99,8 @@ struct _PpNewPrinterDialogPrivate
 
   GCancellable *cancellable;
 
+  PpPPDIndex *ppd_index;
+
   gboolean  cups_searching;
   gboolean  remote_cups_searching;
   gboolean  snmp_searching;
@@ -179,6 +181,25 @@ pp_new_printer_dialog_new (GtkWindow *parent)
   return PP_NEW_PRINTER_DIALOG (dialog);
 }
 
+/*
+ * Index of installed drivers used to find a driver for
+ * the added printer without asking system-config-printer.
+ */
+void
+pp_new_printer_dialog_set_ppd_index (PpNewPrinterDialog *dialog,
+                                     PpPPDIndex         *index)
+{
+  PpNewPrinterDialogPrivate *priv = dialog->priv;
+
+  if (index)
+    pp_ppd_index_ref (index);
+
+  if (priv->ppd_index)
+    pp_ppd_index_unref (priv->ppd_index);
+
+  priv->ppd_index = index;
+}
+
 static void
 emit_pre_response (PpNewPrinterDialog *dialog,
                    const gchar        *device_name,
@@ -337,6 +358,12 @@ pp_new_printer_dialog_finalize (GObject *object)
   if (priv->builder)
     g_clear_object (&priv->builder);
 
+  if (priv->ppd_index)
+    {
+      pp_ppd_index_unref (priv->ppd_index);
+      priv->ppd_index = NULL;
+    }
+
   g_list_free_full (priv->devices, t_device_free);
   priv->devices = NULL;
 
@@ -1478,6 +1505,7 @@ new_printer_dialog_response_cb (GtkDialog *_dialog,
       if (device)
         {
           PpNewPrinter *new_printer;
+          PPDName     **ppd_names = NULL;
           guint         window_id = 0;
 
           emit_pre_response (dialog,
@@ -1490,13 +1518,25 @@ new_printer_dialog_response_cb (GtkDialog *_dialog,
           window_id = GDK_WINDOW_XID (gtk_widget_get_window (GTK_WIDGET (_dialog)));
 #endif
 
+          /* An exactly matching installed driver needs no further lookup */
+          if (!device->device_ppd && device->device_id && priv->ppd_index)
+            {
+              ppd_names = pp_ppd_index_match_device (priv->ppd_index,
+                                                     device->device_id,
+                                                     device->device_make_and_model,
+                                                     1);
+
+              if (ppd_names && ppd_names[0]->ppd_match_level < PPD_EXACT_MATCH)
+                g_clear_pointer (&ppd_names, ppd_names_free);
+            }
+
           new_printer = pp_new_printer_new ();
           g_object_set (new_printer,
                         "name", device->device_name,
                         "original-name""", device->device_original_name,
                         "device-uri", device->device_uri,
                         "device-id", device->device_id,
-                        "ppd-name", device->device_ppd,
+                        "ppd-name", ppd_names ? ppd_names[0]->ppd_name : device->device_ppd,
                         "ppd-file-name", device->device_ppd,
                         "info", device->device_info,
                         "location", device->device_location,
@@ -1507,6 +1547,8 @@ new_printer_dialog_response_cb (GtkDialog *_dialog,
                         "window-id", window_id,
                         NULL);
 
+          ppd_names_free (ppd_names);
+
           priv->cancellable = g_cancellable_new ();
 
           pp_new_printer_add_async (new_printer,
@@ -22,6 +22,7 @@
 #define __PP_NEW_PRINTER_DIALOG_H__
 
 #include <gtk/gtk.h>
+#include "pp-utils.h"
 
 G_BEGIN_DECLS
 
@@ -58,6 +59,8 @@ struct _PpNewPrinterDialogClass
 
 GType               pp_new_printer_dialog_get_type (void) G_GNUC_CONST;
 PpNewPrinterDialog *pp_new_printer_dialog_new      (GtkWindow *parent);
+void                pp_new_printer_dialog_set_ppd_index (PpNewPrinterDialog *dialog,
+                                                         PpPPDIndex         *index);
 
 G_END_DECLS
 
@@ -38,6 +38,8 @@
 
 static void pp_ppd_selection_dialog_hide (PpPPDSelectionDialog *dialog);
 
+#define SEARCH_RESULTS_LIMIT 100
+
 enum
 {
   PPD_NAMES_COLUMN = 0,
@@ -63,7 +65,8 @@ struct _PpPPDSelectionDialog {
   GtkResponseType  response;
   gchar           *manufacturer;
 
-  PPDList *list;
+  PPDList    *list;
+  PpPPDIndex *index;
 };
 
 static void
@@ -153,6 +156,61 @@ model_selection_changed_cb (GtkTreeSelection *selection,
     }
 }
 
+static void
+search_changed_cb (GtkEditable *editable,
+                   gpointer     user_data)
+{
+  PpPPDSelectionDialog  *dialog = (PpPPDSelectionDialog *) user_data;
+  GtkTreeSelection      *selection;
+  GtkListStore          *store;
+  GtkTreeView           *manufacturers_treeview;
+  GtkTreeView           *models_treeview;
+  GtkTreeIter            iter;
+  const gchar           *text;
+  PPDName              **names;
+  gint                   i;
+
+  if (!dialog->index)
+    return;
+
+  manufacturers_treeview = (GtkTreeView*)
+    gtk_builder_get_object (dialog->builder, "ppd-selection-manufacturers-treeview");
+  models_treeview = (GtkTreeView*)
+    gtk_builder_get_object (dialog->builder, "ppd-selection-models-treeview");
+
+  text = gtk_entry_get_text (GTK_ENTRY (editable));
+
+  if (text[0] == '\0')
+    {
+      /* Show drivers of selected manufacturer again */
+      selection = gtk_tree_view_get_selection (manufacturers_treeview);
+      if (gtk_tree_selection_count_selected_rows (selection) > 0)
+        manufacturer_selection_changed_cb (selection, dialog);
+      else
+        gtk_tree_view_set_model (models_treeview, NULL);
+
+      return;
+    }
+
+  names = pp_ppd_index_search (dialog->index, text, SEARCH_RESULTS_LIMIT);
+
+  store = gtk_list_store_new (2, G_TYPE_STRING, G_TYPE_STRING);
+
+  for (i = 0; names && names[i]; i++)
+    {
+      gtk_list_store_append (store, &iter);
+      gtk_list_store_set (store, &iter,
+                          PPD_NAMES_COLUMN, names[i]->ppd_name,
+                          PPD_DISPLAY_NAMES_COLUMN, names[i]->ppd_display_name,
+                          -1);
+    }
+
+  gtk_tree_view_set_model (models_treeview, GTK_TREE_MODEL (store));
+  g_object_unref (store);
+
+  ppd_names_free (names);
+}
+
 static void
 fill_ppds_list (PpPPDSelectionDialog *dialog)
 {
@@ -392,6 +450,10 @@ pp_ppd_selection_dialog_new (GtkWindow            *parent,
   g_signal_connect (dialog->dialog, "delete-event", G_CALLBACK (gtk_widget_hide_on_delete), NULL);
   g_signal_connect (dialog->dialog, "response", G_CALLBACK (ppd_selection_dialog_response_cb), dialog);
 
+  widget = (GtkWidget*)
+    gtk_builder_get_object (dialog->builder, "ppd-selection-search-entry");
+  g_signal_connect (widget, "changed", G_CALLBACK (search_changed_cb), dialog);
+
   widget = (GtkWidget*)
     gtk_builder_get_object (dialog->builder, "content-alignment");
   g_signal_connect (widget, "size-allocate", G_CALLBACK (update_alignment_padding), dialog);
@@ -420,6 +482,9 @@ pp_ppd_selection_dialog_free (PpPPDSelectionDialog *dialog)
 
   g_free (dialog->manufacturer);
 
+  if (dialog->index)
+    pp_ppd_index_unref (dialog->index);
+
   g_free (dialog);
 }
 
@@ -437,6 +502,25 @@ pp_ppd_selection_dialog_set_ppd_list (PpPPDSelectionDialog *dialog,
   fill_ppds_list (dialog);
 }
 
+void
+pp_ppd_selection_dialog_set_ppd_index (PpPPDSelectionDialog *dialog,
+                                       PpPPDIndex           *index)
+{
+  GtkWidget *widget;
+
+  if (index)
+    pp_ppd_index_ref (index);
+
+  if (dialog->index)
+    pp_ppd_index_unref (dialog->index);
+
+  dialog->index = index;
+
+  widget = (GtkWidget*)
+    gtk_builder_get_object (dialog->builder, "ppd-selection-search-entry");
+  gtk_widget_set_sensitive (widget, index != NULL);
+}
+
 static void
 pp_ppd_selection_dialog_hide (PpPPDSelectionDialog *dialog)
 {
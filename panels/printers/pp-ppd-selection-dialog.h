@@ -37,6 +37,8 @@ PpPPDSelectionDialog *pp_ppd_selection_dialog_new          (GtkWindow
 gchar                *pp_ppd_selection_dialog_get_ppd_name (PpPPDSelectionDialog      *dialog);
 void                  pp_ppd_selection_dialog_set_ppd_list (PpPPDSelectionDialog      *dialog,
                                                             PPDList                   *list);
+void                  pp_ppd_selection_dialog_set_ppd_index (PpPPDSelectionDialog     *dialog,
+                                                             PpPPDIndex               *index);
 void                  pp_ppd_selection_dialog_free         (PpPPDSelectionDialog      *dialog);
 
 G_END_DECLS
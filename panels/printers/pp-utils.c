@@ -2039,11 +2039,23 @@ typedef struct
   gchar         *printer_name;
   gint           count;
   PPDName      **result;
+  PpPPDIndex    *index;
   GCancellable  *cancellable;
   GPNCallback    callback;
   gpointer       user_data;
 } GPNData;
 
+static void
+get_ppd_names_data_free (GPNData *data)
+{
+  if (data->index)
+    pp_ppd_index_unref (data->index);
+  if (data->cancellable)
+    g_object_unref (data->cancellable);
+  g_free (data->printer_name);
+  g_free (data);
+}
+
 static void
 get_ppd_names_async_cb (gchar    **attribute_values,
                         gpointer   user_data)
@@ -2081,10 +2093,7 @@ out:
                   g_cancellable_is_cancelled (data->cancellable),
                   data->user_data);
 
-  if (data->cancellable)
-    g_object_unref (data->cancellable);
-  g_free (data->printer_name);
-  g_free (data);
+  get_ppd_names_data_free (data);
 }
 
 static void
@@ -2213,10 +2222,7 @@ get_ppd_names_async_dbus_scb (GObject      *source_object,
                       g_cancellable_is_cancelled (data->cancellable),
                       data->user_data);
 
-      if (data->cancellable)
-        g_object_unref (data->cancellable);
-      g_free (data->printer_name);
-      g_free (data);
+      get_ppd_names_data_free (data);
     }
 }
 
@@ -2236,6 +2242,33 @@ get_device_attributes_cb (gchar    *device_id,
   if (!device_id || !device_make_and_model || !device_uri)
     goto out;
 
+  /*
+   * Exact matches from the local index are what system-config-printer
+   * would return first too, so skip asking it in that case.
+   */
+  if (data->index)
+    {
+      PPDName **names;
+
+      names = pp_ppd_index_match_device (data->index,
+                                         device_id,
+                                         device_make_and_model,
+                                         data->count);
+
+      if (names && names[0]->ppd_match_level >= PPD_EXACT_MATCH)
+        {
+          data->callback (names,
+                          data->printer_name,
+                          FALSE,
+                          data->user_data);
+
+          get_ppd_names_data_free (data);
+          return;
+        }
+
+      ppd_names_free (names);
+    }
+
   bus = g_bus_get_sync (G_BUS_TYPE_SESSION, NULL, &error);
   if (!bus)
     {
@@ -2268,10 +2301,7 @@ out:
                   g_cancellable_is_cancelled (data->cancellable),
                   data->user_data);
 
-  if (data->cancellable)
-    g_object_unref (data->cancellable);
-  g_free (data->printer_name);
-  g_free (data);
+  get_ppd_names_data_free (data);
 }
 
 static void
@@ -2576,6 +2606,7 @@ get_device_attributes_async (const gchar  *printer_name,
 void
 get_ppd_names_async (gchar        *printer_name,
                      gint          count,
+                     PpPPDIndex   *index,
                      GCancellable *cancellable,
                      GPNCallback   callback,
                      gpointer      user_data)
@@ -2591,6 +2622,8 @@ get_ppd_names_async (gchar        *printer_name,
   data = g_new0 (GPNData, 1);
   data->printer_name = g_strdup (printer_name);
   data->count = count;
+  if (index)
+    data->index = pp_ppd_index_ref (index);
   if (cancellable)
     data->cancellable = g_object_ref (cancellable);
   data->callback = callback;
@@ -2608,6 +2641,7 @@ get_ppd_names_async (gchar        *printer_name,
 typedef struct
 {
   PPDList      *result;
+  PpPPDIndex   *index;
   GCancellable *cancellable;
   GAPCallback   callback;
   gpointer      user_data;
@@ -2628,7 +2662,7 @@ get_all_ppds_idle_cb (gpointer user_data)
     }
   else
     {
-      data->callback (data->result, data->user_data);
+      data->callback (data->result, data->index, data->user_data);
     }
 
   return FALSE;
@@ -2639,6 +2673,8 @@ get_all_ppds_data_free (gpointer user_data)
 {
   GAPData *data = (GAPData *) user_data;
 
+  if (data->index)
+    pp_ppd_index_unref (data->index);
   if (data->context)
     g_main_context_unref (data->context);
   if (data->cancellable)
@@ -2646,18 +2682,30 @@ get_all_ppds_data_free (gpointer user_data)
   g_free (data);
 }
 
+/* Hands @result and @index over to the callback in the caller's context */
 static void
-get_all_ppds_cb (gpointer user_data)
+get_all_ppds_cb (GAPData    *data,
+                 PPDList    *result,
+                 PpPPDIndex *index)
 {
-  GAPData *data = (GAPData *) user_data;
+  GAPData *idle_data;
   GSource *idle_source;
 
+  idle_data = g_new0 (GAPData, 1);
+  idle_data->result = result;
+  idle_data->index = index;
+  if (data->cancellable)
+    idle_data->cancellable = g_object_ref (data->cancellable);
+  idle_data->callback = data->callback;
+  idle_data->user_data = data->user_data;
+  idle_data->context = g_main_context_ref (data->context);
+
   idle_source = g_idle_source_new ();
   g_source_set_callback (idle_source,
                          get_all_ppds_idle_cb,
-                         data,
+                         idle_data,
                          get_all_ppds_data_free);
-  g_source_attach (idle_source, data->context);
+  g_source_attach (idle_source, idle_data->context);
   g_source_unref (idle_source);
 }
 
@@ -2737,17 +2785,24 @@ static const struct {
   { "zebra", "Zebra" },
 };
 
-static gpointer
-get_all_ppds_func (gpointer user_data)
+static gint
+compare_manufacturer_names (gconstpointer a,
+                            gconstpointer b)
+{
+  return g_strcmp0 (*(const gchar **) a, *(const gchar **) b);
+}
+
+static PPDList *
+get_all_ppds_from_cups (void)
 {
   ipp_attribute_t *attr;
   GHashTable      *ppds_hash = NULL;
   GHashTable      *manufacturers_hash = NULL;
-  GAPData         *data = (GAPData *) user_data;
+  PPDList         *result = NULL;
   PPDName         *item;
   ipp_t           *request;
   ipp_t           *response;
-  GList           *list;
+  GPtrArray       *ppds;
   const gchar     *ppd_make_and_model;
   const gchar     *ppd_device_id;
   const gchar     *ppd_name;
@@ -2757,7 +2812,7 @@ get_all_ppds_func (gpointer user_data)
   gchar           *mfg_normalized;
   gchar           *mdl;
   gchar           *manufacturer_display_name;
-  gint             i, j;
+  guint            i;
 
   request = ippNewRequest (CUPS_GET_PPDS);
   response = cupsDoRequest (CUPS_HTTP_DEFAULT, request, "/");
@@ -2767,7 +2822,7 @@ get_all_ppds_func (gpointer user_data)
     {
       /*
        * This hash contains names of manufacturers as keys and
-       * values are GLists of PPD names.
+       * values are arrays of PPD names.
        */
       ppds_hash = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
 
@@ -2883,17 +2938,15 @@ get_all_ppds_func (gpointer user_data)
               item->ppd_name = g_strdup (ppd_name);
               item->ppd_display_name = g_strdup (mdl);
               item->ppd_match_level = -1;
+              item->ppd_device_id = g_strdup (ppd_device_id);
 
-              list = g_hash_table_lookup (ppds_hash, mfg_normalized);
-              if (list)
-                {
-                  list = g_list_append (list, item);
-                }
-              else
+              ppds = g_hash_table_lookup (ppds_hash, mfg_normalized);
+              if (!ppds)
                 {
-                  list = g_list_append (list, item);
-                  g_hash_table_insert (ppds_hash, g_strdup (mfg_normalized), list);
+                  ppds = g_ptr_array_new ();
+                  g_hash_table_insert (ppds_hash, g_strdup (mfg_normalized), ppds);
                 }
+              g_ptr_array_add (ppds, item);
             }
 
           g_free (mdl);
@@ -2914,62 +2967,431 @@ get_all_ppds_func (gpointer user_data)
       GHashTableIter  iter;
       gpointer        key;
       gpointer        value;
-      GList          *ppd_item;
-      GList          *sort_list = NULL;
-      GList          *list_iter;
+      GPtrArray      *names;
       gchar          *name;
 
-      data->result = g_new0 (PPDList, 1);
-      data->result->num_of_manufacturers = g_hash_table_size (ppds_hash);
-      data->result->manufacturers = g_new0 (PPDManufacturerItem *, data->result->num_of_manufacturers);
+      result = g_new0 (PPDList, 1);
+      result->num_of_manufacturers = g_hash_table_size (ppds_hash);
+      result->manufacturers = g_new0 (PPDManufacturerItem *, result->num_of_manufacturers);
 
+      names = g_ptr_array_sized_new (result->num_of_manufacturers);
       g_hash_table_iter_init (&iter, ppds_hash);
       while (g_hash_table_iter_next (&iter, &key, &value))
-        {
-          sort_list = g_list_append (sort_list, g_strdup (key));
-        }
+        g_ptr_array_add (names, key);
 
       /* Sort list of manufacturers */
-      sort_list = g_list_sort (sort_list, (GCompareFunc) g_strcmp0);
+      g_ptr_array_sort (names, compare_manufacturer_names);
 
       /*
        * Fill resulting list of lists (list of manufacturers where
        * each item contains list of PPD names)
        */
-      i = 0;
-      for (list_iter = sort_list; list_iter; list_iter = list_iter->next)
+      for (i = 0; i < names->len; i++)
+        {
+          name = g_ptr_array_index (names, i);
+          ppds = g_hash_table_lookup (ppds_hash, name);
+
+          result->manufacturers[i] = g_new0 (PPDManufacturerItem, 1);
+          result->manufacturers[i]->manufacturer_name = g_strdup (name);
+          result->manufacturers[i]->manufacturer_display_name = g_strdup (g_hash_table_lookup (manufacturers_hash, name));
+          result->manufacturers[i]->num_of_ppds = ppds->len;
+          result->manufacturers[i]->ppds = (PPDName **) g_ptr_array_free (ppds, FALSE);
+        }
+
+      g_ptr_array_free (names, TRUE);
+      g_hash_table_destroy (ppds_hash);
+      g_hash_table_destroy (manufacturers_hash);
+    }
+
+  return result;
+}
+
+#define PPD_CACHE_VERSION 2
+#define PPD_CACHE_FORMAT "(usa(ssa(sss)))"
+
+/* Where cups-driverd looks for PPD files besides its DataDir */
+static const gchar * const ppd_directories[] = {
+  "/usr/share/ppd",
+  "/usr/local/share/ppd",
+  "/opt/share/ppd",
+  NULL
+};
+
+/*
+ * Reads a directive of cupsd's configuration, e.g. DataDir from
+ * cups-files.conf. The last occurrence wins, as in cupsd.
+ */
+static gchar *
+get_cupsd_directive (const gchar *conf_path,
+                     const gchar *directive)
+{
+  gchar  *contents;
+  gchar **lines;
+  gchar  *result = NULL;
+  gsize   length = strlen (directive);
+  gint    i;
+
+  if (!g_file_get_contents (conf_path, &contents, NULL, NULL))
+    return NULL;
+
+  lines = g_strsplit (contents, "\n", -1);
+  for (i = 0; lines[i] != NULL; i++)
+    {
+      gchar *line = g_strstrip (lines[i]);
+
+      if (g_ascii_strncasecmp (line, directive, length) == 0 &&
+          g_ascii_isspace (line[length]))
+        {
+          g_free (result);
+          result = g_strdup (g_strstrip (line + length));
+        }
+    }
+
+  g_strfreev (lines);
+  g_free (contents);
+
+  return result;
+}
+
+/*
+ * The directories cupsd finds PPD files and driver programs in, following
+ * its DataDir and ServerBin settings and the environment it honours. The
+ * settings are added to @checksum.
+ */
+static gchar **
+get_ppd_directories (GChecksum *checksum)
+{
+  const gchar *server_root;
+  GPtrArray   *dirs;
+  gchar       *data_dir;
+  gchar       *server_bin;
+  gchar       *conf_path;
+  gint         i;
+
+  server_root = g_getenv ("CUPS_SERVERROOT");
+  if (server_root == NULL)
+    server_root = "/etc/cups";
+
+  /* CUPS 1.6 moved the file settings out of cupsd.conf */
+  conf_path = g_build_filename (server_root, "cups-files.conf", NULL);
+  data_dir = get_cupsd_directive (conf_path, "DataDir");
+  server_bin = get_cupsd_directive (conf_path, "ServerBin");
+  g_free (conf_path);
+
+  if (data_dir == NULL || server_bin == NULL)
+    {
+      conf_path = g_build_filename (server_root, "cupsd.conf", NULL);
+      if (data_dir == NULL)
+        data_dir = get_cupsd_directive (conf_path, "DataDir");
+      if (server_bin == NULL)
+        server_bin = get_cupsd_directive (conf_path, "ServerBin");
+      g_free (conf_path);
+    }
+
+  if (data_dir == NULL)
+    data_dir = g_strdup (g_getenv ("CUPS_DATADIR") ? g_getenv ("CUPS_DATADIR") : "/usr/share/cups");
+  if (server_bin == NULL)
+    server_bin = g_strdup (g_getenv ("CUPS_SERVERBIN") ? g_getenv ("CUPS_SERVERBIN") : "/usr/lib/cups");
+
+  g_checksum_update (checksum, (const guchar *) data_dir, -1);
+  g_checksum_update (checksum, (const guchar *) server_bin, -1);
+
+  dirs = g_ptr_array_new ();
+  g_ptr_array_add (dirs, g_build_filename (data_dir, "model", NULL));
+  g_ptr_array_add (dirs, g_build_filename (data_dir, "drv", NULL));
+  g_ptr_array_add (dirs, g_build_filename (server_bin, "driver", NULL));
+  for (i = 0; ppd_directories[i] != NULL; i++)
+    g_ptr_array_add (dirs, g_strdup (ppd_directories[i]));
+  g_ptr_array_add (dirs, NULL);
+
+  g_free (data_dir);
+  g_free (server_bin);
+
+  return (gchar **) g_ptr_array_free (dirs, FALSE);
+}
+
+static void
+checksum_directory (GChecksum   *checksum,
+                    const gchar *path,
+                    gint         depth)
+{
+  const gchar *name;
+  GStatBuf     buf;
+  GDir        *dir;
+  gchar       *child;
+  gchar       *line;
+
+  if (g_stat (path, &buf) != 0)
+    return;
+
+  /* Adding, removing or replacing a file changes the directory */
+  line = g_strdup_printf ("%s %" G_GINT64_FORMAT "\n", path, (gint64) buf.st_mtime);
+  g_checksum_update (checksum, (const guchar *) line, -1);
+  g_free (line);
+
+  if (depth == 0 || (dir = g_dir_open (path, 0, NULL)) == NULL)
+    return;
+
+  while ((name = g_dir_read_name (dir)) != NULL)
+    {
+      child = g_build_filename (path, name, NULL);
+      if (g_file_test (child, G_FILE_TEST_IS_DIR) &&
+          !g_file_test (child, G_FILE_TEST_IS_SYMLINK))
+        checksum_directory (checksum, child, depth - 1);
+      g_free (child);
+    }
+
+  g_dir_close (dir);
+}
+
+static gboolean
+is_cups_server_local (void)
+{
+  const gchar *server = cupsServer ();
+
+  return server[0] == '/' || g_strcmp0 (server, "localhost") == 0;
+}
+
+/*
+ * Identifies the set of drivers the local cupsd offers. Returns NULL for
+ * a remote server, whose drivers we can't see.
+ */
+static gchar *
+get_ppds_fingerprint (void)
+{
+  GChecksum   *checksum;
+  gchar      **dirs;
+  gchar       *result;
+  gint         i;
+
+  if (!is_cups_server_local ())
+    return NULL;
+
+  checksum = g_checksum_new (G_CHECKSUM_SHA1);
+  g_checksum_update (checksum, (const guchar *) cupsServer (), -1);
+
+  dirs = get_ppd_directories (checksum);
+  for (i = 0; dirs[i] != NULL; i++)
+    checksum_directory (checksum, dirs[i], 8);
+  g_strfreev (dirs);
+
+  result = g_strdup (g_checksum_get_string (checksum));
+  g_checksum_free (checksum);
+
+  return result;
+}
+
+static gchar *
+get_ppds_cache_path (void)
+{
+  return g_build_filename (g_get_user_cache_dir (),
+                           "unity-control-center",
+                           "ppds.cache",
+                           NULL);
+}
+
+/*
+ * Loads the list saved by the last query, without checking that it is
+ * still current; the fingerprint it was saved with is returned in
+ * @fingerprint.
+ */
+static PPDList *
+ppd_list_load_cache (gchar **fingerprint)
+{
+  GMappedFile *mapped;
+  GVariantIter iter;
+  GVariant    *cache;
+  GVariant    *manufacturers;
+  GVariant    *ppds;
+  PPDList     *result = NULL;
+  const gchar *cached_fingerprint;
+  gchar       *cache_path;
+  guint32      version;
+  gsize        i, j;
+
+  cache_path = get_ppds_cache_path ();
+  mapped = g_mapped_file_new (cache_path, FALSE, NULL);
+  g_free (cache_path);
+
+  if (!mapped)
+    return NULL;
+
+  if (g_mapped_file_get_length (mapped) == 0)
+    {
+      g_mapped_file_unref (mapped);
+      return NULL;
+    }
+
+  cache = g_variant_new_from_data (G_VARIANT_TYPE (PPD_CACHE_FORMAT),
+                                   g_mapped_file_get_contents (mapped),
+                                   g_mapped_file_get_length (mapped),
+                                   FALSE,
+                                   (GDestroyNotify) g_mapped_file_unref,
+                                   mapped);
+  g_variant_ref_sink (cache);
+
+  g_variant_get (cache, "(u&s@a(ssa(sss)))",
+                 &version, &cached_fingerprint, &manufacturers);
+
+  if (version == PPD_CACHE_VERSION)
+    {
+      *fingerprint = g_strdup (cached_fingerprint);
+
+      result = g_new0 (PPDList, 1);
+      result->num_of_manufacturers = g_variant_n_children (manufacturers);
+      result->manufacturers = g_new0 (PPDManufacturerItem *, result->num_of_manufacturers);
+
+      for (i = 0; i < result->num_of_manufacturers; i++)
         {
-          name = (gchar *) list_iter->data;
-          value = g_hash_table_lookup (ppds_hash, name);
+          PPDManufacturerItem *manufacturer;
+          const gchar         *ppd_name;
+          const gchar         *ppd_display_name;
+          const gchar         *ppd_device_id;
 
-          data->result->manufacturers[i] = g_new0 (PPDManufacturerItem, 1);
-          data->result->manufacturers[i]->manufacturer_name = g_strdup (name);
-          data->result->manufacturers[i]->manufacturer_display_name = g_strdup (g_hash_table_lookup (manufacturers_hash, name));
-          data->result->manufacturers[i]->num_of_ppds = g_list_length ((GList *) value);
-          data->result->manufacturers[i]->ppds = g_new0 (PPDName *, data->result->manufacturers[i]->num_of_ppds);
+          manufacturer = g_new0 (PPDManufacturerItem, 1);
+          g_variant_get_child (manufacturers, i, "(ss@a(sss))",
+                               &manufacturer->manufacturer_name,
+                               &manufacturer->manufacturer_display_name,
+                               &ppds);
 
-          for (ppd_item = (GList *) value, j = 0; ppd_item; ppd_item = ppd_item->next, j++)
+          if (manufacturer->manufacturer_display_name[0] == '\0')
+            g_clear_pointer (&manufacturer->manufacturer_display_name, g_free);
+
+          manufacturer->num_of_ppds = g_variant_n_children (ppds);
+          manufacturer->ppds = g_new0 (PPDName *, manufacturer->num_of_ppds);
+
+          g_variant_iter_init (&iter, ppds);
+          for (j = 0; g_variant_iter_next (&iter, "(&s&s&s)", &ppd_name, &ppd_display_name, &ppd_device_id); j++)
             {
-              data->result->manufacturers[i]->ppds[j] = ppd_item->data;
+              manufacturer->ppds[j] = g_new0 (PPDName, 1);
+              manufacturer->ppds[j]->ppd_name = g_strdup (ppd_name);
+              manufacturer->ppds[j]->ppd_display_name = g_strdup (ppd_display_name);
+              manufacturer->ppds[j]->ppd_match_level = -1;
+              if (ppd_device_id[0] != '\0')
+                manufacturer->ppds[j]->ppd_device_id = g_strdup (ppd_device_id);
             }
 
-          g_list_free ((GList *) value);
-
-          i++;
+          g_variant_unref (ppds);
+          result->manufacturers[i] = manufacturer;
         }
+    }
 
-      g_list_free_full (sort_list, g_free);
-      g_hash_table_destroy (ppds_hash);
-      g_hash_table_destroy (manufacturers_hash);
+  g_variant_unref (manufacturers);
+  g_variant_unref (cache);
+
+  return result;
+}
+
+static void
+ppd_list_save_cache (PPDList     *list,
+                     const gchar *fingerprint)
+{
+  GVariantBuilder  manufacturers;
+  GVariant        *cache;
+  GError          *error = NULL;
+  gchar           *cache_path;
+  gchar           *dirname;
+  gsize            i, j;
+
+  g_variant_builder_init (&manufacturers, G_VARIANT_TYPE ("a(ssa(sss))"));
+
+  for (i = 0; i < list->num_of_manufacturers; i++)
+    {
+      PPDManufacturerItem *manufacturer = list->manufacturers[i];
+      GVariantBuilder      ppds;
+
+      g_variant_builder_init (&ppds, G_VARIANT_TYPE ("a(sss)"));
+      for (j = 0; j < manufacturer->num_of_ppds; j++)
+        g_variant_builder_add (&ppds, "(sss)",
+                               manufacturer->ppds[j]->ppd_name,
+                               manufacturer->ppds[j]->ppd_display_name,
+                               manufacturer->ppds[j]->ppd_device_id ?
+                                 manufacturer->ppds[j]->ppd_device_id : "");
+
+      g_variant_builder_add (&manufacturers, "(ssa(sss))",
+                             manufacturer->manufacturer_name,
+                             manufacturer->manufacturer_display_name ?
+                               manufacturer->manufacturer_display_name : "",
+                             &ppds);
+    }
+
+  cache = g_variant_new (PPD_CACHE_FORMAT,
+                         PPD_CACHE_VERSION,
+                         fingerprint,
+                         &manufacturers);
+  g_variant_ref_sink (cache);
+
+  cache_path = get_ppds_cache_path ();
+  dirname = g_path_get_dirname (cache_path);
+  g_mkdir_with_parents (dirname, 0700);
+  g_free (dirname);
+
+  if (!g_file_set_contents (cache_path,
+                            g_variant_get_data (cache),
+                            g_variant_get_size (cache),
+                            &error))
+    {
+      g_warning ("Could not write PPD cache '%s': %s", cache_path, error->message);
+      g_error_free (error);
+    }
+
+  g_free (cache_path);
+  g_variant_unref (cache);
+}
+
+static gpointer
+get_all_ppds_func (gpointer user_data)
+{
+  GAPData *data = (GAPData *) user_data;
+  PPDList *result = NULL;
+  gchar   *cached_fingerprint = NULL;
+  gchar   *fingerprint;
+
+  /*
+   * Asking cupsd for all PPDs takes seconds with large driver packages
+   * installed, so the last answer is handed out first. Checking whether
+   * the drivers changed since walks the driver directories, which is
+   * slow too, so it is done afterwards and a new list only follows if
+   * they did.
+   */
+  if (is_cups_server_local ())
+    result = ppd_list_load_cache (&cached_fingerprint);
+
+  if (result)
+    get_all_ppds_cb (data, result, pp_ppd_index_new (result));
+
+  fingerprint = get_ppds_fingerprint ();
+
+  if ((cached_fingerprint == NULL ||
+       g_strcmp0 (fingerprint, cached_fingerprint) != 0) &&
+      (!data->cancellable ||
+       !g_cancellable_is_cancelled (data->cancellable)))
+    {
+      result = get_all_ppds_from_cups ();
+
+      if (result && fingerprint)
+        ppd_list_save_cache (result, fingerprint);
+
+      /* without a cached list, the caller is waiting for any answer */
+      if (result || cached_fingerprint == NULL)
+        get_all_ppds_cb (data, result,
+                         result ? pp_ppd_index_new (result) : NULL);
     }
 
-  get_all_ppds_cb (data);
+  g_free (cached_fingerprint);
+  g_free (fingerprint);
+
+  get_all_ppds_data_free (data);
 
   return NULL;
 }
 
 /*
  * Get names of all installed PPDs sorted by manufacturers names.
+ *
+ * @callback gets the list saved by the last call first, if there is one,
+ * and is called again with a new list if the installed drivers changed
+ * since. It owns the lists it gets, each replacing the previous one.
  */
 void
 get_all_ppds_async (GCancellable *cancellable,
@@ -2995,7 +3417,7 @@ get_all_ppds_async (GCancellable *cancellable,
   if (!thread)
     {
       g_warning ("%s", error->message);
-      callback (NULL, user_data);
+      callback (NULL, NULL, user_data);
 
       g_error_free (error);
       get_all_ppds_data_free (data);
@@ -3042,6 +3464,9 @@ ppd_list_copy (PPDList *list)
 
               result->manufacturers[i]->ppds[j]->ppd_match_level =
                 list->manufacturers[i]->ppds[j]->ppd_match_level;
+
+              result->manufacturers[i]->ppds[j]->ppd_device_id =
+                g_strdup (list->manufacturers[i]->ppds[j]->ppd_device_id);
             }
         }
     }
@@ -3062,6 +3487,7 @@ ppd_list_free (PPDList *list)
             {
               g_free (list->manufacturers[i]->ppds[j]->ppd_name);
               g_free (list->manufacturers[i]->ppds[j]->ppd_display_name);
+              g_free (list->manufacturers[i]->ppds[j]->ppd_device_id);
               g_free (list->manufacturers[i]->ppds[j]);
             }
 
@@ -3076,720 +3502,2141 @@ ppd_list_free (PPDList *list)
     }
 }
 
-gchar *
-get_standard_manufacturers_name (gchar *name)
+void
+ppd_names_free (PPDName **names)
 {
-  gchar *normalized_name;
-  gchar *result = NULL;
-  gint   i;
+  gint i;
 
-  if (name)
+  if (names)
     {
-      normalized_name = normalize (name);
-
-      for (i = 0; i < G_N_ELEMENTS (manufacturers_names); i++)
+      for (i = 0; names[i]; i++)
         {
-          if (g_strcmp0 (manufacturers_names[i].normalized_name, normalized_name) == 0)
-            {
-              result = g_strdup (manufacturers_names[i].display_name);
-              break;
-            }
+          g_free (names[i]->ppd_name);
+          g_free (names[i]->ppd_display_name);
+          g_free (names[i]->ppd_device_id);
+          g_free (names[i]);
         }
 
-      g_free (normalized_name);
+      g_free (names);
     }
-
-  return result;
 }
 
+/*
+ * In-memory index over the PPD catalogue, so that drivers for a device
+ * and drivers matching what the user types can be found without asking
+ * cupsd or system-config-printer.  It is built once in the thread which
+ * loads the catalogue and is read-only afterwards.
+ */
+
+#define PPD_INDEX_CLOSE_SCORE 50
+
 typedef struct
 {
-  gchar        *printer_name;
-  gchar        *host_name;
-  gint          port;
-  gchar        *result;
-  PGPCallback   callback;
-  gpointer      user_data;
-  GMainContext *context;
-} PGPData;
+  gchar  *ppd_name;
+  gchar  *ppd_display_name;
+  gchar  *ppd_device_id;
+  gchar  *manufacturer;
+  /* normalized words of model name without the manufacturer */
+  gchar **model;
+  /* command sets from the CMD field of the PPD's device-id */
+  gchar **commands;
+  /* normalized words of manufacturer and model, for searching */
+  gchar **words;
+} PpPPDIndexEntry;
 
-static gboolean
-printer_get_ppd_idle_cb (gpointer user_data)
+typedef struct
 {
-  PGPData *data = (PGPData *) user_data;
+  gchar  *word;
+  GArray *entries;
+} PpPPDIndexWord;
 
-  data->callback (data->result, data->user_data);
+struct _PpPPDIndex
+{
+  gint             ref_count;
 
-  return FALSE;
-}
+  PpPPDIndexEntry *entries;
+  guint            num_of_entries;
 
-static void
-printer_get_ppd_data_free (gpointer user_data)
-{
-  PGPData *data = (PGPData *) user_data;
+  /* all words sorted, for prefix lookups */
+  PpPPDIndexWord  *words;
+  guint            num_of_words;
 
-  if (data->context)
-    g_main_context_unref (data->context);
-  g_free (data->result);
-  g_free (data->printer_name);
-  g_free (data->host_name);
-  g_free (data);
-}
+  /* "manufacturer\nmodel" -> GArray of entries */
+  GHashTable      *models;
+  /* manufacturer -> GArray of entries */
+  GHashTable      *manufacturers;
+};
 
-static void
-printer_get_ppd_cb (gpointer user_data)
+typedef struct
 {
-  PGPData *data = (PGPData *) user_data;
-  GSource *idle_source;
+  guint entry;
+  gint  match_level;
+  gint  score;
+} PpPPDIndexMatch;
 
-  idle_source = g_idle_source_new ();
-  g_source_set_callback (idle_source,
-                         printer_get_ppd_idle_cb,
-                         data,
-                         printer_get_ppd_data_free);
-  g_source_attach (idle_source, data->context);
-  g_source_unref (idle_source);
-}
-
-static gpointer
-printer_get_ppd_func (gpointer user_data)
+/*
+ * Map all names of a manufacturer to the one used as
+ * manufacturer_name in PPDList (e.g. "HP" -> "hewlett packard").
+ */
+static gchar *
+canonical_manufacturer_name (const gchar *name)
 {
-  PGPData *data = (PGPData *) user_data;
+  gchar *normalized_name;
+  gint   i;
 
-  if (data->host_name)
-    {
-      http_t *http;
+  normalized_name = normalize (name);
+  if (!normalized_name)
+    return NULL;
 
-      http = httpConnect (data->host_name, data->port);
-      if (http)
+  for (i = 0; i < G_N_ELEMENTS (manufacturers_names); i++)
+    {
+      if (g_strcmp0 (manufacturers_names[i].normalized_name, normalized_name) == 0)
         {
-          data->result = g_strdup (cupsGetPPD2 (http, data->printer_name));
-          httpClose (http);
+          g_free (normalized_name);
+          normalized_name = normalize (manufacturers_names[i].display_name);
+          break;
         }
     }
-  else
+
+  return normalized_name;
+}
+
+/*
+ * Split text into its normalized words, skipping empty ones.
+ */
+static gchar **
+split_words (const gchar *text)
+{
+  GPtrArray  *result;
+  gchar     **words;
+  gchar      *normalized;
+  gint        i;
+
+  result = g_ptr_array_new ();
+
+  normalized = normalize (text);
+  if (normalized)
     {
-      data->result = g_strdup (cupsGetPPD (data->printer_name));
+      words = g_strsplit (normalized, " ", -1);
+      for (i = 0; words[i]; i++)
+        {
+          if (words[i][0] != '\0')
+            g_ptr_array_add (result, g_strdup (words[i]));
+        }
+
+      g_strfreev (words);
+      g_free (normalized);
     }
 
-  printer_get_ppd_cb (data);
+  g_ptr_array_add (result, NULL);
 
-  return NULL;
+  return (gchar **) g_ptr_array_free (result, FALSE);
 }
 
-void
-printer_get_ppd_async (const gchar *printer_name,
-                       const gchar *host_name,
-                       gint         port,
-                       PGPCallback  callback,
-                       gpointer     user_data)
+/*
+ * Return normalized words of model name without leading name
+ * of the manufacturer (e.g. "HP LaserJet 4050" -> "laserjet", "4050").
+ */
+static gchar **
+get_model_words (const gchar *manufacturer,
+                 const gchar *model)
 {
-  PGPData *data;
-  GThread *thread;
-  GError  *error = NULL;
-
-  data = g_new0 (PGPData, 1);
-  data->printer_name = g_strdup (printer_name);
-  data->host_name = g_strdup (host_name);
-  data->port = port;
-  data->callback = callback;
-  data->user_data = user_data;
-  data->context = g_main_context_ref_thread_default ();
+  gchar **words;
+  gchar **result;
+  gchar  *first_word;
+  gchar  *prefix;
+  gchar  *name;
+  gint    length, n;
 
-  thread = g_thread_try_new ("printer-get-ppd",
-                             printer_get_ppd_func,
-                             data,
-                             &error);
+  words = split_words (model);
+  length = g_strv_length (words);
 
-  if (!thread)
+  for (n = MIN (3, length - 1); n > 0; n--)
     {
-      g_warning ("%s", error->message);
-      callback (NULL, user_data);
+      first_word = words[n];
+      words[n] = NULL;
+      prefix = g_strjoinv (" ", words);
+      words[n] = first_word;
 
-      g_error_free (error);
-      printer_get_ppd_data_free (data);
-    }
-  else
-    {
-      g_thread_unref (thread);
+      name = canonical_manufacturer_name (prefix);
+      g_free (prefix);
+
+      if (g_strcmp0 (name, manufacturer) == 0)
+        {
+          g_free (name);
+          break;
+        }
+
+      g_free (name);
     }
+
+  result = g_strdupv (words + MAX (n, 0));
+  g_strfreev (words);
+
+  return result;
 }
 
-typedef struct
+static gchar **
+get_command_sets (const gchar *device_id)
 {
-  gchar        *printer_name;
-  cups_dest_t  *result;
-  GNDCallback   callback;
-  gpointer      user_data;
-  GMainContext *context;
-} GNDData;
+  GPtrArray  *result;
+  gchar     **commands;
+  gchar      *value;
+  gint        i;
+
+  value = get_tag_value (device_id, "cmd");
+  if (!value)
+    value = get_tag_value (device_id, "command set");
+
+  if (!value)
+    return NULL;
+
+  result = g_ptr_array_new ();
+
+  commands = g_strsplit (value, ",", -1);
+  for (i = 0; commands[i]; i++)
+    {
+      g_strstrip (commands[i]);
+      if (commands[i][0] != '\0')
+        g_ptr_array_add (result, g_ascii_strdown (commands[i], -1));
+    }
+
+  g_ptr_array_add (result, NULL);
+
+  g_strfreev (commands);
+  g_free (value);
+
+  return (gchar **) g_ptr_array_free (result, FALSE);
+}
 
 static gboolean
-get_named_dest_idle_cb (gpointer user_data)
+has_command_set (gchar       **commands,
+                 const gchar  *command)
 {
-  GNDData *data = (GNDData *) user_data;
+  gint i;
 
-  data->callback (data->result, data->user_data);
+  for (i = 0; commands && commands[i]; i++)
+    {
+      if (g_str_has_prefix (commands[i], command))
+        return TRUE;
+    }
 
   return FALSE;
 }
 
-static void
-get_named_dest_data_free (gpointer user_data)
+/*
+ * Score how well words of a query match words of a model name,
+ * from 0 (no match) to 100 (the same words in the same order).
+ * Each query word counts if it equals a word of the name or, when
+ * "prefix" is set, starts one.  Words the name doesn't contain fail
+ * the match unless "allow_missing" is set; numbers identify a model
+ * so they have to be there even then.
+ */
+static gint
+score_words (gchar    **query,
+             gchar    **name,
+             gboolean   prefix,
+             gboolean   allow_missing)
 {
-  GNDData *data = (GNDData *) user_data;
+  gint n_query, n_name;
+  gint points = 0, best, score;
+  gint last = -1, best_position;
+  gint i, j;
 
-  if (data->context)
-    g_main_context_unref (data->context);
-  g_free (data->printer_name);
-  g_free (data);
+  n_query = g_strv_length (query);
+  n_name = g_strv_length (name);
+
+  if (n_query == 0 || n_name == 0)
+    return 0;
+
+  for (i = 0; i < n_query; i++)
+    {
+      best = 0;
+      best_position = last;
+
+      for (j = 0; j < n_name; j++)
+        {
+          if (g_strcmp0 (name[j], query[i]) == 0)
+            score = 4;
+          else if (prefix && g_str_has_prefix (name[j], query[i]))
+            score = 2;
+          else
+            continue;
+
+          /* Prefer words in the same order */
+          if (j > last)
+            score++;
+
+          if (score > best)
+            {
+              best = score;
+              best_position = j;
+            }
+        }
+
+      if (best == 0 &&
+          (!allow_missing || g_ascii_isdigit (query[i][0])))
+        return 0;
+
+      points += best;
+      last = best_position;
+    }
+
+  return points * 100 / (5 * MAX (n_query, n_name));
 }
 
-static void
-get_named_dest_cb (gpointer user_data)
+static gint
+compare_matches (gconstpointer a,
+                 gconstpointer b,
+                 gpointer      user_data)
 {
-  GNDData *data = (GNDData *) user_data;
-  GSource *idle_source;
+  const PpPPDIndexMatch *match_a = a;
+  const PpPPDIndexMatch *match_b = b;
+  PpPPDIndex            *index = user_data;
 
-  idle_source = g_idle_source_new ();
-  g_source_set_callback (idle_source,
-                         get_named_dest_idle_cb,
-                         data,
-                         get_named_dest_data_free);
-  g_source_attach (idle_source, data->context);
-  g_source_unref (idle_source);
+  if (match_a->match_level != match_b->match_level)
+    return match_b->match_level - match_a->match_level;
+
+  if (match_a->score != match_b->score)
+    return match_b->score - match_a->score;
+
+  return g_strcmp0 (index->entries[match_a->entry].ppd_display_name,
+                    index->entries[match_b->entry].ppd_display_name);
 }
 
-static gpointer
-get_named_dest_func (gpointer user_data)
+static gint
+compare_index_words (gconstpointer a,
+                     gconstpointer b,
+                     gpointer      user_data)
 {
-  GNDData *data = (GNDData *) user_data;
+  return g_strcmp0 (((const PpPPDIndexWord *) a)->word,
+                    ((const PpPPDIndexWord *) b)->word);
+}
 
-  data->result = cupsGetNamedDest (CUPS_HTTP_DEFAULT, data->printer_name, NULL);
+static void
+index_add_entry (GHashTable  *table,
+                 const gchar *key,
+                 guint        entry)
+{
+  GArray *entries;
 
-  get_named_dest_cb (data);
+  entries = g_hash_table_lookup (table, key);
+  if (!entries)
+    {
+      entries = g_array_new (FALSE, FALSE, sizeof (guint));
+      g_hash_table_insert (table, g_strdup (key), entries);
+    }
 
-  return NULL;
+  /* Don't add an entry twice for one key */
+  if (entries->len == 0 ||
+      g_array_index (entries, guint, entries->len - 1) != entry)
+    g_array_append_val (entries, entry);
 }
 
-void
-get_named_dest_async (const gchar *printer_name,
-                      GNDCallback  callback,
-                      gpointer     user_data)
+/*
+ * Build index over given list of PPDs.  The list isn't
+ * referenced afterwards.
+ */
+PpPPDIndex *
+pp_ppd_index_new (PPDList *list)
 {
-  GNDData *data;
-  GThread *thread;
-  GError  *error = NULL;
+  PPDManufacturerItem *manufacturer;
+  PpPPDIndexEntry     *entry;
+  GHashTableIter       iter;
+  GHashTable          *words;
+  PpPPDIndex          *index;
+  gpointer             key, value;
+  gchar               *model_key;
+  gchar               *model;
+  gchar               *text;
+  gsize                i, j, n = 0;
+  gint                 k;
+
+  index = g_new0 (PpPPDIndex, 1);
+  index->ref_count = 1;
+  index->models = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                         g_free, (GDestroyNotify) g_array_unref);
+  index->manufacturers = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                g_free, (GDestroyNotify) g_array_unref);
+
+  if (!list)
+    return index;
+
+  for (i = 0; i < list->num_of_manufacturers; i++)
+    index->num_of_entries += list->manufacturers[i]->num_of_ppds;
+
+  index->entries = g_new0 (PpPPDIndexEntry, index->num_of_entries);
+  words = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, NULL);
+
+  for (i = 0; i < list->num_of_manufacturers; i++)
+    {
+      manufacturer = list->manufacturers[i];
 
-  data = g_new0 (GNDData, 1);
-  data->printer_name = g_strdup (printer_name);
-  data->callback = callback;
-  data->user_data = user_data;
-  data->context = g_main_context_ref_thread_default ();
+      for (j = 0; j < manufacturer->num_of_ppds; j++, n++)
+        {
+          PPDName *ppd = manufacturer->ppds[j];
 
-  thread = g_thread_try_new ("get-named-dest",
-                             get_named_dest_func,
-                             data,
-                             &error);
+          entry = &index->entries[n];
+          entry->ppd_name = g_strdup (ppd->ppd_name);
+          entry->ppd_display_name = g_strdup (ppd->ppd_display_name);
+          entry->ppd_device_id = g_strdup (ppd->ppd_device_id);
+          entry->manufacturer = g_strdup (manufacturer->manufacturer_name);
 
-  if (!thread)
-    {
-      g_warning ("%s", error->message);
-      callback (NULL, user_data);
+          model = NULL;
+          if (ppd->ppd_device_id)
+            {
+              model = get_tag_value (ppd->ppd_device_id, "mdl");
+              if (!model)
+                model = get_tag_value (ppd->ppd_device_id, "model");
 
-      g_error_free (error);
-      get_named_dest_data_free (data);
+              entry->commands = get_command_sets (ppd->ppd_device_id);
+            }
+
+          entry->model = get_model_words (entry->manufacturer,
+                                          model ? model : ppd->ppd_display_name);
+          g_free (model);
+
+          if (entry->model[0])
+            {
+              model = g_strjoinv (" ", entry->model);
+              model_key = g_strdup_printf ("%s\n%s", entry->manufacturer, model);
+              index_add_entry (index->models, model_key, n);
+              g_free (model_key);
+              g_free (model);
+            }
+
+          index_add_entry (index->manufacturers, entry->manufacturer, n);
+
+          text = g_strdup_printf ("%s %s",
+                                  manufacturer->manufacturer_display_name ?
+                                    manufacturer->manufacturer_display_name : "",
+                                  ppd->ppd_display_name);
+          entry->words = split_words (text);
+          g_free (text);
+
+          for (k = 0; entry->words[k]; k++)
+            {
+              GArray *entries;
+
+              entries = g_hash_table_lookup (words, entry->words[k]);
+              if (!entries)
+                {
+                  entries = g_array_new (FALSE, FALSE, sizeof (guint));
+                  g_hash_table_insert (words, entry->words[k], entries);
+                }
+
+              if (entries->len == 0 ||
+                  g_array_index (entries, guint, entries->len - 1) != n)
+                g_array_append_val (entries, n);
+            }
+        }
     }
-  else
+
+  index->num_of_words = g_hash_table_size (words);
+  index->words = g_new0 (PpPPDIndexWord, index->num_of_words);
+
+  i = 0;
+  g_hash_table_iter_init (&iter, words);
+  while (g_hash_table_iter_next (&iter, &key, &value))
     {
-      g_thread_unref (thread);
+      index->words[i].word = g_strdup (key);
+      index->words[i].entries = value;
+      i++;
     }
+
+  g_qsort_with_data (index->words,
+                     index->num_of_words,
+                     sizeof (PpPPDIndexWord),
+                     compare_index_words,
+                     NULL);
+
+  g_hash_table_destroy (words);
+
+  return index;
 }
 
-typedef struct
+PpPPDIndex *
+pp_ppd_index_ref (PpPPDIndex *index)
 {
-  GCancellable *cancellable;
-  PAOCallback   callback;
-  gpointer      user_data;
-} PAOData;
+  g_atomic_int_inc (&index->ref_count);
 
-static void
-printer_add_option_async_dbus_cb (GObject      *source_object,
-                                  GAsyncResult *res,
-                                  gpointer      user_data)
+  return index;
+}
+
+void
+pp_ppd_index_unref (PpPPDIndex *index)
 {
-  GVariant *output;
-  gboolean  success = FALSE;
-  PAOData  *data = (PAOData *) user_data;
-  GError   *error = NULL;
+  guint i;
 
-  output = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source_object),
-                                          res,
-                                          &error);
-  g_object_unref (source_object);
+  if (!g_atomic_int_dec_and_test (&index->ref_count))
+    return;
 
-  if (output)
+  for (i = 0; i < index->num_of_entries; i++)
     {
-      const gchar *ret_error;
-
-      g_variant_get (output, "(&s)", &ret_error);
-      if (ret_error[0] != '\0')
-        g_warning ("cups-pk-helper: setting of an option failed: %s", ret_error);
-      else
-        success = TRUE;
-
-      g_variant_unref (output);
+      g_free (index->entries[i].ppd_name);
+      g_free (index->entries[i].ppd_display_name);
+      g_free (index->entries[i].ppd_device_id);
+      g_free (index->entries[i].manufacturer);
+      g_strfreev (index->entries[i].model);
+      g_strfreev (index->entries[i].commands);
+      g_strfreev (index->entries[i].words);
     }
-  else
+
+  for (i = 0; i < index->num_of_words; i++)
     {
-      if (error->code != G_IO_ERROR_CANCELLED)
-        g_warning ("%s", error->message);
-      g_error_free (error);
+      g_free (index->words[i].word);
+      g_array_unref (index->words[i].entries);
     }
 
-  data->callback (success, data->user_data);
-
-  if (data->cancellable)
-    g_object_unref (data->cancellable);
-  g_free (data);
+  g_hash_table_destroy (index->models);
+  g_hash_table_destroy (index->manufacturers);
+  g_free (index->entries);
+  g_free (index->words);
+  g_free (index);
 }
 
-void
-printer_add_option_async (const gchar   *printer_name,
-                          const gchar   *option_name,
-                          gchar        **values,
-                          gboolean       set_default,
-                          GCancellable  *cancellable,
-                          PAOCallback    callback,
-                          gpointer       user_data)
+static PPDName **
+get_matches_names (PpPPDIndex *index,
+                   GArray     *matches,
+                   gint        count)
 {
-  GVariantBuilder  array_builder;
-  GDBusConnection *bus;
-  PAOData         *data;
-  GError          *error = NULL;
-  gint             i;
+  PpPPDIndexMatch *match;
+  PPDName        **result;
+  guint            i, n;
 
-  bus = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, &error);
-  if (!bus)
-   {
-     g_warning ("Failed to get system bus: %s", error->message);
-     g_error_free (error);
-     callback (FALSE, user_data);
-     return;
-   }
+  if (matches->len == 0)
+    return NULL;
 
-  g_variant_builder_init (&array_builder, G_VARIANT_TYPE ("as"));
-  if (values)
+  g_array_sort_with_data (matches, compare_matches, index);
+
+  n = count > 0 ? MIN (matches->len, (guint) count) : matches->len;
+  result = g_new0 (PPDName *, n + 1);
+
+  for (i = 0; i < n; i++)
     {
-      for (i = 0; values[i]; i++)
-        g_variant_builder_add (&array_builder, "s", values[i]);
-    }
+      match = &g_array_index (matches, PpPPDIndexMatch, i);
 
-  data = g_new0 (PAOData, 1);
-  data->cancellable = cancellable;
-  data->callback = callback;
-  data->user_data = user_data;
+      result[i] = g_new0 (PPDName, 1);
+      result[i]->ppd_name = g_strdup (index->entries[match->entry].ppd_name);
+      result[i]->ppd_display_name = g_strdup (index->entries[match->entry].ppd_display_name);
+      result[i]->ppd_device_id = g_strdup (index->entries[match->entry].ppd_device_id);
+      result[i]->ppd_match_level = match->match_level;
+    }
 
-  g_dbus_connection_call (bus,
-                          MECHANISM_BUS,
-                          "/",
-                          MECHANISM_BUS,
-                          set_default ? "PrinterAddOptionDefault" :
-                                        "PrinterAddOption",
-                          g_variant_new ("(ssas)",
-                                         printer_name,
-                                         option_name,
-                                         &array_builder),
-                          G_VARIANT_TYPE ("(s)"),
-                          G_DBUS_CALL_FLAGS_NONE,
-                          DBUS_TIMEOUT,
-                          cancellable,
-                          printer_add_option_async_dbus_cb,
-                          data);
+  return result;
 }
 
-typedef struct
+/*
+ * Return "count" best drivers for a device, ordered by match level
+ * like the result of GetBestDrivers: exact model (and command sets),
+ * close model and finally generic drivers for its command sets.
+ */
+PPDName **
+pp_ppd_index_match_device (PpPPDIndex  *index,
+                           const gchar *device_id,
+                           const gchar *device_make_and_model,
+                           gint         count)
 {
-  GCancellable *cancellable;
-  GCDCallback   callback;
-  gpointer      user_data;
-  GList        *backend_list;
-} GCDData;
+  PpPPDIndexMatch  match;
+  PpPPDIndexEntry *entry;
+  PPDName        **result;
+  GArray          *matches;
+  GArray          *entries;
+  guint8          *matched;
+  gchar          **commands = NULL;
+  gchar          **model = NULL;
+  gchar           *manufacturer = NULL;
+  gchar           *mfg = NULL;
+  gchar           *mdl = NULL;
+  gchar           *key;
+  gchar           *tmp;
+  guint            i;
+  gint             j, k;
+
+  if (device_id)
+    {
+      mfg = get_tag_value (device_id, "mfg");
+      if (!mfg)
+        mfg = get_tag_value (device_id, "manufacturer");
 
-static gint
-get_suffix_index (gchar *string)
-{
-  gchar *number;
-  gchar *endptr;
-  gint   index = -1;
+      mdl = get_tag_value (device_id, "mdl");
+      if (!mdl)
+        mdl = get_tag_value (device_id, "model");
 
-  number = g_strrstr (string, ":");
-  if (number)
-    {
-      number++;
-      index = g_ascii_strtoll (number, &endptr, 10);
-      if (index == 0 && endptr == number)
-        index = -1;
+      commands = get_command_sets (device_id);
     }
 
-  return index;
-}
-
-static void
-get_cups_devices_async_dbus_cb (GObject      *source_object,
-                                GAsyncResult *res,
-                                gpointer      user_data)
+  /* make-and-model usually starts with name of the manufacturer */
+  if (device_make_and_model && device_make_and_model[0] != '\0')
+    {
+      if (!mfg && (tmp = strchr (device_make_and_model, ' ')) != NULL)
+        mfg = g_strndup (device_make_and_model, tmp - device_make_and_model);
 
-{
-  PpPrintDevice **devices = NULL;
-  GVariant       *output;
-  GCDData        *data = (GCDData *) user_data;
-  GError         *error = NULL;
-  GList          *result = NULL;
-  gint            num_of_devices = 0;
+      if (!mdl)
+        mdl = g_strdup (device_make_and_model);
+    }
 
-  output = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source_object),
-                                          res,
-                                          &error);
+  matches = g_array_new (FALSE, FALSE, sizeof (PpPPDIndexMatch));
+  matched = g_new0 (guint8, index->num_of_entries);
 
-  if (output)
+  if (mfg && mdl)
     {
-      const gchar *ret_error;
-      GVariant    *devices_variant = NULL;
-
-      g_variant_get (output, "(&s@a{ss})",
-                     &ret_error,
-                     &devices_variant);
-
-      if (ret_error[0] != '\0')
-        {
-          g_warning ("cups-pk-helper: getting of CUPS devices failed: %s", ret_error);
-        }
+      manufacturer = canonical_manufacturer_name (mfg);
+      model = get_model_words (manufacturer, mdl);
 
-      if (devices_variant)
+      if (model[0])
         {
-          GVariantIter *iter;
-          GVariant     *item;
-          gchar        *key;
-          gchar        *value;
-          gint          index = -1, max_index = -1, i;
-
-          g_variant_get (devices_variant, "a{ss}", &iter);
-          while ((item = g_variant_iter_next_value (iter)))
-            {
-              g_variant_get (item, "{ss}", &key, &value);
-
-              index = get_suffix_index (key);
-              if (index > max_index)
-                max_index = index;
-
-              g_free (key);
-              g_free (value);
-              g_variant_unref (item);
-            }
+          tmp = g_strjoinv (" ", model);
+          key = g_strdup_printf ("%s\n%s", manufacturer, tmp);
+          entries = g_hash_table_lookup (index->models, key);
+          g_free (key);
+          g_free (tmp);
 
-          if (max_index >= 0)
+          for (i = 0; entries && i < entries->len; i++)
             {
-              num_of_devices = max_index + 1;
-              devices = g_new0 (PpPrintDevice *, num_of_devices);
+              match.entry = g_array_index (entries, guint, i);
+              match.match_level = PPD_EXACT_MATCH;
+              match.score = 100;
 
-              g_variant_get (devices_variant, "a{ss}", &iter);
-              while ((item = g_variant_iter_next_value (iter)))
+              /* All command sets of the driver have to be supported */
+              entry = &index->entries[match.entry];
+              if (commands && entry->commands && entry->commands[0])
                 {
-                  g_variant_get (item, "{ss}", &key, &value);
-
-                  index = get_suffix_index (key);
-                  if (index >= 0)
+                  match.match_level = PPD_EXACT_CMD_MATCH;
+                  for (j = 0; entry->commands[j]; j++)
                     {
-                      if (!devices[index])
-                        devices[index] = g_new0 (PpPrintDevice, 1);
+                      for (k = 0; commands[k]; k++)
+                        if (g_strcmp0 (commands[k], entry->commands[j]) == 0)
+                          break;
 
-                      if (g_str_has_prefix (key, "device-class"))
-                        devices[index]->device_class = g_strdup (value);
-                      else if (g_str_has_prefix (key, "device-id"))
-                        devices[index]->device_id = g_strdup (value);
-                      else if (g_str_has_prefix (key, "device-info"))
-                        devices[index]->device_info = g_strdup (value);
-                      else if (g_str_has_prefix (key, "device-make-and-model"))
+                      if (!commands[k])
                         {
-                          devices[index]->device_make_and_model = g_strdup (value);
-                          devices[index]->device_name = g_strdup (value);
+                          match.match_level = PPD_EXACT_MATCH;
+                          break;
                         }
-                      else if (g_str_has_prefix (key, "device-uri"))
-                        devices[index]->device_uri = g_strdup (value);
-                      else if (g_str_has_prefix (key, "device-location"))
-                        devices[index]->device_location = g_strdup (value);
-
-                      devices[index]->acquisition_method = ACQUISITION_METHOD_DEFAULT_CUPS_SERVER;
                     }
-
-                  g_free (key);
-                  g_free (value);
-                  g_variant_unref (item);
                 }
 
-              for (i = 0; i < num_of_devices; i++)
-                result = g_list_append (result, devices[i]);
-
-              g_free (devices);
+              g_array_append_val (matches, match);
+              matched[match.entry] = 1;
             }
-
-          g_variant_unref (devices_variant);
         }
 
-      g_variant_unref (output);
+      entries = g_hash_table_lookup (index->manufacturers, manufacturer);
+      for (i = 0; entries && i < entries->len; i++)
+        {
+          match.entry = g_array_index (entries, guint, i);
+          if (matched[match.entry])
+            continue;
+
+          match.score = score_words (model, index->entries[match.entry].model, FALSE, TRUE);
+          if (match.score >= PPD_INDEX_CLOSE_SCORE)
+            {
+              match.match_level = PPD_CLOSE_MATCH;
+              g_array_append_val (matches, match);
+              matched[match.entry] = 1;
+            }
+        }
     }
-  else
+
+  entries = g_hash_table_lookup (index->manufacturers, "generic");
+  if (entries && commands)
     {
-      if (error->domain != G_IO_ERROR ||
-          error->code != G_IO_ERROR_CANCELLED)
-        g_warning ("%s", error->message);
-      g_error_free (error);
+      gchar *generic[2] = { NULL, NULL };
 
-      data->callback (result,
-                      TRUE,
-                      g_cancellable_is_cancelled (data->cancellable),
-                      data->user_data);
+      if (has_command_set (commands, "postscript") ||
+          has_command_set (commands, "brscript"))
+        generic[0] = (gchar *) "postscript";
+      else if (has_command_set (commands, "pcl"))
+        generic[0] = (gchar *) "pcl";
 
-      g_list_free_full (data->backend_list, g_free);
-      data->backend_list = NULL;
-      g_object_unref (source_object);
-      if (data->cancellable)
-        g_object_unref (data->cancellable);
-      g_free (data);
+      for (i = 0; generic[0] && i < entries->len; i++)
+        {
+          match.entry = g_array_index (entries, guint, i);
+          if (matched[match.entry])
+            continue;
 
-      return;
+          match.score = score_words (generic, index->entries[match.entry].words, FALSE, FALSE);
+          if (match.score > 0)
+            {
+              match.match_level = PPD_GENERIC_MATCH;
+              g_array_append_val (matches, match);
+            }
+        }
     }
 
-  if (data->backend_list)
-    {
-      if (!g_cancellable_is_cancelled (data->cancellable))
-        {
-          GVariantBuilder include_scheme_builder;
+  result = get_matches_names (index, matches, count);
 
-          data->callback (result,
-                          FALSE,
-                          FALSE,
-                          data->user_data);
+  g_free (matched);
+  g_array_free (matches, TRUE);
+  g_strfreev (commands);
+  g_strfreev (model);
+  g_free (manufacturer);
+  g_free (mfg);
+  g_free (mdl);
 
-          g_variant_builder_init (&include_scheme_builder, G_VARIANT_TYPE ("as"));
-          g_variant_builder_add (&include_scheme_builder, "s", data->backend_list->data);
+  return result;
+}
 
-          g_free (data->backend_list->data);
-          data->backend_list = g_list_remove_link (data->backend_list, data->backend_list);
+/*
+ * Find range of words starting with given prefix and
+ * return number of entries containing them.
+ */
+static guint
+find_words_with_prefix (PpPPDIndex  *index,
+                        const gchar *prefix,
+                        guint       *first,
+                        guint       *last)
+{
+  guint low = 0, high = index->num_of_words, middle;
+  guint n = 0;
 
-          g_dbus_connection_call (G_DBUS_CONNECTION (g_object_ref (source_object)),
-                                  MECHANISM_BUS,
-                                  "/",
-                                  MECHANISM_BUS,
-                                  "DevicesGet",
-                                  g_variant_new ("(iiasas)",
-                                                 0,
-                                                 0,
-                                                 &include_scheme_builder,
-                                                 NULL),
-                                  G_VARIANT_TYPE ("(sa{ss})"),
-                                  G_DBUS_CALL_FLAGS_NONE,
-                                  DBUS_TIMEOUT,
-                                  data->cancellable,
-                                  get_cups_devices_async_dbus_cb,
-                                  user_data);
-          return;
-        }
+  while (low < high)
+    {
+      middle = low + (high - low) / 2;
+      if (g_strcmp0 (index->words[middle].word, prefix) < 0)
+        low = middle + 1;
       else
-        {
-          data->callback (result,
-                          TRUE,
-                          TRUE,
-                          data->user_data);
+        high = middle;
+    }
 
-          g_list_free_full (data->backend_list, g_free);
-          data->backend_list = NULL;
+  *first = low;
+  while (low < index->num_of_words &&
+         g_str_has_prefix (index->words[low].word, prefix))
+    n += index->words[low++].entries->len;
+  *last = low;
+
+  return n;
+}
+
+/*
+ * Return at most "count" drivers whose manufacturer and model
+ * match what the user typed so far, best matches first.
+ */
+PPDName **
+pp_ppd_index_search (PpPPDIndex  *index,
+                     const gchar *text,
+                     gint         count)
+{
+  PpPPDIndexMatch  match;
+  PPDName        **result;
+  GArray          *matches;
+  GArray          *entries;
+  guint8          *checked;
+  gchar          **query;
+  guint            first, last, best_first = 0, best_last = 0;
+  guint            n, best_n = G_MAXUINT;
+  guint            i, j;
+
+  query = split_words (text);
+  if (!query[0])
+    {
+      g_strfreev (query);
+      return NULL;
+    }
+
+  /*
+   * Every word of the query has to match, so only entries
+   * of the least frequent one need to be scored.
+   */
+  for (i = 0; query[i]; i++)
+    {
+      n = find_words_with_prefix (index, query[i], &first, &last);
+      if (n < best_n)
+        {
+          best_n = n;
+          best_first = first;
+          best_last = last;
         }
     }
-  else
+
+  matches = g_array_new (FALSE, FALSE, sizeof (PpPPDIndexMatch));
+  checked = g_new0 (guint8, index->num_of_entries);
+
+  for (i = best_first; i < best_last; i++)
     {
-      data->callback (result,
-                      TRUE,
-                      g_cancellable_is_cancelled (data->cancellable),
-                      data->user_data);
+      entries = index->words[i].entries;
+      for (j = 0; j < entries->len; j++)
+        {
+          match.entry = g_array_index (entries, guint, j);
+          if (checked[match.entry])
+            continue;
+          checked[match.entry] = 1;
+
+          match.score = score_words (query, index->entries[match.entry].words, TRUE, FALSE);
+          if (match.score > 0)
+            {
+              match.match_level = PPD_NO_MATCH;
+              g_array_append_val (matches, match);
+            }
+        }
     }
 
-  g_object_unref (source_object);
-  if (data->cancellable)
-    g_object_unref (data->cancellable);
-  g_free (data);
+  result = get_matches_names (index, matches, count);
+
+  g_free (checked);
+  g_array_free (matches, TRUE);
+  g_strfreev (query);
+
+  return result;
 }
 
-void
-get_cups_devices_async (GCancellable *cancellable,
-                        GCDCallback   callback,
-                        gpointer      user_data)
+gchar *
+get_standard_manufacturers_name (gchar *name)
 {
-  GDBusConnection *bus;
-  GVariantBuilder  include_scheme_builder;
+  gchar *normalized_name;
+  gchar *result = NULL;
+  gint   i;
+
+  if (name)
+    {
+      normalized_name = normalize (name);
+
+      for (i = 0; i < G_N_ELEMENTS (manufacturers_names); i++)
+        {
+          if (g_strcmp0 (manufacturers_names[i].normalized_name, normalized_name) == 0)
+            {
+              result = g_strdup (manufacturers_names[i].display_name);
+              break;
+            }
+        }
+
+      g_free (normalized_name);
+    }
+
+  return result;
+}
+
+typedef struct
+{
+  gchar        *printer_name;
+  gchar        *host_name;
+  gint          port;
+  gchar        *result;
+  PGPCallback   callback;
+  gpointer      user_data;
+  GMainContext *context;
+} PGPData;
+
+static gboolean
+printer_get_ppd_idle_cb (gpointer user_data)
+{
+  PGPData *data = (PGPData *) user_data;
+
+  data->callback (data->result, data->user_data);
+
+  return FALSE;
+}
+
+static void
+printer_get_ppd_data_free (gpointer user_data)
+{
+  PGPData *data = (PGPData *) user_data;
+
+  if (data->context)
+    g_main_context_unref (data->context);
+  g_free (data->result);
+  g_free (data->printer_name);
+  g_free (data->host_name);
+  g_free (data);
+}
+
+static void
+printer_get_ppd_cb (gpointer user_data)
+{
+  PGPData *data = (PGPData *) user_data;
+  GSource *idle_source;
+
+  idle_source = g_idle_source_new ();
+  g_source_set_callback (idle_source,
+                         printer_get_ppd_idle_cb,
+                         data,
+                         printer_get_ppd_data_free);
+  g_source_attach (idle_source, data->context);
+  g_source_unref (idle_source);
+}
+
+static gpointer
+printer_get_ppd_func (gpointer user_data)
+{
+  PGPData *data = (PGPData *) user_data;
+
+  if (data->host_name)
+    {
+      http_t *http;
+
+      http = httpConnect (data->host_name, data->port);
+      if (http)
+        {
+          data->result = g_strdup (cupsGetPPD2 (http, data->printer_name));
+          httpClose (http);
+        }
+    }
+  else
+    {
+      data->result = g_strdup (cupsGetPPD (data->printer_name));
+    }
+
+  printer_get_ppd_cb (data);
+
+  return NULL;
+}
+
+void
+printer_get_ppd_async (const gchar *printer_name,
+                       const gchar *host_name,
+                       gint         port,
+                       PGPCallback  callback,
+                       gpointer     user_data)
+{
+  PGPData *data;
+  GThread *thread;
+  GError  *error = NULL;
+
+  data = g_new0 (PGPData, 1);
+  data->printer_name = g_strdup (printer_name);
+  data->host_name = g_strdup (host_name);
+  data->port = port;
+  data->callback = callback;
+  data->user_data = user_data;
+  data->context = g_main_context_ref_thread_default ();
+
+  thread = g_thread_try_new ("printer-get-ppd",
+                             printer_get_ppd_func,
+                             data,
+                             &error);
+
+  if (!thread)
+    {
+      g_warning ("%s", error->message);
+      callback (NULL, user_data);
+
+      g_error_free (error);
+      printer_get_ppd_data_free (data);
+    }
+  else
+    {
+      g_thread_unref (thread);
+    }
+}
+
+typedef struct
+{
+  gchar        *printer_name;
+  cups_dest_t  *result;
+  GNDCallback   callback;
+  gpointer      user_data;
+  GMainContext *context;
+} GNDData;
+
+static gboolean
+get_named_dest_idle_cb (gpointer user_data)
+{
+  GNDData *data = (GNDData *) user_data;
+
+  data->callback (data->result, data->user_data);
+
+  return FALSE;
+}
+
+static void
+get_named_dest_data_free (gpointer user_data)
+{
+  GNDData *data = (GNDData *) user_data;
+
+  if (data->context)
+    g_main_context_unref (data->context);
+  g_free (data->printer_name);
+  g_free (data);
+}
+
+static void
+get_named_dest_cb (gpointer user_data)
+{
+  GNDData *data = (GNDData *) user_data;
+  GSource *idle_source;
+
+  idle_source = g_idle_source_new ();
+  g_source_set_callback (idle_source,
+                         get_named_dest_idle_cb,
+                         data,
+                         get_named_dest_data_free);
+  g_source_attach (idle_source, data->context);
+  g_source_unref (idle_source);
+}
+
+static gpointer
+get_named_dest_func (gpointer user_data)
+{
+  GNDData *data = (GNDData *) user_data;
+
+  data->result = cupsGetNamedDest (CUPS_HTTP_DEFAULT, data->printer_name, NULL);
+
+  get_named_dest_cb (data);
+
+  return NULL;
+}
+
+void
+get_named_dest_async (const gchar *printer_name,
+                      GNDCallback  callback,
+                      gpointer     user_data)
+{
+  GNDData *data;
+  GThread *thread;
+  GError  *error = NULL;
+
+  data = g_new0 (GNDData, 1);
+  data->printer_name = g_strdup (printer_name);
+  data->callback = callback;
+  data->user_data = user_data;
+  data->context = g_main_context_ref_thread_default ();
+
+  thread = g_thread_try_new ("get-named-dest",
+                             get_named_dest_func,
+                             data,
+                             &error);
+
+  if (!thread)
+    {
+      g_warning ("%s", error->message);
+      callback (NULL, user_data);
+
+      g_error_free (error);
+      get_named_dest_data_free (data);
+    }
+  else
+    {
+      g_thread_unref (thread);
+    }
+}
+
+typedef struct
+{
+  GCancellable *cancellable;
+  PAOCallback   callback;
+  gpointer      user_data;
+} PAOData;
+
+static void
+printer_add_option_async_dbus_cb (GObject      *source_object,
+                                  GAsyncResult *res,
+                                  gpointer      user_data)
+{
+  GVariant *output;
+  gboolean  success = FALSE;
+  PAOData  *data = (PAOData *) user_data;
+  GError   *error = NULL;
+
+  output = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source_object),
+                                          res,
+                                          &error);
+  g_object_unref (source_object);
+
+  if (output)
+    {
+      const gchar *ret_error;
+
+      g_variant_get (output, "(&s)", &ret_error);
+      if (ret_error[0] != '\0')
+        g_warning ("cups-pk-helper: setting of an option failed: %s", ret_error);
+      else
+        success = TRUE;
+
+      g_variant_unref (output);
+    }
+  else
+    {
+      if (error->code != G_IO_ERROR_CANCELLED)
+        g_warning ("%s", error->message);
+      g_error_free (error);
+    }
+
+  data->callback (success, data->user_data);
+
+  if (data->cancellable)
+    g_object_unref (data->cancellable);
+  g_free (data);
+}
+
+void
+printer_add_option_async (const gchar   *printer_name,
+                          const gchar   *option_name,
+                          gchar        **values,
+                          gboolean       set_default,
+                          GCancellable  *cancellable,
+                          PAOCallback    callback,
+                          gpointer       user_data)
+{
+  GVariantBuilder  array_builder;
+  GDBusConnection *bus;
+  PAOData         *data;
+  GError          *error = NULL;
+  gint             i;
+
+  bus = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, &error);
+  if (!bus)
+   {
+     g_warning ("Failed to get system bus: %s", error->message);
+     g_error_free (error);
+     callback (FALSE, user_data);
+     return;
+   }
+
+  g_variant_builder_init (&array_builder, G_VARIANT_TYPE ("as"));
+  if (values)
+    {
+      for (i = 0; values[i]; i++)
+        g_variant_builder_add (&array_builder, "s", values[i]);
+    }
+
+  data = g_new0 (PAOData, 1);
+  data->cancellable = cancellable;
+  data->callback = callback;
+  data->user_data = user_data;
+
+  g_dbus_connection_call (bus,
+                          MECHANISM_BUS,
+                          "/",
+                          MECHANISM_BUS,
+                          set_default ? "PrinterAddOptionDefault" :
+                                        "PrinterAddOption",
+                          g_variant_new ("(ssas)",
+                                         printer_name,
+                                         option_name,
+                                         &array_builder),
+                          G_VARIANT_TYPE ("(s)"),
+                          G_DBUS_CALL_FLAGS_NONE,
+                          DBUS_TIMEOUT,
+                          cancellable,
+                          printer_add_option_async_dbus_cb,
+                          data);
+}
+
+typedef struct
+{
+  GCancellable *cancellable;
+  GCDCallback   callback;
+  gpointer      user_data;
+  GList        *backend_list;
+} GCDData;
+
+static gint
+get_suffix_index (gchar *string)
+{
+  gchar *number;
+  gchar *endptr;
+  gint   index = -1;
+
+  number = g_strrstr (string, ":");
+  if (number)
+    {
+      number++;
+      index = g_ascii_strtoll (number, &endptr, 10);
+      if (index == 0 && endptr == number)
+        index = -1;
+    }
+
+  return index;
+}
+
+static void
+get_cups_devices_async_dbus_cb (GObject      *source_object,
+                                GAsyncResult *res,
+                                gpointer      user_data)
+
+{
+  PpPrintDevice **devices = NULL;
+  GVariant       *output;
+  GCDData        *data = (GCDData *) user_data;
+  GError         *error = NULL;
+  GList          *result = NULL;
+  gint            num_of_devices = 0;
+
+  output = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source_object),
+                                          res,
+                                          &error);
+
+  if (output)
+    {
+      const gchar *ret_error;
+      GVariant    *devices_variant = NULL;
+
+      g_variant_get (output, "(&s@a{ss})",
+                     &ret_error,
+                     &devices_variant);
+
+      if (ret_error[0] != '\0')
+        {
+          g_warning ("cups-pk-helper: getting of CUPS devices failed: %s", ret_error);
+        }
+
+      if (devices_variant)
+        {
+          GVariantIter *iter;
+          GVariant     *item;
+          gchar        *key;
+          gchar        *value;
+          gint          index = -1, max_index = -1, i;
+
+          g_variant_get (devices_variant, "a{ss}", &iter);
+          while ((item = g_variant_iter_next_value (iter)))
+            {
+              g_variant_get (item, "{ss}", &key, &value);
+
+              index = get_suffix_index (key);
+              if (index > max_index)
+                max_index = index;
+
+              g_free (key);
+              g_free (value);
+              g_variant_unref (item);
+            }
+
+          if (max_index >= 0)
+            {
+              num_of_devices = max_index + 1;
+              devices = g_new0 (PpPrintDevice *, num_of_devices);
+
+              g_variant_get (devices_variant, "a{ss}", &iter);
+              while ((item = g_variant_iter_next_value (iter)))
+                {
+                  g_variant_get (item, "{ss}", &key, &value);
+
+                  index = get_suffix_index (key);
+                  if (index >= 0)
+                    {
+                      if (!devices[index])
+                        devices[index] = g_new0 (PpPrintDevice, 1);
+
+                      if (g_str_has_prefix (key, "device-class"))
+                        devices[index]->device_class = g_strdup (value);
+                      else if (g_str_has_prefix (key, "device-id"))
+                        devices[index]->device_id = g_strdup (value);
+                      else if (g_str_has_prefix (key, "device-info"))
+                        devices[index]->device_info = g_strdup (value);
+                      else if (g_str_has_prefix (key, "device-make-and-model"))
+                        {
+                          devices[index]->device_make_and_model = g_strdup (value);
+                          devices[index]->device_name = g_strdup (value);
+                        }
+                      else if (g_str_has_prefix (key, "device-uri"))
+                        devices[index]->device_uri = g_strdup (value);
+                      else if (g_str_has_prefix (key, "device-location"))
+                        devices[index]->device_location = g_strdup (value);
+
+                      devices[index]->acquisition_method = ACQUISITION_METHOD_DEFAULT_CUPS_SERVER;
+                    }
+
+                  g_free (key);
+                  g_free (value);
+                  g_variant_unref (item);
+                }
+
+              for (i = 0; i < num_of_devices; i++)
+                result = g_list_append (result, devices[i]);
+
+              g_free (devices);
+            }
+
+          g_variant_unref (devices_variant);
+        }
+
+      g_variant_unref (output);
+    }
+  else
+    {
+      if (error->domain != G_IO_ERROR ||
+          error->code != G_IO_ERROR_CANCELLED)
+        g_warning ("%s", error->message);
+      g_error_free (error);
+
+      data->callback (result,
+                      TRUE,
+                      g_cancellable_is_cancelled (data->cancellable),
+                      data->user_data);
+
+      g_list_free_full (data->backend_list, g_free);
+      data->backend_list = NULL;
+      g_object_unref (source_object);
+      if (data->cancellable)
+        g_object_unref (data->cancellable);
+      g_free (data);
+
+      return;
+    }
+
+  if (data->backend_list)
+    {
+      if (!g_cancellable_is_cancelled (data->cancellable))
+        {
+          GVariantBuilder include_scheme_builder;
+
+          data->callback (result,
+                          FALSE,
+                          FALSE,
+                          data->user_data);
+
+          g_variant_builder_init (&include_scheme_builder, G_VARIANT_TYPE ("as"));
+          g_variant_builder_add (&include_scheme_builder, "s", data->backend_list->data);
+
+          g_free (data->backend_list->data);
+          data->backend_list = g_list_remove_link (data->backend_list, data->backend_list);
+
+          g_dbus_connection_call (G_DBUS_CONNECTION (g_object_ref (source_object)),
+                                  MECHANISM_BUS,
+                                  "/",
+                                  MECHANISM_BUS,
+                                  "DevicesGet",
+                                  g_variant_new ("(iiasas)",
+                                                 0,
+                                                 0,
+                                                 &include_scheme_builder,
+                                                 NULL),
+                                  G_VARIANT_TYPE ("(sa{ss})"),
+                                  G_DBUS_CALL_FLAGS_NONE,
+                                  DBUS_TIMEOUT,
+                                  data->cancellable,
+                                  get_cups_devices_async_dbus_cb,
+                                  user_data);
+          return;
+        }
+      else
+        {
+          data->callback (result,
+                          TRUE,
+                          TRUE,
+                          data->user_data);
+
+          g_list_free_full (data->backend_list, g_free);
+          data->backend_list = NULL;
+        }
+    }
+  else
+    {
+      data->callback (result,
+                      TRUE,
+                      g_cancellable_is_cancelled (data->cancellable),
+                      data->user_data);
+    }
+
+  g_object_unref (source_object);
+  if (data->cancellable)
+    g_object_unref (data->cancellable);
+  g_free (data);
+}
+
+void
+get_cups_devices_async (GCancellable *cancellable,
+                        GCDCallback   callback,
+                        gpointer      user_data)
+{
+  GDBusConnection *bus;
+  GVariantBuilder  include_scheme_builder;
   GCDData         *data;
   GError          *error = NULL;
-  gint             i;
-  const gchar     *backends[] =
-    {"hpfax", "ncp", "beh", "bluetooth", "snmp",
-     "dnssd", "hp", "ipp", "lpd", "parallel",
-     "serial", "socket", "usb", NULL};
+  gint             i;
+  const gchar     *backends[] =
+    {"hpfax", "ncp", "beh", "bluetooth", "snmp",
+     "dnssd", "hp", "ipp", "lpd", "parallel",
+     "serial", "socket", "usb", NULL};
+
+  bus = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, &error);
+  if (!bus)
+   {
+     g_warning ("Failed to get system bus: %s", error->message);
+     g_error_free (error);
+     callback (NULL, TRUE, FALSE, user_data);
+     return;
+   }
+
+  data = g_new0 (GCDData, 1);
+  if (cancellable)
+    data->cancellable = g_object_ref (cancellable);
+  data->callback = callback;
+  data->user_data = user_data;
+  for (i = 0; backends[i]; i++)
+    data->backend_list = g_list_prepend (data->backend_list, g_strdup (backends[i]));
+
+  g_variant_builder_init (&include_scheme_builder, G_VARIANT_TYPE ("as"));
+  g_variant_builder_add (&include_scheme_builder, "s", data->backend_list->data);
+
+  g_free (data->backend_list->data);
+  data->backend_list = g_list_remove_link (data->backend_list, data->backend_list);
+
+  g_dbus_connection_call (bus,
+                          MECHANISM_BUS,
+                          "/",
+                          MECHANISM_BUS,
+                          "DevicesGet",
+                          g_variant_new ("(iiasas)",
+                                         0,
+                                         0,
+                                         &include_scheme_builder,
+                                         NULL),
+                          G_VARIANT_TYPE ("(sa{ss})"),
+                          G_DBUS_CALL_FLAGS_NONE,
+                          DBUS_TIMEOUT,
+                          cancellable,
+                          get_cups_devices_async_dbus_cb,
+                          data);
+}
+
+void
+pp_print_device_free (PpPrintDevice *device)
+{
+  if (device)
+    {
+      g_free (device->device_class);
+      g_free (device->device_id);
+      g_free (device->device_info);
+      g_free (device->device_make_and_model);
+      g_free (device->device_uri);
+      g_free (device->device_location);
+      g_free (device->device_name);
+      g_free (device->device_ppd);
+      g_free (device);
+    }
+}
+
+typedef struct
+{
+  gchar        *printer_name;
+  gboolean      my_jobs;
+  gint          which_jobs;
+  cups_job_t   *jobs;
+  gint          num_of_jobs;
+  CGJCallback   callback;
+  gpointer      user_data;
+  GMainContext *context;
+} CGJData;
+
+static gboolean
+cups_get_jobs_idle_cb (gpointer user_data)
+{
+  CGJData *data = (CGJData *) user_data;
+
+  data->callback (data->jobs,
+                  data->num_of_jobs,
+                  data->user_data);
+
+  return FALSE;
+}
+
+static void
+cups_get_jobs_data_free (gpointer user_data)
+{
+  CGJData *data = (CGJData *) user_data;
+
+  if (data->context)
+    g_main_context_unref (data->context);
+  g_free (data->printer_name);
+  g_free (data);
+}
+
+static void
+cups_get_jobs_cb (gpointer user_data)
+{
+  CGJData *data = (CGJData *) user_data;
+  GSource *idle_source;
+
+  idle_source = g_idle_source_new ();
+  g_source_set_callback (idle_source,
+                         cups_get_jobs_idle_cb,
+                         data,
+                         cups_get_jobs_data_free);
+  g_source_attach (idle_source, data->context);
+  g_source_unref (idle_source);
+}
+
+static gpointer
+cups_get_jobs_func (gpointer user_data)
+{
+  CGJData *data = (CGJData *) user_data;
+
+  data->num_of_jobs = cupsGetJobs (&data->jobs,
+                                   data->printer_name,
+                                   data->my_jobs ? 1 : 0,
+                                   data->which_jobs);
+
+  cups_get_jobs_cb (data);
+
+  return NULL;
+}
+
+void
+cups_get_jobs_async (const gchar *printer_name,
+                     gboolean     my_jobs,
+                     gint         which_jobs,
+                     CGJCallback  callback,
+                     gpointer     user_data)
+{
+  CGJData *data;
+  GThread *thread;
+  GError  *error = NULL;
+
+  data = g_new0 (CGJData, 1);
+  data->printer_name = g_strdup (printer_name);
+  data->my_jobs = my_jobs;
+  data->which_jobs = which_jobs;
+  data->callback = callback;
+  data->user_data = user_data;
+  data->context = g_main_context_ref_thread_default ();
+
+  thread = g_thread_try_new ("cups-get-jobs",
+                             cups_get_jobs_func,
+                             data,
+                             &error);
+
+  if (!thread)
+    {
+      g_warning ("%s", error->message);
+      callback (NULL, 0, user_data);
+
+      g_error_free (error);
+      cups_get_jobs_data_free (data);
+    }
+  else
+    {
+      g_thread_unref (thread);
+    }
+}
+
+typedef struct
+{
+  GCancellable *cancellable;
+  JCPCallback   callback;
+  gpointer      user_data;
+} JCPData;
+
+static void
+job_cancel_purge_async_dbus_cb (GObject      *source_object,
+                                GAsyncResult *res,
+                                gpointer      user_data)
+{
+  GVariant *output;
+  JCPData  *data = (JCPData *) user_data;
+  GError   *error = NULL;
+
+  output = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source_object),
+                                          res,
+                                          &error);
+  g_object_unref (source_object);
+
+  if (output)
+    {
+      g_variant_unref (output);
+    }
+  else
+    {
+      if (!g_cancellable_is_cancelled (data->cancellable))
+        g_warning ("%s", error->message);
+      g_error_free (error);
+    }
+
+  data->callback (data->user_data);
+
+  if (data->cancellable)
+    g_object_unref (data->cancellable);
+  g_free (data);
+}
+
+void
+job_cancel_purge_async (gint          job_id,
+                        gboolean      job_purge,
+                        GCancellable *cancellable,
+                        JCPCallback   callback,
+                        gpointer      user_data)
+{
+  GDBusConnection *bus;
+  JCPData         *data;
+  GError          *error = NULL;
 
   bus = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, &error);
   if (!bus)
-   {
-     g_warning ("Failed to get system bus: %s", error->message);
-     g_error_free (error);
-     callback (NULL, TRUE, FALSE, user_data);
-     return;
-   }
+    {
+      g_warning ("Failed to get session bus: %s", error->message);
+      g_error_free (error);
+      callback (user_data);
+      return;
+    }
 
-  data = g_new0 (GCDData, 1);
+  data = g_new0 (JCPData, 1);
   if (cancellable)
     data->cancellable = g_object_ref (cancellable);
   data->callback = callback;
   data->user_data = user_data;
-  for (i = 0; backends[i]; i++)
-    data->backend_list = g_list_prepend (data->backend_list, g_strdup (backends[i]));
 
-  g_variant_builder_init (&include_scheme_builder, G_VARIANT_TYPE ("as"));
-  g_variant_builder_add (&include_scheme_builder, "s", data->backend_list->data);
+  g_dbus_connection_call (bus,
+                          MECHANISM_BUS,
+                          "/",
+                          MECHANISM_BUS,
+                          "JobCancelPurge",
+                          g_variant_new ("(ib)",
+                                         job_id,
+                                         job_purge),
+                          G_VARIANT_TYPE ("(s)"),
+                          G_DBUS_CALL_FLAGS_NONE,
+                          -1,
+                          NULL,
+                          job_cancel_purge_async_dbus_cb,
+                          data);
+}
 
-  g_free (data->backend_list->data);
-  data->backend_list = g_list_remove_link (data->backend_list, data->backend_list);
+typedef struct
+{
+  GCancellable *cancellable;
+  JSHUCallback  callback;
+  gpointer      user_data;
+} JSHUData;
+
+static void
+job_set_hold_until_async_dbus_cb (GObject      *source_object,
+                                  GAsyncResult *res,
+                                  gpointer      user_data)
+{
+  GVariant *output;
+  JSHUData *data = (JSHUData *) user_data;
+  GError   *error = NULL;
+
+  output = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source_object),
+                                          res,
+                                          &error);
+  g_object_unref (source_object);
+
+  if (output)
+    {
+      g_variant_unref (output);
+    }
+  else
+    {
+      if (!g_cancellable_is_cancelled (data->cancellable))
+        g_warning ("%s", error->message);
+      g_error_free (error);
+    }
+
+  data->callback (data->user_data);
+
+  if (data->cancellable)
+    g_object_unref (data->cancellable);
+  g_free (data);
+}
+
+void
+job_set_hold_until_async (gint          job_id,
+                          const gchar  *job_hold_until,
+                          GCancellable *cancellable,
+                          JSHUCallback  callback,
+                          gpointer      user_data)
+{
+  GDBusConnection *bus;
+  JSHUData        *data;
+  GError          *error = NULL;
+
+  bus = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, &error);
+  if (!bus)
+    {
+      g_warning ("Failed to get session bus: %s", error->message);
+      g_error_free (error);
+      callback (user_data);
+      return;
+    }
+
+  data = g_new0 (JSHUData, 1);
+  if (cancellable)
+    data->cancellable = g_object_ref (cancellable);
+  data->callback = callback;
+  data->user_data = user_data;
 
   g_dbus_connection_call (bus,
                           MECHANISM_BUS,
                           "/",
                           MECHANISM_BUS,
-                          "DevicesGet",
-                          g_variant_new ("(iiasas)",
-                                         0,
-                                         0,
-                                         &include_scheme_builder,
-                                         NULL),
-                          G_VARIANT_TYPE ("(sa{ss})"),
+                          "JobSetHoldUntil",
+                          g_variant_new ("(is)",
+                                         job_id,
+                                         job_hold_until),
+                          G_VARIANT_TYPE ("(s)"),
                           G_DBUS_CALL_FLAGS_NONE,
-                          DBUS_TIMEOUT,
-                          cancellable,
-                          get_cups_devices_async_dbus_cb,
+                          -1,
+                          NULL,
+                          job_set_hold_until_async_dbus_cb,
                           data);
 }
 
+/* Number of job states which are not final, IPP_JOB_PENDING to IPP_JOB_STOPPED */
+#define NUM_ACTIVE_JOB_STATES (IPP_JOB_CANCELED - IPP_JOB_PENDING)
+
+typedef struct
+{
+  const gchar *printer_name;
+  gint         job_state;
+} PpJobsCounterJob;
+
+struct _PpJobsCounter
+{
+  /* printer name -> guint[NUM_ACTIVE_JOB_STATES] */
+  GHashTable *printers;
+  /* job id -> PpJobsCounterJob */
+  GHashTable *jobs;
+  /* ids of the active jobs of other users */
+  GHashTable *foreign_jobs;
+};
+
+static gboolean
+job_state_is_active (gint job_state)
+{
+  return job_state >= IPP_JOB_PENDING && job_state < IPP_JOB_CANCELED;
+}
+
+static PpJobsCounter *
+pp_jobs_counter_new (void)
+{
+  PpJobsCounter *counter;
+
+  counter = g_new0 (PpJobsCounter, 1);
+  counter->printers = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  counter->jobs = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, g_free);
+  counter->foreign_jobs = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+  return counter;
+}
+
+void
+pp_jobs_counter_free (PpJobsCounter *counter)
+{
+  if (counter)
+    {
+      g_hash_table_destroy (counter->foreign_jobs);
+      g_hash_table_destroy (counter->jobs);
+      g_hash_table_destroy (counter->printers);
+      g_free (counter);
+    }
+}
+
+/*
+ * Records that job @job_id is now in @job_state, as
+ * reported by the job-created and job-completed notifications. Jobs which
+ * reached a final state are forgotten.
+ *
+ * The notifications don't say whose job it is, so only jobs the counter
+ * already knows are updated; jobs of other users it saw are just
+ * forgotten once they finish. Returns FALSE for a job it doesn't know; if
+ * the job is active, it may be a new job of the current user, which only
+ * a new count can tell.
+ */
+gboolean
+pp_jobs_counter_job_changed (PpJobsCounter *counter,
+                             gint           job_id,
+                             gint           job_state)
+{
+  PpJobsCounterJob *job;
+  guint            *counts;
+
+  g_return_val_if_fail (counter != NULL, FALSE);
+
+  if (g_hash_table_lookup_extended (counter->foreign_jobs, GINT_TO_POINTER (job_id), NULL, NULL))
+    {
+      if (!job_state_is_active (job_state))
+        g_hash_table_remove (counter->foreign_jobs, GINT_TO_POINTER (job_id));
+      return TRUE;
+    }
+
+  job = g_hash_table_lookup (counter->jobs, GINT_TO_POINTER (job_id));
+  if (!job)
+    return FALSE;
+
+  counts = g_hash_table_lookup (counter->printers, job->printer_name);
+  counts[job->job_state - IPP_JOB_PENDING]--;
+
+  if (!job_state_is_active (job_state))
+    {
+      g_hash_table_remove (counter->jobs, GINT_TO_POINTER (job_id));
+      return TRUE;
+    }
+
+  job->job_state = job_state;
+  counts[job_state - IPP_JOB_PENDING]++;
+
+  return TRUE;
+}
+
+static void
+pp_jobs_counter_add_job (PpJobsCounter *counter,
+                         const gchar   *printer_name,
+                         gint           job_id,
+                         gint           job_state)
+{
+  PpJobsCounterJob *job;
+  gpointer          key;
+  guint            *counts;
+
+  if (pp_jobs_counter_job_changed (counter, job_id, job_state))
+    return;
+
+  if (!printer_name || !job_state_is_active (job_state))
+    return;
+
+  if (!g_hash_table_lookup_extended (counter->printers, printer_name,
+                                     &key, (gpointer *) &counts))
+    {
+      key = g_strdup (printer_name);
+      counts = g_new0 (guint, NUM_ACTIVE_JOB_STATES);
+      g_hash_table_insert (counter->printers, key, counts);
+    }
+
+  job = g_new0 (PpJobsCounterJob, 1);
+  job->printer_name = key;
+  job->job_state = job_state;
+  g_hash_table_insert (counter->jobs, GINT_TO_POINTER (job_id), job);
+
+  counts[job_state - IPP_JOB_PENDING]++;
+}
+
+guint
+pp_jobs_counter_get_active (PpJobsCounter *counter,
+                            const gchar   *printer_name)
+{
+  guint *counts;
+  guint  result = 0;
+  gint   i;
+
+  if (!counter || !printer_name)
+    return 0;
+
+  counts = g_hash_table_lookup (counter->printers, printer_name);
+  if (counts)
+    {
+      for (i = 0; i < NUM_ACTIVE_JOB_STATES; i++)
+        result += counts[i];
+    }
+
+  return result;
+}
+
+static const gchar *
+printer_name_from_uri (const gchar *printer_uri)
+{
+  const gchar *name;
+
+  name = printer_uri ? g_strrstr (printer_uri, "/") : NULL;
+
+  return name ? name + 1 : NULL;
+}
+
+/*
+ * Counts the jobs of the current user which are not finished yet, per
+ * printer and state. Only the attributes needed for that are requested,
+ * in a single request for all printers. The active jobs of other users
+ * are remembered too, so that their notifications can be told apart from
+ * new jobs of the current user. This blocks, so call it from a thread.
+ */
+PpJobsCounter *
+pp_jobs_counter_new_from_cups (void)
+{
+  PpJobsCounter   *counter;
+  ipp_attribute_t *attr;
+  const gchar     *printer_uri;
+  const gchar     *user_name;
+  ipp_t           *request;
+  ipp_t           *response;
+  gint             job_id;
+  gint             job_state;
+  static const char * const requested_attrs[] = {
+    "job-id",
+    "job-originating-user-name",
+    "job-printer-uri",
+    "job-state"};
+
+  request = ippNewRequest (IPP_GET_JOBS);
+  ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI,
+                "printer-uri", NULL, "ipp://localhost/");
+  ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_NAME,
+                "requesting-user-name", NULL, cupsUser ());
+  ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_KEYWORD,
+                "which-jobs", NULL, "not-completed");
+  ippAddStrings (request, IPP_TAG_OPERATION, IPP_TAG_KEYWORD,
+                 "requested-attributes", G_N_ELEMENTS (requested_attrs), NULL, requested_attrs);
+  response = cupsDoRequest (CUPS_HTTP_DEFAULT, request, "/");
+
+  if (!response)
+    return NULL;
+
+  if (ippGetStatusCode (response) > IPP_OK_CONFLICT)
+    {
+      ippDelete (response);
+      return NULL;
+    }
+
+  counter = pp_jobs_counter_new ();
+
+  for (attr = ippFirstAttribute (response); attr != NULL; attr = ippNextAttribute (response))
+    {
+      while (attr != NULL && ippGetGroupTag (attr) != IPP_TAG_JOB)
+        attr = ippNextAttribute (response);
+
+      if (attr == NULL)
+        break;
+
+      job_id = 0;
+      job_state = 0;
+      printer_uri = NULL;
+      user_name = NULL;
+
+      while (attr != NULL && ippGetGroupTag (attr) == IPP_TAG_JOB)
+        {
+          if (g_strcmp0 (ippGetName (attr), "job-id") == 0 &&
+              ippGetValueTag (attr) == IPP_TAG_INTEGER)
+            job_id = ippGetInteger (attr, 0);
+          else if (g_strcmp0 (ippGetName (attr), "job-state") == 0 &&
+                   ippGetValueTag (attr) == IPP_TAG_ENUM)
+            job_state = ippGetInteger (attr, 0);
+          else if (g_strcmp0 (ippGetName (attr), "job-printer-uri") == 0 &&
+                   ippGetValueTag (attr) == IPP_TAG_URI)
+            printer_uri = ippGetString (attr, 0, NULL);
+          else if (g_strcmp0 (ippGetName (attr), "job-originating-user-name") == 0 &&
+                   ippGetValueTag (attr) == IPP_TAG_NAME)
+            user_name = ippGetString (attr, 0, NULL);
+
+          attr = ippNextAttribute (response);
+        }
+
+      /* CUPS hides the owner of other users' jobs by default, so a job is
+       * only ours if it carries our name */
+      if (job_id > 0 && g_strcmp0 (user_name, cupsUser ()) != 0)
+        {
+          if (job_state_is_active (job_state))
+            g_hash_table_add (counter->foreign_jobs, GINT_TO_POINTER (job_id));
+        }
+      else if (job_id > 0)
+        pp_jobs_counter_add_job (counter,
+                                 printer_name_from_uri (printer_uri),
+                                 job_id,
+                                 job_state);
+
+      if (attr == NULL)
+        break;
+    }
+
+  ippDelete (response);
+
+  return counter;
+}
+
+/*
+ * Finds the printer which got the most recent job of the current user,
+ * asking only for the job's printer.
+ */
+static gchar *
+get_last_used_printer (void)
+{
+  ipp_attribute_t *attr;
+  ipp_t           *request;
+  ipp_t           *response;
+  gchar           *result = NULL;
+  gint             last_job_id = 0;
+  gint             job_id;
+  const gchar     *printer_uri;
+  static const char * const requested_attrs[] = {
+    "job-id",
+    "job-printer-uri"};
+
+  request = ippNewRequest (IPP_GET_JOBS);
+  ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_URI,
+                "printer-uri", NULL, "ipp://localhost/");
+  ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_NAME,
+                "requesting-user-name", NULL, cupsUser ());
+  ippAddBoolean (request, IPP_TAG_OPERATION, "my-jobs", 1);
+  ippAddString (request, IPP_TAG_OPERATION, IPP_TAG_KEYWORD,
+                "which-jobs", NULL, "all");
+  ippAddStrings (request, IPP_TAG_OPERATION, IPP_TAG_KEYWORD,
+                 "requested-attributes", G_N_ELEMENTS (requested_attrs), NULL, requested_attrs);
+  response = cupsDoRequest (CUPS_HTTP_DEFAULT, request, "/");
+
+  if (!response)
+    return NULL;
+
+  if (ippGetStatusCode (response) <= IPP_OK_CONFLICT)
+    {
+      for (attr = ippFirstAttribute (response); attr != NULL; attr = ippNextAttribute (response))
+        {
+          while (attr != NULL && ippGetGroupTag (attr) != IPP_TAG_JOB)
+            attr = ippNextAttribute (response);
+
+          if (attr == NULL)
+            break;
+
+          job_id = 0;
+          printer_uri = NULL;
+
+          while (attr != NULL && ippGetGroupTag (attr) == IPP_TAG_JOB)
+            {
+              if (g_strcmp0 (ippGetName (attr), "job-id") == 0 &&
+                  ippGetValueTag (attr) == IPP_TAG_INTEGER)
+                job_id = ippGetInteger (attr, 0);
+              else if (g_strcmp0 (ippGetName (attr), "job-printer-uri") == 0 &&
+                       ippGetValueTag (attr) == IPP_TAG_URI)
+                printer_uri = ippGetString (attr, 0, NULL);
+
+              attr = ippNextAttribute (response);
+            }
+
+          if (job_id > last_job_id && printer_name_from_uri (printer_uri))
+            {
+              last_job_id = job_id;
+              g_free (result);
+              result = g_strdup (printer_name_from_uri (printer_uri));
+            }
+
+          if (attr == NULL)
+            break;
+        }
+    }
+
+  ippDelete (response);
+
+  return result;
+}
+
 void
-pp_print_device_free (PpPrintDevice *device)
+pp_printers_snapshot_free (PpPrintersSnapshot *snapshot)
 {
-  if (device)
+  if (snapshot)
     {
-      g_free (device->device_class);
-      g_free (device->device_id);
-      g_free (device->device_info);
-      g_free (device->device_make_and_model);
-      g_free (device->device_uri);
-      g_free (device->device_location);
-      g_free (device->device_name);
-      g_free (device->device_ppd);
-      g_free (device);
+      if (snapshot->dests)
+        cupsFreeDests (snapshot->num_of_dests, snapshot->dests);
+      g_free (snapshot->last_used_dest);
+      pp_jobs_counter_free (snapshot->jobs);
+      g_free (snapshot);
     }
 }
 
 typedef struct
 {
-  gchar        *printer_name;
-  gboolean      my_jobs;
-  gint          which_jobs;
-  cups_job_t   *jobs;
-  gint          num_of_jobs;
-  CGJCallback   callback;
-  gpointer      user_data;
-  GMainContext *context;
-} CGJData;
+  gboolean            get_last_used;
+  PpPrintersSnapshot *result;
+  GCancellable       *cancellable;
+  GPSCallback         callback;
+  gpointer            user_data;
+  GMainContext       *context;
+} GPSData;
 
 static gboolean
-cups_get_jobs_idle_cb (gpointer user_data)
+get_printers_snapshot_idle_cb (gpointer user_data)
 {
-  CGJData *data = (CGJData *) user_data;
+  GPSData *data = (GPSData *) user_data;
 
-  data->callback (data->jobs,
-                  data->num_of_jobs,
-                  data->user_data);
+  /* Don't call callback if cancelled */
+  if (data->cancellable &&
+      g_cancellable_is_cancelled (data->cancellable))
+    {
+      pp_printers_snapshot_free (data->result);
+      data->result = NULL;
+    }
+  else
+    {
+      data->callback (data->result, data->user_data);
+    }
 
   return FALSE;
 }
 
 static void
-cups_get_jobs_data_free (gpointer user_data)
+get_printers_snapshot_data_free (gpointer user_data)
 {
-  CGJData *data = (CGJData *) user_data;
+  GPSData *data = (GPSData *) user_data;
 
   if (data->context)
     g_main_context_unref (data->context);
-  g_free (data->printer_name);
+  if (data->cancellable)
+    g_object_unref (data->cancellable);
   g_free (data);
 }
 
 static void
-cups_get_jobs_cb (gpointer user_data)
+get_printers_snapshot_cb (gpointer user_data)
 {
-  CGJData *data = (CGJData *) user_data;
+  GPSData *data = (GPSData *) user_data;
   GSource *idle_source;
 
   idle_source = g_idle_source_new ();
   g_source_set_callback (idle_source,
-                         cups_get_jobs_idle_cb,
+                         get_printers_snapshot_idle_cb,
                          data,
-                         cups_get_jobs_data_free);
+                         get_printers_snapshot_data_free);
   g_source_attach (idle_source, data->context);
   g_source_unref (idle_source);
 }
 
 static gpointer
-cups_get_jobs_func (gpointer user_data)
+get_printers_snapshot_func (gpointer user_data)
 {
-  CGJData *data = (CGJData *) user_data;
+  PpPrintersSnapshot *snapshot;
+  GPSData            *data = (GPSData *) user_data;
+  http_t             *http;
 
-  data->num_of_jobs = cupsGetJobs (&data->jobs,
-                                   data->printer_name,
-                                   data->my_jobs ? 1 : 0,
-                                   data->which_jobs);
+  snapshot = g_new0 (PpPrintersSnapshot, 1);
+  snapshot->num_of_dests = cupsGetDests (&snapshot->dests);
+  snapshot->cups_running = TRUE;
 
-  cups_get_jobs_cb (data);
+  if (snapshot->num_of_dests == 0)
+    {
+      http = httpConnectEncrypt (cupsServer (), ippPort (), cupsEncryption ());
+      if (http)
+        httpClose (http);
+      else
+        snapshot->cups_running = FALSE;
+    }
+
+  if (snapshot->num_of_dests > 0)
+    {
+      snapshot->jobs = pp_jobs_counter_new_from_cups ();
+
+      if (data->get_last_used)
+        snapshot->last_used_dest = get_last_used_printer ();
+    }
+
+  data->result = snapshot;
+
+  get_printers_snapshot_cb (data);
 
   return NULL;
 }
 
+/*
+ * Get list of destinations without blocking the main loop.
+ * The callback takes ownership of the snapshot.
+ */
 void
-cups_get_jobs_async (const gchar *printer_name,
-                     gboolean     my_jobs,
-                     gint         which_jobs,
-                     CGJCallback  callback,
-                     gpointer     user_data)
+get_printers_snapshot_async (gboolean      get_last_used,
+                             GCancellable *cancellable,
+                             GPSCallback   callback,
+                             gpointer      user_data)
 {
-  CGJData *data;
+  GPSData *data;
   GThread *thread;
   GError  *error = NULL;
 
-  data = g_new0 (CGJData, 1);
-  data->printer_name = g_strdup (printer_name);
-  data->my_jobs = my_jobs;
-  data->which_jobs = which_jobs;
+  data = g_new0 (GPSData, 1);
+  data->get_last_used = get_last_used;
+  if (cancellable)
+    data->cancellable = g_object_ref (cancellable);
   data->callback = callback;
   data->user_data = user_data;
   data->context = g_main_context_ref_thread_default ();
 
-  thread = g_thread_try_new ("cups-get-jobs",
-                             cups_get_jobs_func,
+  thread = g_thread_try_new ("get-printers-snapshot",
+                             get_printers_snapshot_func,
                              data,
                              &error);
 
   if (!thread)
     {
       g_warning ("%s", error->message);
-      callback (NULL, 0, user_data);
+      callback (NULL, user_data);
 
       g_error_free (error);
-      cups_get_jobs_data_free (data);
+      get_printers_snapshot_data_free (data);
     }
   else
     {
@@ -3799,162 +5646,100 @@ cups_get_jobs_async (const gchar *printer_name,
 
 typedef struct
 {
-  GCancellable *cancellable;
-  JCPCallback   callback;
-  gpointer      user_data;
-} JCPData;
+  PpJobsCounter *result;
+  GCancellable  *cancellable;
+  GJCCallback    callback;
+  gpointer       user_data;
+  GMainContext  *context;
+} GJCData;
 
-static void
-job_cancel_purge_async_dbus_cb (GObject      *source_object,
-                                GAsyncResult *res,
-                                gpointer      user_data)
+static gboolean
+get_jobs_counter_idle_cb (gpointer user_data)
 {
-  GVariant *output;
-  JCPData  *data = (JCPData *) user_data;
-  GError   *error = NULL;
-
-  output = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source_object),
-                                          res,
-                                          &error);
-  g_object_unref (source_object);
+  GJCData *data = (GJCData *) user_data;
 
-  if (output)
+  /* Don't call callback if cancelled */
+  if (data->cancellable &&
+      g_cancellable_is_cancelled (data->cancellable))
     {
-      g_variant_unref (output);
+      pp_jobs_counter_free (data->result);
+      data->result = NULL;
     }
   else
     {
-      if (!g_cancellable_is_cancelled (data->cancellable))
-        g_warning ("%s", error->message);
-      g_error_free (error);
+      data->callback (data->result, data->user_data);
     }
 
-  data->callback (data->user_data);
+  return FALSE;
+}
+
+static void
+get_jobs_counter_data_free (gpointer user_data)
+{
+  GJCData *data = (GJCData *) user_data;
 
+  if (data->context)
+    g_main_context_unref (data->context);
   if (data->cancellable)
     g_object_unref (data->cancellable);
   g_free (data);
 }
 
-void
-job_cancel_purge_async (gint          job_id,
-                        gboolean      job_purge,
-                        GCancellable *cancellable,
-                        JCPCallback   callback,
-                        gpointer      user_data)
+static gpointer
+get_jobs_counter_func (gpointer user_data)
 {
-  GDBusConnection *bus;
-  JCPData         *data;
-  GError          *error = NULL;
+  GJCData *data = (GJCData *) user_data;
+  GSource *idle_source;
 
-  bus = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, &error);
-  if (!bus)
-    {
-      g_warning ("Failed to get session bus: %s", error->message);
-      g_error_free (error);
-      callback (user_data);
-      return;
-    }
+  data->result = pp_jobs_counter_new_from_cups ();
 
-  data = g_new0 (JCPData, 1);
-  if (cancellable)
-    data->cancellable = g_object_ref (cancellable);
-  data->callback = callback;
-  data->user_data = user_data;
+  idle_source = g_idle_source_new ();
+  g_source_set_callback (idle_source,
+                         get_jobs_counter_idle_cb,
+                         data,
+                         get_jobs_counter_data_free);
+  g_source_attach (idle_source, data->context);
+  g_source_unref (idle_source);
 
-  g_dbus_connection_call (bus,
-                          MECHANISM_BUS,
-                          "/",
-                          MECHANISM_BUS,
-                          "JobCancelPurge",
-                          g_variant_new ("(ib)",
-                                         job_id,
-                                         job_purge),
-                          G_VARIANT_TYPE ("(s)"),
-                          G_DBUS_CALL_FLAGS_NONE,
-                          -1,
-                          NULL,
-                          job_cancel_purge_async_dbus_cb,
-                          data);
+  return NULL;
 }
 
-typedef struct
+/*
+ * Counts the jobs of the current user without blocking the main loop.
+ * The callback takes ownership of the counter, which is NULL if CUPS
+ * could not be asked.
+ */
+void
+get_jobs_counter_async (GCancellable *cancellable,
+                        GJCCallback   callback,
+                        gpointer      user_data)
 {
-  GCancellable *cancellable;
-  JSHUCallback  callback;
-  gpointer      user_data;
-} JSHUData;
+  GJCData *data;
+  GThread *thread;
+  GError  *error = NULL;
 
-static void
-job_set_hold_until_async_dbus_cb (GObject      *source_object,
-                                  GAsyncResult *res,
-                                  gpointer      user_data)
-{
-  GVariant *output;
-  JSHUData *data = (JSHUData *) user_data;
-  GError   *error = NULL;
+  data = g_new0 (GJCData, 1);
+  if (cancellable)
+    data->cancellable = g_object_ref (cancellable);
+  data->callback = callback;
+  data->user_data = user_data;
+  data->context = g_main_context_ref_thread_default ();
 
-  output = g_dbus_connection_call_finish (G_DBUS_CONNECTION (source_object),
-                                          res,
-                                          &error);
-  g_object_unref (source_object);
+  thread = g_thread_try_new ("get-jobs-counter",
+                             get_jobs_counter_func,
+                             data,
+                             &error);
 
-  if (output)
-    {
-      g_variant_unref (output);
-    }
-  else
+  if (!thread)
     {
-      if (!g_cancellable_is_cancelled (data->cancellable))
-        g_warning ("%s", error->message);
+      g_warning ("%s", error->message);
+      callback (NULL, user_data);
+
       g_error_free (error);
+      get_jobs_counter_data_free (data);
     }
-
-  data->callback (data->user_data);
-
-  if (data->cancellable)
-    g_object_unref (data->cancellable);
-  g_free (data);
-}
-
-void
-job_set_hold_until_async (gint          job_id,
-                          const gchar  *job_hold_until,
-                          GCancellable *cancellable,
-                          JSHUCallback  callback,
-                          gpointer      user_data)
-{
-  GDBusConnection *bus;
-  JSHUData        *data;
-  GError          *error = NULL;
-
-  bus = g_bus_get_sync (G_BUS_TYPE_SYSTEM, NULL, &error);
-  if (!bus)
+  else
     {
-      g_warning ("Failed to get session bus: %s", error->message);
-      g_error_free (error);
-      callback (user_data);
-      return;
+      g_thread_unref (thread);
     }
-
-  data = g_new0 (JSHUData, 1);
-  if (cancellable)
-    data->cancellable = g_object_ref (cancellable);
-  data->callback = callback;
-  data->user_data = user_data;
-
-  g_dbus_connection_call (bus,
-                          MECHANISM_BUS,
-                          "/",
-                          MECHANISM_BUS,
-                          "JobSetHoldUntil",
-                          g_variant_new ("(is)",
-                                         job_id,
-                                         job_hold_until),
-                          G_VARIANT_TYPE ("(s)"),
-                          G_DBUS_CALL_FLAGS_NONE,
-                          -1,
-                          NULL,
-                          job_set_hold_until_async_dbus_cb,
-                          data);
 }
@@ -60,6 +60,7 @@ typedef struct
   gchar *ppd_name;
   gchar *ppd_display_name;
   gint   ppd_match_level;
+  gchar *ppd_device_id;
 } PPDName;
 
 typedef struct
@@ -159,14 +160,18 @@ typedef void (*GPNCallback) (PPDName     **names,
                              gboolean      cancelled,
                              gpointer      user_data);
 
+typedef struct _PpPPDIndex PpPPDIndex;
+
 void        get_ppd_names_async (gchar        *printer_name,
                                  gint          count,
+                                 PpPPDIndex   *index,
                                  GCancellable *cancellable,
                                  GPNCallback   callback,
                                  gpointer      user_data);
 
-typedef void (*GAPCallback) (PPDList  *ppds,
-                             gpointer  user_data);
+typedef void (*GAPCallback) (PPDList    *ppds,
+                             PpPPDIndex *index,
+                             gpointer    user_data);
 
 void        get_all_ppds_async (GCancellable *cancellable,
                                 GAPCallback   callback,
@@ -175,6 +180,23 @@ void        get_all_ppds_async (GCancellable *cancellable,
 PPDList    *ppd_list_copy (PPDList *list);
 void        ppd_list_free (PPDList *list);
 
+void        ppd_names_free (PPDName **names);
+
+PpPPDIndex *pp_ppd_index_new (PPDList *list);
+
+PpPPDIndex *pp_ppd_index_ref (PpPPDIndex *index);
+
+void        pp_ppd_index_unref (PpPPDIndex *index);
+
+PPDName   **pp_ppd_index_match_device (PpPPDIndex  *index,
+                                       const gchar *device_id,
+                                       const gchar *device_make_and_model,
+                                       gint         count);
+
+PPDName   **pp_ppd_index_search (PpPPDIndex  *index,
+                                 const gchar *text,
+                                 gint         count);
+
 enum
 {
   IPP_ATTRIBUTE_TYPE_INTEGER = 0,
@@ -293,6 +315,45 @@ void        get_cups_devices_async (GCancellable *cancellable,
                                     GCDCallback   callback,
                                     gpointer      user_data);
 
+typedef struct _PpJobsCounter PpJobsCounter;
+
+PpJobsCounter *pp_jobs_counter_new_from_cups (void);
+
+void        pp_jobs_counter_free (PpJobsCounter *counter);
+
+gboolean    pp_jobs_counter_job_changed (PpJobsCounter *counter,
+                                         gint           job_id,
+                                         gint           job_state);
+
+guint       pp_jobs_counter_get_active (PpJobsCounter *counter,
+                                        const gchar   *printer_name);
+
+typedef struct
+{
+  cups_dest_t   *dests;
+  gint           num_of_dests;
+  gboolean       cups_running;
+  gchar         *last_used_dest;
+  PpJobsCounter *jobs;
+} PpPrintersSnapshot;
+
+void        pp_printers_snapshot_free (PpPrintersSnapshot *snapshot);
+
+typedef void (*GPSCallback) (PpPrintersSnapshot *snapshot,
+                             gpointer            user_data);
+
+void        get_printers_snapshot_async (gboolean      get_last_used,
+                                         GCancellable *cancellable,
+                                         GPSCallback   callback,
+                                         gpointer      user_data);
+
+typedef void (*GJCCallback) (PpJobsCounter *counter,
+                             gpointer       user_data);
+
+void        get_jobs_counter_async (GCancellable *cancellable,
+                                    GJCCallback   callback,
+                                    gpointer      user_data);
+
 G_END_DECLS
 
 #endif /* __PP_UTILS_H */
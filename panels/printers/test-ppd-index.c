@@ -0,0 +1,175 @@
+/* -*- Mode: C; tab-width: 8; indent-tabs-mode: nil; c-basic-offset: 8 -*-
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ */
+
+#include "config.h"
+
+#include <glib.h>
+
+#include "pp-utils.h"
+
+/* Checks the match levels pp_ppd_index_match_device() gives for a small,
+ * fixed list of drivers. */
+
+typedef struct
+{
+  const gchar *manufacturer_name;
+  const gchar *manufacturer_display_name;
+  const gchar *ppd_name;
+  const gchar *ppd_display_name;
+  const gchar *ppd_device_id;
+} TestPPD;
+
+static const TestPPD ppds[] = {
+  { "generic", "Generic", "generic-ps.ppd", "Generic PostScript Printer", NULL },
+  { "generic", "Generic", "generic-pcl.ppd", "Generic PCL 6/PCL XL Printer", NULL },
+  { "generic", "Generic", "generic-text.ppd", "Generic text-only printer", NULL },
+  { "hewlett packard", "Hewlett-Packard", "hp-lj4050-ps.ppd", "HP LaserJet 4050 Series Postscript",
+    "MFG:Hewlett-Packard;MDL:HP LaserJet 4050 Series;CMD:PJL,MLC,PCL,POSTSCRIPT;" },
+  { "hewlett packard", "Hewlett-Packard", "hp-lj4050-pcl.ppd", "HP LaserJet 4050 Series pcl3",
+    "MFG:HP;MDL:LaserJet 4050 Series;CMD:PCL,PCLXL;" },
+  { "hewlett packard", "Hewlett-Packard", "hp-dj5550.ppd", "HP DeskJet 5550",
+    "MFG:HP;MDL:DeskJet 5550;" },
+  { "brother", "Brother", "br-hl2270dw.ppd", "Brother HL-2270DW",
+    "MFG:Brother;MDL:HL-2270DW series;CMD:PJL,PCL,PCLXL;" },
+};
+
+static PPDList *
+get_test_list (void)
+{
+  PPDManufacturerItem *manufacturer = NULL;
+  PPDList             *list;
+  PPDName             *ppd;
+  gsize                i;
+
+  list = g_new0 (PPDList, 1);
+  list->manufacturers = g_new0 (PPDManufacturerItem *, G_N_ELEMENTS (ppds));
+
+  for (i = 0; i < G_N_ELEMENTS (ppds); i++)
+    {
+      if (!manufacturer ||
+          g_strcmp0 (manufacturer->manufacturer_name, ppds[i].manufacturer_name) != 0)
+        {
+          manufacturer = g_new0 (PPDManufacturerItem, 1);
+          manufacturer->manufacturer_name = g_strdup (ppds[i].manufacturer_name);
+          manufacturer->manufacturer_display_name = g_strdup (ppds[i].manufacturer_display_name);
+          manufacturer->ppds = g_new0 (PPDName *, G_N_ELEMENTS (ppds));
+          list->manufacturers[list->num_of_manufacturers++] = manufacturer;
+        }
+
+      ppd = g_new0 (PPDName, 1);
+      ppd->ppd_name = g_strdup (ppds[i].ppd_name);
+      ppd->ppd_display_name = g_strdup (ppds[i].ppd_display_name);
+      ppd->ppd_device_id = g_strdup (ppds[i].ppd_device_id);
+      manufacturer->ppds[manufacturer->num_of_ppds++] = ppd;
+    }
+
+  return list;
+}
+
+static gboolean
+check_match (PpPPDIndex  *index,
+             const gchar *device_id,
+             const gchar *device_make_and_model,
+             const gchar *ppd_name,
+             gint         match_level)
+{
+  PPDName **names;
+  gboolean  result;
+
+  names = pp_ppd_index_match_device (index, device_id, device_make_and_model, 1);
+
+  result = names != NULL &&
+           g_strcmp0 (names[0]->ppd_name, ppd_name) == 0 &&
+           names[0]->ppd_match_level == match_level;
+
+  if (!result)
+    g_printerr ("%s: expected %s (%d), got %s (%d)\n",
+                device_id ? device_id : device_make_and_model,
+                ppd_name, match_level,
+                names ? names[0]->ppd_name : "nothing",
+                names ? names[0]->ppd_match_level : PPD_NO_MATCH);
+
+  ppd_names_free (names);
+
+  return result;
+}
+
+int main (int argc, char **argv)
+{
+  PpPPDIndex *index;
+  PPDList    *list;
+  PPDName   **names;
+  gboolean    ok = TRUE;
+
+  list = get_test_list ();
+  index = pp_ppd_index_new (list);
+  ppd_list_free (list);
+
+  /* all the command sets of the driver are supported */
+  ok &= check_match (index,
+                     "MFG:Hewlett-Packard;MDL:HP LaserJet 4050 Series;CMD:PJL,MLC,PCL,POSTSCRIPT;",
+                     NULL,
+                     "hp-lj4050-ps.ppd", PPD_EXACT_CMD_MATCH);
+
+  /* the model matches but not the command sets */
+  ok &= check_match (index,
+                     "MFG:HP;MDL:DeskJet 5550;CMD:PCL3GUI;",
+                     NULL,
+                     "hp-dj5550.ppd", PPD_EXACT_MATCH);
+
+  /* only the make and model is known */
+  ok &= check_match (index, NULL, "Brother HL-2270DW series",
+                     "br-hl2270dw.ppd", PPD_EXACT_MATCH);
+
+  /* a model of the same series scores at least PPD_INDEX_CLOSE_SCORE */
+  ok &= check_match (index,
+                     "MFG:HP;MDL:DeskJet 5550C;",
+                     NULL,
+                     "hp-dj5550.ppd", PPD_CLOSE_MATCH);
+
+  /* unknown device, known command set */
+  ok &= check_match (index,
+                     "MFG:Foo;MDL:Bar 1;CMD:PJL,POSTSCRIPT;",
+                     NULL,
+                     "generic-ps.ppd", PPD_GENERIC_MATCH);
+
+  /* nothing to go by */
+  names = pp_ppd_index_match_device (index, "MFG:Foo;MDL:Bar 1;", NULL, 1);
+  if (names)
+    {
+      g_printerr ("MFG:Foo;MDL:Bar 1;: expected nothing, got %s\n",
+                  names[0]->ppd_name);
+      ok = FALSE;
+    }
+  ppd_names_free (names);
+
+  /* the device id of the driver comes with the match */
+  names = pp_ppd_index_match_device (index, NULL, "Brother HL-2270DW series", 1);
+  if (!names ||
+      g_strcmp0 (names[0]->ppd_device_id,
+                 "MFG:Brother;MDL:HL-2270DW series;CMD:PJL,PCL,PCLXL;") != 0)
+    {
+      g_printerr ("device id of the driver is missing\n");
+      ok = FALSE;
+    }
+  ppd_names_free (names);
+
+  pp_ppd_index_unref (index);
+
+  return ok ? 0 : 1;
+}
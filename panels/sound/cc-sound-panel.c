@@ -67,13 +67,24 @@ cc_sound_panel_set_property (GObject      *object,
         }
 }
 
+static void
+cc_sound_panel_set_active (CcPanel  *panel,
+                           gboolean  active)
+{
+        CcSoundPanel *self = CC_SOUND_PANEL (panel);
+
+        gvc_mixer_dialog_set_monitoring (self->dialog, active);
+}
+
 static void
 cc_sound_panel_class_init (CcSoundPanelClass *klass)
 {
         GObjectClass *object_class = G_OBJECT_CLASS (klass);
+        CcPanelClass *panel_class = CC_PANEL_CLASS (klass);
 
         object_class->finalize = cc_sound_panel_finalize;
         object_class->set_property = cc_sound_panel_set_property;
+        panel_class->set_active = cc_sound_panel_set_active;
 
         g_object_class_override_property (object_class, PROP_ARGV, "argv");
 }
@@ -92,6 +92,7 @@ struct GvcMixerDialogPrivate
 
         gdouble          last_input_peak;
         guint            num_apps;
+        gboolean         monitoring_suspended;
 };
 
 enum {
@@ -801,7 +802,8 @@ active_input_update (GvcMixerDialog *dialog,
         
         stop_monitor_stream_for_source (dialog);
         //if (test_it < 6){
-        create_monitor_stream_for_source (dialog, stream);
+        if (!dialog->priv->monitoring_suspended)
+                create_monitor_stream_for_source (dialog, stream);
         test_it += 1;
         //}
         bar_set_stream (dialog, dialog->priv->input_bar, stream);   
@@ -2295,3 +2297,25 @@ gvc_mixer_dialog_set_page (GvcMixerDialog *self,
 
         return TRUE;
 }
+
+/* Stops the input level monitor while the dialog is hidden, so that the
+ * microphone is not kept open in the background */
+void
+gvc_mixer_dialog_set_monitoring (GvcMixerDialog *self,
+                                 gboolean        monitoring)
+{
+        GvcMixerStream *stream;
+
+        g_return_if_fail (GVC_IS_MIXER_DIALOG (self));
+
+        self->priv->monitoring_suspended = !monitoring;
+
+        if (!monitoring) {
+                stop_monitor_stream_for_source (self);
+                return;
+        }
+
+        stream = gvc_mixer_control_get_default_source (self->priv->mixer_control);
+        if (stream != NULL)
+                create_monitor_stream_for_source (self, stream);
+}
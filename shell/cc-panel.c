@@ -34,6 +34,7 @@
 #include "config.h"
 
 #include "cc-panel.h"
+#include "cc-trace.h"
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -51,6 +52,7 @@ struct CcPanelPrivate
   gchar    *current_location;
 
   gboolean  is_active;
+  gboolean  active_set;
   CcShell  *shell;
   gchar    *name;
 };
@@ -284,3 +286,81 @@ cc_panel_get_display_name (CcPanel *panel)
   return panel->priv->name;
 }
 
+/**
+ * cc_panel_set_active:
+ * @panel: A #CcPanel
+ * @active: whether @panel is shown
+ *
+ * Called by the shell when @panel is shown, and when it is hidden but
+ * kept around so that switching back to it is quick. Panels can override
+ * the set_active vfunc to release expensive resources, like D-Bus proxies
+ * or sound streams, while they are hidden. The first call always reaches
+ * the vfunc, so a panel that the shell built in the background without
+ * showing it is told to stop what it started when it was constructed.
+ */
+void
+cc_panel_set_active (CcPanel  *panel,
+                     gboolean  active)
+{
+  CcPanelClass *class;
+
+  g_return_if_fail (CC_IS_PANEL (panel));
+
+  active = !!active;
+  if (panel->priv->active_set && panel->priv->is_active == active)
+    return;
+
+  panel->priv->is_active = active;
+  panel->priv->active_set = TRUE;
+
+  class = CC_PANEL_GET_CLASS (panel);
+  if (class->set_active)
+    class->set_active (panel, active);
+}
+
+/**
+ * cc_panel_get_active:
+ * @panel: A #CcPanel
+ *
+ * Returns: whether @panel is currently shown by the shell
+ */
+gboolean
+cc_panel_get_active (CcPanel *panel)
+{
+  g_return_val_if_fail (CC_IS_PANEL (panel), FALSE);
+
+  return panel->priv->is_active;
+}
+
+/**
+ * cc_panel_trace_begin:
+ * @panel: A #CcPanel
+ *
+ * Starts a span in the shell's timings, e.g. around loading a GtkBuilder
+ * file. Timings are shown with --timings, or saved when UCC_TRACE is set.
+ *
+ * Returns: a timestamp to pass to cc_panel_trace_end()
+ */
+gint64
+cc_panel_trace_begin (CcPanel *panel)
+{
+  return cc_trace_begin ();
+}
+
+/**
+ * cc_panel_trace_end:
+ * @panel: A #CcPanel
+ * @name: the name of the span
+ * @begin: the value returned by cc_panel_trace_begin()
+ *
+ * Ends a span started with cc_panel_trace_begin().
+ */
+void
+cc_panel_trace_end (CcPanel    *panel,
+                    const char *name,
+                    gint64      begin)
+{
+  g_return_if_fail (CC_IS_PANEL (panel));
+
+  cc_trace_end ("panel", name, G_OBJECT_TYPE_NAME (panel), begin);
+}
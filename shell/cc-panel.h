@@ -83,6 +83,8 @@ struct _CcPanelClass
 
   GPermission * (* get_permission) (CcPanel *panel);
   const char  * (* get_help_uri)   (CcPanel *panel);
+  void          (* set_active)     (CcPanel *panel,
+                                    gboolean active);
 };
 
 GType        cc_panel_get_type         (void);
@@ -95,6 +97,17 @@ const char  *cc_panel_get_help_uri     (CcPanel     *panel);
 
 const char  *cc_panel_get_display_name (CcPanel     *panel);
 
+void         cc_panel_set_active       (CcPanel     *panel,
+                                        gboolean     active);
+
+gboolean     cc_panel_get_active       (CcPanel     *panel);
+
+gint64       cc_panel_trace_begin      (CcPanel     *panel);
+
+void         cc_panel_trace_end        (CcPanel     *panel,
+                                        const char  *name,
+                                        gint64       begin);
+
 G_END_DECLS
 
 #endif /* __CC_PANEL_H */
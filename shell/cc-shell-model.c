@@ -21,51 +21,882 @@
 
 #include "cc-shell-model.h"
 #include <string.h>
+#include <glib/gstdio.h>
 
 #define GNOME_SETTINGS_PANEL_ID_KEY "X-Unity-Settings-Panel"
 #define GNOME_SETTINGS_PANEL_CATEGORY GNOME_SETTINGS_PANEL_ID_KEY
 #define GNOME_SETTINGS_PANEL_ID_KEYWORDS "Keywords"
 
 
+#define ICON_SIZE 48
+
+/* Number of icons decoded per worker round trip */
+#define ICON_BATCH_SIZE 8
+
+#define ICON_CACHE_VERSION 1
+/* version, theme mtime, icons as (gicon, width, height, rowstride, pixels) */
+#define ICON_CACHE_FORMAT "(uxa(siiiay))"
+
+#define SHELL_MODEL_PRIVATE(o) \
+  (G_TYPE_INSTANCE_GET_PRIVATE ((o), CC_TYPE_SHELL_MODEL, CcShellModelPrivate))
+
+struct _CcShellModelPrivate
+{
+  /* panel id -> GtkTreeIter; list store iters stay valid until their row
+   * is removed, and any removal drops the whole table until the next
+   * lookup rebuilds it */
+  GHashTable   *rows_by_id;
+  gboolean      rows_by_id_valid;
+
+  GdkPixbuf    *placeholder;
+
+  /* GtkTreeRowReference for every row still showing the placeholder */
+  GQueue        pending_icons;
+  guint         icon_idle_id;
+  GCancellable *icon_cancellable;
+
+  /* g_icon_to_string() -> decoded GdkPixbuf, for the current theme */
+  GHashTable   *icon_cache;
+  gchar        *icon_cache_path;
+  gint64        icon_theme_mtime;
+  gboolean      icon_cache_dirty;
+
+  /* category and desktop file -> GtkTreeIter of the rows not yet seen
+   * during an update, see cc_shell_model_begin_update() */
+  GHashTable   *update_rows;
+};
+
+typedef struct
+{
+  GCancellable *cancellable;
+  GPtrArray *rows;
+  GPtrArray *infos;
+  GPtrArray *pixbufs;
+} IconBatch;
+
 G_DEFINE_TYPE (CcShellModel, cc_shell_model, GTK_TYPE_LIST_STORE)
 
-static GdkPixbuf *
-load_pixbuf_for_gicon (GIcon *icon)
+static void queue_icon_batch (CcShellModel *self);
+
+/* Icon cache
+ *
+ * Decoded icons are kept in a per-theme file under the user cache dir so
+ * that the next start can fill the grid without touching the icon theme.
+ * The file is discarded whenever any directory of the theme (or of
+ * hicolor, which every theme inherits from) is newer than when it was
+ * written.
+ */
+
+static gchar *
+get_icon_theme_name (void)
 {
-  GtkIconTheme *theme;
-  GtkIconInfo *icon_info;
-  GdkPixbuf *pixbuf = NULL;
-  GError *err = NULL;
+  gchar *name = NULL;
 
-  if (icon == NULL)
+  g_object_get (gtk_settings_get_default (), "gtk-icon-theme-name", &name, NULL);
+  if (name == NULL)
+    name = g_strdup ("hicolor");
+
+  return name;
+}
+
+/* The newest modification time of @dir and of the directories below it,
+ * down to @depth levels */
+static gint64
+get_dir_tree_mtime (const gchar *dir,
+                    gint         depth)
+{
+  GStatBuf buf;
+  const gchar *name;
+  gint64 mtime;
+  GDir *d;
+
+  if (g_stat (dir, &buf) != 0 || !S_ISDIR (buf.st_mode))
+    return 0;
+
+  mtime = buf.st_mtime;
+
+  if (depth == 0 || (d = g_dir_open (dir, 0, NULL)) == NULL)
+    return mtime;
+
+  while ((name = g_dir_read_name (d)) != NULL)
+    {
+      gchar *child;
+
+      child = g_build_filename (dir, name, NULL);
+      mtime = MAX (mtime, get_dir_tree_mtime (child, depth - 1));
+      g_free (child);
+    }
+
+  g_dir_close (d);
+
+  return mtime;
+}
+
+/* Like GTK, trust the icon-theme.cache of a theme directory when it is not
+ * older than the directory. Otherwise the icons are read from the size and
+ * context directories (e.g. 48x48/apps), so any of them changing counts. */
+static gint64
+get_icon_theme_mtime (const gchar *theme_name)
+{
+  const gchar *themes[] = { theme_name, "hicolor", NULL };
+  gchar **search_path;
+  gint n_elements, i, j;
+  gint64 mtime = 0;
+
+  gtk_icon_theme_get_search_path (gtk_icon_theme_get_default (),
+                                  &search_path, &n_elements);
+
+  for (i = 0; i < n_elements; i++)
+    {
+      for (j = 0; themes[j] != NULL; j++)
+        {
+          GStatBuf dir_buf, cache_buf;
+          gchar *dir, *cache;
+
+          dir = g_build_filename (search_path[i], themes[j], NULL);
+          if (g_stat (dir, &dir_buf) != 0)
+            {
+              g_free (dir);
+              continue;
+            }
+
+          cache = g_build_filename (dir, "icon-theme.cache", NULL);
+          if (g_stat (cache, &cache_buf) == 0 &&
+              cache_buf.st_mtime >= dir_buf.st_mtime)
+            mtime = MAX (mtime, (gint64) cache_buf.st_mtime);
+          else
+            mtime = MAX (mtime, get_dir_tree_mtime (dir, 2));
+
+          g_free (cache);
+          g_free (dir);
+        }
+    }
+
+  g_strfreev (search_path);
+
+  return mtime;
+}
+
+static void
+icon_cache_load (CcShellModel *self)
+{
+  CcShellModelPrivate *priv = self->priv;
+  GMappedFile *mapped;
+  GVariant *cache, *icons;
+  GVariantIter iter;
+  guint32 version;
+  gint64 mtime;
+  const gchar *name;
+  gint width, height, rowstride;
+  GVariant *pixels;
+  gchar *theme_name, *basename;
+
+  g_hash_table_remove_all (priv->icon_cache);
+  g_free (priv->icon_cache_path);
+
+  theme_name = get_icon_theme_name ();
+  basename = g_strdup_printf ("%s-%d.cache", theme_name, ICON_SIZE);
+  priv->icon_cache_path = g_build_filename (g_get_user_cache_dir (),
+                                            "unity-control-center",
+                                            "icons",
+                                            basename,
+                                            NULL);
+  priv->icon_theme_mtime = get_icon_theme_mtime (theme_name);
+  priv->icon_cache_dirty = FALSE;
+  g_free (basename);
+  g_free (theme_name);
+
+  mapped = g_mapped_file_new (priv->icon_cache_path, FALSE, NULL);
+  if (mapped == NULL)
+    return;
+
+  if (g_mapped_file_get_length (mapped) == 0)
+    {
+      g_mapped_file_unref (mapped);
+      return;
+    }
+
+  cache = g_variant_new_from_data (G_VARIANT_TYPE (ICON_CACHE_FORMAT),
+                                   g_mapped_file_get_contents (mapped),
+                                   g_mapped_file_get_length (mapped),
+                                   FALSE,
+                                   (GDestroyNotify) g_mapped_file_unref,
+                                   mapped);
+  g_variant_ref_sink (cache);
+
+  g_variant_get (cache, "(ux@a(siiiay))", &version, &mtime, &icons);
+
+  if (version == ICON_CACHE_VERSION && mtime == priv->icon_theme_mtime)
+    {
+      g_variant_iter_init (&iter, icons);
+      while (g_variant_iter_next (&iter, "(&siii@ay)",
+                                  &name, &width, &height, &rowstride, &pixels))
+        {
+          gconstpointer data;
+          gsize size;
+
+          data = g_variant_get_fixed_array (pixels, &size, 1);
+
+          if (width > 0 && height > 0 && rowstride >= width * 4 &&
+              size >= (gsize) rowstride * (height - 1) + width * 4)
+            {
+              GdkPixbuf *pixbuf;
+
+              pixbuf = gdk_pixbuf_new_from_data (g_memdup (data, size),
+                                                 GDK_COLORSPACE_RGB, TRUE, 8,
+                                                 width, height, rowstride,
+                                                 (GdkPixbufDestroyNotify) g_free,
+                                                 NULL);
+              g_hash_table_insert (priv->icon_cache, g_strdup (name), pixbuf);
+            }
+
+          g_variant_unref (pixels);
+        }
+    }
+
+  g_variant_unref (icons);
+  g_variant_unref (cache);
+}
+
+static void
+icon_cache_save (CcShellModel *self)
+{
+  CcShellModelPrivate *priv = self->priv;
+  GVariantBuilder builder;
+  GHashTableIter iter;
+  gpointer key, value;
+  GVariant *cache;
+  gchar *dirname;
+  GError *error = NULL;
+
+  if (!priv->icon_cache_dirty || priv->icon_cache_path == NULL)
+    return;
+
+  priv->icon_cache_dirty = FALSE;
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(siiiay)"));
+
+  g_hash_table_iter_init (&iter, priv->icon_cache);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      GdkPixbuf *pixbuf = value;
+      gint height, rowstride;
+      gsize size;
+
+      /* only the common 8-bit RGBA layout is stored */
+      if (gdk_pixbuf_get_n_channels (pixbuf) != 4 ||
+          gdk_pixbuf_get_bits_per_sample (pixbuf) != 8)
+        continue;
+
+      height = gdk_pixbuf_get_height (pixbuf);
+      rowstride = gdk_pixbuf_get_rowstride (pixbuf);
+      size = (gsize) rowstride * (height - 1) +
+             gdk_pixbuf_get_width (pixbuf) * 4;
+
+      g_variant_builder_add (&builder, "(siii@ay)",
+                             key,
+                             gdk_pixbuf_get_width (pixbuf),
+                             height,
+                             rowstride,
+                             g_variant_new_fixed_array (G_VARIANT_TYPE_BYTE,
+                                                        gdk_pixbuf_get_pixels (pixbuf),
+                                                        size, 1));
+    }
+
+  cache = g_variant_new ("(uxa(siiiay))", ICON_CACHE_VERSION,
+                         priv->icon_theme_mtime, &builder);
+  g_variant_ref_sink (cache);
+
+  dirname = g_path_get_dirname (priv->icon_cache_path);
+  g_mkdir_with_parents (dirname, 0700);
+  g_free (dirname);
+
+  if (!g_file_set_contents (priv->icon_cache_path,
+                            g_variant_get_data (cache),
+                            g_variant_get_size (cache),
+                            &error))
+    {
+      g_warning ("Could not write icon cache '%s': %s",
+                 priv->icon_cache_path, error->message);
+      g_error_free (error);
+    }
+
+  g_variant_unref (cache);
+}
+
+/* Search index
+ *
+ * Every row carries a CcShellSearchEntry with its name, description and
+ * keywords already normalized, so matching a search string against the
+ * model is a handful of strstr() calls per row and never allocates.
+ */
+
+struct _CcShellSearchEntry
+{
+  volatile gint  ref_count;
+
+  gchar         *id;
+  gchar         *name;
+  gchar         *description;
+  gchar        **keywords;
+};
+
+static CcShellSearchEntry *
+cc_shell_search_entry_ref (CcShellSearchEntry *entry)
+{
+  g_atomic_int_inc (&entry->ref_count);
+  return entry;
+}
+
+static void
+cc_shell_search_entry_unref (CcShellSearchEntry *entry)
+{
+  if (!g_atomic_int_dec_and_test (&entry->ref_count))
+    return;
+
+  g_free (entry->id);
+  g_free (entry->name);
+  g_free (entry->description);
+  g_strfreev (entry->keywords);
+  g_slice_free (CcShellSearchEntry, entry);
+}
+
+G_DEFINE_BOXED_TYPE (CcShellSearchEntry, cc_shell_search_entry,
+                     cc_shell_search_entry_ref, cc_shell_search_entry_unref)
+
+/**
+ * cc_shell_model_fold_search_string:
+ * @str: a UTF-8 string, or %NULL
+ *
+ * Normalizes @str for searching: compatibility characters are decomposed,
+ * accents and other combining marks are dropped and the result is
+ * casefolded, so that "Écran" and "ecran" compare equal.
+ *
+ * Returns: a newly allocated string, or %NULL
+ */
+gchar *
+cc_shell_model_fold_search_string (const gchar *str)
+{
+  gchar *normalized, *folded;
+  GString *stripped;
+  const gchar *p;
+
+  if (str == NULL)
     return NULL;
 
-  theme = gtk_icon_theme_get_default ();
+  normalized = g_utf8_normalize (str, -1, G_NORMALIZE_ALL);
+  if (normalized == NULL)
+    return NULL;
+
+  stripped = g_string_sized_new (strlen (normalized));
+  for (p = normalized; *p != '\0'; p = g_utf8_next_char (p))
+    {
+      gunichar c = g_utf8_get_char (p);
+
+      if (!g_unichar_ismark (c))
+        g_string_append_unichar (stripped, c);
+    }
+
+  folded = g_utf8_casefold (stripped->str, stripped->len);
+
+  g_string_free (stripped, TRUE);
+  g_free (normalized);
+
+  return folded;
+}
+
+static CcShellSearchEntry *
+cc_shell_search_entry_new (const gchar         *id,
+                           const gchar         *name,
+                           const gchar         *description,
+                           const gchar * const *keywords)
+{
+  CcShellSearchEntry *entry;
+  guint i, n_keywords;
+
+  entry = g_slice_new0 (CcShellSearchEntry);
+  entry->ref_count = 1;
+  entry->id = g_strdup (id);
+  entry->name = cc_shell_model_fold_search_string (name);
+  entry->description = cc_shell_model_fold_search_string (description);
+
+  n_keywords = keywords ? g_strv_length ((gchar **) keywords) : 0;
+  entry->keywords = g_new0 (gchar *, n_keywords + 1);
+  for (i = 0; i < n_keywords; i++)
+    entry->keywords[i] = cc_shell_model_fold_search_string (keywords[i]);
+
+  return entry;
+}
+
+/**
+ * cc_shell_model_has_word_prefix:
+ * @haystack: a string folded with cc_shell_model_fold_search_string()
+ * @needle: a string folded with cc_shell_model_fold_search_string()
+ *
+ * Returns: whether @needle occurs in @haystack at the start of a word
+ */
+gboolean
+cc_shell_model_has_word_prefix (const gchar *haystack,
+                                const gchar *needle)
+{
+  const gchar *p = haystack;
+
+  while ((p = strstr (p, needle)) != NULL)
+    {
+      if (p == haystack || g_ascii_isspace (p[-1]) || p[-1] == '-')
+        return TRUE;
+      p++;
+    }
+
+  return FALSE;
+}
+
+static gint
+search_entry_match (CcShellSearchEntry *entry,
+                    const gchar        *needle,
+                    GHashTable         *panel_ids)
+{
+  gboolean keyword_substring = FALSE;
+  guint i;
+
+  if (entry->name)
+    {
+      if (cc_shell_model_has_word_prefix (entry->name, needle))
+        return CC_SHELL_SEARCH_RANK_NAME_PREFIX;
+      if (strstr (entry->name, needle) != NULL)
+        return CC_SHELL_SEARCH_RANK_NAME;
+    }
+
+  for (i = 0; entry->keywords[i] != NULL; i++)
+    {
+      if (g_str_has_prefix (entry->keywords[i], needle))
+        return CC_SHELL_SEARCH_RANK_KEYWORD_PREFIX;
+      if (!keyword_substring && strstr (entry->keywords[i], needle) != NULL)
+        keyword_substring = TRUE;
+    }
+
+  if (keyword_substring)
+    return CC_SHELL_SEARCH_RANK_KEYWORD;
+
+  if (entry->description && strstr (entry->description, needle) != NULL)
+    return CC_SHELL_SEARCH_RANK_DESCRIPTION;
+
+  if (panel_ids && entry->id && g_hash_table_contains (panel_ids, entry->id))
+    return CC_SHELL_SEARCH_RANK_SETTING;
+
+  return CC_SHELL_SEARCH_RANK_NONE;
+}
+
+/**
+ * cc_shell_model_search_ranks_new:
+ *
+ * Creates the table in which cc_shell_model_search_match() keeps the rank
+ * of each row, for the filter doing the search. The rows are shared by
+ * every view of the model, so the ranks of one search can't live in them.
+ *
+ * Returns: a new #GHashTable, free it with g_hash_table_destroy()
+ */
+GHashTable *
+cc_shell_model_search_ranks_new (void)
+{
+  return g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                (GDestroyNotify) cc_shell_search_entry_unref,
+                                NULL);
+}
+
+static gint
+lookup_rank (GHashTable         *ranks,
+             CcShellSearchEntry *entry)
+{
+  gpointer rank;
+
+  if (ranks == NULL ||
+      !g_hash_table_lookup_extended (ranks, entry, NULL, &rank))
+    return CC_SHELL_SEARCH_RANK_NONE;
+
+  return GPOINTER_TO_INT (rank);
+}
+
+/**
+ * cc_shell_model_search_match:
+ * @model: a #CcShellModel, or a model wrapping one
+ * @iter: the row to match
+ * @needle: a search string normalized with
+ *   cc_shell_model_fold_search_string()
+ * @panel_ids: (allow-none): a set of panel ids that matched @needle through
+ *   one of their settings, as returned by cc_shell_settings_index_query()
+ * @ranks: (allow-none): a table from cc_shell_model_search_ranks_new()
+ *
+ * Matches a row against a search string and remembers the result in
+ * @ranks for cc_shell_model_search_get_rank() and
+ * cc_shell_model_search_compare().
+ *
+ * Returns: the rank of the match, or %CC_SHELL_SEARCH_RANK_NONE
+ */
+gint
+cc_shell_model_search_match (GtkTreeModel *model,
+                             GtkTreeIter  *iter,
+                             const gchar  *needle,
+                             GHashTable   *panel_ids,
+                             GHashTable   *ranks)
+{
+  CcShellSearchEntry *entry;
+  gint rank;
+
+  gtk_tree_model_get (model, iter, COL_SEARCH_ENTRY, &entry, -1);
+  if (entry == NULL)
+    return CC_SHELL_SEARCH_RANK_NONE;
+
+  if (needle == NULL || *needle == '\0')
+    rank = CC_SHELL_SEARCH_RANK_NONE;
+  else
+    rank = search_entry_match (entry, needle, panel_ids);
+
+  /* the table keeps the reference */
+  if (ranks)
+    g_hash_table_insert (ranks, entry, GINT_TO_POINTER (rank));
+  else
+    cc_shell_search_entry_unref (entry);
+
+  return rank;
+}
+
+/**
+ * cc_shell_model_search_get_rank:
+ * @model: a #CcShellModel, or a model wrapping one
+ * @iter: a row
+ * @ranks: a table filled by cc_shell_model_search_match()
+ *
+ * Returns: the rank of the row in the last search
+ */
+gint
+cc_shell_model_search_get_rank (GtkTreeModel *model,
+                                GtkTreeIter  *iter,
+                                GHashTable   *ranks)
+{
+  CcShellSearchEntry *entry;
+  gint rank;
+
+  gtk_tree_model_get (model, iter, COL_SEARCH_ENTRY, &entry, -1);
+  if (entry == NULL)
+    return CC_SHELL_SEARCH_RANK_NONE;
+
+  rank = lookup_rank (ranks, entry);
+  cc_shell_search_entry_unref (entry);
+
+  return rank;
+}
+
+/**
+ * cc_shell_model_search_compare:
+ * @model: a #CcShellModel, or a model wrapping one
+ * @a: a row
+ * @b: another row
+ * @user_data: a table filled by cc_shell_model_search_match()
+ *
+ * A #GtkTreeIterCompareFunc ordering rows by the rank of their last
+ * search match, then by name.
+ */
+gint
+cc_shell_model_search_compare (GtkTreeModel *model,
+                               GtkTreeIter  *a,
+                               GtkTreeIter  *b,
+                               gpointer      user_data)
+{
+  CcShellSearchEntry *entry_a, *entry_b;
+  GHashTable *ranks = user_data;
+  gint rank_a, rank_b;
+  gint result;
+
+  gtk_tree_model_get (model, a, COL_SEARCH_ENTRY, &entry_a, -1);
+  gtk_tree_model_get (model, b, COL_SEARCH_ENTRY, &entry_b, -1);
+
+  if (entry_a == NULL || entry_b == NULL)
+    result = (entry_a != NULL) - (entry_b != NULL);
+  else if ((rank_a = lookup_rank (ranks, entry_a)) !=
+           (rank_b = lookup_rank (ranks, entry_b)))
+    result = rank_a - rank_b;
+  else
+    result = g_strcmp0 (entry_a->name, entry_b->name);
+
+  if (entry_a)
+    cc_shell_search_entry_unref (entry_a);
+  if (entry_b)
+    cc_shell_search_entry_unref (entry_b);
+
+  return result;
+}
+
+/* Background icon loading */
+
+static void
+pixbuf_unref0 (gpointer pixbuf)
+{
+  if (pixbuf)
+    g_object_unref (pixbuf);
+}
+
+static void
+icon_batch_free (IconBatch *batch)
+{
+  g_clear_object (&batch->cancellable);
+  g_ptr_array_unref (batch->rows);
+  g_ptr_array_unref (batch->infos);
+  g_ptr_array_unref (batch->pixbufs);
+  g_free (batch);
+}
+
+static void
+load_icon_batch_thread (GSimpleAsyncResult *res,
+                        GObject            *object,
+                        GCancellable       *cancellable)
+{
+  IconBatch *batch;
+  guint i;
+
+  batch = g_simple_async_result_get_op_res_gpointer (res);
+
+  for (i = 0; i < batch->infos->len; i++)
+    {
+      GtkIconInfo *info = g_ptr_array_index (batch->infos, i);
+      GdkPixbuf *pixbuf = NULL;
+      GError *err = NULL;
+
+      if (g_cancellable_is_cancelled (cancellable))
+        break;
+
+      if (info)
+        {
+          pixbuf = gtk_icon_info_load_icon (info, &err);
+          if (err)
+            {
+              g_warning ("Could not load icon '%s': %s",
+                         gtk_icon_info_get_filename (info), err->message);
+              g_error_free (err);
+            }
+        }
+
+      g_ptr_array_add (batch->pixbufs, pixbuf);
+    }
+}
+
+static void
+load_icon_batch_cb (GObject      *source_object,
+                    GAsyncResult *res,
+                    gpointer      user_data)
+{
+  CcShellModel *self = CC_SHELL_MODEL (source_object);
+  CcShellModelPrivate *priv = self->priv;
+  IconBatch *batch;
+  guint i;
+
+  batch = g_simple_async_result_get_op_res_gpointer (G_SIMPLE_ASYNC_RESULT (res));
 
-  icon_info = gtk_icon_theme_lookup_by_gicon (theme, icon,
-                                              48, GTK_ICON_LOOKUP_FORCE_SIZE);
-  if (icon_info)
+  /* a cancelled batch means the model is going away or the theme changed,
+   * and whoever cancelled it has taken care of the queue */
+  if (g_cancellable_is_cancelled (batch->cancellable))
+    return;
+
+  g_clear_object (&priv->icon_cancellable);
+
+  for (i = 0; i < batch->pixbufs->len; i++)
     {
-      pixbuf = gtk_icon_info_load_icon (icon_info, &err);
-      if (err)
+      GtkTreeRowReference *row = g_ptr_array_index (batch->rows, i);
+      GdkPixbuf *pixbuf = g_ptr_array_index (batch->pixbufs, i);
+      GtkTreePath *path;
+      GtkTreeIter iter;
+      GIcon *icon;
+
+      path = gtk_tree_row_reference_get_path (row);
+      if (pixbuf == NULL || path == NULL)
+        {
+          if (path)
+            gtk_tree_path_free (path);
+          continue;
+        }
+
+      if (gtk_tree_model_get_iter (GTK_TREE_MODEL (self), &iter, path))
         {
-          g_warning ("Could not load icon '%s': %s",
-                     gtk_icon_info_get_filename (icon_info), err->message);
-          g_error_free (err);
+          gtk_tree_model_get (GTK_TREE_MODEL (self), &iter,
+                              COL_GICON, &icon,
+                              -1);
+          gtk_list_store_set (GTK_LIST_STORE (self), &iter,
+                              COL_PIXBUF, pixbuf,
+                              -1);
+
+          if (icon)
+            {
+              g_hash_table_insert (priv->icon_cache, g_icon_to_string (icon),
+                                   g_object_ref (pixbuf));
+              priv->icon_cache_dirty = TRUE;
+              g_object_unref (icon);
+            }
         }
 
-      g_object_unref (icon_info);
+      gtk_tree_path_free (path);
     }
+
+  if (g_queue_is_empty (&priv->pending_icons))
+    icon_cache_save (self);
   else
+    queue_icon_batch (self);
+}
+
+static gboolean
+start_icon_batch (CcShellModel *self)
+{
+  CcShellModelPrivate *priv = self->priv;
+  GtkIconTheme *theme;
+  GSimpleAsyncResult *res;
+  IconBatch *batch;
+
+  priv->icon_idle_id = 0;
+
+  batch = g_new0 (IconBatch, 1);
+  batch->rows = g_ptr_array_new_with_free_func ((GDestroyNotify) gtk_tree_row_reference_free);
+  batch->infos = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
+  batch->pixbufs = g_ptr_array_new_with_free_func (pixbuf_unref0);
+
+  theme = gtk_icon_theme_get_default ();
+
+  /* the lookup touches the icon theme, which is not thread safe, so it
+   * stays here; only the decoding happens in the worker */
+  while (batch->rows->len < ICON_BATCH_SIZE &&
+         !g_queue_is_empty (&priv->pending_icons))
+    {
+      GtkTreeRowReference *row = g_queue_pop_head (&priv->pending_icons);
+      GtkTreePath *path;
+      GtkTreeIter iter;
+      GtkIconInfo *info = NULL;
+      GIcon *icon = NULL;
+
+      path = gtk_tree_row_reference_get_path (row);
+      if (path && gtk_tree_model_get_iter (GTK_TREE_MODEL (self), &iter, path))
+        {
+          gtk_tree_model_get (GTK_TREE_MODEL (self), &iter,
+                              COL_GICON, &icon,
+                              -1);
+        }
+
+      if (icon)
+        {
+          info = gtk_icon_theme_lookup_by_gicon (theme, icon, ICON_SIZE,
+                                                 GTK_ICON_LOOKUP_FORCE_SIZE);
+          if (info == NULL)
+            {
+              char *name;
+
+              name = g_icon_to_string (icon);
+              g_warning ("Could not find icon '%s'", name);
+              g_free (name);
+            }
+          g_object_unref (icon);
+        }
+
+      if (path)
+        gtk_tree_path_free (path);
+
+      if (info == NULL)
+        {
+          gtk_tree_row_reference_free (row);
+          continue;
+        }
+
+      g_ptr_array_add (batch->rows, row);
+      g_ptr_array_add (batch->infos, info);
+    }
+
+  if (batch->rows->len == 0)
+    {
+      icon_batch_free (batch);
+      icon_cache_save (self);
+      return FALSE;
+    }
+
+  priv->icon_cancellable = g_cancellable_new ();
+  batch->cancellable = g_object_ref (priv->icon_cancellable);
+
+  res = g_simple_async_result_new (G_OBJECT (self), load_icon_batch_cb,
+                                   NULL, start_icon_batch);
+  g_simple_async_result_set_op_res_gpointer (res, batch,
+                                             (GDestroyNotify) icon_batch_free);
+  g_simple_async_result_run_in_thread (res, load_icon_batch_thread,
+                                       G_PRIORITY_LOW, priv->icon_cancellable);
+  g_object_unref (res);
+
+  return FALSE;
+}
+
+static void
+queue_icon_batch (CcShellModel *self)
+{
+  CcShellModelPrivate *priv = self->priv;
+
+  /* only one batch is in flight at a time */
+  if (priv->icon_idle_id != 0 || priv->icon_cancellable != NULL)
+    return;
+
+  priv->icon_idle_id = g_idle_add_full (G_PRIORITY_LOW,
+                                        (GSourceFunc) start_icon_batch,
+                                        self, NULL);
+}
+
+static void
+cancel_icon_loading (CcShellModel *self)
+{
+  CcShellModelPrivate *priv = self->priv;
+
+  if (priv->icon_idle_id != 0)
+    {
+      g_source_remove (priv->icon_idle_id);
+      priv->icon_idle_id = 0;
+    }
+
+  if (priv->icon_cancellable)
     {
-      char *name;
+      g_cancellable_cancel (priv->icon_cancellable);
+      g_clear_object (&priv->icon_cancellable);
+    }
+
+  g_queue_foreach (&priv->pending_icons, (GFunc) gtk_tree_row_reference_free, NULL);
+  g_queue_clear (&priv->pending_icons);
+}
+
+static void
+set_icon_for_row (CcShellModel *self,
+                  GtkTreeIter  *iter,
+                  GIcon        *icon)
+{
+  CcShellModelPrivate *priv = self->priv;
+  GdkPixbuf *pixbuf = NULL;
+  GtkTreePath *path;
+
+  if (icon)
+    {
+      gchar *name;
 
       name = g_icon_to_string (icon);
-      g_warning ("Could not find icon '%s'", name);
+      pixbuf = g_hash_table_lookup (priv->icon_cache, name);
       g_free (name);
     }
 
-  return pixbuf;
+  if (pixbuf)
+    {
+      gtk_list_store_set (GTK_LIST_STORE (self), iter,
+                          COL_PIXBUF, pixbuf,
+                          -1);
+      return;
+    }
+
+  if (icon == NULL)
+    return;
+
+  path = gtk_tree_model_get_path (GTK_TREE_MODEL (self), iter);
+  g_queue_push_tail (&priv->pending_icons,
+                     gtk_tree_row_reference_new (GTK_TREE_MODEL (self), path));
+  gtk_tree_path_free (path);
+
+  queue_icon_batch (self);
 }
 
 static void
@@ -76,36 +907,115 @@ icon_theme_changed (GtkIconTheme *theme,
   GtkTreeModel *model;
   gboolean cont;
 
+  cancel_icon_loading (self);
+  icon_cache_load (self);
+
+  /* rows keep showing the old icon until the new one has been decoded */
   model = GTK_TREE_MODEL (self);
   cont = gtk_tree_model_get_iter_first (model, &iter);
   while (cont)
     {
-      GdkPixbuf *pixbuf;
       GIcon *icon;
 
       gtk_tree_model_get (model, &iter,
                           COL_GICON, &icon,
                           -1);
-      pixbuf = load_pixbuf_for_gicon (icon);
-      g_object_unref (icon);
-      gtk_list_store_set (GTK_LIST_STORE (model), &iter,
-                          COL_PIXBUF, pixbuf,
-                          -1);
+      set_icon_for_row (self, &iter, icon);
+      if (icon)
+        g_object_unref (icon);
+
+      cont = gtk_tree_model_iter_next (model, &iter);
+    }
+}
+
+static void
+row_deleted_cb (GtkTreeModel *model,
+                GtkTreePath  *path,
+                gpointer      user_data)
+{
+  CcShellModelPrivate *priv = CC_SHELL_MODEL (model)->priv;
+
+  if (!priv->rows_by_id_valid)
+    return;
+
+  g_hash_table_remove_all (priv->rows_by_id);
+  priv->rows_by_id_valid = FALSE;
+}
+
+static void
+rebuild_rows_by_id (CcShellModel *self)
+{
+  CcShellModelPrivate *priv = self->priv;
+  GtkTreeModel *model = GTK_TREE_MODEL (self);
+  GtkTreeIter iter;
+  gboolean cont;
+
+  cont = gtk_tree_model_get_iter_first (model, &iter);
+  while (cont)
+    {
+      gchar *id;
+
+      gtk_tree_model_get (model, &iter, COL_ID, &id, -1);
+      if (id)
+        g_hash_table_insert (priv->rows_by_id, id, gtk_tree_iter_copy (&iter));
 
       cont = gtk_tree_model_iter_next (model, &iter);
     }
+
+  priv->rows_by_id_valid = TRUE;
+}
+
+static void
+cc_shell_model_dispose (GObject *object)
+{
+  CcShellModel *self = CC_SHELL_MODEL (object);
+  CcShellModelPrivate *priv = self->priv;
+
+  g_signal_handlers_disconnect_by_func (gtk_icon_theme_get_default (),
+                                        icon_theme_changed, self);
+
+  cancel_icon_loading (self);
+  icon_cache_save (self);
+
+  g_clear_object (&priv->placeholder);
+
+  G_OBJECT_CLASS (cc_shell_model_parent_class)->dispose (object);
+}
+
+static void
+cc_shell_model_finalize (GObject *object)
+{
+  CcShellModelPrivate *priv = CC_SHELL_MODEL (object)->priv;
+
+  g_hash_table_destroy (priv->rows_by_id);
+  g_hash_table_destroy (priv->icon_cache);
+  if (priv->update_rows)
+    g_hash_table_destroy (priv->update_rows);
+  g_free (priv->icon_cache_path);
+
+  G_OBJECT_CLASS (cc_shell_model_parent_class)->finalize (object);
 }
 
 static void
 cc_shell_model_class_init (CcShellModelClass *klass)
 {
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  g_type_class_add_private (klass, sizeof (CcShellModelPrivate));
+
+  object_class->dispose = cc_shell_model_dispose;
+  object_class->finalize = cc_shell_model_finalize;
 }
 
 static void
 cc_shell_model_init (CcShellModel *self)
 {
+  CcShellModelPrivate *priv;
   GType types[] = {G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING,
-      GDK_TYPE_PIXBUF, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_ICON, G_TYPE_STRV};
+      GDK_TYPE_PIXBUF, G_TYPE_STRING, G_TYPE_STRING, G_TYPE_ICON, G_TYPE_STRV,
+      CC_TYPE_SHELL_SEARCH_ENTRY, G_TYPE_INT64};
+
+  priv = self->priv = SHELL_MODEL_PRIVATE (self);
 
   gtk_list_store_set_column_types (GTK_LIST_STORE (self),
                                    N_COLS, types);
@@ -113,6 +1023,21 @@ cc_shell_model_init (CcShellModel *self)
   gtk_tree_sortable_set_sort_column_id (GTK_TREE_SORTABLE (self), COL_NAME,
                                         GTK_SORT_ASCENDING);
 
+  /* a blank icon keeps the grid layout stable until the real one arrives */
+  priv->placeholder = gdk_pixbuf_new (GDK_COLORSPACE_RGB, TRUE, 8,
+                                      ICON_SIZE, ICON_SIZE);
+  gdk_pixbuf_fill (priv->placeholder, 0x00000000);
+
+  priv->rows_by_id = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                            (GDestroyNotify) gtk_tree_iter_free);
+  priv->rows_by_id_valid = TRUE;
+  g_signal_connect (self, "row-deleted", G_CALLBACK (row_deleted_cb), NULL);
+
+  g_queue_init (&priv->pending_icons);
+  priv->icon_cache = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                            g_free, g_object_unref);
+  icon_cache_load (self);
+
   g_signal_connect (G_OBJECT (gtk_icon_theme_get_default ()), "changed",
                     G_CALLBACK (icon_theme_changed), self);
 }
@@ -153,6 +1078,98 @@ desktop_entry_has_panel_category (GKeyFile *key_file)
 
 }
 
+static gint64
+get_desktop_mtime (const gchar *desktop)
+{
+  GStatBuf buf;
+
+  if (desktop == NULL || g_stat (desktop, &buf) != 0)
+    return 0;
+
+  return (gint64) buf.st_mtime;
+}
+
+static void
+set_entry (CcShellModel        *model,
+           GtkTreeIter         *iter,
+           const gchar         *category_name,
+           const gchar         *id,
+           const gchar         *name,
+           const gchar         *desktop,
+           const gchar         *comment,
+           GIcon               *icon,
+           const gchar * const *keywords,
+           gint64               mtime)
+{
+  CcShellSearchEntry *search_entry;
+
+  search_entry = cc_shell_search_entry_new (id, name, comment, keywords);
+
+  gtk_list_store_set (GTK_LIST_STORE (model), iter,
+                      COL_NAME, name,
+                      COL_DESKTOP_FILE, desktop,
+                      COL_ID, id,
+                      COL_CATEGORY, category_name,
+                      COL_DESCRIPTION, comment,
+                      COL_GICON, icon,
+                      COL_KEYWORDS, keywords,
+                      COL_SEARCH_ENTRY, search_entry,
+                      COL_MTIME, mtime,
+                      -1);
+
+  cc_shell_search_entry_unref (search_entry);
+
+  set_icon_for_row (model, iter, icon);
+}
+
+static gchar *
+get_update_key (const gchar *category_name,
+                const gchar *desktop)
+{
+  return g_strconcat (category_name ? category_name : "", "\n", desktop, NULL);
+}
+
+/* During an update, finds the row already showing @desktop in
+ * @category_name, and whether it is still up to date. */
+static gboolean
+take_update_row (CcShellModel *model,
+                 const gchar  *category_name,
+                 const gchar  *desktop,
+                 gint64        mtime,
+                 GtkTreeIter  *iter,
+                 gboolean     *up_to_date)
+{
+  CcShellModelPrivate *priv = model->priv;
+  GtkTreeIter *found;
+  gchar *key;
+  gint64 row_mtime;
+  gboolean ret = FALSE;
+
+  *up_to_date = FALSE;
+
+  if (priv->update_rows == NULL || desktop == NULL)
+    return FALSE;
+
+  key = get_update_key (category_name, desktop);
+  found = g_hash_table_lookup (priv->update_rows, key);
+  if (found != NULL)
+    {
+      *iter = *found;
+      g_hash_table_remove (priv->update_rows, key);
+
+      gtk_tree_model_get (GTK_TREE_MODEL (model), iter,
+                          COL_MTIME, &row_mtime,
+                          -1);
+
+      *up_to_date = (row_mtime == mtime);
+      ret = TRUE;
+    }
+
+  g_free (key);
+
+  return ret;
+}
+
 void
 cc_shell_model_add_item (CcShellModel   *model,
                          const gchar    *category_name,
@@ -164,9 +1181,17 @@ cc_shell_model_add_item (CcShellModel   *model,
   const gchar *desktop = gmenu_tree_entry_get_desktop_file_path (item);
   const gchar *comment = g_app_info_get_description (appinfo);
   gchar *id;
-  GdkPixbuf *pixbuf = NULL;
   GKeyFile *key_file;
   gchar **keywords;
+  GtkTreeIter iter;
+  gboolean has_row, up_to_date;
+  gint64 mtime;
+
+  mtime = get_desktop_mtime (desktop);
+  has_row = take_update_row (model, category_name, desktop, mtime,
+                             &iter, &up_to_date);
+  if (up_to_date)
+    return;
 
   /* load the .desktop file since gnome-menus doesn't have a way to read
    * custom properties from desktop files */
@@ -188,6 +1213,8 @@ cc_shell_model_add_item (CcShellModel   *model,
 		     " category but isn't a panel.",
 		     desktop);
          g_key_file_free (key_file);
+         if (has_row)
+           gtk_list_store_remove (GTK_LIST_STORE (model), &iter);
          return;
 	}
       id = g_strdup (gmenu_tree_entry_get_desktop_file_id (item));
@@ -200,19 +1227,179 @@ cc_shell_model_add_item (CcShellModel   *model,
   g_key_file_free (key_file);
   key_file = NULL;
 
-  pixbuf = load_pixbuf_for_gicon (icon);
+  if (has_row)
+    {
+      gchar *old_id;
+
+      /* the row keeps its place and its icon while it is updated */
+      gtk_tree_model_get (GTK_TREE_MODEL (model), &iter, COL_ID, &old_id, -1);
+      if (g_strcmp0 (old_id, id) != 0)
+        {
+          g_hash_table_remove_all (model->priv->rows_by_id);
+          model->priv->rows_by_id_valid = FALSE;
+        }
+      g_free (old_id);
+
+      set_entry (model, &iter, category_name, id, name, desktop, comment,
+                 icon, (const gchar * const *) keywords, mtime);
+    }
+  else
+    {
+      cc_shell_model_add_entry (model, category_name, id, name, desktop,
+                                comment, icon, (const gchar * const *) keywords);
+    }
+
+  g_free (id);
+  g_strfreev (keywords);
+}
 
-  gtk_list_store_insert_with_values (GTK_LIST_STORE (model), NULL, 0,
+/* Adds a row from already-parsed desktop entry data, as used when the
+ * panel list comes from the on-disk panel cache rather than from the
+ * menu tree. */
+void
+cc_shell_model_add_entry (CcShellModel        *model,
+                          const gchar         *category_name,
+                          const gchar         *id,
+                          const gchar         *name,
+                          const gchar         *desktop,
+                          const gchar         *comment,
+                          GIcon               *icon,
+                          const gchar * const *keywords)
+{
+  CcShellSearchEntry *search_entry;
+  GtkTreeIter iter;
+  gboolean up_to_date;
+  gint64 mtime;
+
+  mtime = get_desktop_mtime (desktop);
+
+  if (take_update_row (model, category_name, desktop, mtime, &iter, &up_to_date))
+    {
+      if (!up_to_date)
+        set_entry (model, &iter, category_name, id, name, desktop, comment,
+                   icon, keywords, mtime);
+      return;
+    }
+
+  search_entry = cc_shell_search_entry_new (id, name, comment, keywords);
+
+  gtk_list_store_insert_with_values (GTK_LIST_STORE (model), &iter, 0,
                                      COL_NAME, name,
                                      COL_DESKTOP_FILE, desktop,
                                      COL_ID, id,
-                                     COL_PIXBUF, pixbuf,
+                                     COL_PIXBUF, model->priv->placeholder,
                                      COL_CATEGORY, category_name,
                                      COL_DESCRIPTION, comment,
                                      COL_GICON, icon,
                                      COL_KEYWORDS, keywords,
+                                     COL_SEARCH_ENTRY, search_entry,
+                                     COL_MTIME, mtime,
                                      -1);
 
-  g_free (id);
-  g_strfreev (keywords);
+  cc_shell_search_entry_unref (search_entry);
+
+  if (id && model->priv->rows_by_id_valid)
+    g_hash_table_insert (model->priv->rows_by_id, g_strdup (id),
+                         gtk_tree_iter_copy (&iter));
+
+  set_icon_for_row (model, &iter, icon);
+}
+
+/**
+ * cc_shell_model_begin_update:
+ * @model: a #CcShellModel
+ *
+ * Starts reloading the model from the menu. Until
+ * cc_shell_model_end_update() is called, adding a panel that already has
+ * a row in the same category only updates that row, and only if its
+ * desktop file changed.
+ */
+void
+cc_shell_model_begin_update (CcShellModel *model)
+{
+  CcShellModelPrivate *priv = model->priv;
+  GtkTreeModel *tree_model = GTK_TREE_MODEL (model);
+  GtkTreeIter iter;
+  gboolean cont;
+
+  g_return_if_fail (priv->update_rows == NULL);
+
+  priv->update_rows = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                             (GDestroyNotify) gtk_tree_iter_free);
+
+  cont = gtk_tree_model_get_iter_first (tree_model, &iter);
+  while (cont)
+    {
+      gchar *desktop, *category;
+
+      gtk_tree_model_get (tree_model, &iter,
+                          COL_DESKTOP_FILE, &desktop,
+                          COL_CATEGORY, &category,
+                          -1);
+
+      if (desktop)
+        g_hash_table_insert (priv->update_rows,
+                             get_update_key (category, desktop),
+                             gtk_tree_iter_copy (&iter));
+
+      g_free (desktop);
+      g_free (category);
+
+      cont = gtk_tree_model_iter_next (tree_model, &iter);
+    }
+}
+
+/**
+ * cc_shell_model_end_update:
+ * @model: a #CcShellModel
+ *
+ * Removes the rows of the panels that were not added again since
+ * cc_shell_model_begin_update().
+ */
+void
+cc_shell_model_end_update (CcShellModel *model)
+{
+  CcShellModelPrivate *priv = model->priv;
+  GHashTableIter hash_iter;
+  GtkTreeIter *iter;
+
+  g_return_if_fail (priv->update_rows != NULL);
+
+  g_hash_table_iter_init (&hash_iter, priv->update_rows);
+  while (g_hash_table_iter_next (&hash_iter, NULL, (gpointer *) &iter))
+    gtk_list_store_remove (GTK_LIST_STORE (model), iter);
+
+  g_clear_pointer (&priv->update_rows, g_hash_table_destroy);
+}
+
+/**
+ * cc_shell_model_lookup_id:
+ * @model: a #CcShellModel
+ * @id: a panel id
+ * @iter: (out): return location for the row of the panel
+ *
+ * Finds the row of a panel without walking the model.
+ *
+ * Returns: %TRUE if the panel is in the model
+ */
+gboolean
+cc_shell_model_lookup_id (CcShellModel *model,
+                          const gchar  *id,
+                          GtkTreeIter  *iter)
+{
+  GtkTreeIter *found;
+
+  g_return_val_if_fail (CC_IS_SHELL_MODEL (model), FALSE);
+  g_return_val_if_fail (id != NULL, FALSE);
+
+  if (!model->priv->rows_by_id_valid)
+    rebuild_rows_by_id (model);
+
+  found = g_hash_table_lookup (model->priv->rows_by_id, id);
+  if (found == NULL)
+    return FALSE;
+
+  *iter = *found;
+
+  return TRUE;
 }
@@ -52,6 +52,17 @@ G_BEGIN_DECLS
 
 typedef struct _CcShellModel CcShellModel;
 typedef struct _CcShellModelClass CcShellModelClass;
+typedef struct _CcShellModelPrivate CcShellModelPrivate;
+
+/**
+ * CcShellSearchEntry:
+ *
+ * The normalized search data of a row. The contents of this struct are
+ * private and should not be accessed directly.
+ */
+typedef struct _CcShellSearchEntry CcShellSearchEntry;
+
+#define CC_TYPE_SHELL_SEARCH_ENTRY (cc_shell_search_entry_get_type ())
 
 enum
 {
@@ -63,13 +74,29 @@ enum
   COL_DESCRIPTION,
   COL_GICON,
   COL_KEYWORDS,
+  COL_SEARCH_ENTRY,
+  COL_MTIME,
 
   N_COLS
 };
 
+/* Search match quality, best first */
+enum
+{
+  CC_SHELL_SEARCH_RANK_NONE = -1,
+  CC_SHELL_SEARCH_RANK_NAME_PREFIX,
+  CC_SHELL_SEARCH_RANK_NAME,
+  CC_SHELL_SEARCH_RANK_KEYWORD_PREFIX,
+  CC_SHELL_SEARCH_RANK_KEYWORD,
+  CC_SHELL_SEARCH_RANK_DESCRIPTION,
+  CC_SHELL_SEARCH_RANK_SETTING
+};
+
 struct _CcShellModel
 {
   GtkListStore parent;
+
+  CcShellModelPrivate *priv;
 };
 
 struct _CcShellModelClass
@@ -78,6 +105,7 @@ struct _CcShellModelClass
 };
 
 GType cc_shell_model_get_type (void) G_GNUC_CONST;
+GType cc_shell_search_entry_get_type (void) G_GNUC_CONST;
 
 CcShellModel *cc_shell_model_new (void);
 
@@ -85,6 +113,44 @@ void cc_shell_model_add_item (CcShellModel   *model,
                               const gchar    *category_name,
                               GMenuTreeEntry *item);
 
+void cc_shell_model_add_entry (CcShellModel        *model,
+                               const gchar         *category_name,
+                               const gchar         *id,
+                               const gchar         *name,
+                               const gchar         *desktop,
+                               const gchar         *comment,
+                               GIcon               *icon,
+                               const gchar * const *keywords);
+
+void cc_shell_model_begin_update (CcShellModel *model);
+void cc_shell_model_end_update   (CcShellModel *model);
+
+gboolean cc_shell_model_lookup_id (CcShellModel *model,
+                                   const gchar  *id,
+                                   GtkTreeIter  *iter);
+
+gchar *cc_shell_model_fold_search_string (const gchar *str);
+
+gboolean cc_shell_model_has_word_prefix (const gchar *haystack,
+                                         const gchar *needle);
+
+GHashTable *cc_shell_model_search_ranks_new (void);
+
+gint cc_shell_model_search_match (GtkTreeModel *model,
+                                  GtkTreeIter  *iter,
+                                  const gchar  *needle,
+                                  GHashTable   *panel_ids,
+                                  GHashTable   *ranks);
+
+gint cc_shell_model_search_get_rank (GtkTreeModel *model,
+                                     GtkTreeIter  *iter,
+                                     GHashTable   *ranks);
+
+gint cc_shell_model_search_compare (GtkTreeModel *model,
+                                    GtkTreeIter  *a,
+                                    GtkTreeIter  *b,
+                                    gpointer      user_data);
+
 G_END_DECLS
 
 #endif /* _CC_SHELL_MODEL_H */
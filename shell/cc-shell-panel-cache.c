@@ -0,0 +1,336 @@
+/*
+ * Copyright (c) 2026 Canonical Ltd.
+ *
+ * The Control Center is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * The Control Center is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with the Control Center; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * The panel cache is a serialized GVariant holding everything the overview
+ * needs from the panel .desktop files. It is mapped straight from disk, so
+ * a warm start neither loads the menu tree nor parses any key file; the
+ * only file system work is one stat per desktop file and directory to make
+ * sure nothing changed since the cache was written.
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <glib/gstdio.h>
+
+#include "cc-shell-panel-cache.h"
+
+#define CACHE_VERSION 1
+
+/* version, locale, menu mtime, categories, directories, entries */
+#define CACHE_FORMAT "(usxasa(sx)a(ssssssasx))"
+/* id, name, description, category, icon, desktop file, keywords, mtime */
+#define ENTRY_FORMAT "(ssssssasx)"
+
+gchar *
+cc_shell_panel_cache_get_path (void)
+{
+  return g_build_filename (g_get_user_cache_dir (),
+                           "unity-control-center",
+                           "panels.cache",
+                           NULL);
+}
+
+static gboolean
+get_mtime (const gchar *path,
+           gint64      *mtime)
+{
+  GStatBuf buf;
+
+  if (g_stat (path, &buf) != 0)
+    return FALSE;
+
+  *mtime = (gint64) buf.st_mtime;
+  return TRUE;
+}
+
+static gboolean
+mtime_matches (const gchar *path,
+               gint64       cached)
+{
+  gint64 mtime;
+
+  if (!get_mtime (path, &mtime))
+    return FALSE;
+
+  return mtime == cached;
+}
+
+static const gchar *
+empty_to_null (const gchar *str)
+{
+  return (str && *str) ? str : NULL;
+}
+
+static gboolean
+cache_is_valid (GVariant    *cache,
+                const gchar *menu_path)
+{
+  guint32 version;
+  const gchar *locale;
+  gint64 menu_mtime;
+  GVariant *dirs, *entries;
+  GVariantIter iter;
+  const gchar *path;
+  gint64 mtime;
+  gboolean valid = FALSE;
+
+  g_variant_get (cache, "(u&sx@as@a(sx)@a" ENTRY_FORMAT ")",
+                 &version, &locale, &menu_mtime, NULL, &dirs, &entries);
+
+  if (version != CACHE_VERSION)
+    goto out;
+
+  /* names, descriptions and keywords are stored translated */
+  if (g_strcmp0 (locale, g_get_language_names ()[0]) != 0)
+    goto out;
+
+  if (!mtime_matches (menu_path, menu_mtime))
+    goto out;
+
+  /* directory mtimes catch panels that were added since the last run */
+  g_variant_iter_init (&iter, dirs);
+  while (g_variant_iter_next (&iter, "(&sx)", &path, &mtime))
+    {
+      if (!mtime_matches (path, mtime))
+        goto out;
+    }
+
+  g_variant_iter_init (&iter, entries);
+  while (g_variant_iter_next (&iter, "(&s&s&s&s&s&s@asx)",
+                              NULL, NULL, NULL, NULL, NULL,
+                              &path, NULL, &mtime))
+    {
+      if (!mtime_matches (path, mtime))
+        goto out;
+    }
+
+  valid = TRUE;
+
+out:
+  g_variant_unref (dirs);
+  g_variant_unref (entries);
+
+  return valid;
+}
+
+/**
+ * cc_shell_panel_cache_load:
+ * @model: the model to fill
+ * @menu_path: the menu file the cache was generated from
+ * @categories: (out): return location for the category names, in menu order
+ *
+ * Fills @model from the panel cache if it is still up to date.
+ *
+ * Returns: %TRUE if the model was filled, %FALSE if the cache is missing or
+ * stale, in which case the model is left untouched.
+ */
+gboolean
+cc_shell_panel_cache_load (CcShellModel   *model,
+                           const gchar    *menu_path,
+                           gchar        ***categories)
+{
+  GMappedFile *mapped;
+  GVariant *cache, *entries;
+  GVariantIter iter;
+  const gchar *id, *name, *description, *category, *icon_name, *desktop;
+  GVariant *keywords;
+  gchar *path;
+
+  path = cc_shell_panel_cache_get_path ();
+  mapped = g_mapped_file_new (path, FALSE, NULL);
+  g_free (path);
+
+  if (mapped == NULL)
+    return FALSE;
+
+  if (g_mapped_file_get_length (mapped) == 0)
+    {
+      g_mapped_file_unref (mapped);
+      return FALSE;
+    }
+
+  /* the cache is not trusted: GVariant copes with corrupt data by
+   * returning default values, which then fail the version check */
+  cache = g_variant_new_from_data (G_VARIANT_TYPE (CACHE_FORMAT),
+                                   g_mapped_file_get_contents (mapped),
+                                   g_mapped_file_get_length (mapped),
+                                   FALSE,
+                                   (GDestroyNotify) g_mapped_file_unref,
+                                   mapped);
+  g_variant_ref_sink (cache);
+
+  if (!cache_is_valid (cache, menu_path))
+    {
+      g_debug ("Panel cache is out of date, loading the menu");
+      g_variant_unref (cache);
+      return FALSE;
+    }
+
+  g_variant_get (cache, "(u&sx^as@a(sx)@a" ENTRY_FORMAT ")",
+                 NULL, NULL, NULL, categories, NULL, &entries);
+
+  g_variant_iter_init (&iter, entries);
+  while (g_variant_iter_next (&iter, "(&s&s&s&s&s&s@asx)",
+                              &id, &name, &description, &category,
+                              &icon_name, &desktop, &keywords, NULL))
+    {
+      GIcon *icon = NULL;
+      const gchar **strv;
+
+      if (*icon_name)
+        icon = g_icon_new_for_string (icon_name, NULL);
+
+      strv = g_variant_get_strv (keywords, NULL);
+
+      cc_shell_model_add_entry (model, category, id, name, desktop,
+                                empty_to_null (description), icon, strv);
+
+      g_free (strv);
+      g_variant_unref (keywords);
+      if (icon)
+        g_object_unref (icon);
+    }
+
+  g_variant_unref (entries);
+  g_variant_unref (cache);
+
+  return TRUE;
+}
+
+/**
+ * cc_shell_panel_cache_save:
+ * @model: a model filled from the menu tree
+ * @menu_path: the menu file the model was loaded from
+ * @categories: the category names, in menu order
+ *
+ * Writes the contents of @model to the panel cache so that the next start
+ * can skip loading the menu tree.
+ */
+void
+cc_shell_panel_cache_save (CcShellModel        *model,
+                           const gchar         *menu_path,
+                           const gchar * const *categories)
+{
+  GVariantBuilder dirs, entries;
+  GHashTable *seen_dirs;
+  GVariant *cache;
+  GtkTreeModel *tree_model;
+  GtkTreeIter iter;
+  gboolean cont;
+  gint64 menu_mtime = 0;
+  gchar *path, *dirname;
+  GError *error = NULL;
+  const gchar *empty_strv[] = { NULL };
+
+  get_mtime (menu_path, &menu_mtime);
+
+  g_variant_builder_init (&dirs, G_VARIANT_TYPE ("a(sx)"));
+  g_variant_builder_init (&entries, G_VARIANT_TYPE ("a" ENTRY_FORMAT));
+  seen_dirs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+  tree_model = GTK_TREE_MODEL (model);
+  cont = gtk_tree_model_get_iter_first (tree_model, &iter);
+  while (cont)
+    {
+      gchar *id, *name, *description, *category, *desktop;
+      gchar **keywords;
+      GIcon *icon;
+      gchar *icon_name = NULL;
+      gint64 mtime;
+
+      gtk_tree_model_get (tree_model, &iter,
+                          COL_ID, &id,
+                          COL_NAME, &name,
+                          COL_DESCRIPTION, &description,
+                          COL_CATEGORY, &category,
+                          COL_GICON, &icon,
+                          COL_DESKTOP_FILE, &desktop,
+                          COL_KEYWORDS, &keywords,
+                          -1);
+
+      if (icon)
+        icon_name = g_icon_to_string (icon);
+
+      if (desktop && get_mtime (desktop, &mtime))
+        {
+          g_variant_builder_add (&entries, "(ssssss^asx)",
+                                 id ? id : "",
+                                 name ? name : "",
+                                 description ? description : "",
+                                 category ? category : "",
+                                 icon_name ? icon_name : "",
+                                 desktop,
+                                 keywords ? keywords : empty_strv,
+                                 mtime);
+
+          dirname = g_path_get_dirname (desktop);
+          if (!g_hash_table_contains (seen_dirs, dirname) &&
+              get_mtime (dirname, &mtime))
+            {
+              g_variant_builder_add (&dirs, "(sx)", dirname, mtime);
+              g_hash_table_add (seen_dirs, dirname);
+            }
+          else
+            {
+              g_free (dirname);
+            }
+        }
+
+      g_free (id);
+      g_free (name);
+      g_free (description);
+      g_free (category);
+      g_free (desktop);
+      g_free (icon_name);
+      g_strfreev (keywords);
+      if (icon)
+        g_object_unref (icon);
+
+      cont = gtk_tree_model_iter_next (tree_model, &iter);
+    }
+
+  g_hash_table_destroy (seen_dirs);
+
+  cache = g_variant_new ("(usx^asa(sx)a" ENTRY_FORMAT ")",
+                         CACHE_VERSION,
+                         g_get_language_names ()[0],
+                         menu_mtime,
+                         categories ? categories : empty_strv,
+                         &dirs,
+                         &entries);
+  g_variant_ref_sink (cache);
+
+  path = cc_shell_panel_cache_get_path ();
+  dirname = g_path_get_dirname (path);
+  g_mkdir_with_parents (dirname, 0700);
+  g_free (dirname);
+
+  if (!g_file_set_contents (path,
+                            g_variant_get_data (cache),
+                            g_variant_get_size (cache),
+                            &error))
+    {
+      g_warning ("Could not write panel cache '%s': %s", path, error->message);
+      g_error_free (error);
+    }
+
+  g_free (path);
+  g_variant_unref (cache);
+}
@@ -0,0 +1,38 @@
+/*
+ * Copyright (c) 2026 Canonical Ltd.
+ *
+ * The Control Center is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * The Control Center is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with the Control Center; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _CC_SHELL_PANEL_CACHE_H
+#define _CC_SHELL_PANEL_CACHE_H
+
+#include "cc-shell-model.h"
+
+G_BEGIN_DECLS
+
+gchar    *cc_shell_panel_cache_get_path (void);
+
+gboolean  cc_shell_panel_cache_load     (CcShellModel        *model,
+                                         const gchar         *menu_path,
+                                         gchar             ***categories);
+
+void      cc_shell_panel_cache_save     (CcShellModel        *model,
+                                         const gchar         *menu_path,
+                                         const gchar * const *categories);
+
+G_END_DECLS
+
+#endif /* _CC_SHELL_PANEL_CACHE_H */
@@ -0,0 +1,213 @@
+/*
+ * Copyright (c) 2026 Canonical Ltd.
+ *
+ * The Control Center is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * The Control Center is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with the Control Center; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * The settings index maps the labels found in the panels' .ui files, and
+ * the summaries of the GSettings keys they use, to the panel that shows
+ * them. It is generated at build time by settings-index-generator and
+ * mapped from disk, so deep search works without loading any panel module.
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <glib/gi18n.h>
+#include <pango/pango.h>
+
+#include "cc-shell-model.h"
+#include "cc-shell-settings-index.h"
+
+struct _CcShellSettingsIndex
+{
+  GVariant     *entries;
+  guint         n_entries;
+
+  /* translated, folded labels; built on the first query */
+  gchar       **labels;
+};
+
+CcShellSettingsIndex *
+cc_shell_settings_index_new (const gchar *path)
+{
+  CcShellSettingsIndex *index;
+  GMappedFile *mapped;
+  GVariant *variant;
+  guint32 version;
+  GError *error = NULL;
+
+  mapped = g_mapped_file_new (path, FALSE, &error);
+  if (mapped == NULL)
+    {
+      g_debug ("Could not load settings index: %s", error->message);
+      g_error_free (error);
+      return NULL;
+    }
+
+  if (g_mapped_file_get_length (mapped) == 0)
+    {
+      g_mapped_file_unref (mapped);
+      return NULL;
+    }
+
+  variant = g_variant_new_from_data (G_VARIANT_TYPE ("(ua" CC_SHELL_SETTINGS_INDEX_ENTRY_FORMAT ")"),
+                                     g_mapped_file_get_contents (mapped),
+                                     g_mapped_file_get_length (mapped),
+                                     FALSE,
+                                     (GDestroyNotify) g_mapped_file_unref,
+                                     mapped);
+  g_variant_ref_sink (variant);
+
+  index = g_new0 (CcShellSettingsIndex, 1);
+  g_variant_get (variant, "(u@a" CC_SHELL_SETTINGS_INDEX_ENTRY_FORMAT ")",
+                 &version, &index->entries);
+  g_variant_unref (variant);
+
+  if (version != CC_SHELL_SETTINGS_INDEX_VERSION)
+    {
+      g_warning ("Ignoring settings index '%s' with unknown version %u",
+                 path, version);
+      cc_shell_settings_index_free (index);
+      return NULL;
+    }
+
+  index->n_entries = g_variant_n_children (index->entries);
+
+  return index;
+}
+
+void
+cc_shell_settings_index_free (CcShellSettingsIndex *index)
+{
+  if (index == NULL)
+    return;
+
+  g_variant_unref (index->entries);
+  g_strfreev (index->labels);
+  g_free (index);
+}
+
+static gchar *
+fold_label (const gchar *domain,
+            const gchar *context,
+            const gchar *label)
+{
+  const gchar *translated;
+  gchar *plain = NULL;
+  gchar *folded;
+
+  if (*context != '\0')
+    translated = g_dpgettext2 (*domain ? domain : NULL, context, label);
+  else
+    translated = g_dgettext (*domain ? domain : NULL, label);
+
+  /* drop markup and mnemonics; labels that are not valid markup are
+   * used as they are */
+  if (!pango_parse_markup (translated, -1, '_', NULL, &plain, NULL, NULL))
+    plain = g_strdup (translated);
+
+  folded = cc_shell_model_fold_search_string (plain);
+  g_free (plain);
+
+  return folded;
+}
+
+static void
+ensure_labels (CcShellSettingsIndex *index)
+{
+  guint i;
+
+  if (index->labels != NULL)
+    return;
+
+  index->labels = g_new0 (gchar *, index->n_entries + 1);
+
+  for (i = 0; i < index->n_entries; i++)
+    {
+      const gchar *domain, *context, *label;
+
+      g_variant_get_child (index->entries, i,
+                           "(&s&s&s&s&s)",
+                           &domain, &context, &label, NULL, NULL);
+
+      index->labels[i] = fold_label (domain, context, label);
+      if (index->labels[i] == NULL)
+        index->labels[i] = g_strdup ("");
+    }
+}
+
+/**
+ * cc_shell_settings_index_query:
+ * @index: a #CcShellSettingsIndex
+ * @needle: a search string normalized with
+ *   cc_shell_model_fold_search_string()
+ *
+ * Finds the panels containing a setting whose label has a word starting
+ * with each word of @needle, so that "lid close" finds "When the lid is
+ * closed".
+ *
+ * Returns: a new hash table mapping panel ids to the argument that leads to
+ * the first matching setting. The strings are owned by @index.
+ */
+GHashTable *
+cc_shell_settings_index_query (CcShellSettingsIndex *index,
+                               const gchar          *needle)
+{
+  GHashTable *matches;
+  gchar **tokens;
+  guint i, j;
+
+  matches = g_hash_table_new (g_str_hash, g_str_equal);
+
+  if (index == NULL || needle == NULL)
+    return matches;
+
+  tokens = g_strsplit_set (needle, " \t", -1);
+  if (tokens[0] == NULL)
+    {
+      g_strfreev (tokens);
+      return matches;
+    }
+
+  ensure_labels (index);
+
+  for (i = 0; i < index->n_entries; i++)
+    {
+      const gchar *panel, *argument;
+      gboolean match = TRUE;
+
+      for (j = 0; match && tokens[j] != NULL; j++)
+        {
+          if (*tokens[j] != '\0')
+            match = cc_shell_model_has_word_prefix (index->labels[i], tokens[j]);
+        }
+
+      if (!match)
+        continue;
+
+      g_variant_get_child (index->entries, i,
+                           "(&s&s&s&s&s)",
+                           NULL, NULL, NULL, &panel, &argument);
+
+      if (!g_hash_table_contains (matches, panel))
+        g_hash_table_insert (matches, (gpointer) panel, (gpointer) argument);
+    }
+
+  g_strfreev (tokens);
+
+  return matches;
+}
@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2026 Canonical Ltd.
+ *
+ * The Control Center is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * The Control Center is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with the Control Center; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _CC_SHELL_SETTINGS_INDEX_H
+#define _CC_SHELL_SETTINGS_INDEX_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+#define CC_SHELL_SETTINGS_INDEX_VERSION 1
+
+/* gettext domain, context, untranslated label, panel id, panel argument */
+#define CC_SHELL_SETTINGS_INDEX_ENTRY_FORMAT "(sssss)"
+
+typedef struct _CcShellSettingsIndex CcShellSettingsIndex;
+
+CcShellSettingsIndex *cc_shell_settings_index_new   (const gchar          *path);
+
+void                  cc_shell_settings_index_free  (CcShellSettingsIndex *index);
+
+GHashTable           *cc_shell_settings_index_query (CcShellSettingsIndex *index,
+                                                     const gchar          *needle);
+
+G_END_DECLS
+
+#endif /* _CC_SHELL_SETTINGS_INDEX_H */
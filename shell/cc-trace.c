@@ -0,0 +1,250 @@
+/*
+ * Copyright (c) 2026 Canonical Ltd.
+ *
+ * The Control Center is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * The Control Center is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with the Control Center; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * A minimal span recorder for startup and panel activation timings. Spans
+ * are kept in memory and written out as a Chrome trace (which Perfetto and
+ * chrome://tracing can open) when UCC_TRACE is set, or printed with
+ * --timings. Recording is cheap enough to be always on; the number of
+ * spans is capped so a long session cannot grow it without bounds.
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <unistd.h>
+
+#include "cc-trace.h"
+
+#define MAX_SPANS 10000
+
+typedef struct
+{
+  const gchar *category;
+  const gchar *name;
+  gchar       *detail;
+  gint64       begin;
+  gint64       end;
+} Span;
+
+static GMutex lock;
+static GArray *spans = NULL;
+
+/**
+ * cc_trace_begin:
+ *
+ * Returns: the current monotonic time, to be passed to cc_trace_end()
+ */
+gint64
+cc_trace_begin (void)
+{
+  return g_get_monotonic_time ();
+}
+
+/**
+ * cc_trace_end:
+ * @category: a static string grouping related spans, e.g. "shell"
+ * @name: a static string naming the span
+ * @detail: (allow-none): extra information, e.g. a panel id
+ * @begin: the value returned by cc_trace_begin() when the span started
+ *
+ * Records a span that started at @begin and ends now.
+ */
+void
+cc_trace_end (const gchar *category,
+              const gchar *name,
+              const gchar *detail,
+              gint64       begin)
+{
+  Span span;
+
+  span.category = g_intern_string (category);
+  span.name = g_intern_string (name);
+  span.detail = g_strdup (detail);
+  span.begin = begin;
+  span.end = g_get_monotonic_time ();
+
+  g_mutex_lock (&lock);
+
+  if (spans == NULL)
+    spans = g_array_new (FALSE, FALSE, sizeof (Span));
+
+  if (spans->len < MAX_SPANS)
+    g_array_append_val (spans, span);
+  else
+    g_free (span.detail);
+
+  g_mutex_unlock (&lock);
+}
+
+static void
+append_json_string (GString     *out,
+                    const gchar *str)
+{
+  const gchar *p;
+
+  g_string_append_c (out, '"');
+
+  for (p = str; *p != '\0'; p++)
+    {
+      switch (*p)
+        {
+        case '"':
+          g_string_append (out, "\\\"");
+          break;
+        case '\\':
+          g_string_append (out, "\\\\");
+          break;
+        case '\n':
+          g_string_append (out, "\\n");
+          break;
+        default:
+          if ((guchar) *p < 0x20)
+            g_string_append_printf (out, "\\u%04x", (guint) *p);
+          else
+            g_string_append_c (out, *p);
+        }
+    }
+
+  g_string_append_c (out, '"');
+}
+
+/**
+ * cc_trace_write:
+ * @path: the file to write
+ * @error: return location for a #GError
+ *
+ * Writes the recorded spans to @path in the Chrome trace event format.
+ *
+ * Returns: %TRUE on success
+ */
+gboolean
+cc_trace_write (const gchar  *path,
+                GError      **error)
+{
+  GString *out;
+  gboolean ret;
+  guint i;
+
+  out = g_string_new ("{\"traceEvents\":[\n");
+
+  g_mutex_lock (&lock);
+
+  for (i = 0; spans != NULL && i < spans->len; i++)
+    {
+      Span *span = &g_array_index (spans, Span, i);
+
+      g_string_append (out, i > 0 ? ",\n{\"name\":" : "{\"name\":");
+      append_json_string (out, span->name);
+      g_string_append (out, ",\"cat\":");
+      append_json_string (out, span->category);
+      g_string_append_printf (out,
+                              ",\"ph\":\"X\",\"ts\":%" G_GINT64_FORMAT
+                              ",\"dur\":%" G_GINT64_FORMAT
+                              ",\"pid\":%d,\"tid\":%d",
+                              span->begin, span->end - span->begin,
+                              (gint) getpid (), (gint) getpid ());
+
+      if (span->detail != NULL)
+        {
+          g_string_append (out, ",\"args\":{\"detail\":");
+          append_json_string (out, span->detail);
+          g_string_append_c (out, '}');
+        }
+
+      g_string_append_c (out, '}');
+    }
+
+  g_mutex_unlock (&lock);
+
+  g_string_append (out, "\n]}\n");
+
+  ret = g_file_set_contents (path, out->str, out->len, error);
+  g_string_free (out, TRUE);
+
+  return ret;
+}
+
+static gint
+compare_spans (gconstpointer a,
+               gconstpointer b)
+{
+  const Span *span_a = a;
+  const Span *span_b = b;
+
+  if (span_a->begin != span_b->begin)
+    return span_a->begin < span_b->begin ? -1 : 1;
+
+  /* enclosing spans first */
+  if (span_a->end != span_b->end)
+    return span_a->end > span_b->end ? -1 : 1;
+
+  return 0;
+}
+
+/**
+ * cc_trace_format_summary:
+ *
+ * Returns: a human readable list of the recorded spans, in the order they
+ * started, with their offset from the first one
+ */
+gchar *
+cc_trace_format_summary (void)
+{
+  GString *out;
+  GArray *sorted;
+  gint64 origin;
+  guint i;
+
+  out = g_string_new (NULL);
+
+  g_mutex_lock (&lock);
+
+  if (spans == NULL || spans->len == 0)
+    {
+      g_mutex_unlock (&lock);
+      return g_string_free (out, FALSE);
+    }
+
+  /* spans are recorded when they end, list them by start */
+  sorted = g_array_sized_new (FALSE, FALSE, sizeof (Span), spans->len);
+  g_array_append_vals (sorted, spans->data, spans->len);
+
+  g_mutex_unlock (&lock);
+
+  g_array_sort (sorted, compare_spans);
+  origin = g_array_index (sorted, Span, 0).begin;
+
+  g_string_append_printf (out, "%10s %10s  %s\n", "start (ms)", "took (ms)", "span");
+
+  for (i = 0; i < sorted->len; i++)
+    {
+      Span *span = &g_array_index (sorted, Span, i);
+
+      g_string_append_printf (out, "%10.1f %10.1f  %s: %s%s%s\n",
+                              (span->begin - origin) / 1000.0,
+                              (span->end - span->begin) / 1000.0,
+                              span->category, span->name,
+                              span->detail ? " " : "",
+                              span->detail ? span->detail : "");
+    }
+
+  g_array_free (sorted, TRUE);
+
+  return g_string_free (out, FALSE);
+}
@@ -0,0 +1,40 @@
+/*
+ * Copyright (c) 2026 Canonical Ltd.
+ *
+ * The Control Center is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * The Control Center is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with the Control Center; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _CC_TRACE_H
+#define _CC_TRACE_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+gint64    cc_trace_begin          (void);
+
+void      cc_trace_end            (const gchar  *category,
+                                   const gchar  *name,
+                                   const gchar  *detail,
+                                   gint64        begin);
+
+gboolean  cc_trace_write          (const gchar  *path,
+                                   GError      **error);
+
+gchar    *cc_trace_format_summary (void);
+
+G_END_DECLS
+
+#endif /* _CC_TRACE_H */
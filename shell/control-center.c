@@ -35,6 +35,7 @@
 #endif
 
 #include "cc-shell-log.h"
+#include "cc-trace.h"
 
 G_GNUC_NORETURN static gboolean
 option_version_cb (const gchar *option_name,
@@ -53,12 +54,17 @@ static gboolean verbose = FALSE;
 static gboolean show_help = FALSE;
 static gboolean show_help_gtk = FALSE;
 static gboolean show_help_all = FALSE;
+static gboolean list_loaded_modules = FALSE;
+static gboolean show_timings = FALSE;
+static gint64 main_begin = 0;
 
 const GOptionEntry all_options[] = {
   { "version", 0, G_OPTION_FLAG_NO_ARG, G_OPTION_ARG_CALLBACK, option_version_cb, NULL, NULL },
   { "verbose", 'v', 0, G_OPTION_ARG_NONE, &verbose, N_("Enable verbose mode"), NULL },
   { "overview", 'o', 0, G_OPTION_ARG_NONE, &show_overview, N_("Show the overview"), NULL },
   { "search", 's', 0, G_OPTION_ARG_STRING, &search_str, N_("Search for the string"), "SEARCH" },
+  { "list-loaded-modules", 0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_NONE, &list_loaded_modules, N_("List the panel modules that have been loaded"), NULL },
+  { "timings", 0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_NONE, &show_timings, N_("Print startup and panel timings on exit"), NULL },
   { "help", 'h', G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_NONE, &show_help, N_("Show help options"), NULL },
   { "help-all", 0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_NONE, &show_help_all, N_("Show help options"), NULL },
   { "help-gtk", 0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_NONE, &show_help_gtk, N_("Show help options"), NULL },
@@ -76,9 +82,13 @@ application_command_line_cb (GApplication  *application,
   int retval = 0;
   GOptionContext *context;
   GError *error = NULL;
+  gint64 begin;
+
+  begin = cc_trace_begin ();
 
   verbose = FALSE;
   show_overview = FALSE;
+  list_loaded_modules = FALSE;
   show_help = FALSE;
   start_panels = NULL;
 
@@ -158,6 +168,17 @@ application_command_line_cb (GApplication  *application,
   gnome_control_center_present (shell);
   gdk_notify_startup_complete ();
 
+  if (list_loaded_modules)
+    {
+      gchar **modules;
+      guint i;
+
+      modules = gnome_control_center_get_loaded_modules (shell);
+      for (i = 0; modules[i] != NULL; i++)
+        g_application_command_line_print (command_line, "%s\n", modules[i]);
+      g_strfreev (modules);
+    }
+
   g_strfreev (argv);
   if (start_panels != NULL)
     {
@@ -166,6 +187,8 @@ application_command_line_cb (GApplication  *application,
     }
   show_overview = FALSE;
 
+  cc_trace_end ("shell", "command-line", NULL, begin);
+
   return retval;
 }
 
@@ -236,6 +259,17 @@ active_panel_changed_cb (GObject    *gobject,
   }
 }
 
+static gboolean
+window_first_draw_cb (GtkWidget *window,
+                      cairo_t   *cr,
+                      gpointer   user_data)
+{
+  cc_trace_end ("shell", "first frame", NULL, main_begin);
+  g_signal_handlers_disconnect_by_func (window, window_first_draw_cb, user_data);
+
+  return FALSE;
+}
+
 static void
 application_startup_cb (GApplication       *application,
                         GnomeControlCenter *shell)
@@ -243,6 +277,9 @@ application_startup_cb (GApplication       *application,
   GMenu *menubar, *menu, *section;
   GMenu *menuitem;
   GAction *action;
+  gint64 begin;
+
+  begin = cc_trace_begin ();
 
   action = G_ACTION (g_simple_action_new ("help", NULL));
   g_action_map_add_action (G_ACTION_MAP (application), action);
@@ -276,6 +313,11 @@ application_startup_cb (GApplication       *application,
   gtk_application_add_accelerator (GTK_APPLICATION (application),
                                    "F1", "app.help", NULL);
 
+  g_signal_connect_after (cc_shell_get_toplevel (CC_SHELL (shell)), "draw",
+                          G_CALLBACK (window_first_draw_cb), NULL);
+
+  cc_trace_end ("shell", "startup", NULL, begin);
+
   /* nothing else to do here, we don't want to show a window before
    * we've looked at the commandline
    */
@@ -286,7 +328,11 @@ main (int argc, char **argv)
 {
   GnomeControlCenter *shell;
   GtkApplication *application;
+  const gchar *trace_path;
   int status;
+  gint64 begin;
+
+  main_begin = cc_trace_begin ();
 
   bindtextdomain (GETTEXT_PACKAGE, GNOMELOCALEDIR);
   bind_textdomain_codeset (GETTEXT_PACKAGE, "UTF-8");
@@ -296,7 +342,9 @@ main (int argc, char **argv)
   XInitThreads ();
 #endif
 
+  begin = cc_trace_begin ();
   gtk_init (&argc, &argv);
+  cc_trace_end ("shell", "gtk_init", NULL, begin);
   cc_shell_log_init ();
 
   /* register a symbolic icon size for use in sidebar lists */
@@ -304,7 +352,9 @@ main (int argc, char **argv)
 
   notify_init ("gnome-control-center");
 
+  begin = cc_trace_begin ();
   shell = gnome_control_center_new ();
+  cc_trace_end ("shell", "gnome_control_center_new", NULL, begin);
 
   /* enforce single instance of this application */
   application = gtk_application_new ("org.gnome.ControlCenter", G_APPLICATION_HANDLES_COMMAND_LINE);
@@ -317,5 +367,26 @@ main (int argc, char **argv)
 
   g_object_unref (application);
 
+  trace_path = g_getenv ("UCC_TRACE");
+  if (trace_path != NULL && *trace_path != '\0')
+    {
+      GError *error = NULL;
+
+      if (!cc_trace_write (trace_path, &error))
+        {
+          g_warning ("Could not write trace to '%s': %s", trace_path, error->message);
+          g_error_free (error);
+        }
+    }
+
+  if (show_timings)
+    {
+      gchar *summary;
+
+      summary = cc_trace_format_summary ();
+      g_print ("%s", summary);
+      g_free (summary);
+    }
+
   return status;
 }
@@ -27,7 +27,9 @@
 #include <gio/gdesktopappinfo.h>
 #include <gtk/gtk.h>
 #include <gdk/gdkkeysyms.h>
+#include <stdio.h>
 #include <string.h>
+#include <unistd.h>
 #ifdef HAVE_CHEESE
 #include <clutter-gtk/clutter-gtk.h>
 #endif /* HAVE_CHEESE */
@@ -39,6 +41,9 @@
 #include "cc-shell-category-view.h"
 #include "cc-shell-model.h"
 #include "cc-shell-nav-bar.h"
+#include "cc-shell-panel-cache.h"
+#include "cc-shell-settings-index.h"
+#include "cc-trace.h"
 
 G_DEFINE_TYPE (GnomeControlCenter, gnome_control_center, CC_TYPE_SHELL)
 
@@ -56,6 +61,40 @@ G_DEFINE_TYPE (GnomeControlCenter, gnome_control_center, CC_TYPE_SHELL)
 
 #define MIN_ICON_VIEW_HEIGHT 300
 
+#define MENU_PATH MENUDIR "/unitycc.menu"
+
+/* package upgrades touch many desktop files in a row; wait for them to
+ * settle before reloading the menu, but not for longer than
+ * MENU_RELOAD_MAX_DELAY after the first change */
+#define MENU_RELOAD_DELAY 500 /* ms */
+#define MENU_RELOAD_MAX_DELAY 5000 /* ms */
+
+/* maps panel ids to the module implementing them, see get_panel_type() */
+#define PANELS_MANIFEST PANELS_DIR "/panels.manifest"
+#define PANELS_MANIFEST_GROUP "Panels"
+
+/* hardcoded fallback from pre-multiarching */
+#define PANELS_FALLBACK_DIR "/usr/lib/control-center-1/panels"
+
+/* hidden panels kept alive for quick switching, see cache_panel();
+ * can be overridden with UCC_PANEL_CACHE_SIZE and UCC_PANEL_CACHE_BUDGET
+ * (in MiB) */
+#define DEFAULT_PANEL_CACHE_SIZE 4
+#define DEFAULT_PANEL_CACHE_BUDGET 64
+
+/* the most used panels are prepared in the background once the user has
+ * not touched the window for a while, see schedule_prefetch() */
+#define PREFETCH_DELAY 2 /* seconds */
+#define PREFETCH_N_PANELS 2
+#define PREFETCH_MIN_ACTIVATIONS 3
+/* panels are only built in the background when their last construction
+ * took less than this, as it cannot be split over several idles */
+#define PREFETCH_MAX_CONSTRUCT_TIME 50 /* ms */
+/* the least used panels are forgotten past this many */
+#define PREFETCH_MAX_CANDIDATES 32
+#define ACTIVATIONS_GROUP "Activations"
+#define CONSTRUCT_TIME_GROUP "ConstructTime"
+
 typedef enum {
 	SMALL_SCREEN_UNSET,
 	SMALL_SCREEN_TRUE,
@@ -72,23 +111,52 @@ struct _GnomeControlCenterPrivate
   GtkWidget  *current_panel_box;
   GtkWidget  *current_panel;
   char       *current_panel_id;
+  gulong      first_draw_id;
   GtkWidget  *window;
   GtkWidget  *search_entry;
   GtkWidget  *lock_button;
   GPtrArray  *custom_widgets;
   GtkWidget  *nav_bar;
 
+  gsize       current_panel_size;
+  GQueue     *panel_cache;
+  guint       panel_cache_size;
+  gsize       panel_cache_budget;
+
+  GKeyFile   *activations;
+  guint       activations_save_id;
+  guint       prefetch_id;
+  GCancellable *prefetch_cancellable;
+  GQueue     *prefetch_steps;
+  GPtrArray  *prefetch_icons;
+  GPtrArray  *prefetch_header_widgets;
+  gboolean    prefetch_pending;
+  gulong      prefetch_input_hook_id;
+
   GMenuTree  *menu_tree;
+  guint       menu_tree_idle_id;
+  guint       menu_reload_id;
+  gint64      menu_changed_since;
   GtkListStore *store;
   GHashTable *category_views;
+  GPtrArray  *categories;
 
   GtkTreeModel *search_filter;
+  GtkTreeModel *search_sort;
+  GHashTable *search_ranks;
   GtkWidget *search_view;
   gchar *filter_string;
+  gchar *filter_folded;
+
+  CcShellSettingsIndex *settings_index;
+  GHashTable *setting_matches;
 
   guint32 last_time;
 
   GIOExtensionPoint *extension_point;
+  GIOModuleScope *module_scope;
+  GKeyFile *module_manifest;
+  gboolean all_modules_loaded;
 
   gchar *default_window_title;
   gchar *default_window_icon;
@@ -97,6 +165,28 @@ struct _GnomeControlCenterPrivate
   CcSmallScreen small_screen;
 };
 
+typedef struct
+{
+  gchar     *id;
+  GtkWidget *box;
+  GtkWidget *panel;
+  GPtrArray *header_widgets;
+  gsize      size;
+} CachedPanel;
+
+typedef enum
+{
+  PREFETCH_MODULE,
+  PREFETCH_ICON,
+  PREFETCH_PANEL
+} PrefetchKind;
+
+typedef struct
+{
+  PrefetchKind  kind;
+  gchar        *id;
+} PrefetchStep;
+
 /* Notebook helpers */
 static GtkWidget *
 notebook_get_selected_page (GtkWidget *notebook)
@@ -176,6 +266,271 @@ get_icon_name_from_g_icon (GIcon *gicon)
   return NULL;
 }
 
+static gboolean
+load_panel_module (GnomeControlCenter *shell,
+                   const gchar        *id)
+{
+  GnomeControlCenterPrivate *priv = shell->priv;
+  GIOModule *module;
+  gchar *basename, *path;
+  gboolean ret = FALSE;
+  gint64 begin;
+
+  basename = g_key_file_get_string (priv->module_manifest,
+                                    PANELS_MANIFEST_GROUP, id, NULL);
+  if (basename == NULL)
+    return FALSE;
+
+  path = g_build_filename (PANELS_DIR, basename, NULL);
+
+  /* packagers may leave some panels out; the panel is then found by
+   * scanning the module directories, if at all */
+  if (!g_file_test (path, G_FILE_TEST_EXISTS))
+    {
+      g_debug ("Panel module %s is not installed", path);
+      g_free (path);
+      g_free (basename);
+      return FALSE;
+    }
+
+  module = g_io_module_new (path);
+
+  begin = cc_trace_begin ();
+
+  if (g_type_module_use (G_TYPE_MODULE (module)))
+    {
+      cc_trace_end ("shell", "load module", basename, begin);
+      g_debug ("Loaded panel module %s", path);
+
+      /* keep a later scan of the whole directory from loading it again */
+      g_io_module_scope_block (priv->module_scope, basename);
+      ret = TRUE;
+    }
+  else
+    {
+      g_warning ("Failed to load panel module %s", path);
+      g_object_unref (module);
+    }
+
+  g_free (path);
+  g_free (basename);
+
+  return ret;
+}
+
+static void
+load_all_panel_modules (GnomeControlCenter *shell)
+{
+  GnomeControlCenterPrivate *priv = shell->priv;
+  GList *modules;
+  gint64 begin;
+
+  if (priv->all_modules_loaded)
+    return;
+
+  priv->all_modules_loaded = TRUE;
+  begin = cc_trace_begin ();
+
+  modules = g_io_modules_load_all_in_directory_with_scope (PANELS_DIR,
+                                                           priv->module_scope);
+  g_list_free (modules);
+
+  modules = g_io_modules_load_all_in_directory_with_scope (PANELS_FALLBACK_DIR,
+                                                           priv->module_scope);
+  g_list_free (modules);
+
+  cc_trace_end ("shell", "load all modules", NULL, begin);
+}
+
+/* Panel modules are only loaded when one of their panels is first
+ * activated. The manifest says which module implements a panel; panels
+ * missing from it, e.g. ones installed by other packages, make us fall
+ * back to loading every module once. */
+static GType
+get_panel_type (GnomeControlCenter *shell,
+                const gchar        *id)
+{
+  GnomeControlCenterPrivate *priv = shell->priv;
+  GIOExtension *extension;
+
+  extension = g_io_extension_point_get_extension_by_name (priv->extension_point, id);
+
+  if (extension == NULL && load_panel_module (shell, id))
+    extension = g_io_extension_point_get_extension_by_name (priv->extension_point, id);
+
+  if (extension == NULL && !priv->all_modules_loaded)
+    {
+      load_all_panel_modules (shell);
+      extension = g_io_extension_point_get_extension_by_name (priv->extension_point, id);
+    }
+
+  if (extension == NULL)
+    return G_TYPE_INVALID;
+
+  return g_io_extension_get_type (extension);
+}
+
+static void
+cached_panel_free (CachedPanel *cached)
+{
+  g_free (cached->id);
+  if (cached->box)
+    {
+      gtk_widget_destroy (cached->box);
+      g_object_unref (cached->box);
+    }
+  if (cached->header_widgets)
+    g_ptr_array_unref (cached->header_widgets);
+  g_slice_free (CachedPanel, cached);
+}
+
+/* An estimate of how much memory a panel uses: how much the resident
+ * size grew while it was created and first shown */
+static gsize
+get_resident_size (void)
+{
+  gchar *contents;
+  unsigned long pages;
+  gsize size = 0;
+
+  if (!g_file_get_contents ("/proc/self/statm", &contents, NULL, NULL))
+    return 0;
+
+  if (sscanf (contents, "%*u %lu", &pages) == 1)
+    size = (gsize) pages * sysconf (_SC_PAGESIZE);
+
+  g_free (contents);
+
+  return size;
+}
+
+static void
+trim_panel_cache (GnomeControlCenterPrivate *priv)
+{
+  gsize total = 0;
+  GList *l;
+
+  for (l = priv->panel_cache->head; l != NULL; l = l->next)
+    total += ((CachedPanel *) l->data)->size;
+
+  /* evict the least recently used panels first */
+  while (priv->panel_cache->length > priv->panel_cache_size ||
+         (total > priv->panel_cache_budget && priv->panel_cache->length > 0))
+    {
+      CachedPanel *cached = g_queue_pop_tail (priv->panel_cache);
+
+      g_debug ("Dropping cached panel %s", cached->id);
+      total -= cached->size;
+      cached_panel_free (cached);
+    }
+}
+
+/* Takes the page of a panel that is being switched away from. Unless the
+ * cache is disabled, the panel is kept alive, outside the notebook, so that
+ * it can be shown again without being rebuilt. */
+static void
+cache_panel (GnomeControlCenterPrivate *priv,
+             const gchar               *id,
+             GtkWidget                 *box,
+             GtkWidget                 *panel,
+             GPtrArray                 *header_widgets,
+             gsize                      size)
+{
+  CachedPanel *cached;
+
+  if (id == NULL || panel == NULL || priv->panel_cache_size == 0)
+    {
+      notebook_remove_page (priv->notebook, box);
+      if (header_widgets)
+        g_ptr_array_unref (header_widgets);
+      return;
+    }
+
+  cached = g_slice_new0 (CachedPanel);
+  cached->id = g_strdup (id);
+  cached->box = g_object_ref (box);
+  cached->panel = panel;
+  cached->header_widgets = header_widgets;
+  cached->size = size;
+
+  /* prefetched panels were never added */
+  if (gtk_widget_get_parent (box) != NULL)
+    notebook_remove_page (priv->notebook, box);
+  cc_panel_set_active (CC_PANEL (panel), FALSE);
+
+  g_queue_push_head (priv->panel_cache, cached);
+  trim_panel_cache (priv);
+}
+
+static CachedPanel *
+take_cached_panel (GnomeControlCenterPrivate *priv,
+                   const gchar               *id)
+{
+  GList *l;
+
+  for (l = priv->panel_cache->head; l != NULL; l = l->next)
+    {
+      CachedPanel *cached = l->data;
+
+      if (g_strcmp0 (cached->id, id) == 0)
+        {
+          g_queue_delete_link (priv->panel_cache, l);
+          return cached;
+        }
+    }
+
+  return NULL;
+}
+
+static void
+_shell_embed_widget_in_header (CcShell      *shell,
+                               GtkWidget    *widget);
+static void
+record_construct_time (GnomeControlCenter *shell,
+                       const gchar        *id,
+                       gint64              begin);
+
+typedef struct
+{
+  GnomeControlCenterPrivate *priv;
+  gchar                     *id;
+  gint64                     begin;
+} FirstDraw;
+
+static void
+first_draw_free (FirstDraw *first_draw,
+                 GClosure  *closure)
+{
+  g_free (first_draw->id);
+  g_slice_free (FirstDraw, first_draw);
+}
+
+static gboolean
+panel_first_draw_cb (GtkWidget *panel,
+                     cairo_t   *cr,
+                     FirstDraw *first_draw)
+{
+  GnomeControlCenterPrivate *priv = first_draw->priv;
+
+  cc_trace_end ("shell", "first draw", first_draw->id, first_draw->begin);
+
+  g_signal_handler_disconnect (panel, priv->first_draw_id);
+  priv->first_draw_id = 0;
+
+  return FALSE;
+}
+
+/* The panel may be switched away from before it is ever drawn */
+static void
+clear_first_draw (GnomeControlCenterPrivate *priv)
+{
+  if (priv->first_draw_id == 0)
+    return;
+
+  g_signal_handler_disconnect (priv->current_panel, priv->first_draw_id);
+  priv->first_draw_id = 0;
+}
+
 static gboolean
 activate_panel (GnomeControlCenter *shell,
                 const gchar        *id,
@@ -185,78 +540,119 @@ activate_panel (GnomeControlCenter *shell,
                 GIcon              *gicon)
 {
   GnomeControlCenterPrivate *priv = shell->priv;
-  GType panel_type = G_TYPE_INVALID;
-  GList *panels, *l;
+  GType panel_type;
   GtkWidget *box;
+  CachedPanel *cached;
+  FirstDraw *first_draw;
   const gchar *icon_name;
-
-  /* check if there is an plugin that implements this panel */
-  panels = g_io_extension_point_get_extensions (priv->extension_point);
+  gboolean was_cached;
+  gsize resident_size = 0;
+  gint64 begin, construct_begin;
 
   if (!desktop_file)
     return FALSE;
   if (!id)
     return FALSE;
 
-  for (l = panels; l != NULL; l = l->next)
+  begin = cc_trace_begin ();
+
+  cached = take_cached_panel (priv, id);
+  was_cached = (cached != NULL);
+  if (cached != NULL)
     {
-      GIOExtension *extension;
-      const gchar *name;
+      guint i;
 
-      extension = l->data;
+      g_debug ("Reusing cached panel %s", id);
 
-      name = g_io_extension_get_name (extension);
+      priv->current_panel = cached->panel;
+      priv->current_panel_size = cached->size;
+      box = cached->box;
 
-      if (!g_strcmp0 (name, id))
+      for (i = 0; cached->header_widgets && i < cached->header_widgets->len; i++)
+        _shell_embed_widget_in_header (CC_SHELL (shell),
+                                       g_ptr_array_index (cached->header_widgets, i));
+
+      if (argv && argv[0])
+        g_object_set (G_OBJECT (priv->current_panel), "argv", argv, NULL);
+
+      notebook_add_page (priv->notebook, box);
+
+      /* the notebook owns the page now */
+      g_object_unref (cached->box);
+      cached->box = NULL;
+      cached_panel_free (cached);
+    }
+  else
+    {
+      /* check if there is an plugin that implements this panel */
+      panel_type = get_panel_type (shell, id);
+
+      if (panel_type == G_TYPE_INVALID)
         {
-          panel_type = g_io_extension_get_type (extension);
-          break;
+          GKeyFile *key_file;
+
+          /* It might be an external panel */
+          key_file = g_key_file_new ();
+          if (g_key_file_load_from_file (key_file, desktop_file, G_KEY_FILE_NONE, NULL))
+            {
+              gchar *command;
+
+              command = g_key_file_get_string (key_file, G_KEY_FILE_DESKTOP_GROUP, G_KEY_FILE_DESKTOP_KEY_EXEC, NULL);
+              if (command && command[0])
+                {
+                  g_spawn_command_line_async (command, NULL);
+                  g_free (command);
+                }
+            }
+
+          g_key_file_free (key_file);
+          return FALSE;
         }
-    }
 
-  if (panel_type == G_TYPE_INVALID)
-    {
-	  GKeyFile *key_file;
+      resident_size = get_resident_size ();
 
-	  /* It might be an external panel */
-	  key_file = g_key_file_new ();
-	  if (g_key_file_load_from_file (key_file, desktop_file, G_KEY_FILE_NONE, NULL))
-	    {
-	      gchar *command;
+      /* create the panel plugin */
+      construct_begin = cc_trace_begin ();
+      priv->current_panel = g_object_new (panel_type, "shell", shell, "name", name, "argv", argv, NULL);
+      cc_trace_end ("shell", "construct panel", id, construct_begin);
+      record_construct_time (shell, id, construct_begin);
 
-	      command = g_key_file_get_string (key_file, G_KEY_FILE_DESKTOP_GROUP, G_KEY_FILE_DESKTOP_KEY_EXEC, NULL);
-	      if (command && command[0])
-	        {
-		  g_spawn_command_line_async (command, NULL);
-		  g_free (command);
-		}
-	    }
+      box = gtk_alignment_new (0, 0, 1, 1);
+      gtk_alignment_set_padding (GTK_ALIGNMENT (box), 6, 6, 6, 6);
 
-	  g_key_file_free (key_file);
-      return FALSE;
+      gtk_container_add (GTK_CONTAINER (box), priv->current_panel);
+
+      gtk_widget_set_name (box, id);
+      notebook_add_page (priv->notebook, box);
     }
 
-  /* create the panel plugin */
-  priv->current_panel = g_object_new (panel_type, "shell", shell, "name", name, "argv", argv, NULL);
   cc_shell_set_active_panel (CC_SHELL (shell), CC_PANEL (priv->current_panel));
+  cc_panel_set_active (CC_PANEL (priv->current_panel), TRUE);
   gtk_widget_show (priv->current_panel);
 
   gtk_lock_button_set_permission (GTK_LOCK_BUTTON (priv->lock_button),
                                   cc_panel_get_permission (CC_PANEL (priv->current_panel)));
 
-  box = gtk_alignment_new (0, 0, 1, 1);
-  gtk_alignment_set_padding (GTK_ALIGNMENT (box), 6, 6, 6, 6);
-
-  gtk_container_add (GTK_CONTAINER (box), priv->current_panel);
-
-  gtk_widget_set_name (box, id);
-  notebook_add_page (priv->notebook, box);
+  first_draw = g_slice_new (FirstDraw);
+  first_draw->priv = priv;
+  first_draw->id = g_strdup (id);
+  first_draw->begin = begin;
+  priv->first_draw_id = g_signal_connect_data (priv->current_panel, "draw",
+                                               G_CALLBACK (panel_first_draw_cb), first_draw,
+                                               (GClosureNotify) first_draw_free, G_CONNECT_AFTER);
 
   /* switch to the new panel */
   gtk_widget_show (box);
   notebook_select_page (priv->notebook, box);
   cc_shell_nav_bar_show_detail_button (CC_SHELL_NAV_BAR(shell->priv->nav_bar), name);
 
+  if (resident_size != 0)
+    {
+      gsize new_size = get_resident_size ();
+
+      priv->current_panel_size = new_size > resident_size ? new_size - resident_size : 0;
+    }
+
   /* set the title of the window */
   icon_name = get_icon_name_from_g_icon (gicon);
   gtk_window_set_role (GTK_WINDOW (priv->window), id);
@@ -266,42 +662,71 @@ activate_panel (GnomeControlCenter *shell,
 
   priv->current_panel_box = box;
 
+  cc_trace_end ("shell", was_cached ? "activate cached panel" : "activate panel", id, begin);
+
   return TRUE;
 }
 
-static void
+/* Removes the current panel's widgets from the header, and returns them so
+ * that they can be put back if the panel is shown again */
+static GPtrArray *
 _shell_remove_all_custom_widgets (GnomeControlCenterPrivate *priv)
 {
+  GPtrArray *widgets;
   GtkBox *box;
   GtkWidget *widget;
   guint i;
 
+  widgets = priv->custom_widgets;
+  priv->custom_widgets = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
+
   /* remove from the header */
   box = GTK_BOX (W (priv->builder, "topright"));
-  for (i = 0; i < priv->custom_widgets->len; i++)
+  for (i = 0; i < widgets->len; i++)
     {
-        widget = g_ptr_array_index (priv->custom_widgets, i);
+        widget = g_ptr_array_index (widgets, i);
         gtk_container_remove (GTK_CONTAINER (box), widget);
     }
-  g_ptr_array_set_size (priv->custom_widgets, 0);
+
+  return widgets;
+}
+
+static void
+shell_hide_current_panel (GnomeControlCenterPrivate *priv,
+                          GtkWidget                 *box,
+                          GPtrArray                 *header_widgets)
+{
+  clear_first_draw (priv);
+  cache_panel (priv, priv->current_panel_id, box, priv->current_panel,
+               header_widgets, priv->current_panel_size);
+
+  priv->current_panel = NULL;
+  priv->current_panel_box = NULL;
+  priv->current_panel_size = 0;
+  g_clear_pointer (&priv->current_panel_id, g_free);
 }
 
 static void
 shell_show_overview_page (GnomeControlCenter *center)
 {
   GnomeControlCenterPrivate *priv = center->priv;
+  GPtrArray *header_widgets;
 
   notebook_select_page (priv->notebook, priv->scrolled_window);
 
+  /* clear any custom widgets */
+  header_widgets = _shell_remove_all_custom_widgets (priv);
+
   if (priv->current_panel_box)
-    notebook_remove_page (priv->notebook, priv->current_panel_box);
-  priv->current_panel = NULL;
-  priv->current_panel_box = NULL;
-  g_clear_pointer (&priv->current_panel_id, g_free);
+    shell_hide_current_panel (priv, priv->current_panel_box, header_widgets);
+  else
+    g_ptr_array_unref (header_widgets);
 
   /* clear the search text */
   g_free (priv->filter_string);
   priv->filter_string = g_strdup ("");
+  g_clear_pointer (&priv->filter_folded, g_free);
+  g_clear_pointer (&priv->setting_matches, g_hash_table_destroy);
   gtk_entry_set_text (GTK_ENTRY (priv->search_entry), "");
   gtk_widget_grab_focus (priv->search_entry);
 
@@ -316,9 +741,6 @@ shell_show_overview_page (GnomeControlCenter *center)
 
   cc_shell_set_active_panel (CC_SHELL (center), NULL);
 
-  /* clear any custom widgets */
-  _shell_remove_all_custom_widgets (priv);
-
   cc_shell_nav_bar_hide_detail_button (CC_SHELL_NAV_BAR (priv->nav_bar));
 }
 
@@ -642,58 +1064,10 @@ model_filter_func (GtkTreeModel              *model,
                    GtkTreeIter               *iter,
                    GnomeControlCenterPrivate *priv)
 {
-  gchar *name, *description;
-  gchar *needle, *haystack;
-  gboolean result;
-  gchar **keywords;
-
-  gtk_tree_model_get (model, iter,
-                      COL_NAME, &name,
-                      COL_DESCRIPTION, &description,
-                      COL_KEYWORDS, &keywords,
-                      -1);
-
-  if (!priv->filter_string || !name)
-    {
-      g_free (name);
-      g_free (description);
-      g_strfreev (keywords);
-      return FALSE;
-    }
-
-  needle = g_utf8_casefold (priv->filter_string, -1);
-  haystack = g_utf8_casefold (name, -1);
-
-  result = (strstr (haystack, needle) != NULL);
-
-  if (!result && description)
-    {
-      gchar *folded;
-
-      folded = g_utf8_casefold (description, -1);
-      result = (strstr (folded, needle) != NULL);
-      g_free (folded);
-    }
-
-  if (!result && keywords)
-    {
-      gint i;
-      gchar *keyword;
-
-      for (i = 0; !result && keywords[i]; i++)
-        {
-          keyword = g_utf8_casefold (keywords[i], -1);
-          result = strstr (keyword, needle) == keyword;
-          g_free (keyword);
-        }
-    }
-
-  g_free (name);
-  g_free (haystack);
-  g_free (needle);
-  g_strfreev (keywords);
-
-  return result;
+  return cc_shell_model_search_match (model, iter, priv->filter_folded,
+                                      priv->setting_matches,
+                                      priv->search_ranks)
+         != CC_SHELL_SEARCH_RANK_NONE;
 }
 
 static gboolean
@@ -736,13 +1110,32 @@ search_entry_changed_cb (GtkEntry           *entry,
   g_free (priv->filter_string);
   priv->filter_string = str;
 
+  /* the model keeps its rows pre-folded, so this is the only string
+   * that needs normalizing per keystroke */
+  g_free (priv->filter_folded);
+  priv->filter_folded = cc_shell_model_fold_search_string (str);
+
+  g_clear_pointer (&priv->setting_matches, g_hash_table_destroy);
+  priv->setting_matches = cc_shell_settings_index_query (priv->settings_index,
+                                                         priv->filter_folded);
+
   if (!g_strcmp0 (priv->filter_string, ""))
     {
       shell_show_overview_page (center);
     }
   else
     {
+      g_hash_table_remove_all (priv->search_ranks);
       gtk_tree_model_filter_refilter (GTK_TREE_MODEL_FILTER (priv->search_filter));
+
+      /* ranks changed, so rows that stayed visible need sorting again;
+       * setting the function of the current column sorts once */
+      gtk_tree_sortable_set_sort_func (GTK_TREE_SORTABLE (priv->search_sort),
+                                       COL_SEARCH_ENTRY,
+                                       cc_shell_model_search_compare,
+                                       priv->search_ranks, NULL);
+      gtk_tree_sortable_sort_column_changed (GTK_TREE_SORTABLE (priv->search_sort));
+
       notebook_select_page (priv->notebook, priv->search_scrolled);
     }
 }
@@ -781,10 +1174,12 @@ on_search_row_activated (GtkTreeView       *treeview,
                          GtkTreeViewColumn *column,
                          GnomeControlCenter *shell)
 {
+  GnomeControlCenterPrivate *priv = shell->priv;
   GtkTreeSelection *selection;
   GtkTreeModel *model;
   GtkTreeIter   iter;
   char         *id = NULL;
+  const gchar  *argv[] = { NULL, NULL };
 
   selection = gtk_tree_view_get_selection (treeview);
 
@@ -795,8 +1190,17 @@ on_search_row_activated (GtkTreeView       *treeview,
                       COL_ID, &id,
                       -1);
 
+  /* point the panel at the setting that matched */
+  if (id && priv->setting_matches &&
+      cc_shell_model_search_get_rank (model, &iter, priv->search_ranks) == CC_SHELL_SEARCH_RANK_SETTING)
+    {
+      argv[0] = g_hash_table_lookup (priv->setting_matches, id);
+      if (argv[0] && *argv[0] == '\0')
+        argv[0] = NULL;
+    }
+
   if (id)
-    cc_shell_set_active_panel_from_id (CC_SHELL (shell), id, NULL, NULL);
+    cc_shell_set_active_panel_from_id (CC_SHELL (shell), id, argv, NULL);
 
   gtk_tree_selection_unselect_all (selection);
 
@@ -857,6 +1261,7 @@ setup_search (GnomeControlCenter *shell)
   g_return_if_fail (priv->store != NULL);
 
   /* create the search filter */
+  priv->search_ranks = cc_shell_model_search_ranks_new ();
   priv->search_filter = gtk_tree_model_filter_new (GTK_TREE_MODEL (priv->store),
                                                    NULL);
 
@@ -865,11 +1270,21 @@ setup_search (GnomeControlCenter *shell)
                                           model_filter_func,
                                           priv, NULL);
 
+  /* best matches first */
+  priv->search_sort = gtk_tree_model_sort_new_with_model (priv->search_filter);
+  gtk_tree_sortable_set_sort_func (GTK_TREE_SORTABLE (priv->search_sort),
+                                   COL_SEARCH_ENTRY,
+                                   cc_shell_model_search_compare,
+                                   priv->search_ranks, NULL);
+  gtk_tree_sortable_set_sort_column_id (GTK_TREE_SORTABLE (priv->search_sort),
+                                        COL_SEARCH_ENTRY,
+                                        GTK_SORT_ASCENDING);
+
   /* set up the search view */
   priv->search_view = search_view = gtk_tree_view_new ();
   gtk_tree_view_set_headers_visible (GTK_TREE_VIEW (search_view), FALSE);
   gtk_tree_view_set_model (GTK_TREE_VIEW (search_view),
-                           GTK_TREE_MODEL (priv->search_filter));
+                           GTK_TREE_MODEL (priv->search_sort));
 
   renderer = gtk_cell_renderer_pixbuf_new ();
   g_object_set (renderer,
@@ -916,6 +1331,8 @@ setup_search (GnomeControlCenter *shell)
   priv->search_entry = widget;
   priv->filter_string = g_strdup ("");
 
+  priv->settings_index = cc_shell_settings_index_new (PKGDATADIR "/settings.index");
+
   g_signal_connect (widget, "changed", G_CALLBACK (search_entry_changed_cb),
                     shell);
   g_signal_connect (widget, "key-press-event",
@@ -979,6 +1396,19 @@ maybe_add_category_view (GnomeControlCenter *shell,
                     G_CALLBACK (categories_keynav_failed), shell);
 
   g_hash_table_insert (shell->priv->category_views, g_strdup (name), categoryview);
+  g_ptr_array_add (shell->priv->categories, g_strdup (name));
+}
+
+static void
+save_menu_cache (GnomeControlCenter *shell)
+{
+  GPtrArray *categories = shell->priv->categories;
+
+  /* temporarily NULL-terminate the category list */
+  g_ptr_array_add (categories, NULL);
+  cc_shell_panel_cache_save (CC_SHELL_MODEL (shell->priv->store), MENU_PATH,
+                             (const gchar * const *) categories->pdata);
+  g_ptr_array_remove_index (categories, categories->len - 1);
 }
 
 static void
@@ -998,6 +1428,10 @@ reload_menu (GnomeControlCenter *shell)
     }
 
 
+  /* only rows whose desktop file changed are touched, so that selections
+   * and icons survive a reload */
+  cc_shell_model_begin_update (CC_SHELL_MODEL (shell->priv->store));
+
   d = gmenu_tree_get_root_directory (shell->priv->menu_tree);
   iter = gmenu_tree_directory_iter (d);
 
@@ -1035,20 +1469,74 @@ reload_menu (GnomeControlCenter *shell)
     }
 
   gmenu_tree_iter_unref (iter);
+  gmenu_tree_item_unref (d);
+
+  cc_shell_model_end_update (CC_SHELL_MODEL (shell->priv->store));
+
+  save_menu_cache (shell);
+}
+
+static gboolean
+load_menu_tree_idle (GnomeControlCenter *shell)
+{
+  GError *error = NULL;
+
+  shell->priv->menu_tree_idle_id = 0;
+
+  /* The model was filled from the panel cache; the menu tree still needs
+   * loading for it to start monitoring the menu for changes. */
+  if (!gmenu_tree_load_sync (shell->priv->menu_tree, &error))
+    {
+      g_warning ("Could not load control center menu: %s", error->message);
+      g_clear_error (&error);
+    }
+
+  return FALSE;
+}
+
+static gboolean
+reload_menu_timeout (GnomeControlCenter *shell)
+{
+  shell->priv->menu_reload_id = 0;
+
+  reload_menu (shell);
+
+  return FALSE;
 }
 
 static void
 on_menu_changed (GMenuTree          *monitor,
                  GnomeControlCenter *shell)
 {
-  gtk_list_store_clear (shell->priv->store);
-  reload_menu (shell);
+  GnomeControlCenterPrivate *priv = shell->priv;
+  gint64 now;
+
+  now = g_get_monotonic_time ();
+
+  if (priv->menu_reload_id != 0)
+    {
+      /* keep a long upgrade from postponing the reload forever */
+      if (now - priv->menu_changed_since >= MENU_RELOAD_MAX_DELAY * 1000)
+        return;
+
+      g_source_remove (priv->menu_reload_id);
+    }
+  else
+    {
+      priv->menu_changed_since = now;
+    }
+
+  priv->menu_reload_id = g_timeout_add (MENU_RELOAD_DELAY,
+                                        (GSourceFunc) reload_menu_timeout,
+                                        shell);
 }
 
 static void
 setup_model (GnomeControlCenter *shell)
 {
   GnomeControlCenterPrivate *priv = shell->priv;
+  gchar **categories;
+  guint i;
 
   gtk_widget_set_margin_top (shell->priv->main_vbox, 8);
   gtk_widget_set_margin_bottom (shell->priv->main_vbox, 8);
@@ -1059,37 +1547,76 @@ setup_model (GnomeControlCenter *shell)
 
   priv->store = (GtkListStore *) cc_shell_model_new ();
   priv->category_views = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
-  priv->menu_tree = gmenu_tree_new_for_path (MENUDIR "/unitycc.menu", 0);
+  priv->categories = g_ptr_array_new_with_free_func (g_free);
+  priv->menu_tree = gmenu_tree_new_for_path (MENU_PATH, 0);
 
-  reload_menu (shell);
+  if (cc_shell_panel_cache_load (CC_SHELL_MODEL (priv->store), MENU_PATH,
+                                 &categories))
+    {
+      for (i = 0; categories[i] != NULL; i++)
+        maybe_add_category_view (shell, categories[i]);
+      g_strfreev (categories);
+
+      priv->menu_tree_idle_id = g_idle_add_full (G_PRIORITY_LOW,
+                                                 (GSourceFunc) load_menu_tree_idle,
+                                                 shell, NULL);
+    }
+  else
+    {
+      reload_menu (shell);
+    }
 
   g_signal_connect (priv->menu_tree, "changed", G_CALLBACK (on_menu_changed), shell);
 }
 
+static void
+setup_panel_cache (GnomeControlCenter *shell)
+{
+  GnomeControlCenterPrivate *priv = shell->priv;
+  const gchar *env;
+
+  priv->panel_cache = g_queue_new ();
+  priv->panel_cache_size = DEFAULT_PANEL_CACHE_SIZE;
+  priv->panel_cache_budget = DEFAULT_PANEL_CACHE_BUDGET * 1024 * 1024;
+
+  env = g_getenv ("UCC_PANEL_CACHE_SIZE");
+  if (env != NULL)
+    priv->panel_cache_size = g_ascii_strtoull (env, NULL, 10);
+
+  env = g_getenv ("UCC_PANEL_CACHE_BUDGET");
+  if (env != NULL)
+    priv->panel_cache_budget = g_ascii_strtoull (env, NULL, 10) * 1024 * 1024;
+}
+
 static void
 load_panel_plugins (GnomeControlCenter *shell)
 {
-  GList *modules;
+  GnomeControlCenterPrivate *priv = shell->priv;
+  GError *error = NULL;
 
   /* only allow this function to be run once to prevent modules being loaded
    * twice
    */
-  if (shell->priv->extension_point)
+  if (priv->extension_point)
     return;
 
   /* make sure the base type is registered */
   g_type_from_name ("CcPanel");
 
-  shell->priv->extension_point
+  priv->extension_point
     = g_io_extension_point_register (CC_SHELL_PANEL_EXTENSION_POINT);
 
-  /* load all the plugins in the panels directory */
-  modules = g_io_modules_load_all_in_directory (PANELS_DIR);
-  g_list_free (modules);
+  /* the modules themselves are loaded on demand, see get_panel_type() */
+  priv->module_scope = g_io_module_scope_new (G_IO_MODULE_SCOPE_BLOCK_DUPLICATES);
+  priv->module_manifest = g_key_file_new ();
 
-  /* hardcoded fallback from pre-multiarching */
-  modules = g_io_modules_load_all_in_directory ("/usr/lib/control-center-1/panels");
-  g_list_free (modules);
+  if (!g_key_file_load_from_file (priv->module_manifest, PANELS_MANIFEST,
+                                  G_KEY_FILE_NONE, &error))
+    {
+      g_warning ("Could not load panel manifest '%s': %s",
+                 PANELS_MANIFEST, error->message);
+      g_error_free (error);
+    }
 }
 
 
@@ -1100,6 +1627,491 @@ home_button_clicked_cb (GtkButton *button,
   shell_show_overview_page (shell);
 }
 
+/* Prefetching */
+static gchar *
+get_activations_path (void)
+{
+  return g_build_filename (g_get_user_cache_dir (),
+                           "unity-control-center",
+                           "activations",
+                           NULL);
+}
+
+static gboolean
+save_activations_idle (gpointer user_data)
+{
+  GnomeControlCenterPrivate *priv = GNOME_CONTROL_CENTER (user_data)->priv;
+  GError *error = NULL;
+  gchar *path, *dirname, *data;
+  gsize length;
+
+  priv->activations_save_id = 0;
+
+  path = get_activations_path ();
+  dirname = g_path_get_dirname (path);
+  g_mkdir_with_parents (dirname, 0700);
+  g_free (dirname);
+
+  data = g_key_file_to_data (priv->activations, &length, NULL);
+  if (!g_file_set_contents (path, data, length, &error))
+    {
+      g_debug ("Could not save panel activations: %s", error->message);
+      g_error_free (error);
+    }
+
+  g_free (data);
+  g_free (path);
+
+  return FALSE;
+}
+
+static void
+queue_save_activations (GnomeControlCenter *shell)
+{
+  GnomeControlCenterPrivate *priv = shell->priv;
+
+  if (priv->activations_save_id == 0)
+    priv->activations_save_id = g_idle_add_full (G_PRIORITY_LOW,
+                                                 save_activations_idle,
+                                                 shell, NULL);
+}
+
+static void
+record_activation (GnomeControlCenter *shell,
+                   const gchar        *id)
+{
+  GnomeControlCenterPrivate *priv = shell->priv;
+  guint64 count;
+
+  count = g_key_file_get_uint64 (priv->activations, ACTIVATIONS_GROUP, id, NULL);
+  g_key_file_set_uint64 (priv->activations, ACTIVATIONS_GROUP, id, count + 1);
+
+  queue_save_activations (shell);
+}
+
+static void
+record_construct_time (GnomeControlCenter *shell,
+                       const gchar        *id,
+                       gint64              begin)
+{
+  GnomeControlCenterPrivate *priv = shell->priv;
+  guint64 elapsed;
+
+  elapsed = (g_get_monotonic_time () - begin) / 1000;
+  g_key_file_set_uint64 (priv->activations, CONSTRUCT_TIME_GROUP, id, elapsed);
+
+  queue_save_activations (shell);
+}
+
+/* Panels that were never built here, or took long to build, would block
+ * the main loop for too long */
+static gboolean
+is_panel_quick_to_construct (GnomeControlCenterPrivate *priv,
+                             const gchar               *id)
+{
+  GError *error = NULL;
+  guint64 elapsed;
+
+  elapsed = g_key_file_get_uint64 (priv->activations, CONSTRUCT_TIME_GROUP, id, &error);
+  if (error != NULL)
+    {
+      g_error_free (error);
+      return FALSE;
+    }
+
+  return elapsed <= PREFETCH_MAX_CONSTRUCT_TIME;
+}
+
+static void
+forget_activations (GnomeControlCenterPrivate *priv,
+                    const gchar               *id)
+{
+  g_key_file_remove_key (priv->activations, ACTIVATIONS_GROUP, id, NULL);
+  g_key_file_remove_key (priv->activations, CONSTRUCT_TIME_GROUP, id, NULL);
+}
+
+static gint
+compare_activations (gconstpointer a,
+                     gconstpointer b,
+                     gpointer      user_data)
+{
+  GKeyFile *activations = user_data;
+  guint64 count_a, count_b;
+
+  count_a = g_key_file_get_uint64 (activations, ACTIVATIONS_GROUP,
+                                   *(const gchar **) a, NULL);
+  count_b = g_key_file_get_uint64 (activations, ACTIVATIONS_GROUP,
+                                   *(const gchar **) b, NULL);
+
+  if (count_a == count_b)
+    return 0;
+
+  return count_a > count_b ? -1 : 1;
+}
+
+static void
+prefetch_step_free (PrefetchStep *step)
+{
+  g_free (step->id);
+  g_slice_free (PrefetchStep, step);
+}
+
+static void
+add_prefetch_step (GnomeControlCenterPrivate *priv,
+                   PrefetchKind               kind,
+                   const gchar               *id)
+{
+  PrefetchStep *step;
+
+  step = g_slice_new (PrefetchStep);
+  step->kind = kind;
+  step->id = g_strdup (id);
+  g_queue_push_tail (priv->prefetch_steps, step);
+}
+
+static gboolean
+is_panel_cached (GnomeControlCenterPrivate *priv,
+                 const gchar               *id)
+{
+  GList *l;
+
+  for (l = priv->panel_cache->head; l != NULL; l = l->next)
+    {
+      if (g_strcmp0 (((CachedPanel *) l->data)->id, id) == 0)
+        return TRUE;
+    }
+
+  return FALSE;
+}
+
+static void
+queue_prefetch_steps (GnomeControlCenter *shell)
+{
+  GnomeControlCenterPrivate *priv = shell->priv;
+  gchar **ids;
+  GPtrArray *sorted;
+  gboolean loaded, pruned = FALSE;
+  guint i, n_queued = 0;
+
+  ids = g_key_file_get_keys (priv->activations, ACTIVATIONS_GROUP, NULL, NULL);
+  if (ids == NULL)
+    return;
+
+  /* panels that were uninstalled, or are rarely used, are dropped from
+   * the candidates; the model is empty until the menu has been loaded */
+  loaded = gtk_tree_model_iter_n_children (GTK_TREE_MODEL (priv->store), NULL) > 0;
+
+  sorted = g_ptr_array_new ();
+  for (i = 0; ids[i] != NULL; i++)
+    {
+      GtkTreeIter iter;
+
+      if (loaded &&
+          !cc_shell_model_lookup_id (CC_SHELL_MODEL (priv->store), ids[i], &iter))
+        {
+          forget_activations (priv, ids[i]);
+          pruned = TRUE;
+          continue;
+        }
+
+      g_ptr_array_add (sorted, ids[i]);
+    }
+  g_ptr_array_sort_with_data (sorted, compare_activations, priv->activations);
+
+  for (i = PREFETCH_MAX_CANDIDATES; i < sorted->len; i++)
+    {
+      forget_activations (priv, g_ptr_array_index (sorted, i));
+      pruned = TRUE;
+    }
+  if (sorted->len > PREFETCH_MAX_CANDIDATES)
+    g_ptr_array_set_size (sorted, PREFETCH_MAX_CANDIDATES);
+
+  if (pruned)
+    queue_save_activations (shell);
+
+  for (i = 0; i < sorted->len && n_queued < PREFETCH_N_PANELS; i++)
+    {
+      const gchar *id = g_ptr_array_index (sorted, i);
+
+      if (g_key_file_get_uint64 (priv->activations, ACTIVATIONS_GROUP, id, NULL)
+          < PREFETCH_MIN_ACTIVATIONS)
+        break;
+
+      if (g_strcmp0 (id, priv->current_panel_id) == 0 ||
+          is_panel_cached (priv, id))
+        continue;
+
+      add_prefetch_step (priv, PREFETCH_MODULE, id);
+      add_prefetch_step (priv, PREFETCH_ICON, id);
+      if (priv->panel_cache_size > 0 &&
+          is_panel_quick_to_construct (priv, id))
+        add_prefetch_step (priv, PREFETCH_PANEL, id);
+      n_queued++;
+    }
+
+  g_ptr_array_free (sorted, TRUE);
+  g_strfreev (ids);
+}
+
+static void
+prefetch_icon (GnomeControlCenter *shell,
+               GtkTreeIter        *iter)
+{
+  GnomeControlCenterPrivate *priv = shell->priv;
+  const gint sizes[] = { 16, 24, 32, 48 };
+  GIcon *gicon;
+  guint i;
+
+  gtk_tree_model_get (GTK_TREE_MODEL (priv->store), iter,
+                      COL_GICON, &gicon,
+                      -1);
+  if (gicon == NULL)
+    return;
+
+  /* the window icon is set from these when the panel is shown; holding
+   * on to the icon infos keeps their pixbufs in the theme's cache */
+  for (i = 0; i < G_N_ELEMENTS (sizes); i++)
+    {
+      GtkIconInfo *info;
+      GdkPixbuf *pixbuf;
+
+      info = gtk_icon_theme_lookup_by_gicon (gtk_icon_theme_get_default (),
+                                             gicon, sizes[i], 0);
+      if (info == NULL)
+        continue;
+
+      pixbuf = gtk_icon_info_load_icon (info, NULL);
+      if (pixbuf)
+        {
+          g_ptr_array_add (priv->prefetch_icons, info);
+          g_object_unref (pixbuf);
+        }
+      else
+        {
+          g_object_unref (info);
+        }
+    }
+
+  g_object_unref (gicon);
+}
+
+/* Builds the panel as activate_panel() would, and puts it straight into
+ * the panel cache so that showing it only has to add it to the notebook */
+static void
+prefetch_panel (GnomeControlCenter *shell,
+                const gchar        *id,
+                GtkTreeIter        *iter)
+{
+  GnomeControlCenterPrivate *priv = shell->priv;
+  GtkWidget *panel, *box;
+  GPtrArray *header_widgets;
+  GType panel_type;
+  gchar *name;
+  gsize resident_size, size;
+  gint64 begin;
+
+  panel_type = get_panel_type (shell, id);
+  if (panel_type == G_TYPE_INVALID)
+    return;
+
+  gtk_tree_model_get (GTK_TREE_MODEL (priv->store), iter,
+                      COL_NAME, &name,
+                      -1);
+
+  begin = cc_trace_begin ();
+  resident_size = get_resident_size ();
+
+  priv->prefetch_header_widgets = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
+  panel = g_object_new (panel_type, "shell", shell, "name", name, NULL);
+  header_widgets = priv->prefetch_header_widgets;
+  priv->prefetch_header_widgets = NULL;
+  record_construct_time (shell, id, begin);
+
+  gtk_widget_show (panel);
+
+  box = gtk_alignment_new (0, 0, 1, 1);
+  gtk_alignment_set_padding (GTK_ALIGNMENT (box), 6, 6, 6, 6);
+  gtk_container_add (GTK_CONTAINER (box), panel);
+  gtk_widget_set_name (box, id);
+  g_object_ref_sink (box);
+
+  size = get_resident_size ();
+  size = size > resident_size ? size - resident_size : 0;
+
+  cache_panel (priv, id, box, panel, header_widgets, size);
+  g_object_unref (box);
+
+  cc_trace_end ("shell", "prefetch panel", id, begin);
+
+  g_free (name);
+}
+
+static gboolean
+prefetch_idle (gpointer user_data)
+{
+  GnomeControlCenter *shell = user_data;
+  GnomeControlCenterPrivate *priv = shell->priv;
+  PrefetchStep *step;
+  GtkTreeIter iter;
+
+  if (g_cancellable_is_cancelled (priv->prefetch_cancellable))
+    {
+      priv->prefetch_id = 0;
+      return FALSE;
+    }
+
+  step = g_queue_pop_head (priv->prefetch_steps);
+  if (step == NULL)
+    {
+      g_debug ("Prefetching done");
+      priv->prefetch_id = 0;
+      priv->prefetch_pending = FALSE;
+      return FALSE;
+    }
+
+  /* building a panel takes a while, so let input that is already
+   * waiting go first; it puts prefetching off if it is for the window */
+  if (step->kind == PREFETCH_PANEL && gtk_events_pending ())
+    {
+      g_queue_push_head (priv->prefetch_steps, step);
+      return TRUE;
+    }
+
+  /* the panel may have been removed or shown in the meantime */
+  if (g_strcmp0 (step->id, priv->current_panel_id) != 0 &&
+      cc_shell_model_lookup_id (CC_SHELL_MODEL (priv->store), step->id, &iter))
+    {
+      g_debug ("Prefetching %s (step %d)", step->id, step->kind);
+
+      switch (step->kind)
+        {
+        case PREFETCH_MODULE:
+          get_panel_type (shell, step->id);
+          break;
+        case PREFETCH_ICON:
+          prefetch_icon (shell, &iter);
+          break;
+        case PREFETCH_PANEL:
+          if (!is_panel_cached (priv, step->id))
+            prefetch_panel (shell, step->id, &iter);
+          break;
+        }
+    }
+
+  prefetch_step_free (step);
+
+  return TRUE;
+}
+
+static gboolean
+start_prefetch_timeout (gpointer user_data)
+{
+  GnomeControlCenter *shell = user_data;
+  GnomeControlCenterPrivate *priv = shell->priv;
+
+  g_clear_object (&priv->prefetch_cancellable);
+  priv->prefetch_cancellable = g_cancellable_new ();
+
+  g_queue_free_full (priv->prefetch_steps, (GDestroyNotify) prefetch_step_free);
+  priv->prefetch_steps = g_queue_new ();
+  queue_prefetch_steps (shell);
+
+  priv->prefetch_id = g_idle_add_full (G_PRIORITY_LOW, prefetch_idle, shell, NULL);
+
+  return FALSE;
+}
+
+/* Stops prefetching at once; it starts again once the window has been
+ * left alone for PREFETCH_DELAY seconds */
+static void
+schedule_prefetch (GnomeControlCenter *shell)
+{
+  GnomeControlCenterPrivate *priv = shell->priv;
+
+  if (priv->prefetch_cancellable)
+    g_cancellable_cancel (priv->prefetch_cancellable);
+
+  if (priv->prefetch_id != 0)
+    g_source_remove (priv->prefetch_id);
+
+  priv->prefetch_id = g_timeout_add_seconds (PREFETCH_DELAY,
+                                             start_prefetch_timeout,
+                                             shell);
+  priv->prefetch_pending = TRUE;
+}
+
+static void
+stop_prefetch (GnomeControlCenter *shell)
+{
+  GnomeControlCenterPrivate *priv = shell->priv;
+
+  if (priv->prefetch_cancellable)
+    g_cancellable_cancel (priv->prefetch_cancellable);
+
+  if (priv->prefetch_id != 0)
+    {
+      g_source_remove (priv->prefetch_id);
+      priv->prefetch_id = 0;
+    }
+
+  priv->prefetch_pending = FALSE;
+}
+
+/* Any input while prefetching is pending puts it off again. The hook
+ * runs before the handlers of the widget the event goes to, so the clicks
+ * and scrolls that the icon views, the scrolled window or a panel handle
+ * themselves are seen too. */
+static gboolean
+input_event_hook (GSignalInvocationHint *ihint,
+                  guint                  n_param_values,
+                  const GValue          *param_values,
+                  gpointer               user_data)
+{
+  GnomeControlCenter *shell = user_data;
+  GtkWidget *widget;
+  GdkEvent *event;
+
+  if (!shell->priv->prefetch_pending)
+    return TRUE;
+
+  widget = g_value_get_object (&param_values[0]);
+  event = g_value_get_boxed (&param_values[1]);
+
+  switch (event->type)
+    {
+    case GDK_KEY_PRESS:
+    case GDK_BUTTON_PRESS:
+    case GDK_SCROLL:
+    case GDK_TOUCH_BEGIN:
+      if (gtk_widget_get_toplevel (widget) == shell->priv->window)
+        schedule_prefetch (shell);
+      break;
+    default:
+      break;
+    }
+
+  return TRUE;
+}
+
+static void
+setup_prefetch (GnomeControlCenter *shell)
+{
+  GnomeControlCenterPrivate *priv = shell->priv;
+  gchar *path;
+
+  priv->activations = g_key_file_new ();
+  path = get_activations_path ();
+  g_key_file_load_from_file (priv->activations, path, G_KEY_FILE_NONE, NULL);
+  g_free (path);
+
+  priv->prefetch_steps = g_queue_new ();
+  priv->prefetch_icons = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
+
+  priv->prefetch_input_hook_id =
+    g_signal_add_emission_hook (g_signal_lookup ("event", GTK_TYPE_WIDGET), 0,
+                                input_event_hook, shell, NULL);
+}
+
 static void
 notebook_page_notify_cb (GtkNotebook              *notebook,
 			 GParamSpec               *spec,
@@ -1142,6 +2154,13 @@ _shell_embed_widget_in_header (CcShell      *shell,
   GnomeControlCenterPrivate *priv = GNOME_CONTROL_CENTER (shell)->priv;
   GtkBox *box;
 
+  /* a panel being prefetched gets its widgets once it is shown */
+  if (priv->prefetch_header_widgets != NULL)
+    {
+      g_ptr_array_add (priv->prefetch_header_widgets, g_object_ref (widget));
+      return;
+    }
+
   /* add to header */
   box = GTK_BOX (W (priv->builder, "topright"));
   gtk_box_pack_end (box, widget, FALSE, FALSE, 0);
@@ -1156,12 +2175,14 @@ _shell_set_active_panel_from_id (CcShell      *shell,
                                  GError      **err)
 {
   GtkTreeIter iter;
-  gboolean iter_valid;
   gchar *name = NULL;
   gchar *desktop = NULL;
   GIcon *gicon = NULL;
   GnomeControlCenterPrivate *priv = GNOME_CONTROL_CENTER (shell)->priv;
-  GtkWidget *old_panel;
+  GtkWidget *old_box, *old_panel;
+  GPtrArray *old_header_widgets;
+  gchar *old_id;
+  gsize old_size;
 
   /* When loading the same panel again, just set the argv */
   if (g_strcmp0 (priv->current_panel_id, start_id) == 0)
@@ -1170,73 +2191,54 @@ _shell_set_active_panel_from_id (CcShell      *shell,
       return TRUE;
     }
 
-  /* clear any custom widgets */
-  _shell_remove_all_custom_widgets (priv);
-
-  iter_valid = gtk_tree_model_get_iter_first (GTK_TREE_MODEL (priv->store),
-                                              &iter);
-
   /* find the details for this item */
-  while (iter_valid)
+  if (!cc_shell_model_lookup_id (CC_SHELL_MODEL (priv->store), start_id, &iter))
     {
-      gchar *id;
-
-      gtk_tree_model_get (GTK_TREE_MODEL (priv->store), &iter,
-                          COL_NAME, &name,
-                          COL_DESKTOP_FILE, &desktop,
-                          COL_GICON, &gicon,
-                          COL_ID, &id,
-                          -1);
+      g_set_error (err, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                   "Could not find settings panel \"%s\"", start_id);
+      return FALSE;
+    }
 
-      if (id && !strcmp (id, start_id))
-        {
-          g_free (id);
-          break;
-        }
-      else
-        {
-          g_free (id);
-          g_free (name);
-          g_free (desktop);
-	  if (gicon)
-	    g_object_unref (gicon);
-
-          name = NULL;
-          id = NULL;
-          desktop = NULL;
-          gicon = NULL;
-        }
+  gtk_tree_model_get (GTK_TREE_MODEL (priv->store), &iter,
+                      COL_NAME, &name,
+                      COL_DESKTOP_FILE, &desktop,
+                      COL_GICON, &gicon,
+                      -1);
 
-      iter_valid = gtk_tree_model_iter_next (GTK_TREE_MODEL (priv->store),
-                                             &iter);
-    }
+  /* clear any custom widgets */
+  old_header_widgets = _shell_remove_all_custom_widgets (priv);
+  clear_first_draw (priv);
 
-  old_panel = priv->current_panel_box;
+  old_box = priv->current_panel_box;
+  old_panel = priv->current_panel;
+  old_size = priv->current_panel_size;
+  old_id = priv->current_panel_id;
+  priv->current_panel_id = NULL;
 
-  if (!name)
-    {
-      g_warning ("Could not find settings panel \"%s\"", start_id);
-    }
-  else if (activate_panel (GNOME_CONTROL_CENTER (shell), start_id, argv, desktop,
+  if (activate_panel (GNOME_CONTROL_CENTER (shell), start_id, argv, desktop,
                            name, gicon) == FALSE)
     {
       /* Failed to activate the panel for some reason */
-      old_panel = priv->current_panel_box;
+      priv->current_panel = NULL;
       priv->current_panel_box = NULL;
+      priv->current_panel_size = 0;
       notebook_select_page (priv->notebook, priv->scrolled_window);
-      if (old_panel)
-        notebook_remove_page (priv->notebook, old_panel);
     }
   else
     {
       /* Successful activation */
-      g_free (priv->current_panel_id);
       priv->current_panel_id = g_strdup (start_id);
-
-      if (old_panel)
-        notebook_remove_page (priv->notebook, old_panel);
+      record_activation (GNOME_CONTROL_CENTER (shell), start_id);
+      if (priv->prefetch_pending)
+        schedule_prefetch (GNOME_CONTROL_CENTER (shell));
     }
 
+  if (old_box)
+    cache_panel (priv, old_id, old_box, old_panel, old_header_widgets, old_size);
+  else
+    g_ptr_array_unref (old_header_widgets);
+  g_free (old_id);
+
   g_free (name);
   g_free (desktop);
   if (gicon)
@@ -1283,7 +2285,52 @@ gnome_control_center_dispose (GObject *object)
 {
   GnomeControlCenterPrivate *priv = GNOME_CONTROL_CENTER (object)->priv;
 
-  g_free (priv->current_panel_id);
+  g_clear_pointer (&priv->current_panel_id, g_free);
+
+  if (priv->prefetch_steps)
+    {
+      stop_prefetch (GNOME_CONTROL_CENTER (object));
+      g_queue_free_full (priv->prefetch_steps, (GDestroyNotify) prefetch_step_free);
+      priv->prefetch_steps = NULL;
+    }
+  g_clear_object (&priv->prefetch_cancellable);
+
+  if (priv->prefetch_input_hook_id != 0)
+    {
+      g_signal_remove_emission_hook (g_signal_lookup ("event", GTK_TYPE_WIDGET),
+                                     priv->prefetch_input_hook_id);
+      priv->prefetch_input_hook_id = 0;
+    }
+
+  if (priv->prefetch_icons)
+    {
+      g_ptr_array_unref (priv->prefetch_icons);
+      priv->prefetch_icons = NULL;
+    }
+
+  if (priv->activations_save_id != 0)
+    {
+      g_source_remove (priv->activations_save_id);
+      save_activations_idle (object);
+    }
+
+  if (priv->panel_cache)
+    {
+      g_queue_free_full (priv->panel_cache, (GDestroyNotify) cached_panel_free);
+      priv->panel_cache = NULL;
+    }
+
+  if (priv->menu_tree_idle_id != 0)
+    {
+      g_source_remove (priv->menu_tree_idle_id);
+      priv->menu_tree_idle_id = 0;
+    }
+
+  if (priv->menu_reload_id != 0)
+    {
+      g_source_remove (priv->menu_reload_id);
+      priv->menu_reload_id = 0;
+    }
 
   if (priv->custom_widgets)
     {
@@ -1313,6 +2360,12 @@ gnome_control_center_dispose (GObject *object)
       priv->store = NULL;
     }
 
+  if (priv->search_sort)
+    {
+      g_object_unref (priv->search_sort);
+      priv->search_sort = NULL;
+    }
+
   if (priv->search_filter)
     {
       g_object_unref (priv->search_filter);
@@ -1334,6 +2387,13 @@ gnome_control_center_finalize (GObject *object)
       priv->filter_string = NULL;
     }
 
+  g_free (priv->filter_folded);
+  priv->filter_folded = NULL;
+
+  g_clear_pointer (&priv->setting_matches, g_hash_table_destroy);
+  g_clear_pointer (&priv->settings_index, cc_shell_settings_index_free);
+  g_clear_pointer (&priv->search_ranks, g_hash_table_destroy);
+
   if (priv->default_window_title)
     {
       g_free (priv->default_window_title);
@@ -1358,6 +2418,26 @@ gnome_control_center_finalize (GObject *object)
       g_hash_table_destroy (priv->category_views);
     }
 
+  if (priv->categories)
+    {
+      g_ptr_array_unref (priv->categories);
+    }
+
+  if (priv->module_scope)
+    {
+      g_io_module_scope_free (priv->module_scope);
+    }
+
+  if (priv->module_manifest)
+    {
+      g_key_file_free (priv->module_manifest);
+    }
+
+  if (priv->activations)
+    {
+      g_key_file_free (priv->activations);
+    }
+
   G_OBJECT_CLASS (gnome_control_center_parent_class)->finalize (object);
 }
 
@@ -1513,6 +2593,10 @@ main_window_configure_cb (GtkWidget *widget,
                           GdkEvent  *event,
                           GnomeControlCenter *self)
 {
+  /* don't compete with the window being moved or resized */
+  if (self->priv->prefetch_pending)
+    schedule_prefetch (self);
+
   update_small_screen_settings (self);
   return FALSE;
 }
@@ -1549,6 +2633,7 @@ gnome_control_center_init (GnomeControlCenter *self)
   GnomeControlCenterPrivate *priv;
   GdkScreen *screen;
   GtkWidget *widget;
+  gint64 begin;
 
   priv = self->priv = CONTROL_CENTER_PRIVATE (self);
 
@@ -1607,14 +2692,23 @@ gnome_control_center_init (GnomeControlCenter *self)
   /* keep a list of custom widgets to unload on panel change */
   priv->custom_widgets = g_ptr_array_new_with_free_func ((GDestroyNotify) g_object_unref);
 
+  setup_panel_cache (self);
+  setup_prefetch (self);
+
   /* load the available settings panels */
+  begin = cc_trace_begin ();
   setup_model (self);
+  cc_trace_end ("shell", "setup_model", NULL, begin);
 
   /* load the panels that are implemented as plugins */
+  begin = cc_trace_begin ();
   load_panel_plugins (self);
+  cc_trace_end ("shell", "load_panel_plugins", NULL, begin);
 
   /* setup search functionality */
+  begin = cc_trace_begin ();
   setup_search (self);
+  cc_trace_end ("shell", "setup_search", NULL, begin);
 
   setup_lock (self);
 
@@ -1635,6 +2729,8 @@ void
 gnome_control_center_present (GnomeControlCenter *center)
 {
   gtk_window_present (GTK_WINDOW (center->priv->window));
+
+  schedule_prefetch (center);
 }
 
 void
@@ -1644,3 +2740,59 @@ gnome_control_center_show (GnomeControlCenter *center,
   gtk_window_set_application (GTK_WINDOW (center->priv->window), app);
   gtk_widget_show (gtk_bin_get_child (GTK_BIN (center->priv->window)));
 }
+
+/**
+ * gnome_control_center_get_loaded_modules:
+ * @center: a #GnomeControlCenter
+ *
+ * Lists the panel modules currently mapped into the process, for
+ * debugging on-demand module loading.
+ *
+ * Returns: (transfer full): a %NULL-terminated array of module paths
+ */
+gchar **
+gnome_control_center_get_loaded_modules (GnomeControlCenter *center)
+{
+  GPtrArray *modules;
+  gchar *contents;
+  gchar **lines;
+  guint i;
+
+  modules = g_ptr_array_new ();
+
+  if (g_file_get_contents ("/proc/self/maps", &contents, NULL, NULL))
+    {
+      lines = g_strsplit (contents, "\n", -1);
+      g_free (contents);
+
+      for (i = 0; lines[i] != NULL; i++)
+        {
+          const gchar *path;
+          guint j;
+
+          path = strchr (lines[i], '/');
+          if (path == NULL)
+            continue;
+
+          if (!g_str_has_prefix (path, PANELS_DIR "/") &&
+              !g_str_has_prefix (path, PANELS_FALLBACK_DIR "/"))
+            continue;
+
+          /* every module is mapped several times */
+          for (j = 0; j < modules->len; j++)
+            {
+              if (g_str_equal (g_ptr_array_index (modules, j), path))
+                break;
+            }
+
+          if (j == modules->len)
+            g_ptr_array_add (modules, g_strdup (path));
+        }
+
+      g_strfreev (lines);
+    }
+
+  g_ptr_array_add (modules, NULL);
+
+  return (gchar **) g_ptr_array_free (modules, FALSE);
+}
@@ -77,6 +77,8 @@ void gnome_control_center_set_overview_page (GnomeControlCenter *center);
 void gnome_control_center_set_search_item (GnomeControlCenter *center,
                                            const char         *search);
 
+gchar **gnome_control_center_get_loaded_modules (GnomeControlCenter *center);
+
 G_END_DECLS
 
 #endif /* _GNOME_CONTROL_CENTER_H */
@@ -0,0 +1,439 @@
+/*
+ * Copyright (c) 2026 Canonical Ltd.
+ *
+ * The Control Center is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * The Control Center is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with the Control Center; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Build-time generator for the deep search index read by
+ * cc-shell-settings-index.c. It reads the sources listed in
+ * settings-index.list and writes the untranslated labels and key
+ * summaries it finds, with the panel and argument they lead to, as a
+ * serialized GVariant.
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include "cc-shell-settings-index.h"
+
+typedef struct
+{
+  const gchar *panel;
+  const gchar *argument;
+  const gchar *domain;
+  GPtrArray   *entries;
+  GHashTable  *seen;
+
+  /* .ui parsing */
+  gboolean     in_property;
+
+  /* schema parsing */
+  const gchar *schema_id;
+  gchar       *schema_domain;
+  gboolean     in_schema;
+  gchar       *key_name;
+  gboolean     in_summary;
+
+  gchar       *context;
+  GString     *text;
+} ParseData;
+
+typedef struct
+{
+  gchar *domain;
+  gchar *context;
+  gchar *label;
+  gchar *panel;
+  gchar *argument;
+} Entry;
+
+static void
+entry_free (Entry *entry)
+{
+  g_free (entry->domain);
+  g_free (entry->context);
+  g_free (entry->label);
+  g_free (entry->panel);
+  g_free (entry->argument);
+  g_free (entry);
+}
+
+static void
+add_entry (ParseData   *data,
+           const gchar *domain,
+           const gchar *label)
+{
+  Entry *entry;
+  gchar *key;
+
+  label = g_strstrip ((gchar *) label);
+  if (strlen (label) < 3)
+    return;
+
+  key = g_strdup_printf ("%s\n%s", data->panel, label);
+  if (g_hash_table_contains (data->seen, key))
+    {
+      g_free (key);
+      return;
+    }
+  g_hash_table_add (data->seen, key);
+
+  entry = g_new0 (Entry, 1);
+  entry->domain = g_strdup (domain ? domain : "");
+  entry->context = g_strdup (data->context ? data->context : "");
+  entry->label = g_strdup (label);
+  entry->panel = g_strdup (data->panel);
+  entry->argument = g_strdup (data->argument ? data->argument : "");
+  g_ptr_array_add (data->entries, entry);
+}
+
+static const gchar *
+lookup_attribute (const gchar  *name,
+                  const gchar **attribute_names,
+                  const gchar **attribute_values)
+{
+  guint i;
+
+  for (i = 0; attribute_names[i] != NULL; i++)
+    {
+      if (g_str_equal (attribute_names[i], name))
+        return attribute_values[i];
+    }
+
+  return NULL;
+}
+
+static gboolean
+is_searchable_property (const gchar *name)
+{
+  const gchar *properties[] = {
+    "label", "title", "text", "tooltip_text", "tooltip-text", NULL
+  };
+  guint i;
+
+  for (i = 0; properties[i] != NULL; i++)
+    {
+      if (g_str_equal (name, properties[i]))
+        return TRUE;
+    }
+
+  return FALSE;
+}
+
+static void
+start_element (GMarkupParseContext  *context,
+               const gchar          *element_name,
+               const gchar         **attribute_names,
+               const gchar         **attribute_values,
+               gpointer              user_data,
+               GError              **error)
+{
+  ParseData *data = user_data;
+  const gchar *value;
+
+  if (g_str_equal (element_name, "interface"))
+    {
+      value = lookup_attribute ("domain", attribute_names, attribute_values);
+      if (value)
+        data->domain = g_intern_string (value);
+    }
+  else if (g_str_equal (element_name, "property"))
+    {
+      const gchar *name, *translatable;
+
+      name = lookup_attribute ("name", attribute_names, attribute_values);
+      translatable = lookup_attribute ("translatable", attribute_names, attribute_values);
+
+      if (name && is_searchable_property (name) &&
+          g_strcmp0 (translatable, "yes") == 0)
+        {
+          data->in_property = TRUE;
+          data->context = g_strdup (lookup_attribute ("context",
+                                                      attribute_names,
+                                                      attribute_values));
+          g_string_truncate (data->text, 0);
+        }
+    }
+  else if (g_str_equal (element_name, "schemalist"))
+    {
+      value = lookup_attribute ("gettext-domain", attribute_names, attribute_values);
+      g_free (data->schema_domain);
+      data->schema_domain = g_strdup (value);
+    }
+  else if (g_str_equal (element_name, "schema"))
+    {
+      value = lookup_attribute ("id", attribute_names, attribute_values);
+      data->in_schema = (g_strcmp0 (value, data->schema_id) == 0);
+
+      value = lookup_attribute ("gettext-domain", attribute_names, attribute_values);
+      if (data->in_schema && value)
+        {
+          g_free (data->schema_domain);
+          data->schema_domain = g_strdup (value);
+        }
+    }
+  else if (g_str_equal (element_name, "key") && data->in_schema)
+    {
+      g_free (data->key_name);
+      data->key_name = g_strdup (lookup_attribute ("name", attribute_names,
+                                                   attribute_values));
+    }
+  else if (g_str_equal (element_name, "summary") && data->key_name)
+    {
+      data->in_summary = TRUE;
+      data->context = g_strdup (lookup_attribute ("context",
+                                                  attribute_names,
+                                                  attribute_values));
+      g_string_truncate (data->text, 0);
+    }
+}
+
+static void
+end_element (GMarkupParseContext  *context,
+             const gchar          *element_name,
+             gpointer              user_data,
+             GError              **error)
+{
+  ParseData *data = user_data;
+
+  if (g_str_equal (element_name, "property") && data->in_property)
+    {
+      add_entry (data, data->domain, data->text->str);
+      data->in_property = FALSE;
+      g_clear_pointer (&data->context, g_free);
+    }
+  else if (g_str_equal (element_name, "summary") && data->in_summary)
+    {
+      add_entry (data, data->schema_domain, data->text->str);
+      data->in_summary = FALSE;
+      g_clear_pointer (&data->context, g_free);
+    }
+  else if (g_str_equal (element_name, "key"))
+    {
+      g_clear_pointer (&data->key_name, g_free);
+    }
+  else if (g_str_equal (element_name, "schema"))
+    {
+      data->in_schema = FALSE;
+    }
+}
+
+static void
+text (GMarkupParseContext  *context,
+      const gchar          *text,
+      gsize                 text_len,
+      gpointer              user_data,
+      GError              **error)
+{
+  ParseData *data = user_data;
+
+  if (data->in_property || data->in_summary)
+    g_string_append_len (data->text, text, text_len);
+}
+
+static const GMarkupParser parser = {
+  start_element,
+  end_element,
+  text,
+  NULL,
+  NULL
+};
+
+static gboolean
+parse_file (ParseData    *data,
+            const gchar  *path,
+            GError      **error)
+{
+  GMarkupParseContext *context;
+  gchar *contents;
+  gsize length;
+  gboolean ret;
+
+  if (!g_file_get_contents (path, &contents, &length, error))
+    return FALSE;
+
+  context = g_markup_parse_context_new (&parser, 0, data, NULL);
+  ret = g_markup_parse_context_parse (context, contents, length, error) &&
+        g_markup_parse_context_end_parse (context, error);
+
+  g_markup_parse_context_free (context);
+  g_free (contents);
+
+  return ret;
+}
+
+static gint
+compare_entries (gconstpointer a,
+                 gconstpointer b)
+{
+  const Entry *entry_a = *(const Entry **) a;
+  const Entry *entry_b = *(const Entry **) b;
+  gint result;
+
+  result = strcmp (entry_a->panel, entry_b->panel);
+  if (result == 0)
+    result = strcmp (entry_a->label, entry_b->label);
+
+  return result;
+}
+
+int
+main (int argc, char **argv)
+{
+  const gchar *srcdir, *schemadir, *list_path, *output_path;
+  ParseData data;
+  GVariantBuilder builder;
+  GVariant *index;
+  gchar *contents;
+  gchar **lines;
+  GError *error = NULL;
+  guint n_schemas = 0;
+  guint n_found = 0;
+  guint i;
+
+  if (argc != 6)
+    {
+      g_printerr ("Usage: %s SRCDIR SCHEMADIR GETTEXT-DOMAIN LIST OUTPUT\n", argv[0]);
+      return 1;
+    }
+
+  srcdir = argv[1];
+  schemadir = argv[2];
+  list_path = argv[4];
+  output_path = argv[5];
+
+  if (!g_file_get_contents (list_path, &contents, NULL, &error))
+    {
+      g_printerr ("%s\n", error->message);
+      return 1;
+    }
+
+  memset (&data, 0, sizeof (data));
+  data.entries = g_ptr_array_new_with_free_func ((GDestroyNotify) entry_free);
+  data.seen = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  data.text = g_string_new (NULL);
+
+  lines = g_strsplit (contents, "\n", -1);
+  g_free (contents);
+
+  for (i = 0; lines[i] != NULL; i++)
+    {
+      gchar **fields;
+      gchar *path;
+
+      g_strstrip (lines[i]);
+      if (lines[i][0] == '#' || lines[i][0] == '\0')
+        continue;
+
+      fields = g_regex_split_simple ("\\s+", lines[i], 0, 0);
+      if (g_strv_length (fields) < 3 || g_strv_length (fields) > 4)
+        {
+          g_printerr ("%s:%u: expected 3 or 4 fields\n", list_path, i + 1);
+          return 1;
+        }
+
+      data.panel = g_intern_string (fields[0]);
+      data.argument = g_intern_string (fields[3]);
+
+      if (g_str_equal (fields[1], "ui"))
+        {
+          data.domain = g_intern_string (argv[3]);
+          path = g_build_filename (srcdir, fields[2], NULL);
+
+          if (!parse_file (&data, path, &error))
+            {
+              g_printerr ("%s: %s\n", path, error->message);
+              return 1;
+            }
+        }
+      else if (g_str_equal (fields[1], "schema"))
+        {
+          gchar *basename;
+
+          data.schema_id = fields[2];
+          basename = g_strdup_printf ("%s.gschema.xml", fields[2]);
+          path = g_build_filename (schemadir, basename, NULL);
+          g_free (basename);
+          n_schemas++;
+
+          /* schemas come from other packages and are optional */
+          if (!g_file_test (path, G_FILE_TEST_EXISTS))
+            g_printerr ("Skipping missing schema %s\n", path);
+          else if (!parse_file (&data, path, &error))
+            {
+              g_printerr ("%s: %s\n", path, error->message);
+              return 1;
+            }
+          else
+            n_found++;
+
+          data.schema_id = NULL;
+          g_clear_pointer (&data.schema_domain, g_free);
+        }
+      else
+        {
+          g_printerr ("%s:%u: unknown source type '%s'\n", list_path, i + 1, fields[1]);
+          return 1;
+        }
+
+      g_free (path);
+      g_strfreev (fields);
+    }
+
+  g_strfreev (lines);
+
+  /* a few missing schemas are fine, none at all means a wrong SCHEMADIR */
+  if (n_schemas > 0 && n_found == 0)
+    {
+      g_printerr ("No schemas found in %s\n", schemadir);
+      return 1;
+    }
+
+  g_ptr_array_sort (data.entries, compare_entries);
+
+  g_variant_builder_init (&builder, G_VARIANT_TYPE ("a" CC_SHELL_SETTINGS_INDEX_ENTRY_FORMAT));
+  for (i = 0; i < data.entries->len; i++)
+    {
+      Entry *entry = g_ptr_array_index (data.entries, i);
+
+      g_variant_builder_add (&builder, CC_SHELL_SETTINGS_INDEX_ENTRY_FORMAT,
+                             entry->domain, entry->context, entry->label,
+                             entry->panel, entry->argument);
+    }
+
+  index = g_variant_new ("(ua" CC_SHELL_SETTINGS_INDEX_ENTRY_FORMAT ")",
+                         CC_SHELL_SETTINGS_INDEX_VERSION, &builder);
+  g_variant_ref_sink (index);
+
+  if (!g_file_set_contents (output_path,
+                            g_variant_get_data (index),
+                            g_variant_get_size (index),
+                            &error))
+    {
+      g_printerr ("%s\n", error->message);
+      return 1;
+    }
+
+  g_variant_unref (index);
+  g_ptr_array_unref (data.entries);
+  g_hash_table_destroy (data.seen);
+  g_string_free (data.text, TRUE);
+
+  return 0;
+}
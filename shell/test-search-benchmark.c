@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2026 Canonical Ltd.
+ *
+ * The Control Center is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ * The Control Center is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License
+ * for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with the Control Center; if not, write to the Free Software Foundation,
+ * Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+
+#include <gtk/gtk.h>
+#include <locale.h>
+
+#include "cc-shell-model.h"
+
+/* Measures how long refiltering the shell's search view takes for a
+ * synthetic model of N_PANELS panels, for a few typical search strings. */
+
+#define N_PANELS 1000
+#define N_ROUNDS 100
+
+static const gchar *words[] = {
+  "Display", "Sound", "Network", "Power", "Keyboard", "Mouse", "Écran",
+  "Brightness", "Bluetooth", "Printers", "Region", "Privacy", "Users",
+  "Accessibility", "Appearance", "Wallpaper", "Time", "Wacom", "Color",
+  NULL
+};
+
+static const gchar *needles[] = {
+  "d", "di", "disp", "ecran", "zzz", "sound 7", NULL
+};
+
+static gboolean
+filter_func (GtkTreeModel *model,
+             GtkTreeIter  *iter,
+             const gchar **needle)
+{
+  return cc_shell_model_search_match (model, iter, *needle, NULL, NULL)
+         != CC_SHELL_SEARCH_RANK_NONE;
+}
+
+static void
+fill_model (CcShellModel *model)
+{
+  guint n_words = g_strv_length ((gchar **) words);
+  guint i;
+
+  for (i = 0; i < N_PANELS; i++)
+    {
+      const gchar *keywords[4];
+      gchar *id, *name, *description;
+
+      id = g_strdup_printf ("panel-%u", i);
+      name = g_strdup_printf ("%s %u", words[i % n_words], i);
+      description = g_strdup_printf ("Change %s and %s settings",
+                                     words[(i + 3) % n_words],
+                                     words[(i + 7) % n_words]);
+      keywords[0] = words[(i + 1) % n_words];
+      keywords[1] = words[(i + 5) % n_words];
+      keywords[2] = words[(i + 11) % n_words];
+      keywords[3] = NULL;
+
+      cc_shell_model_add_entry (model, "Hardware", id, name, NULL,
+                                description, NULL, keywords);
+
+      g_free (id);
+      g_free (name);
+      g_free (description);
+    }
+}
+
+int main (int argc, char **argv)
+{
+  CcShellModel *model;
+  GtkTreeModel *filter;
+  const gchar *needle = NULL;
+  GTimer *timer;
+  guint i, j;
+
+  setlocale (LC_ALL, "");
+
+  if (!gtk_init_check (&argc, &argv))
+    {
+      g_debug ("No display available, ignoring benchmark.");
+      return 0;
+    }
+
+  model = cc_shell_model_new ();
+  fill_model (model);
+
+  filter = gtk_tree_model_filter_new (GTK_TREE_MODEL (model), NULL);
+  gtk_tree_model_filter_set_visible_func (GTK_TREE_MODEL_FILTER (filter),
+                                          (GtkTreeModelFilterVisibleFunc) filter_func,
+                                          &needle, NULL);
+
+  timer = g_timer_new ();
+
+  for (i = 0; needles[i] != NULL; i++)
+    {
+      gchar *folded;
+      gint n_visible;
+
+      folded = cc_shell_model_fold_search_string (needles[i]);
+      needle = folded;
+
+      g_timer_start (timer);
+      for (j = 0; j < N_ROUNDS; j++)
+        gtk_tree_model_filter_refilter (GTK_TREE_MODEL_FILTER (filter));
+      g_timer_stop (timer);
+
+      n_visible = gtk_tree_model_iter_n_children (filter, NULL);
+
+      g_print ("%-10s %4d/%d rows  %8.1f us per refilter\n",
+               needles[i], n_visible, N_PANELS,
+               g_timer_elapsed (timer, NULL) * G_USEC_PER_SEC / N_ROUNDS);
+
+      needle = NULL;
+      g_free (folded);
+    }
+
+  g_timer_destroy (timer);
+  g_object_unref (filter);
+  g_object_unref (model);
+
+  return 0;
+}